@@ -313,13 +313,54 @@
   #define MICROSTEP8 HIGH,HIGH
   #define MICROSTEP16 HIGH,HIGH
 
+  #if defined(ADVANCE) && !defined(ADVANCE_STEP_FREQUENCY)
+    #define ADVANCE_STEP_FREQUENCY 100000
+  #endif
+
+  #if defined(BABYSTEPPING) && !defined(BABYSTEP_FREQUENCY)
+    #define BABYSTEP_FREQUENCY 1000
+  #endif
+
+  #if defined(FILAMENT_SENSOR) && !defined(MEASUREMENT_SAMPLE_MM)
+    #define MEASUREMENT_SAMPLE_MM 2
+  #endif
+
+  #if defined(STEP_TRACE) && !defined(STEP_TRACE_SIZE)
+    #define STEP_TRACE_SIZE 2048
+  #endif
+
+  #if defined(FWRETRACT) && !defined(RETRACT_JERK)
+    #define RETRACT_JERK DEFAULT_EJERK
+  #endif
+
+  #ifdef COALESCE_SEGMENTS
+    #ifndef COALESCE_E_RATIO
+      #define COALESCE_E_RATIO 0.05
+    #endif
+    #ifndef COALESCE_MAX_SEGMENTS
+      #define COALESCE_MAX_SEGMENTS 8
+    #endif
+  #endif
+
+  #if defined(SLOWDOWN) && !defined(SLOWDOWN_BUFFER_TIME)
+    #define SLOWDOWN_BUFFER_TIME 100
+  #endif
+
+  #if defined(BUFFER_MONITORING) && !defined(BUFFER_MONITORING_GAP)
+    #define BUFFER_MONITORING_GAP 2000
+  #endif
+
+  // The planner keeps the time of the queued blocks
+  #if defined(SLOWDOWN) || defined(BUFFER_MONITORING)
+    #define PLANNER_RUNTIME
+  #endif
+
   /**
-   * Advance calculated values
+   * Input shaper types
    */
-  #ifdef ADVANCE
-    #define EXTRUSION_AREA (0.25 * D_FILAMENT * D_FILAMENT * M_PI)
-    #define STEPS_PER_CUBIC_MM_E (axis_steps_per_unit[E_AXIS] / EXTRUSION_AREA)
-  #endif
+  #define SHAPER_ZV  1
+  #define SHAPER_MZV 2
+  #define SHAPER_EI  3
 
   #if defined(ULTIPANEL) && !defined(ELB_FULL_GRAPHIC_CONTROLLER)
     #undef SDCARDDETECTINVERTED
@@ -432,6 +473,7 @@
   #define HAS_SERVO_2 (PIN_EXISTS(SERVO2))
   #define HAS_SERVO_3 (PIN_EXISTS(SERVO3))
   #define HAS_FILAMENT_SENSOR (defined(FILAMENT_SENSOR) && PIN_EXISTS(FILWIDTH))
+  #define HAS_TOOL_OFFSETS (EXTRUDERS > 1 && !defined(DELTA) && !defined(SCARA))
   #define HAS_FILRUNOUT (PIN_EXISTS(FILRUNOUT))
   #define HAS_HOME (PIN_EXISTS(HOME))
   #define HAS_KILL (PIN_EXISTS(KILL))
@@ -518,5 +560,24 @@
 
   #define HAS_BUZZER ((defined(BEEPER) && BEEPER >= 0) || defined(LCD_USE_I2C_BUZZER))
 
+  /**
+   * External I2C EEPROM page size
+   */
+  #ifndef I2C_EEPROM_PAGE_SIZE
+    #define I2C_EEPROM_PAGE_SIZE 32
+  #endif
+
+  /**
+   * EEPROM emulation in flash
+   */
+  #ifdef FLASH_EEPROM_EMULATION
+    #ifndef FLASH_EEPROM_SIZE
+      #define FLASH_EEPROM_SIZE 1024
+    #endif
+    #ifndef FLASH_EEPROM_PAGES
+      #define FLASH_EEPROM_PAGES 32
+    #endif
+  #endif
+
 #endif //CONFIGURATION_LCD
 #endif //CONDITIONALS_H
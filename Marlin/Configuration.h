@@ -613,6 +613,9 @@ const bool Z_PROBE_ENDSTOP_INVERTING = false; // set to true to invert the logic
 #ifdef EEPROM_SETTINGS
   // To disable EEPROM Serial responses and decrease program space by ~1700 byte: comment this out:
   #define EEPROM_CHITCHAT // Please keep turned on if you can.
+  // Keep the settings in the internal flash of the SAM3X instead of an external I2C EEPROM.
+  // Uploading new firmware erases the flash, so the settings have to be stored again with M500.
+  //#define FLASH_EEPROM_EMULATION
 #endif
 
 // @section temperature
@@ -801,7 +804,8 @@ const bool Z_PROBE_ENDSTOP_INVERTING = false; // set to true to invert the logic
 #define DEFAULT_NOMINAL_FILAMENT_DIA 3.0 //Enter the diameter (in mm) of the filament generally used (3.0 mm or 1.75 mm) - this is then used in the slicer software.  Used for sensor reading validation
 #define MEASURED_UPPER_LIMIT         3.3 //upper limit factor used for sensor reading validation in mm
 #define MEASURED_LOWER_LIMIT         1.9 //lower limit factor for sensor reading validation in mm
-#define MAX_MEASUREMENT_DELAY       20   //delay buffer size in bytes (1 byte = 1cm)- limits maximum measurement delay allowable (must be larger than MEASUREMENT_DELAY_CM  and lower number saves RAM)
+#define MAX_MEASUREMENT_DELAY       20   //maximum measurement delay allowable in cm (must be larger than MEASUREMENT_DELAY_CM). The buffer takes 2 bytes per sample.
+#define MEASUREMENT_SAMPLE_MM        2   //filament distance between stored measurements in mm (1-10)
 
 //defines used in the code
 #define DEFAULT_MEASURED_FILAMENT_DIA  DEFAULT_NOMINAL_FILAMENT_DIA  //set measured to nominal initially
@@ -195,6 +195,9 @@
   //    Mode 2: Duplication mode. The firmware will transparently make the second x-carriage and extruder copy all
   //                           actions of the first x-carriage. This allows the printer to print 2 arbitrary items at
   //                           once. (2nd extruder x offset and temp offset are set using: M605 S2 [Xnnn] [Rmmm])
+  //    Mode 3: Mirrored duplication mode. Like mode 2, but the second x-carriage moves in the opposite direction
+  //                           to print a mirrored copy. The carriages mirror each other about the middle between
+  //                           their home positions. (temp offset is set using: M605 S3 [Rmmm])
 
   // This is the default power-up mode which can be later using M605.
   #define DEFAULT_DUAL_X_CARRIAGE_MODE 0
@@ -250,8 +253,17 @@
 // minimum time in microseconds that a movement needs to take if the buffer is emptied.
 #define DEFAULT_MINSEGMENTTIME        20000
 
-// If defined the movements slow down when the look ahead buffer is only half full
+// If defined the movements slow down when the look ahead buffer holds less than
+// SLOWDOWN_BUFFER_TIME (ms) of moves. Segments shorter than the minimum segment
+// time are made longer, up to it when the buffer is empty.
 #define SLOWDOWN
+#define SLOWDOWN_BUFFER_TIME 100
+
+// Count planner underruns, where the stepper empties the buffer mid-print and
+// waits for moves, by whether the moves came from serial or SD. Stops longer
+// than BUFFER_MONITORING_GAP (ms) are pauses. M576 reports them.
+//#define BUFFER_MONITORING
+#define BUFFER_MONITORING_GAP 2000
 
 // Frequency limit
 // See nophead's blog for more info
@@ -324,6 +336,19 @@
   // This allows hosts to request long names for files and folders with M33
   //#define LONG_FILENAME_HOST_SUPPORT
 
+  // Print files planned offline by scripts/block_plan.py. They hold the planner
+  // blocks of the moves, ready for the stepper, and the other commands of the
+  // G-code between them. M23 recognizes them, M24 starts them like any file.
+  // The script must be given the configuration of the printer. M23 refuses files
+  // planned with higher speed, acceleration or jerk limits than the printer has.
+  //#define SD_BLOCK_PLAYBACK
+
+  // Print G-code tokenized by scripts/gcode_tokenize.py. Each command is a few
+  // bytes of binary codes and numbers, optionally compressed, so it is read
+  // and decoded faster than the text and takes less of the card. M23
+  // recognizes the files, the commands run as if they were the G-code.
+  //#define SD_TOKENIZED_GCODE
+
 #endif // SDSUPPORT
 
 // for dogm lcd displays you can choose some additional fonts:
@@ -335,8 +360,28 @@
   // If you have spare 2300Byte of progmem and want to use a 
   // smaller font on the Info-screen uncomment the next line.
   //#define USE_SMALL_INFOFONT
+
+  // Only draw and send the parts of the Info Screen that changed since the last refresh.
+  // The time spent in lcd_update() can be compared with M251. scripts/lcd_sim.py
+  // emulates the Info Screen on an ST7920 and reports the bytes and time per frame.
+  #define DOGLCD_PARTIAL_REDRAW
+
+  // Send the pages of an ST7920 display (Full Graphic Smart Controller) through USART1
+  // in SPI mode with DMA instead of bit-banging them. This needs the display clock
+  // wired to A0 (SCK1) and the data to D16 (TXD1). No other pin or thermistor input
+  // may use them, the RADDS, RAMPS-FD and RAMPS4DUE pins files need changing first.
+  // The clock is ST7920_USART_SPI_FREQ (Hz).
+  //#define ST7920_USART_SPI
+  #ifdef ST7920_USART_SPI
+    #define ST7920_USART_SPI_FREQ 1000000
+  #endif
 #endif // DOGLCD
 
+// The LCD is drawn one page or row per call of lcd_update(). While the planner holds
+// moves but fewer than this, the LCD is not updated at all, so drawing doesn't starve
+// the planner when printing many short segments. Set to 0 to always update the LCD.
+#define LCD_MIN_PLANNED_MOVES (BLOCK_BUFFER_SIZE / 4)
+
 // @section more
 
 // The hardware watchdog should reset the microcontroller disabling all outputs, in case the firmware gets stuck and doesn't do temperature regulation.
@@ -362,23 +407,84 @@
   #define BABYSTEP_XY  //not only z, but also XY in the menu. more clutter, more functions
   #define BABYSTEP_INVERT_Z false  //true for inverse movements in Z
   #define BABYSTEP_Z_MULTIPLICATOR 2 //faster z movements
+  #define BABYSTEP_FREQUENCY 1000 //babysteps per second at most. They are done by the stepper interrupt, which runs at 1kHz when idle.
 #endif
 
 // @section extruder
 
-// extruder advance constant (s2/mm3)
+// Pressure advance
 //
-// advance (steps) = STEPS_PER_CUBIC_MM_E * EXTRUDER_ADVANCE_K * cubic mm per second ^ 2
+// The melt in the nozzle is compressed in proportion to the extrusion speed,
+// so the extruder has to run ahead of the commanded position while printing:
 //
-// Hooke's law says:    force = k * distance
-// Bernoulli's principle says:  v ^ 2 / 2 + g . h + pressure / density = constant
-// so: v ^ 2 is proportional to number of steps we advance the extruder
+// advance (mm of filament) = EXTRUDER_ADVANCE_K * filament speed (mm/s)
+//
+// E steps are issued by a separate timer (ADVANCE_TIMER_NUM in HAL.h), which
+// follows the stepper interrupt plus the advance. K (in seconds) can be set
+// with M900 K and is stored by M500. scripts/advance_sim.py shows the E step
+// stream a move produces for a given K.
 //#define ADVANCE
 
 #ifdef ADVANCE
-  #define EXTRUDER_ADVANCE_K .0
-  #define D_FILAMENT 2.85
-  #define STEPS_MM_E 836
+  #define EXTRUDER_ADVANCE_K 0.0
+  #define ADVANCE_STEP_FREQUENCY 100000 // Hz. Every E step takes two ticks (step and release).
+#endif
+
+// @section motion
+
+// Input shaping
+//
+// X and Y follow the planned motion convolved with a shaper tuned to the
+// ringing frequency of the frame, which cancels most of the ringing and
+// allows higher accelerations. Measure the frequency from the ringing on a
+// test print (ringing wavelength in mm / speed in mm/s = period).
+//
+// X/Y steps are issued by a separate timer (SHAPER_TIMER_NUM in HAL.h). The
+// shaper delays the motion by up to one ringing period. Frequency and damping
+// can be set with M593 and are stored by M500. F0 turns shaping off for an
+// axis. scripts/shaper_sim.py shows the shaped motion and the residual ringing.
+//
+// With COREXY use the same frequency for both axes.
+//#define INPUT_SHAPING
+
+#ifdef INPUT_SHAPING
+  #define SHAPING_TYPE SHAPER_MZV         // SHAPER_ZV, SHAPER_MZV or SHAPER_EI (more robust, more smoothing)
+  #define SHAPING_FREQUENCY_X 40.0        // Hz
+  #define SHAPING_FREQUENCY_Y 40.0        // Hz
+  #define SHAPING_DAMPING_X 0.1           // Damping ratio
+  #define SHAPING_DAMPING_Y 0.1
+  #define SHAPING_STEP_FREQUENCY 100000   // Hz. Every X/Y step takes two ticks, the planner keeps X/Y to 50000 steps/s.
+  #define SHAPING_BUFFER_SIZE 2048        // Step events kept for the delayed impulses (power of 2, 4 bytes each)
+#endif
+
+// Step trace
+//
+// The stepper interrupt records the timer interval it sets and the steps it
+// does per motor in a ring buffer (8 bytes per interrupt). M930 S1 starts
+// recording, M930 S0 stops it and M930 prints the recorded interrupts.
+// Consecutive interrupts without steps share one entry with their total time.
+// scripts/step_trace.py rebuilds the motion of each axis from the printout
+// and flags step rate jumps between blocks and step rates above
+// MAX_STEP_FREQUENCY. With ADVANCE or INPUT_SHAPING the recorded E or X/Y
+// steps are those handed to their timers.
+//#define STEP_TRACE
+
+#ifdef STEP_TRACE
+  #define STEP_TRACE_SIZE 2048  // Stepper interrupts kept
+#endif
+
+// @section eeprom
+
+#ifdef EEPROM_SETTINGS
+  // Page size of the external I2C EEPROM (24LC32: 32, 24LC256: 64).
+  // M500 writes whole aligned pages and polls the device for the end of each write cycle.
+  // scripts/eeprom_sim.py compares it with byte-wise writes on a simulated device.
+  #define I2C_EEPROM_PAGE_SIZE 32
+
+  #ifdef FLASH_EEPROM_EMULATION
+    #define FLASH_EEPROM_SIZE 1024  // Size of the emulated EEPROM in bytes
+    #define FLASH_EEPROM_PAGES 32   // 256 byte pages reserved at the end of flash bank 1, used as two alternating blocks
+  #endif
 #endif
 
 // @section extras
@@ -389,6 +495,22 @@
 
 const unsigned int dropsegments=5; //everything with less than this number of steps will be ignored as move and joined with the next movement
 
+// Collinear segment coalescing (Cartesian and CoreXY only)
+// Slicers split curves and meshes into many short G1 moves, most of them
+// nearly in line. With this option consecutive G0/G1 moves are merged into
+// one planner block while the direction changes by less than COALESCE_ANGLE
+// and no merged corner lies further than COALESCE_CHORD from the new move.
+// Moves are only merged when their extrusion per mm differs by less than
+// COALESCE_E_RATIO, so the filament is laid down in proportion to the path.
+// Merging stops at any other command and when the planner runs low.
+//#define COALESCE_SEGMENTS
+#ifdef COALESCE_SEGMENTS
+  #define COALESCE_ANGLE 2.0        // Largest direction change in degrees
+  #define COALESCE_CHORD 0.01       // Largest distance in mm of a merged corner from the move
+  #define COALESCE_E_RATIO 0.05     // Largest relative difference in extrusion per mm
+  #define COALESCE_MAX_SEGMENTS 8   // Most moves merged into one block
+#endif
+
 // @section temperature
 
 // Control heater 0 and heater 1 in parallel.
@@ -417,6 +539,15 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 #define MAX_CMD_SIZE 96
 #define BUFSIZE 8
 
+// Run M105, M108, M112, M410 and M25 as soon as they are received, also
+// while the command queue is full or a command such as M109, M190, G29 or a
+// move waits. They answer "ok" at once, ahead of the queued commands.
+// Received lines wait in one more line buffer for room in the queue, so
+// hosts should keep at most BUFSIZE other commands waiting for "ok".
+// A real-time M410 also ends the running command without its moves, and the
+// position is taken from where the steppers stopped (DELTA/SCARA: home again).
+//#define REALTIME_COMMANDS
+
 // Bad Serial-connections can miss a received command by sending an 'ok'
 // Therefore some clients abort after 30 seconds in a timeout.
 // Some other clients start sending commands while receiving a 'wait'.
@@ -444,6 +575,7 @@ const unsigned int dropsegments=5; //everything with less than this number of st
   #define RETRACT_RECOVER_LENGTH 0       //default additional recover length (mm, added to retract length when recovering)
   #define RETRACT_RECOVER_LENGTH_SWAP 0  //default additional swap recover length (mm, added to retract length when recovering from extruder change)
   #define RETRACT_RECOVER_FEEDRATE 8     //default feedrate for recovering from retraction (mm/s)
+  #define RETRACT_JERK 20                //default E jerk of retract and recover moves (mm/s)
 #endif
 
 // Add support for experimental filament exchange support M600; requires display
@@ -31,7 +31,11 @@
 #include "HAL.h"
 #include "Configuration.h"
 
-#include <Wire.h>
+#ifdef FLASH_EEPROM_EMULATION
+  #include "flash_storage.h"
+#else
+  #include <Wire.h>
+#endif
 
 // --------------------------------------------------------------------------
 // Externals
@@ -104,6 +108,36 @@ int freeMemory() {
 // eeprom
 // --------------------------------------------------------------------------
 
+#ifdef FLASH_EEPROM_EMULATION
+
+// Settings are journaled to the internal flash, see flash_storage.cpp
+
+void eeprom_write_byte(unsigned char *pos, unsigned char value) {
+	flash_storage_write((unsigned) pos, &value, 1);
+}
+
+unsigned char eeprom_read_byte(unsigned char *pos) {
+	uint8_t data;
+	flash_storage_read((unsigned) pos, &data, 1);
+	return data;
+}
+
+bool eeprom_write_block(const void *src, void *pos, size_t n) {
+	return flash_storage_write((unsigned) pos, (const uint8_t *) src, n);
+}
+
+void eeprom_read_block(void *dest, const void *pos, size_t n) {
+	flash_storage_read((unsigned) pos, (uint8_t *) dest, n);
+}
+
+#else // !FLASH_EEPROM_EMULATION
+
+// Wire transfers at most BUFFER_LENGTH bytes, two of them are the address
+#define I2C_EEPROM_CHUNK_SIZE (BUFFER_LENGTH - 2)
+
+// The write cycle takes up to 5ms (24LCxx), give up polling after this
+#define I2C_EEPROM_WRITE_TIMEOUT 10
+
 static bool eeprom_initialised = false;
 static uint8_t eeprom_device_address = 0x50;
 
@@ -114,6 +148,32 @@ static void eeprom_init(void) {
 	}
 }
 
+// Acknowledge polling: the device ignores its address until the
+// internal write cycle has finished, so retry until it ACKs.
+static bool eeprom_wait_ready(unsigned eeprom_address) {
+	uint32_t start = millis();
+	do {
+		Wire.beginTransmission(eeprom_device_address);
+		Wire.write((int)(eeprom_address >> 8));   // MSB, no data follows
+		if (Wire.endTransmission() == 0) return true;
+	} while (millis() - start < I2C_EEPROM_WRITE_TIMEOUT);
+	return false;
+}
+
+// Read up to BUFFER_LENGTH bytes with a single sequential read
+static uint8_t eeprom_read_sequential(unsigned eeprom_address, uint8_t *dest, uint8_t n) {
+	uint8_t count = 0;
+
+	Wire.beginTransmission(eeprom_device_address);
+	Wire.write((int)(eeprom_address >> 8));   // MSB
+	Wire.write((int)(eeprom_address & 0xFF)); // LSB
+	Wire.endTransmission();
+	Wire.requestFrom(eeprom_device_address, n);
+	while (count < n && Wire.available())
+		dest[count++] = Wire.read();
+	return count;
+}
+
 void eeprom_write_byte(unsigned char *pos, unsigned char value) {
 	unsigned eeprom_address = (unsigned) pos;
 
@@ -126,10 +186,42 @@ void eeprom_write_byte(unsigned char *pos, unsigned char value) {
 	Wire.endTransmission();
 
 	// wait for write cycle to complete
-	// this could be done more efficiently with "acknowledge polling"
-	delay(5);
+	eeprom_wait_ready(eeprom_address);
 }
 
+// Write n bytes as aligned page writes. Every chunk is read back
+// after its write cycle; returns false if any chunk did not verify.
+bool eeprom_write_block(const void *src, void *pos, size_t n) {
+	const uint8_t *value = (const uint8_t *) src;
+	unsigned eeprom_address = (unsigned) pos;
+	uint8_t verify[I2C_EEPROM_CHUNK_SIZE];
+	bool ok = true;
+
+	eeprom_init();
+
+	while (n) {
+		// never cross a page boundary, the device would wrap within the page
+		size_t chunk = I2C_EEPROM_PAGE_SIZE - (eeprom_address % I2C_EEPROM_PAGE_SIZE);
+		if (chunk > I2C_EEPROM_CHUNK_SIZE) chunk = I2C_EEPROM_CHUNK_SIZE;
+		if (chunk > n) chunk = n;
+
+		Wire.beginTransmission(eeprom_device_address);
+		Wire.write((int)(eeprom_address >> 8));   // MSB
+		Wire.write((int)(eeprom_address & 0xFF)); // LSB
+		Wire.write(value, chunk);
+		Wire.endTransmission();
+
+		if (!eeprom_wait_ready(eeprom_address)
+		    || eeprom_read_sequential(eeprom_address, verify, chunk) != chunk
+		    || memcmp(verify, value, chunk) != 0)
+			ok = false;
+
+		eeprom_address += chunk;
+		value += chunk;
+		n -= chunk;
+	}
+	return ok;
+}
 
 unsigned char eeprom_read_byte(unsigned char *pos) {
 	byte data = 0xFF;
@@ -147,6 +239,54 @@ unsigned char eeprom_read_byte(unsigned char *pos) {
 	return data;
 }
 
+// Read n bytes with one address set per BUFFER_LENGTH bytes. The address
+// counter of the device runs on across page boundaries.
+void eeprom_read_block(void *dest, const void *pos, size_t n) {
+	uint8_t *value = (uint8_t *) dest;
+	unsigned eeprom_address = (unsigned) pos;
+
+	eeprom_init();
+
+	while (n) {
+		uint8_t chunk = n > BUFFER_LENGTH ? BUFFER_LENGTH : n;
+		uint8_t count = eeprom_read_sequential(eeprom_address, value, chunk);
+		if (count < chunk) memset(value + count, 0xFF, chunk - count); // no device
+		eeprom_address += chunk;
+		value += chunk;
+		n -= chunk;
+	}
+}
+
+#endif // !FLASH_EEPROM_EMULATION
+
+// --------------------------------------------------------------------------
+// internal flash
+// --------------------------------------------------------------------------
+
+#define EFC_FCMD_WP  0x01 // write page
+#define EFC_FCMD_EWP 0x03 // erase page and write page
+
+// Program one page of flash bank 1. The firmware runs from bank 0, so it
+// keeps executing while the controller of bank 1 is busy.
+bool HAL_flash_write_page(uint32_t address, const uint8_t *data, bool erase) {
+	Efc *efc = EFC1;
+	uint32_t page = (address - IFLASH1_ADDR) / IFLASH1_PAGE_SIZE;
+	volatile uint32_t *latch = (volatile uint32_t *)(IFLASH1_ADDR + page * IFLASH1_PAGE_SIZE);
+	uint32_t status;
+
+	// Fill the latch buffer, which only accepts 32-bit writes
+	for (uint16_t i = 0; i < IFLASH1_PAGE_SIZE / 4; i++) {
+		uint32_t word;
+		memcpy(&word, data + i * 4, 4);
+		latch[i] = word;
+	}
+
+	efc->EEFC_FCR = EEFC_FCR_FKEY(0x5A) | EEFC_FCR_FARG(page) | EEFC_FCR_FCMD(erase ? EFC_FCMD_EWP : EFC_FCMD_WP);
+	do { status = efc->EEFC_FSR; } while (!(status & EEFC_FSR_FRDY));
+
+	return !(status & (EEFC_FSR_FCMDE | EEFC_FSR_FLOCKE));
+}
+
 // --------------------------------------------------------------------------
 // Timers
 // --------------------------------------------------------------------------
@@ -233,6 +373,27 @@ void HAL_temp_timer_start (uint8_t timer_num) {
 	NVIC_EnableIRQ(irq);
 }
 
+// Timers that output steps queued by the stepper interrupt (ADVANCE, INPUT_SHAPING).
+// They run at the priority of the stepper interrupt, so neither can interrupt
+// the other while they share the queued steps.
+void HAL_motion_timer_start (uint8_t timer_num, uint32_t frequency) {
+	Tc *tc = TimerConfig [timer_num].pTimerRegs;
+	IRQn_Type irq = TimerConfig [timer_num].IRQ_Id;
+	uint32_t channel = TimerConfig [timer_num].channel;
+
+	pmc_set_writeprotect(false);
+	pmc_enable_periph_clk((uint32_t)irq);
+
+	NVIC_SetPriority(irq, NVIC_GetPriority(STEP_TIMER_IRQN));
+
+	TC_Configure (tc, channel, TC_CMR_WAVSEL_UP_RC | TC_CMR_WAVE | TC_CMR_TCCLKS_TIMER_CLOCK1);
+	tc->TC_CHANNEL[channel].TC_RC = (VARIANT_MCK >> 1) / frequency;
+	tc->TC_CHANNEL[channel].TC_IDR = ~0; // enabled by the stepper interrupt when it queues steps for this timer
+	TC_Start(tc, channel);
+
+	NVIC_EnableIRQ(irq);
+}
+
 void HAL_timer_enable_interrupt (uint8_t timer_num) {
 	const tTimerConfig *pConfig = &TimerConfig [timer_num];
 	pConfig->pTimerRegs->TC_CHANNEL [pConfig->channel].TC_IER = TC_IER_CPCS; //enable interrupt
@@ -90,6 +90,10 @@ static inline void _delay_us(uint32_t usec) {
 int freeMemory(void);
 void eeprom_write_byte(unsigned char *pos, unsigned char value);
 unsigned char eeprom_read_byte(unsigned char *pos);
+bool eeprom_write_block(const void *src, void *pos, size_t n);
+void eeprom_read_block(void *dest, const void *pos, size_t n);
+
+bool HAL_flash_write_page(uint32_t address, const uint8_t *data, bool erase);
 
 
 // timers
@@ -113,6 +117,21 @@ unsigned char eeprom_read_byte(unsigned char *pos);
 #define BEEPER_TIMER_IRQN TC4_IRQn
 #define HAL_BEEPER_TIMER_ISR  void TC4_Handler()
 
+// TC1 (TC0 channel 1) has no pins on the Due and is not used by the Servo library
+#define ADVANCE_TIMER_NUM 1
+#define ADVANCE_TIMER_COUNTER TC0
+#define ADVANCE_TIMER_CHANNEL 1
+#define ADVANCE_TIMER_IRQN TC1_IRQn
+#define HAL_ADVANCE_TIMER_ISR  void TC1_Handler()
+
+// TC8 (TC2 channel 2) also drives the PWM of D11 and D12. With INPUT_SHAPING they are
+// sensitive pins for M42 and SanityCheck.h refuses them as PWM outputs.
+#define SHAPER_TIMER_NUM 8
+#define SHAPER_TIMER_COUNTER TC2
+#define SHAPER_TIMER_CHANNEL 2
+#define SHAPER_TIMER_IRQN TC8_IRQn
+#define HAL_SHAPER_TIMER_ISR  void TC8_Handler()
+
 #define HAL_TIMER_RATE 		     (F_CPU/2)
 #define TICKS_PER_NANOSECOND   (HAL_TIMER_RATE)/1000
 
@@ -123,6 +142,7 @@ unsigned char eeprom_read_byte(unsigned char *pos);
 
 void HAL_step_timer_start(void);
 void HAL_temp_timer_start (uint8_t timer_num);
+void HAL_motion_timer_start (uint8_t timer_num, uint32_t frequency);
 
 void HAL_timer_enable_interrupt (uint8_t timer_num);
 void HAL_timer_disable_interrupt (uint8_t timer_num);
@@ -216,6 +216,9 @@ void ok_to_send();
 #endif
 void reset_bed_level();
 void prepare_move();
+#ifdef COALESCE_SEGMENTS
+  void coalesce_flush(); // Send the held back move to the planner, before any move that doesn't use prepare_move()
+#endif
 void kill(const char *);
 void Stop();
 
@@ -267,6 +270,11 @@ extern float volumetric_multiplier[EXTRUDERS]; // reciprocal of cross-sectional
 extern float current_position[NUM_AXIS];
 extern float home_offset[3];
 
+#ifdef DUAL_X_CARRIAGE
+  extern bool extruder_duplication_enabled; // X2 and E1 follow X and E0 in the moves planned from now on
+  extern bool extruder_duplication_mirrored; // ...with X2 moving in the opposite direction
+#endif
+
 #ifdef DELTA
   extern float endstop_adj[3];
   extern float delta_radius;
@@ -308,9 +316,6 @@ extern int fanSpeed;
   extern float filament_width_nominal;  //holds the theoretical filament diameter ie., 3.00 or 1.75
   extern bool filament_sensor;  //indicates that filament sensor readings should control extrusion
   extern float filament_width_meas; //holds the filament diameter as accurately measured
-  extern signed char measurement_delay[];  //ring buffer to delay measurement
-  extern int delay_index1, delay_index2;  //ring buffer index. used by planner, temperature, and main code
-  extern float delay_dist; //delay distance counter
   extern int meas_delay_cm; //delay distance
 #endif
 
@@ -327,6 +332,10 @@ extern millis_t print_job_stop_ms;
 // Handling multiple extruders pins
 extern uint8_t active_extruder;
 
+#if EXTRUDERS > 1
+  extern float extruder_offset[][EXTRUDERS];
+#endif
+
 #ifdef DIGIPOT_I2C
   extern void digipot_i2c_set_current( int channel, float current );
   extern void digipot_i2c_init();
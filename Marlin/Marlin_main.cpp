@@ -107,10 +107,10 @@
  * M20  - List SD card
  * M21  - Init SD card
  * M22  - Release SD card
- * M23  - Select SD file (M23 filename.g)
+ * M23  - Select SD file (M23 filename.g), G-code, planned blocks (SD_BLOCK_PLAYBACK) or tokenized G-code (SD_TOKENIZED_GCODE)
  * M24  - Start/resume SD print
  * M25  - Pause SD print
- * M26  - Set SD position in bytes (M26 S12345)
+ * M26  - Set SD position in bytes (M26 S12345), not in planned or tokenized files
  * M27  - Report SD print status
  * M28  - Start SD write (M28 filename.g)
  * M29  - Stop SD write
@@ -135,6 +135,7 @@
  * M105 - Read current temp
  * M106 - Fan on
  * M107 - Fan off
+ * M108 - Stop waiting for heaters in M109 and M190. With REALTIME_COMMANDS it runs when received
  * M109 - Sxxx Wait for extruder current temp to reach target temp. Waits only when heating
  *        Rxxx Wait for extruder current temp to reach target temp. Waits when heating and cooling
  *        IF AUTOTEMP is enabled, S<mintemp> B<maxtemp> F<factor>. Exit autotemp by any M109 without F
@@ -163,7 +164,7 @@
  * M204 - Set default acceleration: P for Printing moves, R for Retract only (no X, Y, Z) moves and T for Travel (non printing) moves (ex. M204 P800 T3000 R9000) in mm/sec^2
  * M205 -  advanced settings:  minimum travel speed S=while printing T=travel only,  B=minimum segment time X= maximum xy jerk, Z=maximum Z jerk, E=maximum E jerk
  * M206 - Set additional homing offset
- * M207 - Set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop], stays in mm regardless of M200 setting
+ * M207 - Set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop] J[jerk mm/s], stays in mm regardless of M200 setting
  * M208 - Set recover=unretract length S[positive mm surplus to the M207 S*] F[feedrate mm/min]
  * M209 - S<1=true/0=false> enable automatic retract detect if the slicer did not support G10/11: every normal extrude-only move will be classified as retract depending on the direction.
  * M218 - Set hotend offset (in mm): T<extruder_number> X<offset_on_X> Y<offset_on_Y>
@@ -172,6 +173,8 @@
  * M226 - Wait until the specified pin reaches the state required: P<pin number> S<pin state>
  * M240 - Trigger a camera to take a photograph
  * M250 - Set LCD contrast C<contrast value> (value 0..63)
+ * M251 - Report the time spent in lcd_update() in microseconds, last and longest, the frame rate and the bytes sent
+ *        for the last frame. R resets the longest time and the frame rate.
  * M280 - Set servo position absolute. P: servo index, S: angle or microseconds
  * M300 - Play beep sound S<frequency Hz> P<duration ms>
  * M301 - Set PID parameters P I and D
@@ -196,12 +199,16 @@
  * M502 - Revert to the default "factory settings". You still need to store them in EEPROM afterwards if you want to.
  * M503 - Print the current settings (from memory not from EEPROM). Use S0 to leave off headings.
  * M540 - Use S[0|1] to enable or disable the stop SD card print on endstop hit (requires ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED)
+ * M576 - Report the planner buffer time, underruns by source (serial, SD) and blocks slowed down. R resets the counters (requires BUFFER_MONITORING).
  * M600 - Pause for filament change X[pos] Y[pos] Z[relative lift] E[initial retract] L[later retract distance for removal]
  * M665 - Set delta configurations: L<diagonal rod> R<delta radius> S<segments/s>
  * M666 - Set delta endstop adjustment
+ * M593 - Set input shaping: [X|Y] F<Hz> D<damping ratio> (requires INPUT_SHAPING). F0 turns shaping off.
  * M605 - Set dual x-carriage movement mode: S<mode> [ X<duplication x-offset> R<duplication temp offset> ]
+ * M900 - Set the pressure advance factor K<seconds> (requires ADVANCE). Without K report it.
  * M907 - Set digital trimpot motor current using axis codes.
  * M908 - Control digital trimpot directly.
+ * M930 - Step trace: S1 starts recording the stepper interrupts, S0 stops it. Without S print the trace (requires STEP_TRACE).
  * M350 - Set microstepping mode.
  * M351 - Toggle MS1 MS2 pins directly.
  *
@@ -272,6 +279,15 @@ static bool relative_mode = false;  //Determines Absolute or Relative Coordinate
 static char serial_char;
 static int serial_count = 0;
 static boolean comment_mode = false;
+#ifdef REALTIME_COMMANDS
+  static char serial_line[MAX_CMD_SIZE];      // The line being received, queued when it is complete
+  static bool serial_line_complete = false;   // The line waits for room in the command queue
+  #define SERIAL_LINE serial_line
+  #define SERIAL_LINE_ROOM true
+#else
+  #define SERIAL_LINE command_queue[cmd_queue_index_w]
+  #define SERIAL_LINE_ROOM (commands_in_queue < BUFSIZE)
+#endif
 static char *seen_pointer; ///< A pointer to find chars in the command string (X, Y, Z, E, etc.)
 const char* queued_commands_P= NULL; /* pointer to the current line in the active sequence of commands, or NULL when none */
 const int sensitive_pins[] = SENSITIVE_PINS; ///< Sensitive pin list for M42
@@ -382,10 +398,6 @@ bool target_direction;
   float filament_width_nominal = DEFAULT_NOMINAL_FILAMENT_DIA;  //Set nominal filament width, can be changed with M404
   bool filament_sensor = false;  //M405 turns on filament_sensor control, M406 turns it off
   float filament_width_meas = DEFAULT_MEASURED_FILAMENT_DIA; //Stores the measured filament diameter
-  signed char measurement_delay[MAX_MEASUREMENT_DELAY+1];  //ring buffer to delay measurement  store extruder factor after subtracting 100
-  int delay_index1 = 0;  //index into ring buffer
-  int delay_index2 = -1;  //index into ring buffer - set to -1 on startup to indicate ring buffer needs to be initialized
-  float delay_dist = 0; //delay distance counter
   int meas_delay_cm = MEASUREMENT_DELAY_CM;  //distance delay setting
 #endif
 
@@ -412,6 +424,11 @@ bool target_direction;
 
 void process_next_command();
 
+#ifdef REALTIME_COMMANDS
+  static bool realtime_command(char *command);
+  static void resume_after_abort();
+#endif
+
 bool setTargetedHotend(int code);
 
 void serial_echopair_P(const char *s_P, float v)         { serialprintPGM(s_P); SERIAL_ECHO(v); }
@@ -598,6 +615,7 @@ void servo_init() {
  *    • Digipot I2C
  *    • Z probe sled
  *    • status LEDs
+ *  - Report the boot time
  */
 void setup() {
   setup_killpin();
@@ -678,6 +696,11 @@ void setup() {
     pinMode(STAT_LED_BLUE, OUTPUT);
     digitalWrite(STAT_LED_BLUE, LOW); // turn it off
   #endif  
+
+  // Time from reset until commands are accepted
+  SERIAL_ECHO_START;
+  SERIAL_ECHOPAIR(MSG_BOOT_TIME, (unsigned long)millis());
+  SERIAL_ECHOLNPGM(" ms");
 }
 
 /**
@@ -693,6 +716,10 @@ void setup() {
 void loop() {
   if (commands_in_queue < BUFSIZE - 1) get_command();
 
+  #ifdef REALTIME_COMMANDS
+    if (moves_aborted) resume_after_abort();
+  #endif
+
   #ifdef SDSUPPORT
     card.checkautostart(false);
   #endif
@@ -729,6 +756,10 @@ void loop() {
     commands_in_queue--;
     cmd_queue_index_r = (cmd_queue_index_r + 1) % BUFSIZE;
   }
+  #ifdef COALESCE_SEGMENTS
+    // Nothing to merge with yet, don't let the planner run dry
+    if (!commands_in_queue && movesplanned() < BLOCK_BUFFER_SIZE / 4) coalesce_flush();
+  #endif
   checkHitEndstops();
   idle();
 }
@@ -742,16 +773,145 @@ void gcode_line_error(const char *err, bool doFlush=true) {
   serial_count = 0;
 }
 
+#ifdef SDSUPPORT
+
+  // The whole SD file was read
+  static void sd_file_printed() {
+    SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
+    print_job_stop_ms = millis();
+    char time[30];
+    millis_t t = (print_job_stop_ms - print_job_start_ms) / 1000;
+    int hours = t / 60 / 60, minutes = (t / 60) % 60;
+    sprintf_P(time, PSTR("%i " MSG_END_HOUR " %i " MSG_END_MINUTE), hours, minutes);
+    SERIAL_ECHO_START;
+    SERIAL_ECHOLN(time);
+    lcd_setstatus(time, true);
+    card.printingHasFinished();
+    card.checkautostart(true);
+  }
+
+  #ifdef SD_BLOCK_PLAYBACK
+
+    /**
+     * Read a planned block file: the blocks go to the planner as they are and
+     * the commands to the command queue. The records after a command are read
+     * once it has run, as the lines after a command in a G-code file. A record
+     * with a bad checksum or invalid values stops the print.
+     */
+    static void get_planned_blocks() {
+      while (!commands_in_queue && !card.eof() && movesplanned() < BLOCK_BUFFER_SIZE - 1 && !MOVES_ABORTED) {
+        uint8_t type = 0, length = 0;
+        planned_block_t pb;
+        float pos[NUM_AXIS];
+        char *command = command_queue[cmd_queue_index_w];
+        bool ok = card.read(&type, 1) == 1;
+        uint16_t sum = planned_checksum(0, &type, 1), checksum;
+        switch (type) {
+          case PLANNED_BLOCK:
+            ok = ok && card.read(&pb, sizeof(pb)) == sizeof(pb);
+            sum = planned_checksum(sum, &pb, sizeof(pb));
+            break;
+          case PLANNED_COMMAND:
+            ok = ok && card.read(&length, 1) == 1 && length < MAX_CMD_SIZE && card.read(command, length) == length;
+            sum = planned_checksum(planned_checksum(sum, &length, 1), command, length);
+            break;
+          case PLANNED_POSITION:
+            ok = ok && card.read(pos, sizeof(pos)) == sizeof(pos);
+            sum = planned_checksum(sum, pos, sizeof(pos));
+            break;
+          default:
+            ok = false;
+        }
+        ok = ok && card.read(&checksum, sizeof(checksum)) == sizeof(checksum) && checksum == sum;
+        if (ok) switch (type) {
+          case PLANNED_BLOCK:
+            #ifdef BUFFER_MONITORING
+              plan_source = PLAN_SOURCE_SD;
+            #endif
+            ok = plan_buffer_planned(pb);
+            break;
+          case PLANNED_COMMAND:
+            command[length] = '\0';
+            fromsd[cmd_queue_index_w] = true;
+            commands_in_queue++;
+            cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
+            break;
+          case PLANNED_POSITION:
+            for (int i = 0; i < NUM_AXIS; i++) if (isnan(pos[i]) || isinf(pos[i])) ok = false;
+            if (ok) {
+              // Where the blocks so far end, as a G92 after them
+              st_synchronize();
+              for (int i = 0; i < NUM_AXIS; i++) current_position[i] = pos[i];
+              plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
+            }
+            break;
+        }
+        if (!ok) {
+          SERIAL_ERROR_START;
+          SERIAL_ERRORPGM(MSG_SD_PLANNED_BAD_RECORD);
+          SERIAL_ERRORLN(card.getIndex());
+          card.sdprinting = false;
+          card.closefile();
+          return;
+        }
+      }
+      if (card.eof()) sd_file_printed();
+    }
+
+  #endif // SD_BLOCK_PLAYBACK
+
+  #ifdef SD_TOKENIZED_GCODE
+
+    // Decode the commands of a tokenized file into the command queue
+    static void get_tokenized_commands() {
+      while (commands_in_queue < BUFSIZE) {
+        int8_t result = card.getTokenizedCommand(command_queue[cmd_queue_index_w]);
+        if (result > 0) {
+          fromsd[cmd_queue_index_w] = true;
+          commands_in_queue++;
+          cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
+          continue;
+        }
+        if (result < 0) {
+          SERIAL_ERROR_START;
+          SERIAL_ERRORPGM(MSG_SD_TOKEN_BAD_RECORD);
+          SERIAL_ERRORLN(card.getIndex());
+          card.sdprinting = false;
+          card.closefile();
+        }
+        else
+          sd_file_printed();
+        return;
+      }
+    }
+
+  #endif // SD_TOKENIZED_GCODE
+
+#endif // SDSUPPORT
+
+#ifdef REALTIME_COMMANDS
+
+  // Move the received line to the command queue
+  static void queue_serial_line() {
+    strcpy(command_queue[cmd_queue_index_w], serial_line);
+    #ifdef SDSUPPORT
+      fromsd[cmd_queue_index_w] = false;
+    #endif
+    cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
+    commands_in_queue++;
+    serial_line_complete = false;
+    serial_count = 0;
+  }
+
+#endif // REALTIME_COMMANDS
+
 /**
- * Add to the circular command queue the next command from:
- *  - The command-injection queue (queued_commands_P)
- *  - The active serial input (usually USB)
- *  - The SD card file being actively printed
+ * Add lines from the active serial input (usually USB) to the command queue.
+ * With REALTIME_COMMANDS this also runs from idle(), to catch real-time
+ * commands while the queue is full or a command waits.
  */
-void get_command() {
+static void get_serial_commands() {
 
-  if (drain_queued_commands_P()) return; // priority is given to non-serial commands
-  
   #ifdef NO_TIMEOUTS
     static millis_t last_command_time = 0;
     millis_t ms = millis();
@@ -762,10 +922,18 @@ void get_command() {
     }
   #endif
 
+  #ifdef REALTIME_COMMANDS
+    // The lines after a complete one stay in the serial buffer until it is queued
+    if (serial_line_complete) {
+      if (commands_in_queue >= BUFSIZE) return;
+      queue_serial_line();
+    }
+  #endif
+
   //
-  // Loop while serial characters are incoming and the queue is not full
+  // Loop while serial characters are incoming and the line has room
   //
-  while (commands_in_queue < BUFSIZE && MYSERIAL.available() > 0) {
+  while (SERIAL_LINE_ROOM && MYSERIAL.available() > 0) {
 
     #ifdef NO_TIMEOUTS
       last_command_time = ms;
@@ -783,11 +951,11 @@ void get_command() {
 
       if (!serial_count) return; // empty lines just exit
 
-      char *command = command_queue[cmd_queue_index_w];
+      char *command = SERIAL_LINE;
       command[serial_count] = 0; // terminate string
 
       // this item in the queue is not from sd
-      #ifdef SDSUPPORT
+      #if defined(SDSUPPORT) && !defined(REALTIME_COMMANDS)
         fromsd[cmd_queue_index_w] = false;
       #endif
 
@@ -852,29 +1020,67 @@ void get_command() {
       // If command was e-stop process now
       if (strcmp(command, "M112") == 0) kill(PSTR(MSG_KILLED));
 
-      cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
-      commands_in_queue += 1;
+      #ifdef REALTIME_COMMANDS
+        if (realtime_command(command))
+          serial_count = 0;
+        else if (commands_in_queue < BUFSIZE)
+          queue_serial_line();
+        else {
+          serial_line_complete = true;
+          return;
+        }
+      #else
+        cmd_queue_index_w = (cmd_queue_index_w + 1) % BUFSIZE;
+        commands_in_queue += 1;
 
-      serial_count = 0; //clear buffer
+        serial_count = 0; //clear buffer
+      #endif
     }
     else if (serial_char == '\\') {  // Handle escapes
-      if (MYSERIAL.available() > 0 && commands_in_queue < BUFSIZE) {
+      if (MYSERIAL.available() > 0 && SERIAL_LINE_ROOM) {
         // if we have one more character, copy it over
         serial_char = MYSERIAL.read();
-        command_queue[cmd_queue_index_w][serial_count++] = serial_char;
+        SERIAL_LINE[serial_count++] = serial_char;
       }
       // otherwise do nothing
     }
     else { // its not a newline, carriage return or escape char
       if (serial_char == ';') comment_mode = true;
-      if (!comment_mode) command_queue[cmd_queue_index_w][serial_count++] = serial_char;
+      if (!comment_mode) SERIAL_LINE[serial_count++] = serial_char;
     }
   }
+}
+
+/**
+ * Add to the circular command queue the next command from:
+ *  - The command-injection queue (queued_commands_P)
+ *  - The active serial input (usually USB)
+ *  - The SD card file being actively printed
+ */
+void get_command() {
+
+  if (drain_queued_commands_P()) return; // priority is given to non-serial commands
+
+  get_serial_commands();
 
   #ifdef SDSUPPORT
 
     if (!card.sdprinting || serial_count) return;
 
+    #ifdef SD_BLOCK_PLAYBACK
+      if (card.playback) {
+        get_planned_blocks();
+        return;
+      }
+    #endif
+
+    #ifdef SD_TOKENIZED_GCODE
+      if (card.tokenized) {
+        get_tokenized_commands();
+        return;
+      }
+    #endif
+
     // '#' stops reading from SD to the buffer prematurely, so procedural macro calls are possible
     // if it occurs, stop_buffering is triggered and the buffer is ran dry.
     // this character _can_ occur in serial com, due to checksums. however, no checksums are used in SD printing
@@ -889,19 +1095,7 @@ void get_command() {
           ((serial_char == '#' || serial_char == ':') && !comment_mode) ||
           serial_count >= (MAX_CMD_SIZE - 1) || n == -1
       ) {
-        if (card.eof()) {
-          SERIAL_PROTOCOLLNPGM(MSG_FILE_PRINTED);
-          print_job_stop_ms = millis();
-          char time[30];
-          millis_t t = (print_job_stop_ms - print_job_start_ms) / 1000;
-          int hours = t / 60 / 60, minutes = (t / 60) % 60;
-          sprintf_P(time, PSTR("%i " MSG_END_HOUR " %i " MSG_END_MINUTE), hours, minutes);
-          SERIAL_ECHO_START;
-          SERIAL_ECHOLN(time);
-          lcd_setstatus(time, true);
-          card.printingHasFinished();
-          card.checkautostart(true);
-        }
+        if (card.eof()) sd_file_printed();
         if (serial_char == '#') stop_buffering = true;
 
         if (!serial_count) {
@@ -981,6 +1175,8 @@ XYZ_CONSTS_FROM_CONFIG(signed char, home_dir, HOME_DIR);
   #define DXC_FULL_CONTROL_MODE 0
   #define DXC_AUTO_PARK_MODE    1
   #define DXC_DUPLICATION_MODE  2
+  #define DXC_MIRRORED_MODE     3
+  #define DXC_DUPLICATING (dual_x_carriage_mode >= DXC_DUPLICATION_MODE)
 
   static int dual_x_carriage_mode = DEFAULT_DUAL_X_CARRIAGE_MODE;
 
@@ -1004,8 +1200,16 @@ XYZ_CONSTS_FROM_CONFIG(signed char, home_dir, HOME_DIR);
   static float raised_parked_position[NUM_AXIS]; // used in mode 1
   static millis_t delayed_move_time = 0; // used in mode 1
   static float duplicate_extruder_x_offset = DEFAULT_DUPLICATION_X_OFFSET; // used in mode 2
-  static float duplicate_extruder_temp_offset = 0; // used in mode 2
-  bool extruder_duplication_enabled = false; // used in mode 2
+  static float duplicate_extruder_temp_offset = 0; // used in mode 2 & 3
+  bool extruder_duplication_enabled = false; // used in mode 2 & 3
+  bool extruder_duplication_mirrored = false; // used in mode 3
+
+  // Position of the second carriage when the first is at x. In mirrored
+  // mode the carriages mirror each other about the middle of their homes.
+  static float duplicate_x2_pos(float x) {
+    if (dual_x_carriage_mode == DXC_MIRRORED_MODE) return x_home_pos(0) + x_home_pos(1) - x;
+    return x + duplicate_extruder_x_offset;
+  }
 
 #endif //DUAL_X_CARRIAGE
 
@@ -1019,11 +1223,15 @@ static void axis_is_at_home(AxisEnum axis) {
                  max_pos[X_AXIS] = max(extruder_offset[X_AXIS][1], X2_MAX_POS);
         return;
       }
-      else if (dual_x_carriage_mode == DXC_DUPLICATION_MODE) {
+      else if (DXC_DUPLICATING) {
         float xoff = home_offset[X_AXIS];
         current_position[X_AXIS] = base_home_pos(X_AXIS) + xoff;
                  min_pos[X_AXIS] = base_min_pos(X_AXIS) + xoff;
-                 max_pos[X_AXIS] = min(base_max_pos(X_AXIS) + xoff, max(extruder_offset[X_AXIS][1], X2_MAX_POS) - duplicate_extruder_x_offset);
+        if (dual_x_carriage_mode == DXC_MIRRORED_MODE)
+          // The carriages approach each other: keep them as far apart as X2_MIN_POS keeps X2 from the parked first carriage
+          max_pos[X_AXIS] = min(base_max_pos(X_AXIS) + xoff, (x_home_pos(0) + x_home_pos(1) - (X2_MIN_POS - base_home_pos(X_AXIS))) / 2);
+        else
+          max_pos[X_AXIS] = min(base_max_pos(X_AXIS) + xoff, max(extruder_offset[X_AXIS][1], X2_MAX_POS) - duplicate_extruder_x_offset);
         return;
       }
     }
@@ -1220,7 +1428,7 @@ static void setup_for_endstop_move() {
       st_synchronize();
 
       // Tell the planner where we ended up - Get this from the stepper handler
-      zPosition = st_get_position_mm(Z_AXIS);
+      zPosition = plan_get_axis_position_mm(Z_AXIS);
       plan_set_position(current_position[X_AXIS], current_position[Y_AXIS], zPosition, current_position[E_AXIS]);
 
       // move up the retract distance
@@ -1238,7 +1446,7 @@ static void setup_for_endstop_move() {
       endstops_hit_on_purpose(); // clear endstop hit flags
 
       // Get the current stepper position after bumping an endstop
-      current_position[Z_AXIS] = st_get_position_mm(Z_AXIS);
+      current_position[Z_AXIS] = plan_get_axis_position_mm(Z_AXIS);
       sync_plan_position();
       
     #endif // !DELTA
@@ -1369,6 +1577,7 @@ static void setup_for_endstop_move() {
       prepare_move_raw(); // this will also set_current_to_destination
 
       st_synchronize();
+      if (MOVES_ABORTED) return; // The probe wasn't moved
 
       #ifdef Z_PROBE_ENDSTOP
         z_probe_endstop = (READ(Z_PROBE_PIN) != Z_PROBE_ENDSTOP_INVERTING);
@@ -1462,6 +1671,7 @@ static void setup_for_endstop_move() {
       prepare_move_raw(); // this will also set_current_to_destination
       
       st_synchronize();
+      if (MOVES_ABORTED) return; // The probe wasn't moved
 
       #ifdef Z_PROBE_ENDSTOP
         bool z_probe_endstop = (READ(Z_PROBE_PIN) != Z_PROBE_ENDSTOP_INVERTING);
@@ -1747,7 +1957,7 @@ static void homeaxis(AxisEnum axis) {
     destination[axis] = current_position[axis];
     feedrate = 0.0;
     endstops_hit_on_purpose(); // clear endstop hit flags
-    axis_known_position[axis] = true;
+    axis_known_position[axis] = !MOVES_ABORTED; // Not homed if a real-time M410 dropped the moves
 
     #ifdef Z_PROBE_SLED
     // bring probe back
@@ -1779,51 +1989,22 @@ static void homeaxis(AxisEnum axis) {
 
 #ifdef FWRETRACT
 
+  /**
+   * Retract or recover the filament of the active extruder in a planner block
+   * of its own. The Z lift goes with the next move, the recovery lowers it.
+   * The E coordinate is unaffected.
+   */
   void retract(bool retracting, bool swapping=false) {
 
     if (retracting == retracted[active_extruder]) return;
 
-    float oldFeedrate = feedrate;
-
-    set_destination_to_current();
-
-    if (retracting) {
-
-      feedrate = retract_feedrate * 60;
-      current_position[E_AXIS] += (swapping ? retract_length_swap : retract_length) / volumetric_multiplier[active_extruder];
-      plan_set_e_position(current_position[E_AXIS]);
-      prepare_move();
-
-      if (retract_zlift > 0.01) {
-        current_position[Z_AXIS] -= retract_zlift;
-        #ifdef DELTA
-          sync_plan_position_delta();
-        #else
-          sync_plan_position();
-        #endif
-        prepare_move();
-      }
-    }
-    else {
-
-      if (retract_zlift > 0.01) {
-        current_position[Z_AXIS] += retract_zlift;
-        #ifdef DELTA
-          sync_plan_position_delta();
-        #else
-          sync_plan_position();
-        #endif
-        //prepare_move();
-      }
-
-      feedrate = retract_recover_feedrate * 60;
-      float move_e = swapping ? retract_length_swap + retract_recover_length_swap : retract_length + retract_recover_length;
-      current_position[E_AXIS] -= move_e / volumetric_multiplier[active_extruder];
-      plan_set_e_position(current_position[E_AXIS]);
-      prepare_move();
-    }
+    if (retracting)
+      plan_retract(swapping ? retract_length_swap : retract_length, retract_feedrate,
+                   retract_zlift > 0.01 ? retract_zlift : 0, active_extruder);
+    else
+      plan_retract(-(swapping ? retract_length_swap + retract_recover_length_swap : retract_length + retract_recover_length),
+                   retract_recover_feedrate, 0, active_extruder);
 
-    feedrate = oldFeedrate;
     retracted[active_extruder] = retracting;
 
   } // retract()
@@ -1876,6 +2057,9 @@ inline void gcode_G0_G1() {
         float echange = destination[E_AXIS] - current_position[E_AXIS];
         // Is this move an attempt to retract or recover?
         if ((echange < -MIN_RETRACT && !retracted[active_extruder]) || (echange > MIN_RETRACT && retracted[active_extruder])) {
+          #ifdef COALESCE_SEGMENTS
+            coalesce_flush();
+          #endif
           current_position[E_AXIS] = destination[E_AXIS]; // hide the slicer-generated retract/recover from calculations
           plan_set_e_position(current_position[E_AXIS]);  // AND from the planner
           retract(!retracted[active_extruder]);
@@ -1975,8 +2159,9 @@ void plan_arc(
   arc_target[E_AXIS] = current_position[E_AXIS];
 
   float feed_rate = feedrate*feedrate_multiplier/60/100.0;
+  plan_feedrate_multiplier = feedrate_multiplier;
 
-  for (i = 1; i < segments; i++) { // Increment (segments-1)
+  for (i = 1; i < segments && !MOVES_ABORTED; i++) { // Increment (segments-1)
 
     if (count < N_ARC_CORRECTION) {
       // Apply vector rotation matrix to previous r_axis0 / 1
@@ -2006,6 +2191,7 @@ void plan_arc(
   }
   // Ensure last segment arrives at target location.
   plan_buffer_line(target[X_AXIS], target[Y_AXIS], target[Z_AXIS], target[E_AXIS], feed_rate, active_extruder);
+  plan_feedrate_multiplier = 0;
 
   // As far as the parser is concerned, the position is now == target. In reality the
   // motion control system might still be processing the action and the real tool position
@@ -2457,6 +2643,11 @@ inline void gcode_G28() {
           plan_buffer_line(current_position[X_AXIS], current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], homing_feedrate[X_AXIS]/60, active_extruder);
           st_synchronize();
           probe_point++;
+          if (MOVES_ABORTED) {
+            // The nozzle isn't over the point, start again with G29 S1
+            SERIAL_PROTOCOLLNPGM("Mesh probing aborted.");
+            probe_point = -1;
+          }
         }
         else {
           // After recording the last point, activate the mbl and home
@@ -2748,6 +2939,14 @@ inline void gcode_G28() {
 
       clean_up_after_endstop_move();
 
+      // A real-time M410 dropped the probing moves, the heights are meaningless
+      if (MOVES_ABORTED) {
+        dryrun = true;
+        #ifdef DELTA
+          reset_bed_level();
+        #endif
+      }
+
       #ifdef DELTA
 
         if (!dryrun) extrapolate_unprobed_bed_level();
@@ -2821,6 +3020,7 @@ inline void gcode_G28() {
             z_at_pt_2 = probe_pt(ABL_PROBE_PT_2_X, ABL_PROBE_PT_2_Y, current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS, p2, verbose_level),
             z_at_pt_3 = probe_pt(ABL_PROBE_PT_3_X, ABL_PROBE_PT_3_Y, current_position[Z_AXIS] + Z_RAISE_BETWEEN_PROBINGS, p3, verbose_level);
       clean_up_after_endstop_move();
+      if (MOVES_ABORTED) dryrun = true;
       if (!dryrun) set_bed_level_equation_3pts(z_at_pt_1, z_at_pt_2, z_at_pt_3);
 
     #endif // !AUTO_BED_LEVELING_GRID
@@ -3019,8 +3219,14 @@ inline void gcode_M17() {
    * M26: Set SD Card file index
    */
   inline void gcode_M26() {
-    if (card.cardOK && code_seen('S'))
-      card.setIndex(code_value_short());
+    if (card.cardOK && code_seen('S')) {
+      if (card.isSeekable())
+        card.setIndex(code_value_short());
+      else {
+        SERIAL_ERROR_START;
+        SERIAL_ERRORLNPGM(MSG_SD_NOT_SEEKABLE);
+      }
+    }
   }
 
   /**
@@ -3092,8 +3298,14 @@ inline void gcode_M31() {
     if (card.cardOK) {
       card.openFile(namestartpos, true, !call_procedure);
 
-      if (code_seen('S') && seen_pointer < namestartpos) // "S" (must occur _before_ the filename!)
-        card.setIndex(code_value_short());
+      if (code_seen('S') && seen_pointer < namestartpos) { // "S" (must occur _before_ the filename!)
+        if (card.isSeekable())
+          card.setIndex(code_value_short());
+        else {
+          SERIAL_ERROR_START;
+          SERIAL_ERRORLNPGM(MSG_SD_NOT_SEEKABLE);
+        }
+      }
 
       card.startFileprint();
       if (!call_procedure)
@@ -3212,10 +3424,10 @@ inline void gcode_M42() {
       }
     }
 
-    double X_current = st_get_position_mm(X_AXIS),
-           Y_current = st_get_position_mm(Y_AXIS),
-           Z_current = st_get_position_mm(Z_AXIS),
-           E_current = st_get_position_mm(E_AXIS),
+    double X_current = plan_get_axis_position_mm(X_AXIS),
+           Y_current = plan_get_axis_position_mm(Y_AXIS),
+           Z_current = plan_get_axis_position_mm(Z_AXIS),
+           E_current = plan_get_axis_position_mm(E_AXIS),
            X_probe_location = X_current, Y_probe_location = Y_current,
            Z_start_location = Z_current + Z_RAISE_BEFORE_PROBING;
 
@@ -3269,10 +3481,10 @@ inline void gcode_M42() {
         active_extruder);
     st_synchronize();
 
-    current_position[X_AXIS] = X_current = st_get_position_mm(X_AXIS);
-    current_position[Y_AXIS] = Y_current = st_get_position_mm(Y_AXIS);
-    current_position[Z_AXIS] = Z_current = st_get_position_mm(Z_AXIS);
-    current_position[E_AXIS] = E_current = st_get_position_mm(E_AXIS);
+    current_position[X_AXIS] = X_current = plan_get_axis_position_mm(X_AXIS);
+    current_position[Y_AXIS] = Y_current = plan_get_axis_position_mm(Y_AXIS);
+    current_position[Z_AXIS] = Z_current = plan_get_axis_position_mm(Z_AXIS);
+    current_position[E_AXIS] = E_current = plan_get_axis_position_mm(E_AXIS);
 
     // 
     // OK, do the initial probe to get us close to the bed.
@@ -3284,15 +3496,15 @@ inline void gcode_M42() {
     setup_for_endstop_move();
     run_z_probe();
 
-    current_position[Z_AXIS] = Z_current = st_get_position_mm(Z_AXIS);
-    Z_start_location = st_get_position_mm(Z_AXIS) + Z_RAISE_BEFORE_PROBING;
+    current_position[Z_AXIS] = Z_current = plan_get_axis_position_mm(Z_AXIS);
+    Z_start_location = plan_get_axis_position_mm(Z_AXIS) + Z_RAISE_BEFORE_PROBING;
 
     plan_buffer_line( X_probe_location, Y_probe_location, Z_start_location,
         E_current,
         homing_feedrate[X_AXIS]/60,
         active_extruder);
     st_synchronize();
-    current_position[Z_AXIS] = Z_current = st_get_position_mm(Z_AXIS);
+    current_position[Z_AXIS] = Z_current = plan_get_axis_position_mm(Z_AXIS);
 
     if (deploy_probe_for_each_reading) stow_z_probe();
 
@@ -3423,7 +3635,7 @@ inline void gcode_M104() {
     float temp = code_value();
     setTargetHotend(temp, target_extruder);
     #ifdef DUAL_X_CARRIAGE
-      if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && target_extruder == 0)
+      if (DXC_DUPLICATING && target_extruder == 0)
         setTargetHotend1(temp == 0.0 ? 0.0 : temp + duplicate_extruder_temp_offset);
     #endif
   }
@@ -3512,6 +3724,11 @@ inline void gcode_M105() {
 
 #endif // HAS_FAN
 
+/**
+ * M108: Stop waiting for heaters in M109 and M190
+ */
+inline void gcode_M108() { cancel_heatup = true; }
+
 /**
  * M109: Wait for extruder(s) to reach temperature
  */
@@ -3526,7 +3743,7 @@ inline void gcode_M109() {
     float temp = code_value();
     setTargetHotend(temp, target_extruder);
     #ifdef DUAL_X_CARRIAGE
-      if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && target_extruder == 0)
+      if (DXC_DUPLICATING && target_extruder == 0)
         setTargetHotend1(temp == 0.0 ? 0.0 : temp + duplicate_extruder_temp_offset);
     #endif
   }
@@ -4177,11 +4394,13 @@ inline void gcode_M206() {
    *   W[+mm]    retract_length_swap (multi-extruder)
    *   F[mm/min] retract_feedrate
    *   Z[mm]     retract_zlift
+   *   J[mm/s]   retract_jerk
    */
   inline void gcode_M207() {
     if (code_seen('S')) retract_length = code_value();
     if (code_seen('F')) retract_feedrate = code_value() / 60;
     if (code_seen('Z')) retract_zlift = code_value();
+    if (code_seen('J')) retract_jerk = code_value();
     #if EXTRUDERS > 1
       if (code_seen('W')) retract_length_swap = code_value();
     #endif
@@ -4260,6 +4479,7 @@ inline void gcode_M206() {
 
 /**
  * M220: Set speed percentage factor, aka "Feed Rate" (M220 S95)
+ *       Moves already in the planner buffer follow the new factor too.
  */
 inline void gcode_M220() {
   if (code_seen('S')) feedrate_multiplier = code_value();
@@ -4497,6 +4717,35 @@ inline void gcode_M226() {
 
 #endif // HAS_LCD_CONTRAST
 
+#ifdef ULTRA_LCD
+
+  /**
+   * M251: Report the time spent in lcd_update(), the frame rate and the
+   *       bytes sent for the last frame. R resets the longest time and
+   *       starts a new frame rate measurement.
+   */
+  inline void gcode_M251() {
+    millis_t ms = millis();
+    if (code_seen('R')) {
+      lcd_update_max_us = 0;
+      lcd_frames = 0;
+      lcd_stats_ms = ms;
+    }
+    SERIAL_PROTOCOLPGM("lcd update us: ");
+    SERIAL_PROTOCOL(lcd_update_us);
+    SERIAL_PROTOCOLPGM(" max: ");
+    SERIAL_PROTOCOL(lcd_update_max_us);
+    SERIAL_PROTOCOLPGM(" frames: ");
+    SERIAL_PROTOCOL(lcd_frames);
+    SERIAL_PROTOCOLPGM(" fps: ");
+    SERIAL_PROTOCOL(ms > lcd_stats_ms ? lcd_frames * 1000.0 / (ms - lcd_stats_ms) : 0.0);
+    SERIAL_PROTOCOLPGM(" bytes/frame: ");
+    SERIAL_PROTOCOL(lcd_frame_bytes);
+    SERIAL_EOL;
+  }
+
+#endif // ULTRA_LCD
+
 #ifdef PREVENT_DANGEROUS_EXTRUDE
 
   void set_extrude_min_temp(float temp) { extrude_min_temp = temp; }
@@ -4704,16 +4953,10 @@ inline void gcode_M400() { st_synchronize(); }
    */
   inline void gcode_M405() {
     if (code_seen('D')) meas_delay_cm = code_value();
-    if (meas_delay_cm > MAX_MEASUREMENT_DELAY) meas_delay_cm = MAX_MEASUREMENT_DELAY;
+    meas_delay_cm = constrain(meas_delay_cm, 0, MAX_MEASUREMENT_DELAY);
 
-    if (delay_index2 == -1) { //initialize the ring buffer if it has not been done since startup
-      int temp_ratio = widthFil_to_size_ratio();
-
-      for (delay_index1 = 0; delay_index1 < MAX_MEASUREMENT_DELAY + 1; ++delay_index1)
-        measurement_delay[delay_index1] = temp_ratio - 100;  //subtract 100 to scale within a signed byte
-
-      delay_index1 = delay_index2 = 0;
-    }
+    // The filament between sensor and nozzle wasn't tracked while the sensor was off
+    if (!filament_sensor) plan_filwidth_fill();
 
     filament_sensor = true;
 
@@ -4743,8 +4986,17 @@ inline void gcode_M400() { st_synchronize(); }
  *
  * This will stop the carriages mid-move, so most likely they
  * will be out of sync with the stepper position after this.
+ *
+ * With REALTIME_COMMANDS the command it interrupts (a move, arc,
+ * G28, G29...) plans nothing more and ends, then loop() takes the
+ * position from the step counts. DELTA and SCARA have to home again.
  */
-inline void gcode_M410() { quickStop(); }
+inline void gcode_M410() {
+  quickStop();
+  #ifdef REALTIME_COMMANDS
+    moves_aborted = true;
+  #endif
+}
 
 
 #ifdef MESH_BED_LEVELING
@@ -5051,6 +5303,8 @@ inline void gcode_M503() {
    *                         millimeters x-offset and an optional differential hotend temperature of
    *                         mmm degrees. E.g., with "M605 S2 X100 R2" the second extruder will duplicate
    *                         the first with a spacing of 100mm in the x direction and 2 degrees hotter.
+   *    M605 S3 [Rmmm]: Mirrored duplication mode. Like mode 2, but the second x-carriage moves in the
+   *                         opposite direction, mirrored about the middle between the x-carriage homes.
    *
    *    Note: the X axis should be homed after changing dual x-carriage mode.
    */
@@ -5059,7 +5313,9 @@ inline void gcode_M503() {
     if (code_seen('S')) dual_x_carriage_mode = code_value();
     switch(dual_x_carriage_mode) {
       case DXC_DUPLICATION_MODE:
-        if (code_seen('X')) duplicate_extruder_x_offset = max(code_value(), X2_MIN_POS - x_home_pos(0));
+      case DXC_MIRRORED_MODE:
+        if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && code_seen('X'))
+          duplicate_extruder_x_offset = max(code_value(), X2_MIN_POS - x_home_pos(0));
         if (code_seen('R')) duplicate_extruder_temp_offset = code_value();
         SERIAL_ECHO_START;
         SERIAL_ECHOPGM(MSG_HOTEND_OFFSET);
@@ -5081,11 +5337,105 @@ inline void gcode_M503() {
     }
     active_extruder_parked = false;
     extruder_duplication_enabled = false;
+    extruder_duplication_mirrored = false;
     delayed_move_time = 0;
   }
 
 #endif // DUAL_X_CARRIAGE
 
+#ifdef BUFFER_MONITORING
+
+  /**
+   * M576: Report the planner buffer: the time of the queued moves now and at
+   *       its lowest while moving, the underruns and how long the stepper
+   *       waited in them, by where the moves came from, and the blocks that
+   *       SLOWDOWN made longer.
+   *
+   *   R  Reset the counters after the report
+   */
+  inline void gcode_M576() {
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPAIR("Buffer ms:", block_buffer_runtime_us / 1000);
+    if (plan_lowest_runtime_us != 0xFFFFFFFF) SERIAL_ECHOPAIR(" lowest:", plan_lowest_runtime_us / 1000);
+    SERIAL_ECHOPAIR(" Underruns serial:", plan_underruns[PLAN_SOURCE_SERIAL]);
+    SERIAL_ECHOPAIR(" (ms:", plan_starved_ms[PLAN_SOURCE_SERIAL]);
+    SERIAL_ECHOPAIR(") SD:", plan_underruns[PLAN_SOURCE_SD]);
+    SERIAL_ECHOPAIR(" (ms:", plan_starved_ms[PLAN_SOURCE_SD]);
+    SERIAL_CHAR(')');
+    #ifdef SLOWDOWN
+      SERIAL_ECHOPAIR(" Slowed blocks:", plan_slowed_blocks);
+    #endif
+    SERIAL_EOL;
+    if (code_seen('R')) plan_reset_monitoring();
+  }
+
+#endif // BUFFER_MONITORING
+
+#ifdef INPUT_SHAPING
+
+  /**
+   * M593: Set the input shaping frequency F (Hz, 0 = off) and damping ratio D
+   *       of X and/or Y. Without an axis letter both axes are set.
+   *       Waits for the moves in the buffer to finish.
+   */
+  inline void gcode_M593() {
+    bool seen_x = code_seen('X'), seen_y = code_seen('Y');
+    if (!seen_x && !seen_y) seen_x = seen_y = true;
+    bool seen_f = code_seen('F');
+    float freq = seen_f ? max(code_value(), 0) : 0;
+    bool seen_d = code_seen('D');
+    float damping = seen_d ? constrain(code_value(), 0, 0.9) : 0;
+    for (uint8_t axis = X_AXIS; axis <= Y_AXIS; axis++) {
+      if (axis == X_AXIS ? !seen_x : !seen_y) continue;
+      if (seen_f) shaping_frequency[axis] = freq;
+      if (seen_d) shaping_damping[axis] = damping;
+    }
+    if (seen_f || seen_d) st_set_shaping();
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPAIR("Input shaping X F", shaping_frequency[X_AXIS]);
+    SERIAL_ECHOPAIR(" D", shaping_damping[X_AXIS]);
+    SERIAL_ECHOPAIR(" Y F", shaping_frequency[Y_AXIS]);
+    SERIAL_ECHOPAIR(" D", shaping_damping[Y_AXIS]);
+    SERIAL_EOL;
+  }
+
+#endif // INPUT_SHAPING
+
+#ifdef ADVANCE
+
+  /**
+   * M900: Set the pressure advance factor K (seconds). Moves already in the
+   *       buffer keep the factor they were planned with.
+   */
+  inline void gcode_M900() {
+    if (code_seen('K')) extruder_advance_k = max(code_value(), 0);
+    SERIAL_ECHO_START;
+    SERIAL_ECHOPAIR("Advance K: ", extruder_advance_k);
+    SERIAL_EOL;
+  }
+
+#endif // ADVANCE
+
+#ifdef STEP_TRACE
+
+  /**
+   * M930: Step trace
+   *
+   *   S1  Clear the trace and start recording the stepper interrupts
+   *   S0  Stop recording
+   *
+   *   Without S stop recording and print the trace for scripts/step_trace.py
+   */
+  inline void gcode_M930() {
+    if (code_seen('S')) {
+      if (code_value() > 0) st_trace_start(); else st_trace_stop();
+    }
+    else
+      st_trace_dump();
+  }
+
+#endif // STEP_TRACE
+
 /**
  * M907: Set digital trimpot motor current using axis codes X, Y, Z, E, B, S
  */
@@ -5209,7 +5559,6 @@ inline void gcode_T(uint8_t tmp_extruder) {
                   current_position[E_AXIS], max_feedrate[X_AXIS], active_extruder);
             plan_buffer_line(x_home_pos(active_extruder), current_position[Y_AXIS], current_position[Z_AXIS],
                   current_position[E_AXIS], max_feedrate[Z_AXIS], active_extruder);
-            st_synchronize();
           }
 
           // apply Y & Z extruder offset (x offset is already used in determining home pos)
@@ -5229,12 +5578,12 @@ inline void gcode_T(uint8_t tmp_extruder) {
             current_position[X_AXIS] = inactive_extruder_x_pos;
             inactive_extruder_x_pos = destination[X_AXIS];
           }
-          else if (dual_x_carriage_mode == DXC_DUPLICATION_MODE) {
+          else if (DXC_DUPLICATING) {
             active_extruder_parked = (active_extruder == 0); // this triggers the second extruder to move into the duplication position
             if (active_extruder == 0 || active_extruder_parked)
               current_position[X_AXIS] = inactive_extruder_x_pos;
             else
-              current_position[X_AXIS] = destination[X_AXIS] + duplicate_extruder_x_offset;
+              current_position[X_AXIS] = duplicate_x2_pos(destination[X_AXIS]);
             inactive_extruder_x_pos = destination[X_AXIS];
             extruder_duplication_enabled = false;
           }
@@ -5254,9 +5603,12 @@ inline void gcode_T(uint8_t tmp_extruder) {
         #endif // !DUAL_X_CARRIAGE
         #ifdef DELTA
           sync_plan_position_delta();
-        #else
+        #elif !HAS_TOOL_OFFSETS
           sync_plan_position();
         #endif
+        // Otherwise plan_buffer_line() applies the offsets of the new tool, and
+        // the queued moves run on without a stop between the tools. With
+        // DUAL_X_CARRIAGE the planner keeps the X position of each carriage.
         // Move to the old position if 'F' was in the parameters
         if (make_move && IsRunning()) prepare_move();
       }
@@ -5274,6 +5626,81 @@ inline void gcode_T(uint8_t tmp_extruder) {
   }
 }
 
+#ifdef REALTIME_COMMANDS
+
+  /**
+   * Run a real-time command as soon as it is received, ahead of the command
+   * queue. This may be inside idle() while a queued command waits, so the
+   * parser state of that command is kept.
+   */
+  static bool realtime_command(char *command) {
+    #ifdef SDSUPPORT
+      if (card.saving) return false; // M28 writes every line to the file
+    #endif
+
+    while (*command == ' ') ++command;
+    if (*command == 'N') {
+      ++command;
+      while ((*command >= '0' && *command <= '9') || *command == ' ') ++command;
+    }
+    if (*command != 'M' || command[1] < '0' || command[1] > '9') return false;
+    char *args;
+    int codenum = strtol(command + 1, &args, 10);
+    switch (codenum) {
+      #ifdef SDSUPPORT
+        case 25:
+      #endif
+      case 105: case 108: case 112: case 410:
+        break;
+      default:
+        return false;
+    }
+
+    char *starpos = strchr(args, '*');
+    if (starpos) *starpos = '\0';
+    char *saved_command = current_command, *saved_args = current_command_args, *saved_seen = seen_pointer;
+    uint8_t saved_extruder = target_extruder;
+    current_command = command;
+    current_command_args = args;
+    while (*current_command_args == ' ') ++current_command_args;
+
+    switch (codenum) {
+      #ifdef SDSUPPORT
+        case 25: gcode_M25(); break;
+      #endif
+      case 105: gcode_M105(); break;
+      case 108: gcode_M108(); break;
+      case 112: gcode_M112(); break;
+      case 410: gcode_M410(); break;
+    }
+    if (codenum != 105) SERIAL_PROTOCOLLNPGM(MSG_OK); // M105 prints its own
+
+    current_command = saved_command;
+    current_command_args = saved_args;
+    seen_pointer = saved_seen;
+    target_extruder = saved_extruder;
+    return true;
+  }
+
+  /**
+   * A real-time M410 made the interrupted command end without its moves.
+   * Take the position where the steppers stopped and plan from there.
+   */
+  static void resume_after_abort() {
+    float pos[NUM_AXIS];
+    plan_resume_after_abort(pos);
+    #if defined(DELTA) || defined(SCARA)
+      // The planner has the tower positions, X, Y and Z are unknown until homed
+      current_position[E_AXIS] = pos[E_AXIS];
+      for (int i = X_AXIS; i <= Z_AXIS; i++) axis_known_position[i] = false;
+    #else
+      memcpy(current_position, pos, sizeof(current_position));
+    #endif
+    set_destination_to_current();
+  }
+
+#endif // REALTIME_COMMANDS
+
 /**
  * Process a single command and dispatch it to its handler
  * This is called from the main loop()
@@ -5281,6 +5708,11 @@ inline void gcode_T(uint8_t tmp_extruder) {
 void process_next_command() {
   current_command = command_queue[cmd_queue_index_r];
 
+  #if defined(BUFFER_MONITORING) && defined(SDSUPPORT)
+    // Underruns ended by the moves of this command are counted for its source
+    plan_source = fromsd[cmd_queue_index_r] ? PLAN_SOURCE_SD : PLAN_SOURCE_SERIAL;
+  #endif
+
   if ((marlin_debug_flags & DEBUG_ECHO)) {
     SERIAL_ECHO_START;
     SERIAL_ECHOLN(current_command);
@@ -5320,6 +5752,11 @@ void process_next_command() {
   seen_pointer = current_command;
   codenum = code_value_short();
 
+  #ifdef COALESCE_SEGMENTS
+    // Only G0 and G1 can be merged into the pending move
+    if (command_code != 'G' || codenum > 1) coalesce_flush();
+  #endif
+
   // Handle a known G, M, or T
   switch(command_code) {
     case 'G': switch (codenum) {
@@ -5477,6 +5914,10 @@ void process_next_command() {
         gcode_M105();
         return; // "ok" already printed
 
+      case 108: // M108: Stop waiting for heaters
+        gcode_M108();
+        break;
+
       case 109: // M109: Wait for temperature
         gcode_M109();
         break;
@@ -5618,7 +6059,7 @@ void process_next_command() {
       #endif
 
       #ifdef FWRETRACT
-        case 207: //M207 - set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop]
+        case 207: //M207 - set retract length S[positive mm] F[feedrate mm/min] Z[additional zlift/hop] J[jerk mm/s]
           gcode_M207();
           break;
         case 208: // M208 - set retract recover length S[positive mm surplus to the M207 S*] F[feedrate mm/min]
@@ -5683,6 +6124,12 @@ void process_next_command() {
           break;
       #endif // HAS_LCD_CONTRAST
 
+      #ifdef ULTRA_LCD
+        case 251: // M251  Report lcd_update() time and frame rate: R resets
+          gcode_M251();
+          break;
+      #endif // ULTRA_LCD
+
       #ifdef PREVENT_DANGEROUS_EXTRUDE
         case 302: // allow cold extrudes, or set the minimum extrude temperature
           gcode_M302();
@@ -5790,12 +6237,30 @@ void process_next_command() {
           break;
       #endif // FILAMENTCHANGEENABLE
 
+      #ifdef BUFFER_MONITORING
+        case 576: // M576 Report the planner buffer
+          gcode_M576();
+          break;
+      #endif // BUFFER_MONITORING
+
+      #ifdef INPUT_SHAPING
+        case 593: // M593 Set input shaping
+          gcode_M593();
+          break;
+      #endif // INPUT_SHAPING
+
       #ifdef DUAL_X_CARRIAGE
         case 605:
           gcode_M605();
           break;
       #endif // DUAL_X_CARRIAGE
 
+      #ifdef ADVANCE
+        case 900: // M900 Set the pressure advance factor
+          gcode_M900();
+          break;
+      #endif // ADVANCE
+
       case 907: // M907 Set digital trimpot motor current using axis codes.
         gcode_M907();
         break;
@@ -5806,6 +6271,12 @@ void process_next_command() {
           break;
       #endif // HAS_DIGIPOTSS
 
+      #ifdef STEP_TRACE
+        case 930: // M930 Step trace
+          gcode_M930();
+          break;
+      #endif // STEP_TRACE
+
       #if HAS_MICROSTEPS
 
         case 350: // M350 Set microstepping mode. Warning: Steps per unit remains unchanged. S code sets stepping mode for all drivers.
@@ -5966,7 +6437,7 @@ void clamp_to_software_endstops(float target[3]) {
 // This function is used to split lines on mesh borders so each segment is only part of one mesh area
 void mesh_plan_buffer_line(float x, float y, float z, const float e, float feed_rate, const uint8_t &extruder, uint8_t x_splits=0xff, uint8_t y_splits=0xff)
 {
-  if (!mbl.active) {
+  if (!mbl.active || MOVES_ABORTED) {
     plan_buffer_line(x, y, z, e, feed_rate, extruder);
     set_current_to_destination();
     return;
@@ -6067,7 +6538,8 @@ void mesh_plan_buffer_line(float x, float y, float z, const float e, float feed_
     // SERIAL_ECHOPGM(" seconds="); SERIAL_ECHO(seconds);
     // SERIAL_ECHOPGM(" steps="); SERIAL_ECHOLN(steps);
 
-    for (int s = 1; s <= steps; s++) {
+    plan_feedrate_multiplier = feedrate_multiplier;
+    for (int s = 1; s <= steps && !MOVES_ABORTED; s++) {
 
       float fraction = float(s) / float(steps);
 
@@ -6089,6 +6561,7 @@ void mesh_plan_buffer_line(float x, float y, float z, const float e, float feed_
 
       plan_buffer_line(delta[X_AXIS], delta[Y_AXIS], delta[Z_AXIS], destination[E_AXIS], feedrate/60*feedrate_multiplier/100.0, active_extruder);
     }
+    plan_feedrate_multiplier = 0;
     return true;
   }
 
@@ -6102,14 +6575,20 @@ void mesh_plan_buffer_line(float x, float y, float z, const float e, float feed_
 
   inline bool prepare_move_dual_x_carriage() {
     if (active_extruder_parked) {
-      if (dual_x_carriage_mode == DXC_DUPLICATION_MODE && active_extruder == 0) {
-        // move duplicate extruder into correct duplication position.
-        plan_set_position(inactive_extruder_x_pos, current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS]);
-        plan_buffer_line(current_position[X_AXIS] + duplicate_extruder_x_offset,
-          current_position[Y_AXIS], current_position[Z_AXIS], current_position[E_AXIS], max_feedrate[X_AXIS], 1);
-        sync_plan_position();
-        st_synchronize();
+      #ifdef COALESCE_SEGMENTS
+        coalesce_flush();
+      #endif
+      if (DXC_DUPLICATING && active_extruder == 0) {
+        // move duplicate extruder into correct duplication position. The
+        // planner moves it from where it is, Y and Z are given with the tool
+        // offsets of extruder 1 so the carriage stays at the Y and Z of extruder 0.
+        plan_buffer_line(duplicate_x2_pos(current_position[X_AXIS]),
+          current_position[Y_AXIS] - extruder_offset[Y_AXIS][0] + extruder_offset[Y_AXIS][1],
+          current_position[Z_AXIS] - extruder_offset[Z_AXIS][0] + extruder_offset[Z_AXIS][1],
+          current_position[E_AXIS], max_feedrate[X_AXIS], 1);
+        // Only the blocks planned from here on move both carriages
         extruder_duplication_enabled = true;
+        extruder_duplication_mirrored = (dual_x_carriage_mode == DXC_MIRRORED_MODE);
         active_extruder_parked = false;
       }
       else if (dual_x_carriage_mode == DXC_AUTO_PARK_MODE) { // handle unparking of head
@@ -6139,17 +6618,124 @@ void mesh_plan_buffer_line(float x, float y, float z, const float e, float feed_
 
 #if !defined(DELTA) && !defined(SCARA)
 
+  #ifdef COALESCE_SEGMENTS
+
+    /**
+     * Collinear segment coalescing
+     *
+     * The last XY move is held back as the pending move, from coalesce_start
+     * to coalesce_end, so the next ones can be merged into it while they stay
+     * in line. current_position is already at its end. The pending move goes
+     * to the planner before any other command, before the moves that don't
+     * use prepare_move() (LCD manual moves, extruder runout prevention) and
+     * when the planner runs low.
+     */
+    static uint8_t coalesce_count = 0;          // Moves merged into the pending move, 0 if there is none
+    static float coalesce_start[NUM_AXIS];      // Where the planner stands
+    static float coalesce_end[NUM_AXIS];
+    static float coalesce_corner[COALESCE_MAX_SEGMENTS - 1][3]; // Ends of the merged moves but the last
+    static float coalesce_length;               // Length of the path through the corners
+    static float coalesce_feedrate;             // mm/s, feedrate_multiplier included
+    static int coalesce_multiplier;
+
+    void coalesce_flush() {
+      if (!coalesce_count) return;
+      coalesce_count = 0;
+      if (MOVES_ABORTED) return;
+      plan_feedrate_multiplier = coalesce_multiplier;
+      plan_buffer_line(coalesce_end[X_AXIS], coalesce_end[Y_AXIS], coalesce_end[Z_AXIS], coalesce_end[E_AXIS], coalesce_feedrate, active_extruder);
+      plan_feedrate_multiplier = 0;
+    }
+
+    // Can the move from coalesce_end to destination be merged into the pending move?
+    static bool coalesce_fits(const float feed_rate, const float length) {
+      if (coalesce_count >= COALESCE_MAX_SEGMENTS || feed_rate != coalesce_feedrate || feedrate_multiplier != coalesce_multiplier)
+        return false;
+
+      // Direction change from the last merged move
+      const float *corner = coalesce_count > 1 ? coalesce_corner[coalesce_count - 2] : coalesce_start;
+      float last[3], next[3], last_length = 0, dot = 0;
+      for (int i = X_AXIS; i <= Z_AXIS; i++) {
+        last[i] = coalesce_end[i] - corner[i];
+        next[i] = destination[i] - coalesce_end[i];
+        last_length += last[i] * last[i];
+        dot += last[i] * next[i];
+      }
+      last_length = sqrt(last_length);
+      static const float min_cos = cos(RADIANS(COALESCE_ANGLE));
+      if (dot < min_cos * last_length * length) return false;
+
+      // Extrusion per mm, the merged block spreads it evenly
+      float e_pending = (coalesce_end[E_AXIS] - coalesce_start[E_AXIS]) / coalesce_length,
+            e_next = (destination[E_AXIS] - coalesce_end[E_AXIS]) / length;
+      if (fabs(e_next - e_pending) > COALESCE_E_RATIO * max(fabs(e_pending), fabs(e_next))) return false;
+
+      // Distance of the corners from the merged move
+      float chord[3], chord_length = 0;
+      for (int i = X_AXIS; i <= Z_AXIS; i++) {
+        chord[i] = destination[i] - coalesce_start[i];
+        chord_length += chord[i] * chord[i];
+      }
+      chord_length = sqrt(chord_length);
+      for (uint8_t c = 0; c < coalesce_count; c++) {
+        const float *p = c < coalesce_count - 1 ? coalesce_corner[c] : coalesce_end;
+        float d2 = 0, along = 0;
+        for (int i = X_AXIS; i <= Z_AXIS; i++) {
+          float d = p[i] - coalesce_start[i];
+          d2 += d * d;
+          along += d * chord[i];
+        }
+        along /= chord_length;
+        if (d2 - along * along > COALESCE_CHORD * COALESCE_CHORD) return false;
+      }
+      return true;
+    }
+
+    // Merge the move to destination into the pending move, or start a new one
+    static void coalesce_line(const float feed_rate) {
+      float length = 0;
+      for (int i = X_AXIS; i <= Z_AXIS; i++) length += sq(destination[i] - current_position[i]);
+      length = sqrt(length);
+
+      if (coalesce_count && coalesce_fits(feed_rate, length)) {
+        for (int i = X_AXIS; i <= Z_AXIS; i++) coalesce_corner[coalesce_count - 1][i] = coalesce_end[i];
+        coalesce_count++;
+        coalesce_length += length;
+      }
+      else {
+        coalesce_flush();
+        for (int i = 0; i < NUM_AXIS; i++) coalesce_start[i] = current_position[i];
+        coalesce_count = 1;
+        coalesce_length = length;
+        coalesce_feedrate = feed_rate;
+        coalesce_multiplier = feedrate_multiplier;
+      }
+      for (int i = 0; i < NUM_AXIS; i++) coalesce_end[i] = destination[i];
+    }
+
+  #endif // COALESCE_SEGMENTS
+
   inline bool prepare_move_cartesian() {
     // Do not use feedrate_multiplier for E or Z only moves
     if (current_position[X_AXIS] == destination[X_AXIS] && current_position[Y_AXIS] == destination[Y_AXIS]) {
+      #ifdef COALESCE_SEGMENTS
+        coalesce_flush();
+      #endif
       line_to_destination();
     }
     else {
-      #ifdef MESH_BED_LEVELING
-        mesh_plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], (feedrate/60)*(feedrate_multiplier/100.0), active_extruder);
-        return false;
+      #ifdef COALESCE_SEGMENTS
+        coalesce_line((feedrate/60)*(feedrate_multiplier/100.0));
       #else
-        line_to_destination(feedrate * feedrate_multiplier / 100.0);
+        plan_feedrate_multiplier = feedrate_multiplier;
+        #ifdef MESH_BED_LEVELING
+          mesh_plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS], destination[E_AXIS], (feedrate/60)*(feedrate_multiplier/100.0), active_extruder);
+          plan_feedrate_multiplier = 0;
+          return false;
+        #else
+          line_to_destination(feedrate * feedrate_multiplier / 100.0);
+          plan_feedrate_multiplier = 0;
+        #endif
       #endif
     }
     return true;
@@ -6350,6 +6936,10 @@ void disable_all_steppers() {
  * Standard idle routine keeps the machine alive
  */
 void idle() {
+  #ifdef REALTIME_COMMANDS
+    get_serial_commands(); // Real-time commands run while a command waits
+  #endif
+  plan_update_feedrate_multiplier();
   manage_heater();
   manage_inactivity();
   lcd_update();
@@ -6473,6 +7063,9 @@ void manage_inactivity(bool ignore_stepper_queue/*=false*/) {
           #endif
         #endif
       }
+      #ifdef COALESCE_SEGMENTS
+        coalesce_flush();
+      #endif
       float oldepos = current_position[E_AXIS], oldedes = destination[E_AXIS];
       plan_buffer_line(destination[X_AXIS], destination[Y_AXIS], destination[Z_AXIS],
                       destination[E_AXIS] + EXTRUDER_RUNOUT_EXTRUDE * EXTRUDER_RUNOUT_ESTEPS / axis_steps_per_unit[E_AXIS],
@@ -6539,6 +7132,7 @@ void kill(const char *lcd_msg) {
   SERIAL_ERRORLNPGM(MSG_ERR_KILLED);
   
   // FMC small patch to update the LCD before ending
+  quickStop(); // Drop the planned moves, the LCD would wait for them
   sei();   // enable interrupts
   for (int i = 5; i--; lcd_update()) delay(200); // Wait a short time
   cli();   // disable interrupts
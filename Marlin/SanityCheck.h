@@ -258,6 +258,129 @@
     #error Invalid use of Z_PROBE_ALLEN_KEY.
   #endif
 
+  /**
+   * Input shaping requirements
+   */
+  #ifdef INPUT_SHAPING
+    #ifdef DUAL_X_CARRIAGE
+      #error INPUT_SHAPING is not implemented for DUAL_X_CARRIAGE.
+    #endif
+    #if defined(DELTA) || defined(SCARA)
+      #error INPUT_SHAPING only shapes X and Y, it can't be used with DELTA or SCARA.
+    #endif
+    #if (SHAPING_BUFFER_SIZE & (SHAPING_BUFFER_SIZE - 1)) != 0
+      #error SHAPING_BUFFER_SIZE must be a power of 2.
+    #endif
+    // The shaper timer (TC8) also drives the PWM of D11 and D12
+    #define _SHAPER_PWM_PIN(P) ((P) == 11 || (P) == 12)
+    #if _SHAPER_PWM_PIN(FAN_PIN) || _SHAPER_PWM_PIN(CONTROLLERFAN_PIN) \
+        || _SHAPER_PWM_PIN(EXTRUDER_0_AUTO_FAN_PIN) || _SHAPER_PWM_PIN(EXTRUDER_1_AUTO_FAN_PIN) \
+        || _SHAPER_PWM_PIN(EXTRUDER_2_AUTO_FAN_PIN) || _SHAPER_PWM_PIN(EXTRUDER_3_AUTO_FAN_PIN) \
+        || _SHAPER_PWM_PIN(MOTOR_CURRENT_PWM_XY_PIN) || _SHAPER_PWM_PIN(MOTOR_CURRENT_PWM_Z_PIN) \
+        || _SHAPER_PWM_PIN(MOTOR_CURRENT_PWM_E_PIN) \
+        || (defined(BARICUDA) && (_SHAPER_PWM_PIN(HEATER_1_PIN) || _SHAPER_PWM_PIN(HEATER_2_PIN)))
+      #error INPUT_SHAPING uses TC8, which drives the PWM of D11 and D12. Don't use these pins for PWM outputs.
+    #endif
+    #undef _SHAPER_PWM_PIN
+  #endif
+
+  /**
+   * The USART1 SPI of the ST7920 takes A0 (SCK1, analog input 0) and D16 (TXD1)
+   */
+  #ifdef ST7920_USART_SPI
+    #if (defined(TEMP_0_PIN) && TEMP_0_PIN == 0) || (EXTRUDERS > 1 && defined(TEMP_1_PIN) && TEMP_1_PIN == 0) \
+        || (EXTRUDERS > 2 && defined(TEMP_2_PIN) && TEMP_2_PIN == 0) || (EXTRUDERS > 3 && defined(TEMP_3_PIN) && TEMP_3_PIN == 0) \
+        || (defined(TEMP_BED_PIN) && TEMP_BED_PIN == 0) || (defined(FILAMENT_SENSOR) && FILWIDTH_PIN == 0)
+      #error ST7920_USART_SPI uses A0 (SCK1) as the display clock. It can't be a thermistor or filament sensor input.
+    #endif
+    #define _USART_SPI_PIN(P) ((P) == 16 || (P) == 54)
+    #if _USART_SPI_PIN(X_STEP_PIN) || _USART_SPI_PIN(X_DIR_PIN) || _USART_SPI_PIN(X_ENABLE_PIN) \
+        || _USART_SPI_PIN(Y_STEP_PIN) || _USART_SPI_PIN(Y_DIR_PIN) || _USART_SPI_PIN(Y_ENABLE_PIN) \
+        || _USART_SPI_PIN(Z_STEP_PIN) || _USART_SPI_PIN(Z_DIR_PIN) || _USART_SPI_PIN(Z_ENABLE_PIN) \
+        || _USART_SPI_PIN(E0_STEP_PIN) || _USART_SPI_PIN(E0_DIR_PIN) || _USART_SPI_PIN(E0_ENABLE_PIN) \
+        || (EXTRUDERS > 1 && (_USART_SPI_PIN(E1_STEP_PIN) || _USART_SPI_PIN(E1_DIR_PIN) || _USART_SPI_PIN(E1_ENABLE_PIN) || _USART_SPI_PIN(HEATER_1_PIN))) \
+        || (EXTRUDERS > 2 && (_USART_SPI_PIN(E2_STEP_PIN) || _USART_SPI_PIN(E2_DIR_PIN) || _USART_SPI_PIN(E2_ENABLE_PIN) || _USART_SPI_PIN(HEATER_2_PIN))) \
+        || (EXTRUDERS > 3 && (_USART_SPI_PIN(E3_STEP_PIN) || _USART_SPI_PIN(E3_DIR_PIN) || _USART_SPI_PIN(E3_ENABLE_PIN) || _USART_SPI_PIN(HEATER_3_PIN))) \
+        || (defined(DUAL_X_CARRIAGE) && (_USART_SPI_PIN(X2_STEP_PIN) || _USART_SPI_PIN(X2_DIR_PIN) || _USART_SPI_PIN(X2_ENABLE_PIN))) \
+        || (defined(Y_DUAL_STEPPER_DRIVERS) && (_USART_SPI_PIN(Y2_STEP_PIN) || _USART_SPI_PIN(Y2_DIR_PIN) || _USART_SPI_PIN(Y2_ENABLE_PIN))) \
+        || (defined(Z_DUAL_STEPPER_DRIVERS) && (_USART_SPI_PIN(Z2_STEP_PIN) || _USART_SPI_PIN(Z2_DIR_PIN) || _USART_SPI_PIN(Z2_ENABLE_PIN))) \
+        || _USART_SPI_PIN(X_MIN_PIN) || _USART_SPI_PIN(X_MAX_PIN) || _USART_SPI_PIN(Y_MIN_PIN) || _USART_SPI_PIN(Y_MAX_PIN) \
+        || _USART_SPI_PIN(Z_MIN_PIN) || _USART_SPI_PIN(Z_MAX_PIN) || _USART_SPI_PIN(Z_PROBE_PIN) \
+        || _USART_SPI_PIN(HEATER_0_PIN) || _USART_SPI_PIN(HEATER_BED_PIN) || _USART_SPI_PIN(FAN_PIN) || _USART_SPI_PIN(CONTROLLERFAN_PIN) \
+        || _USART_SPI_PIN(EXTRUDER_0_AUTO_FAN_PIN) || _USART_SPI_PIN(EXTRUDER_1_AUTO_FAN_PIN) \
+        || _USART_SPI_PIN(EXTRUDER_2_AUTO_FAN_PIN) || _USART_SPI_PIN(EXTRUDER_3_AUTO_FAN_PIN) \
+        || _USART_SPI_PIN(PS_ON_PIN) || _USART_SPI_PIN(KILL_PIN) || _USART_SPI_PIN(LED_PIN) || _USART_SPI_PIN(BEEPER) \
+        || _USART_SPI_PIN(BTN_EN1) || _USART_SPI_PIN(BTN_EN2) || _USART_SPI_PIN(BTN_ENC) || _USART_SPI_PIN(LCD_PINS_RS) \
+        || _USART_SPI_PIN(SDSS) || _USART_SPI_PIN(SD_DETECT_PIN) || _USART_SPI_PIN(FILRUNOUT_PIN) \
+        || _USART_SPI_PIN(SERVO0_PIN) || _USART_SPI_PIN(SERVO1_PIN) || _USART_SPI_PIN(SERVO2_PIN) || _USART_SPI_PIN(SERVO3_PIN)
+      #error ST7920_USART_SPI uses D16 (TXD1) and A0 (SCK1, D54) for the display. Move the other pins off them.
+    #endif
+    #undef _USART_SPI_PIN
+  #endif
+
+  /**
+   * Step trace
+   */
+  #if defined(STEP_TRACE) && STEP_TRACE_SIZE > 8192
+    #error STEP_TRACE_SIZE can't be more than 8192 (8 bytes each).
+  #endif
+
+  /**
+   * Segment coalescing
+   */
+  #ifdef COALESCE_SEGMENTS
+    #if defined(DELTA) || defined(SCARA)
+      #error COALESCE_SEGMENTS merges Cartesian moves, it can't be used with DELTA or SCARA.
+    #endif
+    #ifdef MESH_BED_LEVELING
+      #error COALESCE_SEGMENTS is not compatible with MESH_BED_LEVELING.
+    #endif
+    #if COALESCE_MAX_SEGMENTS < 2 || COALESCE_MAX_SEGMENTS > 32
+      #error COALESCE_MAX_SEGMENTS must be between 2 and 32.
+    #endif
+  #endif
+
+  /**
+   * Planner buffer time
+   */
+  #if defined(SLOWDOWN) && SLOWDOWN_BUFFER_TIME <= 0
+    #error SLOWDOWN_BUFFER_TIME must be greater than 0.
+  #endif
+
+  /**
+   * Planned block files
+   */
+  #ifdef SD_BLOCK_PLAYBACK
+    #ifndef SDSUPPORT
+      #error SD_BLOCK_PLAYBACK requires SDSUPPORT.
+    #endif
+    #if defined(DELTA) || defined(SCARA) || defined(DUAL_X_CARRIAGE)
+      #error SD_BLOCK_PLAYBACK only plays back Cartesian and CoreXY blocks.
+    #endif
+    #if defined(ENABLE_AUTO_BED_LEVELING) || defined(MESH_BED_LEVELING)
+      #error SD_BLOCK_PLAYBACK blocks are planned without bed leveling.
+    #endif
+  #endif
+
+  /**
+   * Tokenized G-code files
+   */
+  #if defined(SD_TOKENIZED_GCODE) && !defined(SDSUPPORT)
+    #error SD_TOKENIZED_GCODE requires SDSUPPORT.
+  #endif
+
+  /**
+   * Filament width sensor
+   */
+  #ifdef FILAMENT_SENSOR
+    #if MEASUREMENT_SAMPLE_MM < 1 || MEASUREMENT_SAMPLE_MM > 10
+      #error MEASUREMENT_SAMPLE_MM must be between 1 and 10.
+    #endif
+    #if MEASUREMENT_DELAY_CM > MAX_MEASUREMENT_DELAY
+      #error MAX_MEASUREMENT_DELAY must be larger than MEASUREMENT_DELAY_CM.
+    #endif
+  #endif
+
   /**
    * Dual X Carriage requirements
    */
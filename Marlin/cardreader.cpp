@@ -4,6 +4,9 @@
 #include "stepper.h"
 #include "temperature.h"
 #include "language.h"
+#ifdef SD_BLOCK_PLAYBACK
+  #include "planner.h"
+#endif
 
 #ifdef SDSUPPORT
 
@@ -14,9 +17,14 @@ CardReader::CardReader() {
   cardOK = false;
   saving = false;
   logging = false;
+  #ifdef SD_BLOCK_PLAYBACK
+    playback = false;
+  #endif
+  #ifdef SD_TOKENIZED_GCODE
+    tokenized = false;
+  #endif
   workDirDepth = 0;
   file_subcall_ctr = 0;
-  memset(workDirParents, 0, sizeof(workDirParents));
 
   autostart_stilltocheck = true; //the SD start is delayed, because otherwise the serial cannot answer fast enough to make contact with the host software.
   autostart_index = 0;
@@ -278,6 +286,11 @@ void CardReader::openFile(char* name, bool read, bool replace_current/*=true*/)
   if (!cardOK) return;
   if (file.isOpen()) { //replacing current file by new file, or subfile call
     if (!replace_current) {
+     if (!isSeekable()) { // The position to return to couldn't be restored
+       SERIAL_ERROR_START;
+       SERIAL_ERRORLNPGM(MSG_SD_NOT_SEEKABLE);
+       return;
+     }
      if (file_subcall_ctr > SD_PROCEDURE_DEPTH - 1) {
        SERIAL_ERROR_START;
        SERIAL_ERRORPGM("trying to call sub-gcode files with too many levels. MAX level is:");
@@ -314,6 +327,12 @@ void CardReader::openFile(char* name, bool read, bool replace_current/*=true*/)
     SERIAL_ECHOLN(name);
   }
   sdprinting = false;
+  #ifdef SD_BLOCK_PLAYBACK
+    playback = false;
+  #endif
+  #ifdef SD_TOKENIZED_GCODE
+    tokenized = false;
+  #endif
 
   SdFile myDir;
   curDir = &root;
@@ -322,11 +341,11 @@ void CardReader::openFile(char* name, bool read, bool replace_current/*=true*/)
   char *dirname_start, *dirname_end;
   if (name[0] == '/') {
     dirname_start = &name[1];
-    while (dirname_start > 0) {
+    while (dirname_start != NULL) {
       dirname_end = strchr(dirname_start, '/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start - name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end - name));
-      if (dirname_end > 0 && dirname_end > dirname_start) {
+      if (dirname_end != NULL && dirname_end > dirname_start) {
         char subdirname[FILENAME_LENGTH];
         strncpy(subdirname, dirname_start, dirname_end - dirname_start);
         subdirname[dirname_end - dirname_start] = 0;
@@ -365,6 +384,10 @@ void CardReader::openFile(char* name, bool read, bool replace_current/*=true*/)
       SERIAL_PROTOCOLLN(filesize);
       sdpos = 0;
 
+      #if defined(SD_BLOCK_PLAYBACK) || defined(SD_TOKENIZED_GCODE)
+        if (!openBinary(fname)) return;
+      #endif
+
       SERIAL_PROTOCOLLNPGM(MSG_SD_FILE_SELECTED);
       getfilename(0, fname);
       lcd_setstatus(longFilename[0] ? longFilename : fname);
@@ -390,6 +413,234 @@ void CardReader::openFile(char* name, bool read, bool replace_current/*=true*/)
   }
 }
 
+#if defined(SD_BLOCK_PLAYBACK) || defined(SD_TOKENIZED_GCODE)
+
+  /**
+   * Check for the header of a planned block or tokenized file and skip it.
+   * Returns false, with the file closed, if the file can't be printed.
+   */
+  bool CardReader::openBinary(const char *fname) {
+    char magic[4];
+    if (file.read(magic, sizeof(magic)) == sizeof(magic)) {
+      #ifdef SD_BLOCK_PLAYBACK
+        if (!strncmp(magic, PLANNED_MAGIC, sizeof(magic))) return openPlanned(fname);
+      #endif
+      #ifdef SD_TOKENIZED_GCODE
+        if (!strncmp(magic, TOKEN_MAGIC, sizeof(magic))) {
+          if (openTokenized()) return true;
+          file.close();
+          SERIAL_PROTOCOLPGM(MSG_SD_OPEN_FILE_FAIL);
+          SERIAL_PROTOCOL(fname);
+          SERIAL_PROTOCOLPGM(".\n");
+          return false;
+        }
+      #endif
+    }
+    setIndex(0);
+    return true; // A G-code file
+  }
+
+  /**
+   * Planned and tokenized files are only read from their start: records
+   * don't mark where they begin, and the decoder state depends on all the
+   * records before. M26, M32 S and procedure calls are refused for them.
+   */
+  bool CardReader::isSeekable() {
+    #ifdef SD_BLOCK_PLAYBACK
+      if (playback) return false;
+    #endif
+    #ifdef SD_TOKENIZED_GCODE
+      if (tokenized) return false;
+    #endif
+    return true;
+  }
+
+#endif
+
+#ifdef SD_BLOCK_PLAYBACK
+
+  // The rest of the header of a planned block file
+  bool CardReader::openPlanned(const char *fname) {
+    planned_header_t header;
+    uint16_t checksum;
+    memcpy(header.magic, PLANNED_MAGIC, sizeof(header.magic));
+    const uint8_t rest = sizeof(header) - sizeof(header.magic);
+    bool ok = file.read((char*)&header + sizeof(header.magic), rest) == rest
+      && file.read(&checksum, sizeof(checksum)) == sizeof(checksum)
+      && checksum == planned_checksum(0, &header, sizeof(header));
+    ok = ok && header.version == PLANNED_VERSION && header.block_size == sizeof(planned_block_t);
+    #ifdef COREXY
+      ok = ok && (header.flags & PLANNED_COREXY);
+    #else
+      ok = ok && !(header.flags & PLANNED_COREXY);
+    #endif
+    for (int i = 0; i < NUM_AXIS; i++)
+      if (fabs(header.steps_per_unit[i] - axis_steps_per_unit[i]) > axis_steps_per_unit[i] * 0.0001) ok = false;
+    if (!ok) {
+      file.close();
+      SERIAL_PROTOCOLPGM(MSG_SD_PLANNED_MISMATCH);
+      SERIAL_PROTOCOLLN(fname);
+      return false;
+    }
+    // The printer must allow the speeds, accelerations and jerks the file was planned with
+    for (int i = 0; i < NUM_AXIS; i++)
+      if (header.max_feedrate[i] > max_feedrate[i] || header.max_acceleration[i] > max_acceleration_units_per_sq_second[i]) ok = false;
+    if (!ok || header.acceleration > acceleration || header.retract_acceleration > retract_acceleration
+        || header.travel_acceleration > travel_acceleration || header.max_xy_jerk > max_xy_jerk
+        || header.max_z_jerk > max_z_jerk || header.max_e_jerk > max_e_jerk) {
+      file.close();
+      SERIAL_PROTOCOLPGM(MSG_SD_PLANNED_LIMITS);
+      SERIAL_PROTOCOLLN(fname);
+      return false;
+    }
+    sdpos = file.curPosition();
+    playback = true;
+    SERIAL_PROTOCOLLNPGM(MSG_SD_PLANNED_FILE);
+    return true;
+  }
+
+#endif // SD_BLOCK_PLAYBACK
+
+#ifdef SD_TOKENIZED_GCODE
+
+  // The rest of the header of a tokenized file
+  bool CardReader::openTokenized() {
+    uint8_t header[4]; // Version, flags and 2 reserved bytes
+    if (file.read(header, sizeof(header)) != sizeof(header) || header[0] != TOKEN_VERSION) return false;
+    sdpos = file.curPosition();
+    token_compressed = header[1] & TOKEN_COMPRESSED;
+    token_buffer_pos = token_buffer_len = 0;
+    for (int i = 0; i < TOKEN_DELTA_LETTERS; i++) token_last[i] = 0;
+    lz_head = lz_flags = lz_from = lz_left = 0;
+    tokenized = true;
+    return true;
+  }
+
+  // The next byte of the file, or -1 at its end. sdpos counts the bytes
+  // taken from the read-ahead, so M27 and the progress show what was decoded.
+  int16_t CardReader::fileByte() {
+    if (token_buffer_pos >= token_buffer_len) {
+      int16_t n = file.read(token_buffer, sizeof(token_buffer));
+      if (n <= 0) return -1;
+      token_buffer_len = n;
+      token_buffer_pos = 0;
+    }
+    sdpos++;
+    return token_buffer[token_buffer_pos++];
+  }
+
+  // The next byte of the decompressed records, or -1 at the end of the file
+  int16_t CardReader::tokenByte() {
+    if (!token_compressed) return fileByte();
+    int16_t c = 0;
+    if (!lz_left) {
+      if (lz_flags <= 1) {
+        int16_t flags = fileByte();
+        if (flags < 0) return -1;
+        lz_flags = flags | 0x100;
+      }
+      bool match = lz_flags & 1;
+      lz_flags >>= 1;
+      if ((c = fileByte()) < 0) return -1;
+      if (match) {
+        int16_t high = fileByte();
+        if (high < 0) return -1;
+        uint16_t m = c | (high << 8);
+        lz_from = (lz_head - (m & (TOKEN_LZ_WINDOW - 1)) - 1) & (TOKEN_LZ_WINDOW - 1);
+        lz_left = (m >> 10) + 3;
+      }
+    }
+    if (lz_left) {
+      c = lz_window[lz_from];
+      lz_from = (lz_from + 1) & (TOKEN_LZ_WINDOW - 1);
+      lz_left--;
+    }
+    lz_window[lz_head] = c;
+    lz_head = (lz_head + 1) & (TOKEN_LZ_WINDOW - 1);
+    return c;
+  }
+
+  bool CardReader::tokenNumber(uint32_t &n) {
+    n = 0;
+    for (uint8_t shift = 0; shift < 32; shift += 7) {
+      int16_t c = tokenByte();
+      if (c < 0) return false;
+      n |= (uint32_t)(c & 0x7F) << shift;
+      if (!(c & 0x80)) return true;
+    }
+    return false;
+  }
+
+  // Print a number in 1/10^decimals without trailing zeros
+  static char* token_value(char *p, int32_t value, uint8_t decimals) {
+    static const uint32_t scale[] = { 1, 10, 100, 1000, 10000, 100000 };
+    uint32_t u = value;
+    if (value < 0) {
+      *p++ = '-';
+      u = -u;
+    }
+    p += sprintf_P(p, PSTR("%lu"), (unsigned long)(u / scale[decimals]));
+    uint32_t fraction = u % scale[decimals];
+    if (fraction) {
+      *p++ = '.';
+      while (fraction) {
+        decimals--;
+        *p++ = '0' + fraction / scale[decimals];
+        fraction %= scale[decimals];
+      }
+    }
+    return p;
+  }
+
+  /**
+   * Decode the next record of a tokenized file into command, as the text of
+   * the command. Returns 1 for a command, 0 at the end of the file and -1 for
+   * bad data.
+   */
+  int8_t CardReader::getTokenizedCommand(char *command) {
+    int16_t head = tokenByte();
+    if (head < 0) return 0;
+
+    char *p = command;
+    if ((head & 3) == TOKEN_TEXT) {
+      int16_t length = tokenByte();
+      if (length < 0 || length >= MAX_CMD_SIZE) return -1;
+      while (length--) {
+        int16_t c = tokenByte();
+        if (c < 0) return -1;
+        *p++ = c;
+      }
+      *p = '\0';
+      return 1;
+    }
+
+    uint32_t code = head >> 3;
+    if (code == 31 && !tokenNumber(code)) return -1;
+    p += sprintf_P(p, PSTR("%c%lu"), "GMT"[head & 3], (unsigned long)code);
+
+    if (head & TOKEN_PARAMETERS) {
+      int16_t low = tokenByte(), high = tokenByte();
+      if (low < 0 || high < 0) return -1;
+      uint16_t mask = low | (high << 8);
+      for (uint8_t i = 0; i < 16; i++) {
+        if (!TEST(mask, i)) continue;
+        uint32_t n;
+        if (!tokenNumber(n)) return -1;
+        int32_t value = (n >> 1) ^ -(int32_t)(n & 1);
+        if (i < TOKEN_DELTA_LETTERS) value = token_last[i] += value;
+        // Room for the letter, a sign, 10 digits and the point
+        if (p + 15 > command + MAX_CMD_SIZE - 1) return -1;
+        *p++ = ' ';
+        *p++ = TOKEN_LETTERS[i];
+        p = token_value(p, value, TOKEN_LETTERS[i] == 'E' ? 5 : 3);
+      }
+    }
+    *p = '\0';
+    return 1;
+  }
+
+#endif // SD_TOKENIZED_GCODE
+
 void CardReader::removeFile(char* name) {
   if (!cardOK) return;
 
@@ -403,11 +654,11 @@ void CardReader::removeFile(char* name) {
   char *dirname_start, *dirname_end;
   if (name[0] == '/') {
     dirname_start = strchr(name, '/') + 1;
-    while (dirname_start > 0) {
+    while (dirname_start != NULL) {
       dirname_end = strchr(dirname_start, '/');
       //SERIAL_ECHO("start:");SERIAL_ECHOLN((int)(dirname_start - name));
       //SERIAL_ECHO("end  :");SERIAL_ECHOLN((int)(dirname_end - name));
-      if (dirname_end > 0 && dirname_end > dirname_start) {
+      if (dirname_end != NULL && dirname_end > dirname_start) {
         char subdirname[FILENAME_LENGTH];
         strncpy(subdirname, dirname_start, dirname_end - dirname_start);
         subdirname[dirname_end - dirname_start] = 0;
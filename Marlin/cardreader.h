@@ -8,6 +8,36 @@
 #include "SdFile.h"
 enum LsAction { LS_SerialPrint, LS_Count, LS_GetFilename };
 
+#ifdef SD_TOKENIZED_GCODE
+  /**
+   * Tokenized G-code, written by scripts/gcode_tokenize.py: an 8 byte header,
+   * then one record per command, LZ compressed if the header says so.
+   *
+   * A record starts with a head byte: the kind in bits 0-1, TOKEN_PARAMETERS
+   * and the code number in bits 3-7, or 31 and the code as a number. Numbers
+   * are 7 bits per byte, low first, bit 7 set when more follow. Parameters
+   * are a 16 bit mask of TOKEN_LETTERS and a zigzag number for each letter,
+   * in thousandths (E in 1/100000). TOKEN_DELTA_LETTERS store the change from
+   * their last value in the file. A TOKEN_TEXT record is a length byte and
+   * the text of the command.
+   *
+   * The compressed stream has a flag byte for each 8 items, low bit first:
+   * 0 for a byte as it is, 1 for a match of 2 bytes, 10 bits of distance - 1
+   * and 6 bits of length - 3, copying from the last TOKEN_LZ_WINDOW bytes.
+   */
+  #define TOKEN_MAGIC "MTOK"
+  #define TOKEN_VERSION 1
+  #define TOKEN_COMPRESSED 1            // Bit of the header flags
+  #define TOKEN_G 0
+  #define TOKEN_M 1
+  #define TOKEN_T 2
+  #define TOKEN_TEXT 3
+  #define TOKEN_PARAMETERS 4            // Bit of the head byte
+  #define TOKEN_LETTERS "XYZEFSPRIJTDHLKA"
+  #define TOKEN_DELTA_LETTERS 5         // X Y Z E F
+  #define TOKEN_LZ_WINDOW 1024
+#endif
+
 class CardReader {
 public:
   CardReader();
@@ -46,12 +76,26 @@ public:
   FORCE_INLINE bool isFileOpen() { return file.isOpen(); }
   FORCE_INLINE bool eof() { return sdpos >= filesize; }
   FORCE_INLINE int16_t get() { sdpos = file.curPosition(); return (int16_t)file.read(); }
+  FORCE_INLINE int16_t read(void *buf, uint16_t nbyte) { int16_t n = file.read(buf, nbyte); sdpos = file.curPosition(); return n; }
+  FORCE_INLINE uint32_t getIndex() { return sdpos; }
   FORCE_INLINE void setIndex(long index) { sdpos = index; file.seekSet(index); }
+  #if defined(SD_BLOCK_PLAYBACK) || defined(SD_TOKENIZED_GCODE)
+    bool isSeekable();
+  #else
+    FORCE_INLINE bool isSeekable() { return true; }
+  #endif
   FORCE_INLINE uint8_t percentDone() { return (isFileOpen() && filesize) ? sdpos / ((filesize + 99) / 100) : 0; }
   FORCE_INLINE char* getWorkDirName() { workDir.getFilename(filename); return filename; }
 
 public:
   bool saving, logging, sdprinting, cardOK, filenameIsDir;
+  #ifdef SD_BLOCK_PLAYBACK
+    bool playback; // The file holds blocks planned by scripts/block_plan.py
+  #endif
+  #ifdef SD_TOKENIZED_GCODE
+    bool tokenized; // The file holds tokenized G-code
+    int8_t getTokenizedCommand(char *command);
+  #endif
   char filename[FILENAME_LENGTH], longFilename[LONG_FILENAME_LENGTH];
   int autostart_index;
 private:
@@ -75,6 +119,26 @@ private:
   uint16_t nrFiles; //counter for the files in the current directory and recycled as position counter for getting the nrFiles'th name in the directory.
   char* diveDirName;
   void lsDive(const char *prepend, SdFile parent, const char * const match=NULL);
+  #if defined(SD_BLOCK_PLAYBACK) || defined(SD_TOKENIZED_GCODE)
+    bool openBinary(const char *fname);
+  #endif
+  #ifdef SD_BLOCK_PLAYBACK
+    bool openPlanned(const char *fname);
+  #endif
+  #ifdef SD_TOKENIZED_GCODE
+    uint8_t token_buffer[64], token_buffer_pos, token_buffer_len; // Read ahead from the file
+    bool token_compressed;
+    int32_t token_last[TOKEN_DELTA_LETTERS];  // Last values of the delta letters
+    uint8_t lz_window[TOKEN_LZ_WINDOW];       // The decoded stream
+    uint16_t lz_head;                         // Where the next decoded byte goes
+    uint16_t lz_flags;                        // Flags of the items left in the group, above a stop bit
+    uint16_t lz_from;                         // Where the match being copied continues
+    uint8_t lz_left;                          // Bytes of the match left to copy
+    bool openTokenized();
+    int16_t fileByte();
+    int16_t tokenByte();
+    bool tokenNumber(uint32_t &n);
+  #endif
 };
 
 extern CardReader card;
@@ -12,14 +12,21 @@
  *       If a feature is disabled, some data must still be written that, when read,
  *       either sets a Sane Default, or results in No Change to the existing value.
  *
+ * The settings are serialized into a RAM image. M500 compares the image with a
+ * shadow copy of what the EEPROM holds and only writes the pages that changed.
+ * M501 loads the whole block and checks its size and CRC32 before using it.
+ *
  */
 
-#define EEPROM_VERSION "V20"
+#define EEPROM_VERSION "V24"
 
 /**
- * V19 EEPROM Layout:
+ * V24 EEPROM Layout:
  *
  *  ver
+ *  size      number of bytes following the header
+ *  crc       CRC32 of the bytes following the header
+ *
  *  M92 XYZE  axis_steps_per_unit (x4)
  *  M203 XYZE max_feedrate (x4)
  *  M201 XYZE max_acceleration_units_per_sq_second (x4)
@@ -79,11 +86,19 @@
  *  M208 S    retract_recover_length
  *  M208 W    retract_recover_length_swap
  *  M208 F    retract_recover_feedrate
+ *  M207 J    retract_jerk
  *
  *  M200 D    volumetric_enabled (D>0 makes this enabled)
  *
  *  M200 T D  filament_size (x4) (T0..3)
  *
+ * ADVANCE:
+ *  M900 K    extruder_advance_k
+ *
+ * INPUT_SHAPING:
+ *  M593 F    shaping_frequency (x2)
+ *  M593 D    shaping_damping (x2)
+ *
  * Z_DUAL_ENDSTOPS:
  *  M666 Z    z_endstop_adj
  *
@@ -91,6 +106,7 @@
 #include "Marlin.h"
 #include "language.h"
 #include "planner.h"
+#include "stepper.h"
 #include "temperature.h"
 #include "ultralcd.h"
 #include "configuration_store.h"
@@ -99,45 +115,133 @@
   #include "mesh_bed_leveling.h"
 #endif
 
+#ifdef EEPROM_SETTINGS
+
+#define EEPROM_OFFSET 100
+#define EEPROM_HEADER_SIZE (4 + sizeof(uint16_t) + sizeof(uint32_t)) // ver, size, crc
+#define EEPROM_DATA_OFFSET (EEPROM_OFFSET + EEPROM_HEADER_SIZE)
+
+/**
+ * The size of the settings as Config_StoreSettings() writes them, part by
+ * part. Keep it in step with the writer, M500 checks that the two agree.
+ */
+#ifdef MESH_BED_LEVELING
+  #define EEPROM_MESH_SIZE (3 + sizeof(mbl.z_values)) // active, x and y points, z values
+#else
+  #define EEPROM_MESH_SIZE (3 + 3 * 3 * sizeof(float))
+#endif
+#ifdef SCARA
+  #define EEPROM_SCALING_SIZE sizeof(axis_scaling)
+#else
+  #define EEPROM_SCALING_SIZE sizeof(float)
+#endif
+#ifdef FWRETRACT
+  #define EEPROM_FWRETRACT_SIZE (sizeof(autoretract_enabled) + sizeof(retract_length) \
+    + sizeof(retract_feedrate) + sizeof(retract_zlift) + sizeof(retract_recover_length) \
+    + sizeof(retract_recover_feedrate) + sizeof(retract_jerk) + 2 * sizeof(float)) /* swap lengths */
+#else
+  #define EEPROM_FWRETRACT_SIZE 0
+#endif
+#define EEPROM_DATA_SIZE (sizeof(axis_steps_per_unit) + sizeof(max_feedrate) \
+  + sizeof(max_acceleration_units_per_sq_second) + 3 * sizeof(float)  /* accelerations */ \
+  + 2 * sizeof(float) + sizeof(minsegmenttime)                       /* minimum feedrates, segment time */ \
+  + 3 * sizeof(float) + sizeof(home_offset)                          /* jerks, home offsets */ \
+  + EEPROM_MESH_SIZE \
+  + 7 * sizeof(float)                                                /* z probe offset, delta or dual endstops */ \
+  + 6 * sizeof(int)                                                  /* preheat */ \
+  + 4 * 4 * sizeof(float)                                            /* hotend PID */ \
+  + 3 * sizeof(float) + sizeof(int)                                  /* bed PID, lcd contrast */ \
+  + EEPROM_SCALING_SIZE + EEPROM_FWRETRACT_SIZE \
+  + sizeof(volumetric_enabled) + 4 * sizeof(float)                   /* filament sizes */ \
+  + sizeof(float) + 4 * sizeof(float))                               /* advance, input shaping */
+#define EEPROM_IMAGE_SIZE (EEPROM_HEADER_SIZE + EEPROM_DATA_SIZE)
+
+#ifdef FLASH_EEPROM_EMULATION
+  // The settings must fit the emulated EEPROM
+  typedef char eeprom_image_assert[(EEPROM_OFFSET + EEPROM_IMAGE_SIZE <= FLASH_EEPROM_SIZE) ? 1 : -1];
+#endif
+
+/**
+ * EEPROM_WRITE_VAR and EEPROM_READ_VAR work on the RAM image. The shadow
+ * holds the first eeprom_shadow_size bytes as they are known to be stored.
+ */
+static uint8_t eeprom_image[EEPROM_IMAGE_SIZE];
+static uint8_t eeprom_shadow[EEPROM_IMAGE_SIZE];
+static int eeprom_shadow_size = 0;
+static bool eeprom_error;
+
 void _EEPROM_writeData(int &pos, uint8_t* value, uint8_t size) {
-  uint8_t c;
-  while(size--) {
-    eeprom_write_byte((unsigned char*)pos, *value);
-    _delay_ms(2);
-    c = eeprom_read_byte((unsigned char*)pos);
-    if (c != *value) {
-      SERIAL_ECHO_START;
-      SERIAL_ECHOLNPGM(MSG_ERR_EEPROM_WRITE);
-    }
-    pos++;
-    value++;
-  };
+  int index = pos - EEPROM_OFFSET;
+  if (index + size > EEPROM_IMAGE_SIZE)
+    eeprom_error = true;
+  else
+    memcpy(eeprom_image + index, value, size);
+  pos += size;
 }
 void _EEPROM_readData(int &pos, uint8_t* value, uint8_t size) {
-  do {
-    *value = eeprom_read_byte((unsigned char*)pos);
-    pos++;
-    value++;
-  } while (--size);
+  int index = pos - EEPROM_OFFSET;
+  if (index + size > EEPROM_IMAGE_SIZE)
+    eeprom_error = true;
+  else
+    memcpy(value, eeprom_image + index, size);
+  pos += size;
+}
+
+static uint32_t _EEPROM_crc32(const uint8_t *data, uint16_t size) {
+  uint32_t crc = 0xFFFFFFFF;
+  while (size--) {
+    crc ^= *data++;
+    for (uint8_t b = 8; b--;) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+// Copy size bytes at pos from the EEPROM into the image with one bulk read
+static void _EEPROM_load(int pos, int size) {
+  eeprom_read_block(eeprom_image + (pos - EEPROM_OFFSET), (const void*)pos, size);
+}
+
+// Write the pages of the image that differ from the shadow, return the page count
+static uint8_t _EEPROM_commit(int end) {
+  uint8_t pages = 0;
+  int shadow_end = EEPROM_OFFSET + eeprom_shadow_size;
+  for (int pos = EEPROM_OFFSET; pos < end;) {
+    int next = (pos / I2C_EEPROM_PAGE_SIZE + 1) * I2C_EEPROM_PAGE_SIZE;
+    if (next > end) next = end;
+    int index = pos - EEPROM_OFFSET, len = next - pos;
+    if (next > shadow_end || memcmp(eeprom_image + index, eeprom_shadow + index, len) != 0) {
+      if (!eeprom_write_block(eeprom_image + index, (void*)pos, len)) eeprom_error = true;
+      pages++;
+    }
+    pos = next;
+  }
+  if (eeprom_error) {
+    eeprom_shadow_size = 0; // contents unknown, rewrite everything next time
+  }
+  else {
+    memcpy(eeprom_shadow, eeprom_image, end - EEPROM_OFFSET);
+    eeprom_shadow_size = end - EEPROM_OFFSET;
+  }
+  return pages;
 }
+
 #define EEPROM_WRITE_VAR(pos, value) _EEPROM_writeData(pos, (uint8_t*)&value, sizeof(value))
 #define EEPROM_READ_VAR(pos, value) _EEPROM_readData(pos, (uint8_t*)&value, sizeof(value))
 
+#endif // EEPROM_SETTINGS
+
 /**
  * Store Configuration Settings - M500
  */
 
 #define DUMMY_PID_VALUE 3000.0f
 
-#define EEPROM_OFFSET 100
-
 #ifdef EEPROM_SETTINGS
 
 void Config_StoreSettings()  {
   float dummy = 0.0f;
-  char ver[4] = "000";
-  int i = EEPROM_OFFSET;
-  EEPROM_WRITE_VAR(i, ver); // invalidate data first
+  eeprom_error = false;
+  int i = EEPROM_DATA_OFFSET;
   EEPROM_WRITE_VAR(i, axis_steps_per_unit);
   EEPROM_WRITE_VAR(i, max_feedrate);
   EEPROM_WRITE_VAR(i, max_acceleration_units_per_sq_second);
@@ -267,6 +371,7 @@ void Config_StoreSettings()  {
       EEPROM_WRITE_VAR(i, dummy);
     #endif
     EEPROM_WRITE_VAR(i, retract_recover_feedrate);
+    EEPROM_WRITE_VAR(i, retract_jerk);
   #endif // FWRETRACT
 
   EEPROM_WRITE_VAR(i, volumetric_enabled);
@@ -277,14 +382,49 @@ void Config_StoreSettings()  {
     EEPROM_WRITE_VAR(i, dummy);
   }
 
-  char ver2[4] = EEPROM_VERSION;
+  #ifdef ADVANCE
+    EEPROM_WRITE_VAR(i, extruder_advance_k);
+  #else
+    dummy = 0.0f;
+    EEPROM_WRITE_VAR(i, dummy);
+  #endif
+
+  #ifdef INPUT_SHAPING
+    EEPROM_WRITE_VAR(i, shaping_frequency);
+    EEPROM_WRITE_VAR(i, shaping_damping);
+  #else
+    dummy = 0.0f;
+    for (int q = 0; q < 4; q++) EEPROM_WRITE_VAR(i, dummy);
+  #endif
+
+  if (i != EEPROM_OFFSET + EEPROM_IMAGE_SIZE) {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_ERR_EEPROM_IMAGE);
+    eeprom_error = true;
+  }
+
+  // The header validates the data
+  char ver[4] = EEPROM_VERSION;
+  uint16_t size = i - EEPROM_DATA_OFFSET;
+  uint32_t crc = _EEPROM_crc32(eeprom_image + EEPROM_HEADER_SIZE, size);
   int j = EEPROM_OFFSET;
-  EEPROM_WRITE_VAR(j, ver2); // validate data
+  EEPROM_WRITE_VAR(j, ver);
+  EEPROM_WRITE_VAR(j, size);
+  EEPROM_WRITE_VAR(j, crc);
+
+  uint8_t pages = eeprom_error ? 0 : _EEPROM_commit(i);
+
+  if (eeprom_error) {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_ERR_EEPROM_WRITE);
+    return;
+  }
 
   // Report storage size
   SERIAL_ECHO_START;
   SERIAL_ECHOPAIR("Settings Stored (", (unsigned long)i);
-  SERIAL_ECHOLNPGM(" bytes)");
+  SERIAL_ECHOPAIR(" bytes, ", (unsigned long)pages);
+  SERIAL_ECHOLNPGM(" pages written)");
 }
 
 /**
@@ -295,13 +435,31 @@ void Config_RetrieveSettings() {
 
   int i = EEPROM_OFFSET;
   char stored_ver[4];
+  uint16_t stored_size;
+  uint32_t stored_crc;
   char ver[4] = EEPROM_VERSION;
+  millis_t load_ms = millis();
+  eeprom_error = false;
+  _EEPROM_load(EEPROM_OFFSET, EEPROM_HEADER_SIZE);
   EEPROM_READ_VAR(i, stored_ver); //read stored version
+  EEPROM_READ_VAR(i, stored_size);
+  EEPROM_READ_VAR(i, stored_crc);
   //  SERIAL_ECHOLN("Version: [" << ver << "] Stored version: [" << stored_ver << "]");
 
   if (strncmp(ver, stored_ver, 3) != 0) {
     Config_ResetDefault();
   }
+  else if (stored_size > EEPROM_IMAGE_SIZE - EEPROM_HEADER_SIZE) {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_ERR_EEPROM_SIZE);
+    Config_ResetDefault();
+  }
+  else if (_EEPROM_load(EEPROM_DATA_OFFSET, stored_size),
+           _EEPROM_crc32(eeprom_image + EEPROM_HEADER_SIZE, stored_size) != stored_crc) {
+    SERIAL_ERROR_START;
+    SERIAL_ERRORLNPGM(MSG_ERR_EEPROM_CRC);
+    Config_ResetDefault();
+  }
   else {
     float dummy = 0;
 
@@ -436,6 +594,7 @@ void Config_RetrieveSettings() {
         EEPROM_READ_VAR(i, dummy);
       #endif
       EEPROM_READ_VAR(i, retract_recover_feedrate);
+      EEPROM_READ_VAR(i, retract_jerk);
     #endif // FWRETRACT
 
     EEPROM_READ_VAR(i, volumetric_enabled);
@@ -445,15 +604,44 @@ void Config_RetrieveSettings() {
       if (q < EXTRUDERS) filament_size[q] = dummy;
     }
 
-    calculate_volumetric_multipliers();
-    // Call updatePID (similar to when we have processed M301)
-    updatePID();
+    #ifdef ADVANCE
+      EEPROM_READ_VAR(i, extruder_advance_k);
+    #else
+      EEPROM_READ_VAR(i, dummy);
+    #endif
+
+    #ifdef INPUT_SHAPING
+      EEPROM_READ_VAR(i, shaping_frequency);
+      EEPROM_READ_VAR(i, shaping_damping);
+    #else
+      for (int q = 0; q < 4; q++) EEPROM_READ_VAR(i, dummy);
+    #endif
+
+    if (eeprom_error || i != EEPROM_DATA_OFFSET + stored_size) {
+      // The stored block doesn't match the layout of this version
+      SERIAL_ERROR_START;
+      SERIAL_ERRORLNPGM(MSG_ERR_EEPROM_SIZE);
+      Config_ResetDefault();
+    }
+    else {
+      calculate_volumetric_multipliers();
+      // Call updatePID (similar to when we have processed M301)
+      updatePID();
+      #ifdef INPUT_SHAPING
+        st_set_shaping();
+      #endif
 
-    // Report settings retrieved and length
-    SERIAL_ECHO_START;
-    SERIAL_ECHO(ver);
-    SERIAL_ECHOPAIR(" stored settings retrieved (", (unsigned long)i);
-    SERIAL_ECHOLNPGM(" bytes)");
+      // The EEPROM now holds exactly what was loaded
+      memcpy(eeprom_shadow, eeprom_image, i - EEPROM_OFFSET);
+      eeprom_shadow_size = i - EEPROM_OFFSET;
+
+      // Report settings retrieved, length and load time
+      SERIAL_ECHO_START;
+      SERIAL_ECHO(ver);
+      SERIAL_ECHOPAIR(" stored settings retrieved (", (unsigned long)i);
+      SERIAL_ECHOPAIR(" bytes in ", (unsigned long)(millis() - load_ms));
+      SERIAL_ECHOLNPGM(" ms)");
+    }
   }
 
   #ifdef EEPROM_CHITCHAT
@@ -563,6 +751,7 @@ void Config_ResetDefault() {
       retract_recover_length_swap = RETRACT_RECOVER_LENGTH_SWAP;
     #endif
     retract_recover_feedrate = RETRACT_RECOVER_FEEDRATE;
+    retract_jerk = RETRACT_JERK;
   #endif
 
   volumetric_enabled = false;
@@ -578,6 +767,18 @@ void Config_ResetDefault() {
   #endif
   calculate_volumetric_multipliers();
 
+  #ifdef ADVANCE
+    extruder_advance_k = EXTRUDER_ADVANCE_K;
+  #endif
+
+  #ifdef INPUT_SHAPING
+    shaping_frequency[X_AXIS] = SHAPING_FREQUENCY_X;
+    shaping_frequency[Y_AXIS] = SHAPING_FREQUENCY_Y;
+    shaping_damping[X_AXIS] = SHAPING_DAMPING_X;
+    shaping_damping[Y_AXIS] = SHAPING_DAMPING_Y;
+    st_set_shaping();
+  #endif
+
   SERIAL_ECHO_START;
   SERIAL_ECHOLNPGM("Hardcoded Default Settings Loaded");
 }
@@ -796,7 +997,7 @@ void Config_PrintSettings(bool forReplay) {
 
     CONFIG_ECHO_START;
     if (!forReplay) {
-      SERIAL_ECHOLNPGM("Retract: S=Length (mm) F:Speed (mm/m) Z: ZLift (mm)");
+      SERIAL_ECHOLNPGM("Retract: S=Length (mm) F:Speed (mm/m) Z: ZLift (mm) J: Jerk (mm/s)");
       CONFIG_ECHO_START;
     }
     SERIAL_ECHOPAIR("  M207 S", retract_length);
@@ -805,6 +1006,7 @@ void Config_PrintSettings(bool forReplay) {
     #endif
     SERIAL_ECHOPAIR(" F", retract_feedrate*60);
     SERIAL_ECHOPAIR(" Z", retract_zlift);
+    SERIAL_ECHOPAIR(" J", retract_jerk);
     SERIAL_EOL;
     CONFIG_ECHO_START;
     if (!forReplay) {
@@ -860,6 +1062,31 @@ void Config_PrintSettings(bool forReplay) {
     }
   }
 
+  #ifdef ADVANCE
+    if (!forReplay) {
+      CONFIG_ECHO_START;
+      SERIAL_ECHOLNPGM("Pressure advance K (s):");
+    }
+    CONFIG_ECHO_START;
+    SERIAL_ECHOPAIR("  M900 K", extruder_advance_k);
+    SERIAL_EOL;
+  #endif
+
+  #ifdef INPUT_SHAPING
+    if (!forReplay) {
+      CONFIG_ECHO_START;
+      SERIAL_ECHOLNPGM("Input shaping (Hz, damping ratio):");
+    }
+    CONFIG_ECHO_START;
+    SERIAL_ECHOPAIR("  M593 X F", shaping_frequency[X_AXIS]);
+    SERIAL_ECHOPAIR(" D", shaping_damping[X_AXIS]);
+    SERIAL_EOL;
+    CONFIG_ECHO_START;
+    SERIAL_ECHOPAIR("  M593 Y F", shaping_frequency[Y_AXIS]);
+    SERIAL_ECHOPAIR(" D", shaping_damping[Y_AXIS]);
+    SERIAL_EOL;
+  #endif
+
   #ifdef ENABLE_AUTO_BED_LEVELING
     #ifdef CUSTOM_M_CODES
       if (!forReplay) {
@@ -26,6 +26,9 @@
   #define EN_B BIT(BLEN_B)
   #define EN_C BIT(BLEN_C)
   #define LCD_CLICKED (buttons&EN_C)
+  #if defined(BTN_BACK) && BTN_BACK > 0
+    #define BLEN_D 3
+  #endif
 #endif
 
 #include <U8glib.h>
@@ -39,6 +42,11 @@
    #undef USE_BIG_EDIT_FONT
 #endif
 
+// On a rotated display the pages don't cover rows of the Info Screen
+#if defined(LCD_SCREEN_ROT_90) || defined(LCD_SCREEN_ROT_180) || defined(LCD_SCREEN_ROT_270)
+  #undef DOGLCD_PARTIAL_REDRAW
+#endif
+
 
 #ifdef USE_SMALL_INFOFONT
   #include "dogm_font_data_6x9_marlin.h"
@@ -189,6 +197,143 @@ char lcd_printPGM(const char* str) {
   return n;
 }
 
+/**
+ * Info Screen frame model
+ *
+ * The Info Screen is drawn from a snapshot of the values it shows. The
+ * snapshot is taken once before each picture loop, so all pages of a
+ * frame show the same values.
+ *
+ * With DOGLCD_PARTIAL_REDRAW the new snapshot is compared with the one
+ * on the display. Each widget that changed marks the 8 pixel bands it
+ * covers as dirty, the picture loop only draws the pages holding a dirty
+ * band, and the wrapper around the device function skips the transfer of
+ * all other pages, so the display keeps what it shows there.
+ */
+typedef struct {
+  int target[EXTRUDERS + 1];        // Heater targets, the bed last
+  int current[EXTRUDERS + 1];       // Heater temperatures, the bed last
+  bool heating;
+  bool fan_frame;                   // Frame of the fan animation
+  int fan_percent;
+  bool known[3];
+  float position[3];
+  int feedrate;
+  #ifdef SDSUPPORT
+    bool sd_printing;
+    uint8_t progress;               // Width of the progress bar in pixels
+    uint16_t print_minutes;         // 0xFFFF without a print job
+  #endif
+  char message[3 * LCD_WIDTH + 1];
+} lcd_status_frame_t;
+
+static lcd_status_frame_t lcd_status_frame;
+
+#define LCD_BAND_HEIGHT 8
+#define LCD_BANDS(y0, y1) ((uint8_t)((0xFF << ((y0) / LCD_BAND_HEIGHT)) & (0xFF >> (7 - (y1) / LCD_BAND_HEIGHT))))
+
+static uint8_t lcd_dirty_bands = 0xFF; // Bands of the display to draw and send in the current frame
+
+static void lcd_status_frame_capture(lcd_status_frame_t &frame) {
+  for (int i = 0; i <= EXTRUDERS; i++) {
+    bool isBed = (i == EXTRUDERS);
+    frame.target[i] = int((isBed ? degTargetBed() : degTargetHotend(i)) + 0.5);
+    frame.current[i] = int(isBed ? degBed() : degHotend(i));
+  }
+  frame.heating = isHeatingHotend(0);
+  frame.fan_frame = (blink % 2) && fanSpeed;
+  #if HAS_FAN
+    frame.fan_percent = ((fanSpeed + 1) * 100) / 256;
+  #else
+    frame.fan_percent = 0;
+  #endif
+  for (int i = X_AXIS; i <= Z_AXIS; i++) {
+    frame.known[i] = axis_known_position[i];
+    frame.position[i] = current_position[i];
+  }
+  frame.feedrate = feedrate_multiplier;
+  #ifdef SDSUPPORT
+    frame.sd_printing = IS_SD_PRINTING;
+    frame.progress = frame.sd_printing ? (unsigned int)(71.f * card.percentDone() / 100.f) : 0;
+    frame.print_minutes = print_job_start_ms != 0 ? (millis() - print_job_start_ms) / 60000 : 0xFFFF;
+  #endif
+  memcpy(frame.message, lcd_status_message, sizeof(frame.message));
+}
+
+#ifdef DOGLCD_PARTIAL_REDRAW
+
+  // Bands covered by the widgets whose values differ between two frames
+  static uint8_t lcd_status_frame_diff(const lcd_status_frame_t &a, const lcd_status_frame_t &b) {
+    #define FRAME_CHANGED(field) (memcmp(&a.field, &b.field, sizeof(a.field)) != 0)
+    uint8_t bands = 0;
+    if (FRAME_CHANGED(fan_frame)) bands |= LCD_BANDS(1, STATUS_SCREENHEIGHT);
+    if (FRAME_CHANGED(target)) bands |= LCD_BANDS(0, 9);
+    if (FRAME_CHANGED(heating)) bands |= LCD_BANDS(17, 19);
+    if (FRAME_CHANGED(current) || FRAME_CHANGED(fan_percent)) bands |= LCD_BANDS(19, 30);
+    if (FRAME_CHANGED(known) || FRAME_CHANGED(position)) bands |= LCD_BANDS(30, 39);
+    if (FRAME_CHANGED(feedrate)) bands |= LCD_BANDS(40, 51);
+    #ifdef SDSUPPORT
+      if (FRAME_CHANGED(sd_printing) || FRAME_CHANGED(progress) || FRAME_CHANGED(print_minutes)) bands |= LCD_BANDS(40, 52);
+    #endif
+    #ifdef FILAMENT_LCD_DISPLAY
+      bands |= LCD_BANDS(53, 63); // the filament values are not part of the frame
+    #else
+      if (FRAME_CHANGED(message)) bands |= LCD_BANDS(53, 63);
+    #endif
+    #undef FRAME_CHANGED
+    return bands;
+  }
+
+  static u8g_dev_fnptr lcd_device_fn; // The function of the display device
+
+  // Skip the transfer of the pages that were not drawn
+  static uint8_t lcd_partial_device_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg) {
+    if (msg == U8G_DEV_MSG_PAGE_NEXT) {
+      u8g_pb_t *pb = (u8g_pb_t *)dev->dev_mem;
+      if (!(lcd_dirty_bands & LCD_BANDS(pb->p.page_y0, pb->p.page_y1))) {
+        memset(pb->buf, 0, pb->width * pb->p.page_height / 8);
+        return u8g_page_Next(&pb->p);
+      }
+    }
+    return lcd_device_fn(u8g, dev, msg, arg);
+  }
+
+#endif // DOGLCD_PARTIAL_REDRAW
+
+/**
+ * Take the snapshot of the Info Screen and work out what to draw.
+ * A partial redraw is only done for the periodic refresh of the Info
+ * Screen, everything else redraws the whole display.
+ */
+static void lcd_implementation_prepare_frame(bool status_screen, bool partial) {
+  static bool frame_valid = false;
+
+  lcd_dirty_bands = 0xFF;
+  if (!status_screen) {
+    frame_valid = false;
+    return;
+  }
+
+  lcd_status_frame_t frame;
+  lcd_status_frame_capture(frame);
+  #ifdef DOGLCD_PARTIAL_REDRAW
+    if (partial && frame_valid)
+      lcd_dirty_bands = lcd_status_frame_diff(frame, lcd_status_frame) | LCD_BANDS(63, 63); // and the alive dot
+  #endif
+  lcd_status_frame = frame;
+  frame_valid = true;
+}
+
+// Is the page of the picture loop to be drawn?
+static bool lcd_implementation_page_dirty() {
+  #ifdef DOGLCD_PARTIAL_REDRAW
+    u8g_pb_t *pb = (u8g_pb_t *)u8g.getU8g()->dev->dev_mem;
+    return lcd_dirty_bands & LCD_BANDS(pb->p.page_y0, pb->p.page_y1);
+  #else
+    return true;
+  #endif
+}
+
 static bool show_splashscreen = true;
 
 /* Warning: This function is called from interrupt context */
@@ -212,6 +357,19 @@ static void lcd_implementation_init() {
   #elif defined(LCD_SCREEN_ROT_270)
     u8g.setRot270();  // Rotate screen by 270°
   #endif
+
+  #ifdef DOGLCD_PARTIAL_REDRAW
+    // Route the device through the wrapper that skips unchanged pages
+    u8g_dev_t *dev = u8g.getU8g()->dev;
+    if (dev->dev_fn != lcd_partial_device_fn) {
+      lcd_device_fn = dev->dev_fn;
+      dev->dev_fn = lcd_partial_device_fn;
+    }
+    #ifdef U8GLIB_ST7920
+      u8g_dev_st7920_128x64_rrd_invalidate(); // the display may have lost its content
+    #endif
+  #endif
+  lcd_dirty_bands = 0xFF;
   
   // Show splashscreen
   int offx = (u8g.getWidth() - START_BMPWIDTH) / 2;
@@ -245,16 +403,17 @@ static void lcd_implementation_clear() { } // Automatically cleared by Picture L
 static void _draw_heater_status(int x, int heater) {
   bool isBed = heater < 0;
   int y = 17 + (isBed ? 1 : 0);
+  if (isBed) heater = EXTRUDERS;
 
   lcd_setFont(FONT_STATUSMENU);
   u8g.setPrintPos(x,7);
-  lcd_print(itostr3(int((heater >= 0 ? degTargetHotend(heater) : degTargetBed()) + 0.5)));
+  lcd_print(itostr3(lcd_status_frame.target[heater]));
   lcd_printPGM(PSTR(LCD_STR_DEGREE " "));
   u8g.setPrintPos(x,28);
-  lcd_print(itostr3(int(heater >= 0 ? degHotend(heater) : degBed()) + 0.5));
+  lcd_print(itostr3(lcd_status_frame.current[heater]));
 
   lcd_printPGM(PSTR(LCD_STR_DEGREE " "));
-  if (!isHeatingHotend(0)) {
+  if (!lcd_status_frame.heating) {
     u8g.drawBox(x+7,y,2,2);
   }
   else {
@@ -268,7 +427,7 @@ static void lcd_implementation_status_screen() {
   u8g.setColorIndex(1); // black on white
 
   // Symbols menu graphics, animated fan
-  u8g.drawBitmapP(9,1,STATUS_SCREENBYTEWIDTH,STATUS_SCREENHEIGHT, (blink % 2) && fanSpeed ? status_screen0_bmp : status_screen1_bmp);
+  u8g.drawBitmapP(9,1,STATUS_SCREENBYTEWIDTH,STATUS_SCREENHEIGHT, lcd_status_frame.fan_frame ? status_screen0_bmp : status_screen1_bmp);
  
   #ifdef SDSUPPORT
     // SD Card Symbol
@@ -283,14 +442,14 @@ static void lcd_implementation_status_screen() {
     // SD Card Progress bar and clock
     lcd_setFont(FONT_STATUSMENU);
  
-    if (IS_SD_PRINTING) {
+    if (lcd_status_frame.sd_printing) {
       // Progress bar solid part
-      u8g.drawBox(55, 50, (unsigned int)(71.f * card.percentDone() / 100.f), 2 - TALL_FONT_CORRECTION);
+      u8g.drawBox(55, 50, lcd_status_frame.progress, 2 - TALL_FONT_CORRECTION);
     }
 
     u8g.setPrintPos(80,48);
-    if (print_job_start_ms != 0) {
-      uint16_t time = (millis() - print_job_start_ms) / 60000;
+    if (lcd_status_frame.print_minutes != 0xFFFF) {
+      uint16_t time = lcd_status_frame.print_minutes;
       lcd_print(itostr2(time/60));
       lcd_print(':');
       lcd_print(itostr2(time%60));
@@ -309,17 +468,13 @@ static void lcd_implementation_status_screen() {
   // Fan
   lcd_setFont(FONT_STATUSMENU);
   u8g.setPrintPos(104,27);
-  #if HAS_FAN
-    int per = ((fanSpeed + 1) * 100) / 256;
-    if (per) {
-      lcd_print(itostr3(per));
-      lcd_print('%');
-    }
-    else
-  #endif
-    {
-      lcd_printPGM(PSTR("---"));
-    }
+  if (lcd_status_frame.fan_percent) {
+    lcd_print(itostr3(lcd_status_frame.fan_percent));
+    lcd_print('%');
+  }
+  else {
+    lcd_printPGM(PSTR("---"));
+  }
 
   // X, Y, Z-Coordinates
   #define XYZ_BASELINE 38
@@ -336,8 +491,8 @@ static void lcd_implementation_status_screen() {
   u8g.drawPixel(8,XYZ_BASELINE - 5);
   u8g.drawPixel(8,XYZ_BASELINE - 3);
   u8g.setPrintPos(10,XYZ_BASELINE);
-  if (axis_known_position[X_AXIS])
-    lcd_print(ftostr31ns(current_position[X_AXIS]));
+  if (lcd_status_frame.known[X_AXIS])
+    lcd_print(ftostr31ns(lcd_status_frame.position[X_AXIS]));
   else
     lcd_printPGM(PSTR("---"));
   u8g.setPrintPos(43,XYZ_BASELINE);
@@ -345,8 +500,8 @@ static void lcd_implementation_status_screen() {
   u8g.drawPixel(49,XYZ_BASELINE - 5);
   u8g.drawPixel(49,XYZ_BASELINE - 3);
   u8g.setPrintPos(51,XYZ_BASELINE);
-  if (axis_known_position[Y_AXIS])
-    lcd_print(ftostr31ns(current_position[Y_AXIS]));
+  if (lcd_status_frame.known[Y_AXIS])
+    lcd_print(ftostr31ns(lcd_status_frame.position[Y_AXIS]));
   else
     lcd_printPGM(PSTR("---"));
   u8g.setPrintPos(83,XYZ_BASELINE);
@@ -354,8 +509,8 @@ static void lcd_implementation_status_screen() {
   u8g.drawPixel(89,XYZ_BASELINE - 5);
   u8g.drawPixel(89,XYZ_BASELINE - 3);
   u8g.setPrintPos(91,XYZ_BASELINE);
-  if (axis_known_position[Z_AXIS])
-    lcd_print(ftostr32sp(current_position[Z_AXIS]));
+  if (lcd_status_frame.known[Z_AXIS])
+    lcd_print(ftostr32sp(lcd_status_frame.position[Z_AXIS]));
   else
     lcd_printPGM(PSTR("---.--"));
   u8g.setColorIndex(1); // black on white
@@ -366,7 +521,7 @@ static void lcd_implementation_status_screen() {
   lcd_print(LCD_STR_FEEDRATE[0]);
   lcd_setFont(FONT_STATUSMENU);
   u8g.setPrintPos(12,49);
-  lcd_print(itostr3(feedrate_multiplier));
+  lcd_print(itostr3(lcd_status_frame.feedrate));
   lcd_print('%');
 
   // Status line
@@ -377,16 +532,16 @@ static void lcd_implementation_status_screen() {
     u8g.setPrintPos(0,63);
   #endif
   #ifndef FILAMENT_LCD_DISPLAY
-    lcd_print(lcd_status_message);
+    lcd_print(lcd_status_frame.message);
   #else
     if (millis() < previous_lcd_status_ms + 5000) {  //Display both Status message line and Filament display on the last line
-      lcd_print(lcd_status_message);
+      lcd_print(lcd_status_frame.message);
     }
     else {
       lcd_printPGM(PSTR("dia:"));
       lcd_print(ftostr12ns(filament_width_meas));
       lcd_printPGM(PSTR(" factor:"));
-      lcd_print(itostr3(100.0 * volumetric_multiplier[FILAMENT_SENSOR_EXTRUDER_NUM]));
+      lcd_print(itostr3(100L * filwidth_factor / FILWIDTH_ONE));
       lcd_print('%');
     }
   #endif
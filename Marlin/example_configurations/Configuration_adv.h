@@ -355,23 +355,22 @@
   #endif
 #endif
 
-// extruder advance constant (s2/mm3)
+// Pressure advance
 //
-// advance (steps) = STEPS_PER_CUBIC_MM_E * EXTRUDER_ADVANCE_K * cubic mm per second ^ 2
+// The melt in the nozzle is compressed in proportion to the extrusion speed,
+// so the extruder has to run ahead of the commanded position while printing:
 //
-// Hooke's law says:		force = k * distance
-// Bernoulli's principle says:	v ^ 2 / 2 + g . h + pressure / density = constant
-// so: v ^ 2 is proportional to number of steps we advance the extruder
+// advance (mm of filament) = EXTRUDER_ADVANCE_K * filament speed (mm/s)
+//
+// E steps are issued by a separate timer (ADVANCE_TIMER_NUM in HAL.h), which
+// follows the stepper interrupt plus the advance. K (in seconds) can be set
+// with M900 K and is stored by M500. scripts/advance_sim.py shows the E step
+// stream a move produces for a given K.
 //#define ADVANCE
 
 #ifdef ADVANCE
-  #define EXTRUDER_ADVANCE_K .0
-
-  #define D_FILAMENT 2.85
-  #define STEPS_MM_E 836
-  #define EXTRUSION_AREA (0.25 * D_FILAMENT * D_FILAMENT * 3.14159)
-  #define STEPS_PER_CUBIC_MM_E (axis_steps_per_unit[E_AXIS]/ EXTRUSION_AREA)
-
+  #define EXTRUDER_ADVANCE_K 0.0
+  #define ADVANCE_STEP_FREQUENCY 100000 // Hz. Every E step takes two ticks (step and release).
 #endif // ADVANCE
 
 // Arc interpretation settings:
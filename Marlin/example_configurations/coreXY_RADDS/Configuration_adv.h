@@ -197,6 +197,9 @@
 //    Mode 2: Duplication mode. The firmware will transparently make the second x-carriage and extruder copy all
 //                           actions of the first x-carriage. This allows the printer to print 2 arbitrary items at
 //                           once. (2nd extruder x offset and temp offset are set using: M605 S2 [Xnnn] [Rmmm])
+//    Mode 3: Mirrored duplication mode. Like mode 2, but the second x-carriage moves in the opposite direction
+//                           to print a mirrored copy. The carriages mirror each other about the middle between
+//                           their home positions. (temp offset is set using: M605 S3 [Rmmm])
 
 // This is the default power-up mode which can be later using M605.
 #define DEFAULT_DUAL_X_CARRIAGE_MODE 0
@@ -249,8 +252,17 @@
 // minimum time in microseconds that a movement needs to take if the buffer is emptied.
 #define DEFAULT_MINSEGMENTTIME        20000
 
-// If defined the movements slow down when the look ahead buffer is only half full
+// If defined the movements slow down when the look ahead buffer holds less than
+// SLOWDOWN_BUFFER_TIME (ms) of moves. Segments shorter than the minimum segment
+// time are made longer, up to it when the buffer is empty.
 #define SLOWDOWN
+#define SLOWDOWN_BUFFER_TIME 100
+
+// Count planner underruns, where the stepper empties the buffer mid-print and
+// waits for moves, by whether the moves came from serial or SD. Stops longer
+// than BUFFER_MONITORING_GAP (ms) are pauses. M576 reports them.
+//#define BUFFER_MONITORING
+#define BUFFER_MONITORING_GAP 2000
 
 // Frequency limit
 // See nophead's blog for more info
@@ -322,6 +334,18 @@
   #endif
 #endif
 
+// Print files planned offline by scripts/block_plan.py. They hold the planner
+// blocks of the moves, ready for the stepper, and the other commands of the
+// G-code between them. M23 recognizes them, M24 starts them like any file.
+// The script must be given the configuration of the printer.
+//#define SD_BLOCK_PLAYBACK
+
+// Print G-code tokenized by scripts/gcode_tokenize.py. Each command is a few
+// bytes of binary codes and numbers, optionally compressed, so it is read
+// and decoded faster than the text and takes less of the card. M23
+// recognizes the files, the commands run as if they were the G-code.
+//#define SD_TOKENIZED_GCODE
+
 // The hardware watchdog should reset the microcontroller disabling all outputs, in case the firmware gets stuck and doesn't do temperature regulation.
 //#define USE_WATCHDOG
 
@@ -343,6 +367,7 @@
   #define BABYSTEP_XY  //not only z, but also XY in the menu. more clutter, more functions
   #define BABYSTEP_INVERT_Z false  //true for inverse movements in Z
   #define BABYSTEP_Z_MULTIPLICATOR 2 //faster z movements
+  #define BABYSTEP_FREQUENCY 1000 //babysteps per second at most. They are done by the stepper interrupt, which runs at 1kHz when idle.
 
   #ifdef COREXY
     #error BABYSTEPPING not implemented for COREXY yet.
@@ -355,24 +380,64 @@
   #endif
 #endif
 
-// extruder advance constant (s2/mm3)
+// Pressure advance
 //
-// advance (steps) = STEPS_PER_CUBIC_MM_E * EXTRUDER_ADVANCE_K * cubic mm per second ^ 2
+// The melt in the nozzle is compressed in proportion to the extrusion speed,
+// so the extruder has to run ahead of the commanded position while printing:
 //
-// Hooke's law says:		force = k * distance
-// Bernoulli's principle says:	v ^ 2 / 2 + g . h + pressure / density = constant
-// so: v ^ 2 is proportional to number of steps we advance the extruder
+// advance (mm of filament) = EXTRUDER_ADVANCE_K * filament speed (mm/s)
+//
+// E steps are issued by a separate timer (ADVANCE_TIMER_NUM in HAL.h), which
+// follows the stepper interrupt plus the advance. K (in seconds) can be set
+// with M900 K and is stored by M500. scripts/advance_sim.py shows the E step
+// stream a move produces for a given K.
 //#define ADVANCE
 
 #ifdef ADVANCE
-  #define EXTRUDER_ADVANCE_K .0
+  #define EXTRUDER_ADVANCE_K 0.0
+  #define ADVANCE_STEP_FREQUENCY 100000 // Hz. Every E step takes two ticks (step and release).
+#endif // ADVANCE
 
-  #define D_FILAMENT 2.85
-  #define STEPS_MM_E 836
-  #define EXTRUSION_AREA (0.25 * D_FILAMENT * D_FILAMENT * 3.14159)
-  #define STEPS_PER_CUBIC_MM_E (axis_steps_per_unit[E_AXIS]/ EXTRUSION_AREA)
+// Input shaping
+//
+// X and Y follow the planned motion convolved with a shaper tuned to the
+// ringing frequency of the frame, which cancels most of the ringing and
+// allows higher accelerations. Measure the frequency from the ringing on a
+// test print (ringing wavelength in mm / speed in mm/s = period).
+//
+// X/Y steps are issued by a separate timer (SHAPER_TIMER_NUM in HAL.h). The
+// shaper delays the motion by up to one ringing period. Frequency and damping
+// can be set with M593 and are stored by M500. F0 turns shaping off for an
+// axis. scripts/shaper_sim.py shows the shaped motion and the residual ringing.
+//
+// With COREXY use the same frequency for both axes.
+//#define INPUT_SHAPING
 
-#endif // ADVANCE
+#ifdef INPUT_SHAPING
+  #define SHAPING_TYPE SHAPER_MZV         // SHAPER_ZV, SHAPER_MZV or SHAPER_EI (more robust, more smoothing)
+  #define SHAPING_FREQUENCY_X 40.0        // Hz
+  #define SHAPING_FREQUENCY_Y 40.0        // Hz
+  #define SHAPING_DAMPING_X 0.1           // Damping ratio
+  #define SHAPING_DAMPING_Y 0.1
+  #define SHAPING_STEP_FREQUENCY 100000   // Hz. Every X/Y step takes two ticks, the planner keeps X/Y to 50000 steps/s.
+  #define SHAPING_BUFFER_SIZE 2048        // Step events kept for the delayed impulses (power of 2, 4 bytes each)
+#endif
+
+// Step trace
+//
+// The stepper interrupt records the timer interval it sets and the steps it
+// does per motor in a ring buffer (8 bytes per interrupt). M930 S1 starts
+// recording, M930 S0 stops it and M930 prints the recorded interrupts.
+// Consecutive interrupts without steps share one entry with their total time.
+// scripts/step_trace.py rebuilds the motion of each axis from the printout
+// and flags step rate jumps between blocks and step rates above
+// MAX_STEP_FREQUENCY. With ADVANCE or INPUT_SHAPING the recorded E or X/Y
+// steps are those handed to their timers.
+//#define STEP_TRACE
+
+#ifdef STEP_TRACE
+  #define STEP_TRACE_SIZE 2048  // Stepper interrupts kept
+#endif
 
 // Arc interpretation settings:
 #define MM_PER_ARC_SEGMENT 1
@@ -380,6 +445,22 @@
 
 const unsigned int dropsegments=5; //everything with less than this number of steps will be ignored as move and joined with the next movement
 
+// Collinear segment coalescing (Cartesian and CoreXY only)
+// Slicers split curves and meshes into many short G1 moves, most of them
+// nearly in line. With this option consecutive G0/G1 moves are merged into
+// one planner block while the direction changes by less than COALESCE_ANGLE
+// and no merged corner lies further than COALESCE_CHORD from the new move.
+// Moves are only merged when their extrusion per mm differs by less than
+// COALESCE_E_RATIO, so the filament is laid down in proportion to the path.
+// Merging stops at any other command and when the planner runs low.
+//#define COALESCE_SEGMENTS
+#ifdef COALESCE_SEGMENTS
+  #define COALESCE_ANGLE 2.0        // Largest direction change in degrees
+  #define COALESCE_CHORD 0.01       // Largest distance in mm of a merged corner from the move
+  #define COALESCE_E_RATIO 0.05     // Largest relative difference in extrusion per mm
+  #define COALESCE_MAX_SEGMENTS 8   // Most moves merged into one block
+#endif
+
 // If you are using a RAMPS board or cheap E-bay purchased boards that do not detect when an SD card is inserted
 // You can get round this by connecting a push button or single throw switch to the pin defined as SDCARDCARDDETECT
 // in the pins.h file.  When using a push button pulling the pin to ground this will need inverted.  This setting should
@@ -426,6 +507,15 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 #define MAX_CMD_SIZE 96
 #define BUFSIZE 4
 
+// Run M105, M108, M112, M410 and M25 as soon as they are received, also
+// while the command queue is full or a command such as M109, M190, G29 or a
+// move waits. They answer "ok" at once, ahead of the queued commands.
+// Received lines wait in one more line buffer for room in the queue, so
+// hosts should keep at most BUFSIZE other commands waiting for "ok".
+// A real-time M410 also ends the running command without its moves, and the
+// position is taken from where the steppers stopped (DELTA/SCARA: home again).
+//#define REALTIME_COMMANDS
+
 
 // Firmware based and LCD controlled retract
 // M207 and M208 can be used to define parameters for the retraction.
@@ -443,6 +533,7 @@ const unsigned int dropsegments=5; //everything with less than this number of st
   #define RETRACT_RECOVER_LENGTH 0       //default additional recover length (mm, added to retract length when recovering)
   #define RETRACT_RECOVER_LENGTH_SWAP 0  //default additional swap recover length (mm, added to retract length when recovering from extruder change)
   #define RETRACT_RECOVER_FEEDRATE 8     //default feedrate for recovering from retraction (mm/s)
+  #define RETRACT_JERK 20                //default E jerk of retract and recover moves (mm/s)
 #endif
 
 //adds support for experimental filament exchange support M600; requires display
@@ -173,6 +173,9 @@
   //    Mode 2: Duplication mode. The firmware will transparently make the second x-carriage and extruder copy all
   //                           actions of the first x-carriage. This allows the printer to print 2 arbitrary items at
   //                           once. (2nd extruder x offset and temp offset are set using: M605 S2 [Xnnn] [Rmmm])
+  //    Mode 3: Mirrored duplication mode. Like mode 2, but the second x-carriage moves in the opposite direction
+  //                           to print a mirrored copy. The carriages mirror each other about the middle between
+  //                           their home positions. (temp offset is set using: M605 S3 [Rmmm])
 
   // This is the default power-up mode which can be later using M605.
   #define DEFAULT_DUAL_X_CARRIAGE_MODE 0
@@ -228,9 +231,18 @@
 // minimum time in microseconds that a movement needs to take if the buffer is emptied.
 #define DEFAULT_MINSEGMENTTIME        20000
 
-// If defined the movements slow down when the look ahead buffer is only half full
+// If defined the movements slow down when the look ahead buffer holds less than
+// SLOWDOWN_BUFFER_TIME (ms) of moves. Segments shorter than the minimum segment
+// time are made longer, up to it when the buffer is empty.
 // (don't use SLOWDOWN with DELTA because DELTA generates hundreds of segments per second)
 //#define SLOWDOWN
+#define SLOWDOWN_BUFFER_TIME 100
+
+// Count planner underruns, where the stepper empties the buffer mid-print and
+// waits for moves, by whether the moves came from serial or SD. Stops longer
+// than BUFFER_MONITORING_GAP (ms) are pauses. M576 reports them.
+//#define BUFFER_MONITORING
+#define BUFFER_MONITORING_GAP 2000
 
 // Frequency limit
 // See nophead's blog for more info
@@ -298,6 +310,12 @@
     //#define PROGRESS_MSG_ONCE
   #endif
 
+  // Print G-code tokenized by scripts/gcode_tokenize.py. Each command is a few
+  // bytes of binary codes and numbers, optionally compressed, so it is read
+  // and decoded faster than the text and takes less of the card. M23
+  // recognizes the files, the commands run as if they were the G-code.
+  //#define SD_TOKENIZED_GCODE
+
 #endif // SDSUPPORT
 
 // @section more
@@ -325,23 +343,43 @@
   #define BABYSTEP_XY  //not only z, but also XY in the menu. more clutter, more functions
   #define BABYSTEP_INVERT_Z false  //true for inverse movements in Z
   #define BABYSTEP_Z_MULTIPLICATOR 2 //faster z movements
+  #define BABYSTEP_FREQUENCY 1000 //babysteps per second at most. They are done by the stepper interrupt, which runs at 1kHz when idle.
 #endif
 
 // @section extruder
 
-// extruder advance constant (s2/mm3)
+// Pressure advance
 //
-// advance (steps) = STEPS_PER_CUBIC_MM_E * EXTRUDER_ADVANCE_K * cubic mm per second ^ 2
+// The melt in the nozzle is compressed in proportion to the extrusion speed,
+// so the extruder has to run ahead of the commanded position while printing:
 //
-// Hooke's law says:    force = k * distance
-// Bernoulli's principle says:  v ^ 2 / 2 + g . h + pressure / density = constant
-// so: v ^ 2 is proportional to number of steps we advance the extruder
+// advance (mm of filament) = EXTRUDER_ADVANCE_K * filament speed (mm/s)
+//
+// E steps are issued by a separate timer (ADVANCE_TIMER_NUM in HAL.h), which
+// follows the stepper interrupt plus the advance. K (in seconds) can be set
+// with M900 K and is stored by M500. scripts/advance_sim.py shows the E step
+// stream a move produces for a given K.
 //#define ADVANCE
 
 #ifdef ADVANCE
-  #define EXTRUDER_ADVANCE_K .0
-  #define D_FILAMENT 2.85
-  #define STEPS_MM_E 836
+  #define EXTRUDER_ADVANCE_K 0.0
+  #define ADVANCE_STEP_FREQUENCY 100000 // Hz. Every E step takes two ticks (step and release).
+#endif
+
+// Step trace
+//
+// The stepper interrupt records the timer interval it sets and the steps it
+// does per motor in a ring buffer (8 bytes per interrupt). M930 S1 starts
+// recording, M930 S0 stops it and M930 prints the recorded interrupts.
+// Consecutive interrupts without steps share one entry with their total time.
+// scripts/step_trace.py rebuilds the motion of each axis from the printout
+// and flags step rate jumps between blocks and step rates above
+// MAX_STEP_FREQUENCY. With ADVANCE or INPUT_SHAPING the recorded E or X/Y
+// steps are those handed to their timers.
+//#define STEP_TRACE
+
+#ifdef STEP_TRACE
+  #define STEP_TRACE_SIZE 2048  // Stepper interrupts kept
 #endif
 
 // @section extras
@@ -380,6 +418,15 @@ const unsigned int dropsegments=5; //everything with less than this number of st
 #define MAX_CMD_SIZE 96
 #define BUFSIZE 4
 
+// Run M105, M108, M112, M410 and M25 as soon as they are received, also
+// while the command queue is full or a command such as M109, M190, G29 or a
+// move waits. They answer "ok" at once, ahead of the queued commands.
+// Received lines wait in one more line buffer for room in the queue, so
+// hosts should keep at most BUFSIZE other commands waiting for "ok".
+// A real-time M410 also ends the running command without its moves, and the
+// position is taken from where the steppers stopped (DELTA/SCARA: home again).
+//#define REALTIME_COMMANDS
+
 // @section fwretract
 
 // Firmware based and LCD controlled retract
@@ -398,6 +445,7 @@ const unsigned int dropsegments=5; //everything with less than this number of st
   #define RETRACT_RECOVER_LENGTH 0       //default additional recover length (mm, added to retract length when recovering)
   #define RETRACT_RECOVER_LENGTH_SWAP 0  //default additional swap recover length (mm, added to retract length when recovering from extruder change)
   #define RETRACT_RECOVER_FEEDRATE 8     //default feedrate for recovering from retraction (mm/s)
+  #define RETRACT_JERK 20                //default E jerk of retract and recover moves (mm/s)
 #endif
 
 // Add support for experimental filament exchange support M600; requires display
@@ -0,0 +1,201 @@
+/**
+ * flash_storage.cpp
+ *
+ * EEPROM emulation in the internal flash of the SAM3X
+ *
+ * FLASH_EEPROM_PAGES pages at the end of flash bank 1 are split into two
+ * blocks. The active block starts with a header, followed by an
+ * append-only journal of records:
+ *
+ *  header    magic, sequence number
+ *  record    address, length, checksum, data (padded to 4 bytes)
+ *  record    ...
+ *  0xFF...   erased flash marks the end of the journal
+ *
+ * At startup the records of the block with the newest sequence number are
+ * replayed into a RAM copy of the EEPROM, so reads are memory reads. Writes
+ * update the RAM copy and append a record. When the block is full, the RAM
+ * copy is compacted into the other (erased) block, whose header is written
+ * last. Alternating between the blocks and appending instead of rewriting
+ * spreads the erase cycles over all reserved pages.
+ *
+ * The journal only touches flash through memory reads and
+ * HAL_flash_write_page(), so it can be run against a simulated flash:
+ * scripts/flash_journal_test.py does, with power cuts at every page write.
+ */
+
+#include "HAL.h"
+#include "Configuration.h"
+
+#ifdef FLASH_EEPROM_EMULATION
+
+#include "flash_storage.h"
+
+#define FLASH_PAGE_SIZE IFLASH1_PAGE_SIZE
+#define FLASH_BLOCK_SIZE (FLASH_EEPROM_PAGES / 2 * FLASH_PAGE_SIZE)
+
+#ifndef FLASH_STORAGE_ADDRESS
+  #define FLASH_STORAGE_ADDRESS (IFLASH1_ADDR + IFLASH1_SIZE - FLASH_EEPROM_PAGES * FLASH_PAGE_SIZE)
+#endif
+
+#define FLASH_MAGIC 0x4E524A4DUL  // "MJRN"
+#define FLASH_ERASED 0xFFFF
+
+typedef struct {
+  uint32_t magic;
+  uint32_t sequence;
+} flash_header_t;
+
+typedef struct {
+  uint16_t address;
+  uint16_t length;
+  uint32_t check;
+} flash_record_t;
+
+#define RECORD_SIZE(n) (sizeof(flash_record_t) + (((n) + 3) & ~3))
+
+// A full compaction must always fit into one block
+typedef char flash_assert[(sizeof(flash_header_t) + RECORD_SIZE(FLASH_EEPROM_SIZE) <= FLASH_BLOCK_SIZE) ? 1 : -1];
+
+static uint8_t flash_eeprom[FLASH_EEPROM_SIZE]; // RAM copy of the emulated EEPROM
+static bool flash_initialised = false;
+static uint8_t active_block;                    // block holding the journal
+static uint32_t sequence;                       // sequence number of the active block
+static uint16_t journal_end;                    // offset of the first free byte in the active block
+
+static const uint8_t* block_start(uint8_t block) {
+  return (const uint8_t*)(FLASH_STORAGE_ADDRESS + block * FLASH_BLOCK_SIZE);
+}
+
+static uint32_t record_check(uint16_t address, uint16_t length, const uint8_t *data) {
+  // Fletcher-32 over the record, never all ones
+  uint32_t sum1 = address, sum2 = length;
+  while (length--) {
+    sum1 = (sum1 + *data++) % 65535;
+    sum2 = (sum2 + sum1) % 65535;
+  }
+  return (sum2 << 16) | sum1;
+}
+
+// Program n bytes at offset of a block, page by page
+static bool flash_program(uint8_t block, uint16_t offset, const uint8_t *src, uint16_t n) {
+  uint8_t page[FLASH_PAGE_SIZE];
+  const uint8_t *start = block_start(block);
+  bool ok = true;
+  while (n) {
+    uint16_t page_offset = offset % FLASH_PAGE_SIZE;
+    uint16_t count = FLASH_PAGE_SIZE - page_offset;
+    if (count > n) count = n;
+    // Bytes around the new data are programmed with what they already hold
+    memcpy(page, start + offset - page_offset, FLASH_PAGE_SIZE);
+    memcpy(page + page_offset, src, count);
+    if (!HAL_flash_write_page((uint32_t)(uintptr_t)(start + offset - page_offset), page, false)) ok = false;
+    offset += count;
+    src += count;
+    n -= count;
+  }
+  return ok;
+}
+
+static bool flash_erase(uint8_t block) {
+  uint8_t page[FLASH_PAGE_SIZE];
+  const uint8_t *start = block_start(block);
+  bool ok = true;
+  memset(page, 0xFF, sizeof(page));
+  for (uint16_t offset = 0; offset < FLASH_BLOCK_SIZE; offset += FLASH_PAGE_SIZE) {
+    // Skip pages that are erased already
+    const uint8_t *p = start + offset;
+    uint16_t i = 0;
+    while (i < FLASH_PAGE_SIZE && p[i] == 0xFF) i++;
+    if (i < FLASH_PAGE_SIZE && !HAL_flash_write_page((uint32_t)(uintptr_t)p, page, true)) ok = false;
+  }
+  return ok;
+}
+
+static bool append_record(uint8_t block, uint16_t &offset, uint16_t address, const uint8_t *data, uint16_t length) {
+  flash_record_t record = { address, length, record_check(address, length, data) };
+  bool ok = flash_program(block, offset + sizeof(record), data, length)
+         && flash_program(block, offset, (const uint8_t*)&record, sizeof(record));
+  offset += RECORD_SIZE(length);
+  return ok;
+}
+
+// Write the RAM copy into the other block and make it the active one
+static bool flash_compact() {
+  uint8_t block = active_block ^ 1;
+  uint16_t offset = sizeof(flash_header_t);
+  flash_header_t header = { FLASH_MAGIC, sequence + 1 };
+
+  if (!flash_erase(block)
+      || !append_record(block, offset, 0, flash_eeprom, FLASH_EEPROM_SIZE)
+      || !flash_program(block, 0, (const uint8_t*)&header, sizeof(header)))
+    return false;
+
+  active_block = block;
+  sequence = header.sequence;
+  journal_end = offset;
+  return true;
+}
+
+void flash_storage_init() {
+  if (flash_initialised) return;
+  flash_initialised = true;
+
+  memset(flash_eeprom, 0xFF, sizeof(flash_eeprom));
+
+  // Find the block with the newest valid header
+  const flash_header_t *h0 = (const flash_header_t*)block_start(0),
+                       *h1 = (const flash_header_t*)block_start(1);
+  bool valid0 = h0->magic == FLASH_MAGIC, valid1 = h1->magic == FLASH_MAGIC;
+  if (!valid0 && !valid1) {
+    // Nothing stored yet, the first write compacts into block 0
+    active_block = 1;
+    sequence = 0;
+    journal_end = FLASH_BLOCK_SIZE;
+    return;
+  }
+  active_block = (valid1 && (!valid0 || (int32_t)(h1->sequence - h0->sequence) > 0)) ? 1 : 0;
+  sequence = (active_block ? h1 : h0)->sequence;
+
+  // Replay the journal
+  const uint8_t *start = block_start(active_block);
+  uint16_t offset = sizeof(flash_header_t);
+  while (offset + sizeof(flash_record_t) <= FLASH_BLOCK_SIZE) {
+    const flash_record_t *record = (const flash_record_t*)(start + offset);
+    const uint8_t *data = start + offset + sizeof(flash_record_t);
+    if (record->address == FLASH_ERASED && record->length == FLASH_ERASED) {
+      // End of journal. Anything programmed after it is a torn write.
+      for (uint16_t i = offset; i < FLASH_BLOCK_SIZE; i++)
+        if (start[i] != 0xFF) { offset = FLASH_BLOCK_SIZE; break; }
+      break;
+    }
+    if (record->address + record->length > FLASH_EEPROM_SIZE
+        || offset + RECORD_SIZE(record->length) > FLASH_BLOCK_SIZE
+        || record->check != record_check(record->address, record->length, data)) {
+      // Torn or damaged record: keep what was replayed, compact on the next write
+      offset = FLASH_BLOCK_SIZE;
+      break;
+    }
+    memcpy(flash_eeprom + record->address, data, record->length);
+    offset += RECORD_SIZE(record->length);
+  }
+  journal_end = offset;
+}
+
+void flash_storage_read(uint16_t address, uint8_t *dest, uint16_t n) {
+  flash_storage_init();
+  while (n--) *dest++ = address < FLASH_EEPROM_SIZE ? flash_eeprom[address++] : 0xFF;
+}
+
+bool flash_storage_write(uint16_t address, const uint8_t *src, uint16_t n) {
+  flash_storage_init();
+  if (address + n > FLASH_EEPROM_SIZE) return false;
+  if (memcmp(flash_eeprom + address, src, n) == 0) return true; // unchanged
+  memcpy(flash_eeprom + address, src, n);
+  if (journal_end + RECORD_SIZE(n) > FLASH_BLOCK_SIZE) return flash_compact();
+  if (append_record(active_block, journal_end, address, src, n)) return true;
+  journal_end = FLASH_BLOCK_SIZE; // don't append after a failed record
+  return false;
+}
+
+#endif // FLASH_EEPROM_EMULATION
@@ -0,0 +1,24 @@
+/**
+ * flash_storage.h
+ *
+ * EEPROM emulation in the internal flash of the SAM3X
+ *
+ * The emulated EEPROM is kept in RAM and every change is appended to a
+ * journal in flash. See flash_storage.cpp for the journal layout.
+ */
+
+#ifndef FLASH_STORAGE_H
+#define FLASH_STORAGE_H
+
+#include <stdint.h>
+
+// Replay the journal into RAM (done automatically on first access)
+void flash_storage_init();
+
+// Copy n bytes of the emulated EEPROM starting at address into dest
+void flash_storage_read(uint16_t address, uint8_t *dest, uint16_t n);
+
+// Store n bytes at address, returns false if they could not be written
+bool flash_storage_write(uint16_t address, const uint8_t *src, uint16_t n);
+
+#endif // FLASH_STORAGE_H
@@ -110,6 +110,7 @@
 #define MSG_CONFIGURATION_VER               " Last Updated: "
 #define MSG_FREE_MEMORY                     " Free Memory: "
 #define MSG_PLANNER_BUFFER_BYTES            "  PlannerBufferBytes: "
+#define MSG_BOOT_TIME                       "Ready after "
 #define MSG_OK                              "ok"
 #define MSG_WAIT                            "wait"
 #define MSG_FILE_SAVED                      "Done saving file."
@@ -166,6 +167,12 @@
 #define MSG_SD_NOT_PRINTING                 "Not SD printing"
 #define MSG_SD_ERR_WRITE_TO_FILE            "error writing to file"
 #define MSG_SD_CANT_ENTER_SUBDIR            "Cannot enter subdir: "
+#define MSG_SD_PLANNED_FILE                 "Planned blocks"
+#define MSG_SD_PLANNED_MISMATCH             "Bad header or planned for other steps/unit or kinematics, File: "
+#define MSG_SD_PLANNED_LIMITS               "Planned with higher limits than set, File: "
+#define MSG_SD_PLANNED_BAD_RECORD           "Bad record in planned file at byte "
+#define MSG_SD_TOKEN_BAD_RECORD             "Bad record in tokenized file at byte "
+#define MSG_SD_NOT_SEEKABLE                 "Planned and tokenized files can only be read from the start"
 
 #define MSG_STEPPER_TOO_HIGH                "Steprate too high: "
 #define MSG_ENDSTOPS_HIT                    "endstops hit: "
@@ -178,6 +185,9 @@
 #define MSG_SERIAL_ERROR_MENU_STRUCTURE     "Error in menu structure"
 
 #define MSG_ERR_EEPROM_WRITE                "Error writing to EEPROM!"
+#define MSG_ERR_EEPROM_CRC                  "EEPROM checksum mismatch, settings not loaded"
+#define MSG_ERR_EEPROM_SIZE                 "EEPROM layout mismatch, settings not loaded"
+#define MSG_ERR_EEPROM_IMAGE                "EEPROM image size doesn't match the settings"
 
 // temperature.cpp strings
 #define MSG_PID_AUTOTUNE                    "PID Autotune"
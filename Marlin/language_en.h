@@ -351,6 +351,9 @@
 #ifndef MSG_CONTROL_RETRACT_ZLIFT
 #define MSG_CONTROL_RETRACT_ZLIFT           "Hop mm"
 #endif
+#ifndef MSG_CONTROL_RETRACT_JERK
+#define MSG_CONTROL_RETRACT_JERK            "Retract Ve-jerk"
+#endif
 #ifndef MSG_CONTROL_RETRACT_RECOVER
 #define MSG_CONTROL_RETRACT_RECOVER         "UnRet +mm"
 #endif
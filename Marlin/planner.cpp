@@ -76,6 +76,7 @@ float max_z_jerk;
 float max_e_jerk;
 float mintravelfeedrate;
 unsigned long axis_steps_per_sqr_second[NUM_AXIS];
+int plan_feedrate_multiplier = 0;
 
 #ifdef ENABLE_AUTO_BED_LEVELING
   // Transform required to compensate for bed level
@@ -86,6 +87,14 @@ unsigned long axis_steps_per_sqr_second[NUM_AXIS];
   };
 #endif // ENABLE_AUTO_BED_LEVELING
 
+#ifdef FWRETRACT
+  float retract_jerk;
+#endif
+
+#ifdef ADVANCE
+  float extruder_advance_k = EXTRUDER_ADVANCE_K;
+#endif
+
 #ifdef AUTOTEMP
   float autotemp_max = 250;
   float autotemp_min = 210;
@@ -101,6 +110,21 @@ block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for motion
 volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 volatile unsigned char block_buffer_tail;           // Index of the block to process now
 
+#ifdef PLANNER_RUNTIME
+  volatile unsigned long block_buffer_runtime_us = 0;
+#endif
+
+#ifdef BUFFER_MONITORING
+  uint8_t plan_source = PLAN_SOURCE_SERIAL;
+  volatile bool plan_ran_dry = false;
+  volatile millis_t plan_dry_ms;
+  unsigned long plan_underruns[2], plan_starved_ms[2];
+  unsigned long plan_lowest_runtime_us = 0xFFFFFFFF;
+  #ifdef SLOWDOWN
+    unsigned long plan_slowed_blocks;
+  #endif
+#endif
+
 //===========================================================================
 //============================ private variables ============================
 //===========================================================================
@@ -112,6 +136,17 @@ static float previous_nominal_speed;   // Nominal speed of previous path line se
 
 unsigned char g_uc_extruder_last_move[4] = {0,0,0,0};
 
+#ifdef DUAL_X_CARRIAGE
+  static dxc_position_t dxc_planned = { BIT(DXC_CARRIAGE_1) }; // The carriages of position[X_AXIS]
+
+  // The carriages and extruders the moves of extruder e step
+  static unsigned char dxc_steppers_of(const uint8_t e) {
+    if (extruder_duplication_enabled)
+      return BIT(DXC_CARRIAGE_1) | BIT(DXC_CARRIAGE_2) | (extruder_duplication_mirrored ? BIT(DXC_MIRROR_X2) : 0);
+    return BIT(e ? DXC_CARRIAGE_2 : DXC_CARRIAGE_1);
+  }
+#endif
+
 #ifdef XY_FREQUENCY_LIMIT
   // Used for the frequency limit
   #define MAX_FREQ_TIME (1000000.0/XY_FREQUENCY_LIMIT)
@@ -122,13 +157,102 @@ unsigned char g_uc_extruder_last_move[4] = {0,0,0,0};
 #endif
 
 #ifdef FILAMENT_SENSOR
-  static char meas_sample; //temporary variable to hold filament measurement sample
+  // Volumetric factors measured by the width sensor, one per MEASUREMENT_SAMPLE_MM of filament
+  #define FILWIDTH_SLOTS (MAX_MEASUREMENT_DELAY * 10 / MEASUREMENT_SAMPLE_MM + 1)
+  static uint16_t filwidth_buffer[FILWIDTH_SLOTS];
+  static uint16_t filwidth_head = 0;    // slot of the filament at the sensor
+  static long filwidth_remainder = 0;   // E steps fed since the filament entered filwidth_head
+  uint16_t filwidth_factor = FILWIDTH_ONE;
+#endif
+
+#ifdef FWRETRACT
+  static float retract_hop = 0;            // Z lift of the retraction, added to the targets up to the recovery
+  static bool retract_hop_raised = false;  // position[] includes retract_hop
+  static bool previous_retract = false;    // The previous block was a retract or recover block
+  // A delta lifts the effector by raising all towers alike
+  #ifdef DELTA
+    #define RETRACT_HOP_AXIS(axis) (axis != E_AXIS)
+  #else
+    #define RETRACT_HOP_AXIS(axis) (axis == Z_AXIS)
+  #endif
 #endif
 
 //===========================================================================
 //================================ functions ================================
 //===========================================================================
 
+#ifdef FILAMENT_SENSOR
+
+  void plan_filwidth_fill() {
+    uint16_t factor = widthFil_to_volumetric_factor();
+    for (uint16_t i = 0; i < FILWIDTH_SLOTS; i++) filwidth_buffer[i] = factor;
+    filwidth_remainder = 0;
+  }
+
+  // Factor measured when the filament now in the melt zone passed the sensor
+  FORCE_INLINE uint16_t filwidth_nozzle_factor() {
+    int i = filwidth_head - meas_delay_cm * 10 / MEASUREMENT_SAMPLE_MM;
+    if (i < 0) i += FILWIDTH_SLOTS;
+    return filwidth_buffer[i];
+  }
+
+  // Move the measurements along with the filament fed by a block. Slots
+  // passing the sensor get the current measurement.
+  static void filwidth_feed(long e_steps) {
+    long slot_steps = max(1.0, axis_steps_per_unit[E_AXIS] * MEASUREMENT_SAMPLE_MM);
+    filwidth_remainder += e_steps;
+    if (filwidth_remainder >= slot_steps) {
+      long slots = filwidth_remainder / slot_steps;
+      filwidth_remainder -= slots * slot_steps;
+      uint16_t factor = widthFil_to_volumetric_factor();
+      if (slots > FILWIDTH_SLOTS) slots = FILWIDTH_SLOTS;
+      while (slots--) {
+        if (++filwidth_head == FILWIDTH_SLOTS) filwidth_head = 0;
+        filwidth_buffer[filwidth_head] = factor;
+      }
+    }
+    else if (filwidth_remainder < 0) {
+      // Retracted filament takes its measurements back
+      long slots = (slot_steps - 1 - filwidth_remainder) / slot_steps;
+      filwidth_remainder += slots * slot_steps;
+      filwidth_head = (filwidth_head + FILWIDTH_SLOTS - slots % FILWIDTH_SLOTS) % FILWIDTH_SLOTS;
+    }
+  }
+
+#endif // FILAMENT_SENSOR
+
+#if HAS_TOOL_OFFSETS
+
+  // Offset of the tool of extruder e. The planner takes it off the targets,
+  // so it works in carriage positions. With DUAL_X_CARRIAGE the X position
+  // already is the position of the carriage.
+  static float tool_offset(const uint8_t axis, const uint8_t e) {
+    switch (axis) {
+      #ifdef DUAL_X_CARRIAGE
+        case Z_AXIS: return extruder_offset[Z_AXIS][e];
+      #else
+        case X_AXIS: return extruder_offset[X_AXIS][e];
+      #endif
+      case Y_AXIS: return extruder_offset[Y_AXIS][e];
+    }
+    return 0;
+  }
+
+#else
+
+  #define tool_offset(axis, e) 0
+
+#endif
+
+// Offset of the carriage from the tool position: the tool offset and the Z lift of a retraction
+static float carriage_offset(const uint8_t axis, const uint8_t e) {
+  float offset = tool_offset(axis, e);
+  #ifdef FWRETRACT
+    if (RETRACT_HOP_AXIS(axis)) offset -= retract_hop;
+  #endif
+  return offset;
+}
+
 // Get the next / previous index of the next block in the ring buffer
 // NOTE: Using & here (not %) because BLOCK_BUFFER_SIZE is always a power of 2
 FORCE_INLINE int8_t next_block_index(int8_t block_index) { return BLOCK_MOD(block_index + 1); }
@@ -178,11 +302,6 @@ void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exi
     plateau_steps = 0;
   }
 
-#ifdef ADVANCE
-  volatile long initial_advance = block->advance * entry_factor * entry_factor; 
-  volatile long final_advance = block->advance * exit_factor * exit_factor;
-#endif // ADVANCE
-
   // block->accelerate_until = accelerate_steps;
   // block->decelerate_after = accelerate_steps+plateau_steps;
   CRITICAL_SECTION_START;  // Fill variables used by the stepper in a critical section
@@ -191,10 +310,6 @@ void calculate_trapezoid_for_block(block_t *block, float entry_factor, float exi
     block->decelerate_after = accelerate_steps+plateau_steps;
     block->initial_rate = initial_rate;
     block->final_rate = final_rate;
-    #ifdef ADVANCE
-      block->initial_advance = initial_advance;
-      block->final_advance = final_advance;
-    #endif
   }
   CRITICAL_SECTION_END;
 }                    
@@ -300,6 +415,13 @@ void planner_forward_pass() {
   planner_forward_pass_kernel(block[1], block[2], NULL);
 }
 
+// Blocks planned offline keep the trapezoid they were planned with
+#ifdef SD_BLOCK_PLAYBACK
+  #define BLOCK_PLANNED(block) ((block)->planned_flag)
+#else
+  #define BLOCK_PLANNED(block) false
+#endif
+
 // Recalculates the trapezoid speed profiles for all blocks in the plan according to the 
 // entry_factor for each junction. Must be called by planner_recalculate() after 
 // updating the blocks.
@@ -316,7 +438,7 @@ void planner_recalculate_trapezoids() {
       if (current->recalculate_flag || next->recalculate_flag) {
         // NOTE: Entry and exit factors always > 0 by all previous logic operations.
         float nom = current->nominal_speed;
-        calculate_trapezoid_for_block(current, current->entry_speed / nom, next->entry_speed / nom);
+        if (!BLOCK_PLANNED(current)) calculate_trapezoid_for_block(current, current->entry_speed / nom, next->entry_speed / nom);
         current->recalculate_flag = false; // Reset current only to ensure next trapezoid is computed
       }
     }
@@ -325,7 +447,7 @@ void planner_recalculate_trapezoids() {
   // Last/newest block in buffer. Exit speed is set with MINIMUM_PLANNER_SPEED. Always recalculated.
   if (next) {
     float nom = next->nominal_speed;
-    calculate_trapezoid_for_block(next, next->entry_speed / nom, MINIMUM_PLANNER_SPEED / nom);
+    if (!BLOCK_PLANNED(next)) calculate_trapezoid_for_block(next, next->entry_speed / nom, MINIMUM_PLANNER_SPEED / nom);
     next->recalculate_flag = false;
   }
 }
@@ -355,6 +477,9 @@ void planner_recalculate() {
 
 void plan_init() {
   block_buffer_head = block_buffer_tail = 0;
+  #ifdef PLANNER_RUNTIME
+    block_buffer_runtime_us = 0;
+  #endif
   memset(position, 0, sizeof(position)); // clear position
   for (int i=0; i<NUM_AXIS; i++) previous_speed[i] = 0.0; 
   previous_nominal_speed = 0.0;
@@ -469,6 +594,48 @@ void check_axes_activity() {
 
 
 float junction_deviation = 0.1;
+
+#ifdef PLANNER_RUNTIME
+  // Change the time of a queued block, with interrupts off
+  FORCE_INLINE void set_segment_time(block_t *block, unsigned long time_us) {
+    block_buffer_runtime_us += time_us - block->segment_time_us;
+    block->segment_time_us = time_us;
+  }
+#endif
+
+#ifdef BUFFER_MONITORING
+
+  void plan_reset_monitoring() {
+    for (int i = 0; i < 2; i++) plan_underruns[i] = plan_starved_ms[i] = 0;
+    plan_lowest_runtime_us = 0xFFFFFFFF;
+    #ifdef SLOWDOWN
+      plan_slowed_blocks = 0;
+    #endif
+  }
+
+  /**
+   * Check the queue before a new block goes in. If the stepper emptied it
+   * and nothing waited for that (st_synchronize() clears plan_ran_dry), the
+   * moves didn't come in time: an underrun, unless the stop was long enough
+   * to be a pause between jobs or moves sent by hand.
+   */
+  static void monitor_buffer() {
+    if (plan_ran_dry) {
+      plan_ran_dry = false;
+      millis_t gap = millis() - plan_dry_ms;
+      if (gap < BUFFER_MONITORING_GAP) {
+        plan_underruns[plan_source]++;
+        plan_starved_ms[plan_source] += gap;
+      }
+    }
+    else if (blocks_queued())
+      NOMORE(plan_lowest_runtime_us, block_buffer_runtime_us);
+  }
+
+#endif // BUFFER_MONITORING
+
+static bool plan_buffer_steps(const long target[NUM_AXIS], float feed_rate, const uint8_t &extruder, const int multiplier, const bool retract);
+
 // Add a new linear movement to the buffer. steps[X_AXIS], _y and _z is the absolute position in 
 // mm. Microseconds specify how many microseconds the move should take to perform. To aid acceleration
 // calculation the caller must also provide the physical length of the line in millimeters.
@@ -478,12 +645,19 @@ float junction_deviation = 0.1;
   void plan_buffer_line(const float &x, const float &y, const float &z, const float &e, float feed_rate, const uint8_t &extruder)
 #endif  // ENABLE_AUTO_BED_LEVELING
 {
-  // Calculate the buffer head after we push this byte
-  int next_buffer_head = next_block_index(block_buffer_head);
-
   // If the buffer is full: good! That means we are well ahead of the robot. 
   // Rest here until there is room in the buffer.
-  while (block_buffer_tail == next_buffer_head) idle();
+  while (block_buffer_tail == next_block_index(block_buffer_head) && !MOVES_ABORTED) idle();
+
+  // A real-time M410 drops the moves of the command
+  if (MOVES_ABORTED) return;
+
+  // Follow a multiplier change made while waiting, or since the caller computed feed_rate
+  int multiplier = plan_feedrate_multiplier;
+  if (multiplier && feedrate_multiplier > 0 && multiplier != feedrate_multiplier) {
+    feed_rate = feed_rate * feedrate_multiplier / multiplier;
+    multiplier = feedrate_multiplier;
+  }
 
   #ifdef MESH_BED_LEVELING
     if (mbl.active) z += mbl.get_z(x, y);
@@ -495,11 +669,40 @@ float junction_deviation = 0.1;
   // Calculate target position in absolute steps
   //this should be done after the wait, because otherwise a M92 code within the gcode disrupts this calculation somehow
   long target[NUM_AXIS];
-  target[X_AXIS] = lround(x * axis_steps_per_unit[X_AXIS]);
-  target[Y_AXIS] = lround(y * axis_steps_per_unit[Y_AXIS]);
-  target[Z_AXIS] = lround(z * axis_steps_per_unit[Z_AXIS]);     
+  target[X_AXIS] = lround((x - carriage_offset(X_AXIS, extruder)) * axis_steps_per_unit[X_AXIS]);
+  target[Y_AXIS] = lround((y - carriage_offset(Y_AXIS, extruder)) * axis_steps_per_unit[Y_AXIS]);
+  target[Z_AXIS] = lround((z - carriage_offset(Z_AXIS, extruder)) * axis_steps_per_unit[Z_AXIS]);
   target[E_AXIS] = lround(e * axis_steps_per_unit[E_AXIS]);
 
+  #ifdef FWRETRACT
+    // The first move after a retraction raises the lift
+    if (plan_buffer_steps(target, feed_rate, extruder, multiplier, false) && retract_hop) retract_hop_raised = true;
+  #else
+    plan_buffer_steps(target, feed_rate, extruder, multiplier, false);
+  #endif
+
+} // plan_buffer_line()
+
+/**
+ * Add a block moving the carriage to the target in absolute steps. Returns false
+ * if the block is too short to be queued. The caller waits for a free block.
+ * A retract block moves the filament by the E steps as they are, with
+ * retract_acceleration and retract_jerk.
+ */
+static bool plan_buffer_steps(const long target[NUM_AXIS], float feed_rate, const uint8_t &extruder, const int multiplier, const bool retract) {
+
+  // Calculate the buffer head after we push this byte
+  int next_buffer_head = next_block_index(block_buffer_head);
+
+  #ifdef DUAL_X_CARRIAGE
+    // Move from where the carriages of the block are. Other carriages start from rest.
+    unsigned char dxc_steppers = dxc_steppers_of(extruder);
+    if (dxc_select(dxc_planned, position[X_AXIS], dxc_steppers)) {
+      previous_nominal_speed = 0;
+      for (int i = 0; i < NUM_AXIS; i++) previous_speed[i] = 0;
+    }
+  #endif
+
   float dx = target[X_AXIS] - position[X_AXIS],
         dy = target[Y_AXIS] - position[Y_AXIS],
         dz = target[Z_AXIS] - position[Z_AXIS],
@@ -544,13 +747,24 @@ float junction_deviation = 0.1;
 
   block->steps[Z_AXIS] = labs(dz);
   block->steps[E_AXIS] = labs(de);
-  block->steps[E_AXIS] *= volumetric_multiplier[extruder];
-  block->steps[E_AXIS] *= extruder_multiplier[extruder];
-  block->steps[E_AXIS] /= 100;
+  // A retract block moves the filament as it is, other blocks follow the extrusion multipliers
+  float e_factor = retract ? 1.0 : volumetric_multiplier[extruder] * extruder_multiplier[extruder] / 100.0;
+  if (!retract) {
+    block->steps[E_AXIS] *= volumetric_multiplier[extruder];
+    block->steps[E_AXIS] *= extruder_multiplier[extruder];
+    block->steps[E_AXIS] /= 100;
+    #ifdef FILAMENT_SENSOR
+      if (extruder == FILAMENT_SENSOR_EXTRUDER_NUM) {
+        filwidth_factor = filament_sensor ? filwidth_nozzle_factor() : FILWIDTH_ONE;
+        block->steps[E_AXIS] = ((uint64_t)block->steps[E_AXIS] * filwidth_factor) >> FILWIDTH_SHIFT;
+        e_factor *= filwidth_factor * (1.0 / FILWIDTH_ONE);
+      }
+    #endif
+  }
   block->step_event_count = max(block->steps[X_AXIS], max(block->steps[Y_AXIS], max(block->steps[Z_AXIS], block->steps[E_AXIS])));
 
   // Bail if this is a zero-length block
-  if (block->step_event_count <= dropsegments) return;
+  if (block->step_event_count <= dropsegments) return false;
 
   block->fan_speed = fanSpeed;
   #ifdef BARICUDA
@@ -575,6 +789,11 @@ float junction_deviation = 0.1;
 
   block->active_extruder = extruder;
 
+  #ifdef DUAL_X_CARRIAGE
+    // The stepper interrupt steps the carriages selected here, whatever the mode is by then
+    block->dxc_steppers = dxc_steppers;
+  #endif
+
   //enable active axes
   #ifdef COREXY
     if (block->steps[A_AXIS] || block->steps[B_AXIS]) {
@@ -679,9 +898,10 @@ float junction_deviation = 0.1;
     delta_mm[Y_AXIS] = dy / axis_steps_per_unit[Y_AXIS];
   #endif
   delta_mm[Z_AXIS] = dz / axis_steps_per_unit[Z_AXIS];
-  delta_mm[E_AXIS] = (de / axis_steps_per_unit[E_AXIS]) * volumetric_multiplier[extruder] * extruder_multiplier[extruder] / 100.0;
+  delta_mm[E_AXIS] = (de / axis_steps_per_unit[E_AXIS]) * e_factor;
 
-  if (block->steps[X_AXIS] <= dropsegments && block->steps[Y_AXIS] <= dropsegments && block->steps[Z_AXIS] <= dropsegments) {
+  // The feed rate of a retract block is that of the filament, also when it lowers the lift
+  if (retract || (block->steps[X_AXIS] <= dropsegments && block->steps[Y_AXIS] <= dropsegments && block->steps[Z_AXIS] <= dropsegments)) {
     block->millimeters = fabs(delta_mm[E_AXIS]);
   } 
   else {
@@ -702,64 +922,54 @@ float junction_deviation = 0.1;
   int moves_queued = movesplanned();
 
   // Slow down when the buffer starts to empty, rather than wait at the corner for a buffer refill
-  #if defined(OLD_SLOWDOWN) || defined(SLOWDOWN)
-    bool mq = moves_queued > 1 && moves_queued < BLOCK_BUFFER_SIZE / 2;
-    #ifdef OLD_SLOWDOWN
-      if (mq) feed_rate *= 2.0 * moves_queued / BLOCK_BUFFER_SIZE;
-    #endif
-    #ifdef SLOWDOWN
-      //  segment time im micro seconds
-      unsigned long segment_time = lround(1000000.0/inverse_second);
-      if (mq) {
-        if (segment_time < minsegmenttime) {
-          // buffer is draining, add extra time.  The amount of time added increases if the buffer is still emptied more.
-          inverse_second = 1000000.0 / (segment_time + lround(2 * (minsegmenttime - segment_time) / moves_queued));
-          #ifdef XY_FREQUENCY_LIMIT
-            segment_time = lround(1000000.0 / inverse_second);
-          #endif
-        }
-      }
-    #endif
+  #ifdef OLD_SLOWDOWN
+    if (moves_queued > 1 && moves_queued < BLOCK_BUFFER_SIZE / 2) feed_rate *= 2.0 * moves_queued / BLOCK_BUFFER_SIZE;
+  #endif
+  #ifdef SLOWDOWN
+    //  segment time im micro seconds
+    unsigned long segment_time = lround(1000000.0/inverse_second);
+    // The time the stepper has left with this block, against the target
+    const unsigned long target_time = SLOWDOWN_BUFFER_TIME * 1000UL;
+    unsigned long buffered = block_buffer_runtime_us + segment_time;
+    if (moves_queued > 1 && segment_time < minsegmenttime && buffered < target_time) {
+      // buffer is draining, add extra time. Short segments get closer to minsegmenttime the less time is left.
+      segment_time += lround((float)(minsegmenttime - segment_time) * (target_time - buffered) / target_time);
+      inverse_second = 1000000.0 / segment_time;
+      #ifdef BUFFER_MONITORING
+        plan_slowed_blocks++;
+      #endif
+    }
   #endif
 
   block->nominal_speed = block->millimeters * inverse_second; // (mm/sec) Always > 0
   block->nominal_rate = ceil(block->step_event_count * inverse_second); // (step/sec) Always > 0
 
   #ifdef FILAMENT_SENSOR
-    //FMM update ring buffer used for delay with filament measurements
-  
-    if (extruder == FILAMENT_SENSOR_EXTRUDER_NUM && delay_index2 > -1) {  //only for extruder with filament sensor and if ring buffer is initialized
-
-      const int MMD = MAX_MEASUREMENT_DELAY + 1, MMD10 = MMD * 10;
-
-      delay_dist += delta_mm[E_AXIS];  // increment counter with next move in e axis
-      while (delay_dist >= MMD10) delay_dist -= MMD10; // loop around the buffer
-      while (delay_dist < 0) delay_dist += MMD10;
-
-      delay_index1 = delay_dist / 10.0;  // calculate index
-      delay_index1 = constrain(delay_index1, 0, MAX_MEASUREMENT_DELAY); // (already constrained above)
-
-      if (delay_index1 != delay_index2) { // moved index
-        meas_sample = widthFil_to_size_ratio() - 100;  // Subtract 100 to reduce magnitude - to store in a signed char
-        while (delay_index1 != delay_index2) {
-          // Increment and loop around buffer
-          if (++delay_index2 >= MMD) delay_index2 -= MMD;
-          delay_index2 = constrain(delay_index2, 0, MAX_MEASUREMENT_DELAY);
-          measurement_delay[delay_index2] = meas_sample;
-        }
-      }
-    }
+    // Move the stored measurements along with the filament
+    if (extruder == FILAMENT_SENSOR_EXTRUDER_NUM && filament_sensor)
+      filwidth_feed(de < 0 ? -(long)block->steps[E_AXIS] : (long)block->steps[E_AXIS]);
   #endif
 
   // Calculate and limit speed in mm/sec for each axis
   float current_speed[NUM_AXIS];
-  float speed_factor = 1.0; //factor <=1 do decrease speed
+  float speed_factor = 1.0, //factor <=1 do decrease speed
+        limit_factor = 1e10; //factor at which the first axis reaches its max feedrate
   for (int i = 0; i < NUM_AXIS; i++) {
     current_speed[i] = delta_mm[i] * inverse_second;
     float cs = fabs(current_speed[i]), mf = max_feedrate[i];
+    if (cs > 0) limit_factor = min(limit_factor, mf / cs);
     if (cs > mf) speed_factor = min(speed_factor, mf / cs);
   }
 
+  #ifdef INPUT_SHAPING
+    // Every X/Y step takes two ticks of the shaper timer
+    for (int i = X_AXIS; i <= Y_AXIS; i++) {
+      float sr = block->steps[i] * inverse_second;
+      if (sr > 0) limit_factor = min(limit_factor, (SHAPING_STEP_FREQUENCY / 2) / sr);
+      if (sr > SHAPING_STEP_FREQUENCY / 2) speed_factor = min(speed_factor, (SHAPING_STEP_FREQUENCY / 2) / sr);
+    }
+  #endif
+
   // Max segement time in us.
   #ifdef XY_FREQUENCY_LIMIT
     #define MAX_FREQ_TIME (1000000.0 / XY_FREQUENCY_LIMIT)
@@ -799,6 +1009,10 @@ float junction_deviation = 0.1;
     }
   #endif // XY_FREQUENCY_LIMIT
 
+  // Remember the speed at 100% and the limit, for later feedrate_multiplier changes
+  block->override_speed = multiplier ? block->nominal_speed * 100.0 / multiplier : 0;
+  block->max_nominal_speed = block->nominal_speed * min(speed_factor, limit_factor);
+
   // Correct the speed  
   if (speed_factor < 1.0) {
     for (unsigned char i = 0; i < NUM_AXIS; i++) current_speed[i] *= speed_factor;
@@ -809,7 +1023,7 @@ float junction_deviation = 0.1;
   // Compute and limit the acceleration rate for the trapezoid generator.  
   float steps_per_mm = block->step_event_count / block->millimeters;
   long bsx = block->steps[X_AXIS], bsy = block->steps[Y_AXIS], bsz = block->steps[Z_AXIS], bse = block->steps[E_AXIS];
-  if (bsx == 0 && bsy == 0 && bsz == 0) {
+  if (retract || (bsx == 0 && bsy == 0 && bsz == 0)) {
     block->acceleration_st = ceil(retract_acceleration * steps_per_mm); // convert to: acceleration steps/sec^2
   }
   else if (bse == 0) {
@@ -874,15 +1088,24 @@ float junction_deviation = 0.1;
     }
   #endif
 
+  // Retractions and the junctions around them have a jerk of their own
+  #ifdef FWRETRACT
+    float e_jerk = (retract || previous_retract) ? retract_jerk : max_e_jerk;
+    previous_retract = retract;
+  #else
+    float e_jerk = max_e_jerk;
+  #endif
+
   // Start with a safe speed
   float vmax_junction = max_xy_jerk / 2;
   float vmax_junction_factor = 1.0; 
-  float mz2 = max_z_jerk / 2, me2 = max_e_jerk / 2;
+  float mz2 = max_z_jerk / 2, me2 = e_jerk / 2;
   float csz = current_speed[Z_AXIS], cse = current_speed[E_AXIS];
   if (fabs(csz) > mz2) vmax_junction = min(vmax_junction, mz2);
   if (fabs(cse) > me2) vmax_junction = min(vmax_junction, me2);
   vmax_junction = min(vmax_junction, block->nominal_speed);
   float safe_speed = vmax_junction;
+  block->max_junction_speed = vmax_junction;
 
   if ((moves_queued > 1) && (previous_nominal_speed > 0.0001)) {
     float dx = current_speed[X_AXIS] - previous_speed[X_AXIS],
@@ -896,9 +1119,17 @@ float junction_deviation = 0.1;
     //    }
     if (jerk > max_xy_jerk) vmax_junction_factor = max_xy_jerk / jerk;
     if (dz > max_z_jerk) vmax_junction_factor = min(vmax_junction_factor, max_z_jerk / dz);
-    if (de > max_e_jerk) vmax_junction_factor = min(vmax_junction_factor, max_e_jerk / de);
+    if (de > e_jerk) vmax_junction_factor = min(vmax_junction_factor, e_jerk / de);
 
     vmax_junction = min(previous_nominal_speed, vmax_junction * vmax_junction_factor); // Limit speed to max previous speed
+
+    // The jerk grows with the junction speed, so this stays the junction speed
+    // at which the jerk limits are reached when both blocks are scaled alike.
+    float jerk_factor = 1e10;
+    if (jerk > 0) jerk_factor = max_xy_jerk / jerk;
+    if (dz > 0) jerk_factor = min(jerk_factor, max_z_jerk / dz);
+    if (de > 0) jerk_factor = min(jerk_factor, e_jerk / de);
+    block->max_junction_speed = block->nominal_speed * jerk_factor;
   }
   block->max_entry_speed = vmax_junction;
 
@@ -916,34 +1147,36 @@ float junction_deviation = 0.1;
   // the maximum junction speed and may always be ignored for any speed reduction checks.
   block->nominal_length_flag = (block->nominal_speed <= v_allowable); 
   block->recalculate_flag = true; // Always calculate trapezoid for new block
+  #ifdef SD_BLOCK_PLAYBACK
+    block->planned_flag = false;
+  #endif
 
   // Update previous path unit_vector and nominal speed
   for (int i = 0; i < NUM_AXIS; i++) previous_speed[i] = current_speed[i];
   previous_nominal_speed = block->nominal_speed;
 
   #ifdef ADVANCE
-    // Calculate advance rate
-    if (!bse || (!bsx && !bsy && !bsz)) {
-      block->advance_rate = 0;
-      block->advance = 0;
-    }
-    else {
-      long acc_dist = estimate_acceleration_distance(0, block->nominal_rate, block->acceleration_st);
-      float advance = (STEPS_PER_CUBIC_MM_E * EXTRUDER_ADVANCE_K) * (cse * cse * EXTRUSION_AREA * EXTRUSION_AREA) * 256;
-      block->advance = advance;
-      block->advance_rate = acc_dist ? advance / (float)acc_dist : 0;
-    }
-    /*
-      SERIAL_ECHO_START;
-     SERIAL_ECHOPGM("advance :");
-     SERIAL_ECHO(block->advance/256.0);
-     SERIAL_ECHOPGM("advance rate :");
-     SERIAL_ECHOLN(block->advance_rate/256.0);
-     */
+    // The E velocity is the step rate times the share of E steps, so the
+    // stepper only multiplies its step rate by this factor to get the advance.
+    // Travel moves, retracts and recoveries get no advance.
+    if (retract || !bse || (!bsx && !bsy && !bsz) || TEST(block->direction_bits, E_AXIS))
+      block->advance_k = 0;
+    else
+      block->advance_k = extruder_advance_k * bse / block->step_event_count * 65536;
   #endif // ADVANCE
 
   calculate_trapezoid_for_block(block, block->entry_speed / block->nominal_speed, safe_speed / block->nominal_speed);
 
+  #ifdef BUFFER_MONITORING
+    monitor_buffer();
+  #endif
+  #ifdef PLANNER_RUNTIME
+    block->segment_time_us = 0;
+    CRITICAL_SECTION_START;
+    set_segment_time(block, lround(block->millimeters * 1000000.0 / block->nominal_speed));
+    CRITICAL_SECTION_END;
+  #endif
+
   // Move buffer head
   block_buffer_head = next_buffer_head;
 
@@ -954,11 +1187,158 @@ float junction_deviation = 0.1;
 
   st_wake_up();
 
-} // plan_buffer_line()
+  return true;
+
+} // plan_buffer_steps()
+
+#ifdef SD_BLOCK_PLAYBACK
+
+  uint16_t planned_checksum(uint16_t sum, const void *data, size_t size) {
+    const uint8_t *p = (const uint8_t*)data;
+    uint16_t sum1 = sum & 0xFF, sum2 = sum >> 8;
+    while (size--) {
+      sum1 = (sum1 + *p++) % 255;
+      sum2 = (sum2 + sum1) % 255;
+    }
+    return sum2 << 8 | sum1;
+  }
+
+  // The stepper interrupt can run the block, and within the limits of the printer
+  static bool planned_block_valid(const planned_block_t &pb) {
+    if (pb.active_extruder >= EXTRUDERS) return false;
+    long most = 0;
+    for (int i = 0; i < NUM_AXIS; i++) {
+      if (pb.steps[i] < 0) return false;
+      NOLESS(most, pb.steps[i]);
+      // As the acceleration limit of plan_buffer_line(), with a step/s² for rounding
+      if ((uint64_t)pb.acceleration_st * pb.steps[i] > (uint64_t)(axis_steps_per_sqr_second[i] + 1) * pb.step_event_count)
+        return false;
+      #ifdef INPUT_SHAPING
+        // As the X/Y step rate limit of plan_buffer_line()
+        if (i <= Y_AXIS && (uint64_t)pb.nominal_rate * pb.steps[i] > (uint64_t)(SHAPING_STEP_FREQUENCY / 2) * pb.step_event_count)
+          return false;
+      #endif
+    }
+    return pb.step_event_count > 0 && pb.step_event_count == (unsigned long)most
+      && pb.accelerate_until >= 0 && pb.accelerate_until <= pb.decelerate_after
+      && pb.decelerate_after <= (long)pb.step_event_count
+      && pb.nominal_rate > 0 && pb.nominal_rate <= MAX_STEP_FREQUENCY
+      && pb.initial_rate <= pb.nominal_rate && pb.final_rate <= pb.nominal_rate;
+  }
+
+  bool plan_buffer_planned(const planned_block_t &pb) {
+    if (!planned_block_valid(pb)) return false;
+
+    block_t *block = &block_buffer[block_buffer_head];
+    block->busy = false;
+
+    for (int i = 0; i < NUM_AXIS; i++) block->steps[i] = pb.steps[i];
+    block->step_event_count = pb.step_event_count;
+    block->accelerate_until = pb.accelerate_until;
+    block->decelerate_after = pb.decelerate_after;
+    block->initial_rate = pb.initial_rate;
+    block->nominal_rate = pb.nominal_rate;
+    block->final_rate = pb.final_rate;
+    block->acceleration_st = pb.acceleration_st;
+    block->acceleration_rate = (long)(pb.acceleration_st * (4294967296.0 / HAL_TIMER_RATE));
+    block->direction_bits = pb.direction_bits;
+    block->active_extruder = pb.active_extruder;
+    block->fan_speed = pb.fan_speed;
+    #ifdef BARICUDA
+      block->valve_pressure = ValvePressure;
+      block->e_to_p_pressure = EtoPPressure;
+    #endif
+
+    #ifdef ADVANCE
+      if (!pb.steps[E_AXIS] || (!pb.steps[X_AXIS] && !pb.steps[Y_AXIS] && !pb.steps[Z_AXIS]) || TEST(pb.direction_bits, E_AXIS))
+        block->advance_k = 0;
+      else
+        block->advance_k = extruder_advance_k * pb.steps[E_AXIS] / pb.step_event_count * 65536;
+    #endif
+
+    // The look-ahead and plan_update_feedrate_multiplier() leave the block
+    // alone: its trapezoid is final. Moves planned after the file start from
+    // a stop, the PLANNED_POSITION record waits for the blocks to finish.
+    block->planned_flag = true;
+    block->nominal_speed = 1;
+    block->entry_speed = block->max_entry_speed = block->max_junction_speed = 0;
+    block->millimeters = block->acceleration = 0;
+    block->override_speed = 0;
+    block->nominal_length_flag = true;
+    block->recalculate_flag = false;
+
+    if (block->steps[X_AXIS] || block->steps[Y_AXIS]) {
+      enable_x();
+      enable_y();
+    }
+    #ifndef Z_LATE_ENABLE
+      if (block->steps[Z_AXIS]) enable_z();
+    #endif
+    if (block->steps[E_AXIS]) {
+      enable_e0();
+      enable_e1();
+      enable_e2();
+      enable_e3();
+    }
+
+    #ifdef BUFFER_MONITORING
+      monitor_buffer();
+    #endif
+    #ifdef PLANNER_RUNTIME
+      block->segment_time_us = 0;
+      CRITICAL_SECTION_START;
+      set_segment_time(block, lround(pb.step_event_count * 1000000.0 / pb.nominal_rate));
+      CRITICAL_SECTION_END;
+    #endif
+
+    block_buffer_head = next_block_index(block_buffer_head);
+    previous_nominal_speed = 0;
+    st_wake_up();
+    return true;
+  }
+
+#endif // SD_BLOCK_PLAYBACK
+
+#ifdef FWRETRACT
+
+  void plan_retract(const float &length, const float &feed_rate, const float &zlift, const uint8_t &extruder) {
+    while (block_buffer_tail == next_block_index(block_buffer_head) && !MOVES_ABORTED) idle();
+    if (MOVES_ABORTED) return;
+
+    #ifdef DUAL_X_CARRIAGE
+      dxc_select(dxc_planned, position[X_AXIS], dxc_steppers_of(extruder));
+    #endif
+    long target[NUM_AXIS];
+    for (int i = 0; i < NUM_AXIS; i++) target[i] = position[i];
+    target[E_AXIS] -= lround(length * axis_steps_per_unit[E_AXIS]);
+
+    if (length < 0) {
+      // Lower the lift while the filament is pushed forward
+      if (retract_hop_raised)
+        for (int i = 0; i < E_AXIS; i++)
+          if (RETRACT_HOP_AXIS(i)) target[i] -= lround(retract_hop * axis_steps_per_unit[i]);
+      retract_hop = 0;
+      retract_hop_raised = false;
+    }
+
+    // The E position of the moves doesn't include the retraction
+    long e_position = position[E_AXIS];
+    plan_buffer_steps(target, feed_rate, extruder, 0, true);
+    position[E_AXIS] = e_position;
+
+    // The next move raises the lift on its way
+    if (length > 0) retract_hop = zlift;
+  }
+
+#endif // FWRETRACT
 
 #if defined(ENABLE_AUTO_BED_LEVELING) && !defined(DELTA)
+  float plan_get_axis_position_mm(AxisEnum axis) {
+    return st_get_position_mm(axis) + carriage_offset(axis, active_extruder);
+  }
+
   vector_3 plan_get_position() {
-    vector_3 position = vector_3(st_get_position_mm(X_AXIS), st_get_position_mm(Y_AXIS), st_get_position_mm(Z_AXIS));
+    vector_3 position = vector_3(plan_get_axis_position_mm(X_AXIS), plan_get_axis_position_mm(Y_AXIS), plan_get_axis_position_mm(Z_AXIS));
 
     //position.debug("in plan_get position");
     //plan_bed_level_matrix.debug("in plan_get_position");
@@ -977,27 +1357,173 @@ float junction_deviation = 0.1;
   void plan_set_position(const float &x, const float &y, const float &z, const float &e)
 #endif // ENABLE_AUTO_BED_LEVELING || MESH_BED_LEVELING
   {
+    if (MOVES_ABORTED) return; // The step counts stay where the steppers stopped
+
     #ifdef MESH_BED_LEVELING
       if (mbl.active) z += mbl.get_z(x, y);
     #elif defined(ENABLE_AUTO_BED_LEVELING)
       apply_rotation_xyz(plan_bed_level_matrix, x, y, z);
     #endif
 
-    float nx = position[X_AXIS] = lround(x * axis_steps_per_unit[X_AXIS]),
-          ny = position[Y_AXIS] = lround(y * axis_steps_per_unit[Y_AXIS]),
-          nz = position[Z_AXIS] = lround(z * axis_steps_per_unit[Z_AXIS]),
+    #ifdef DUAL_X_CARRIAGE
+      // The position is that of the carriages of the active extruder, the others stay where they are
+      dxc_select(dxc_planned, position[X_AXIS], dxc_steppers_of(active_extruder));
+    #endif
+
+    float nx = position[X_AXIS] = lround((x - carriage_offset(X_AXIS, active_extruder)) * axis_steps_per_unit[X_AXIS]),
+          ny = position[Y_AXIS] = lround((y - carriage_offset(Y_AXIS, active_extruder)) * axis_steps_per_unit[Y_AXIS]),
+          nz = position[Z_AXIS] = lround((z - carriage_offset(Z_AXIS, active_extruder)) * axis_steps_per_unit[Z_AXIS]),
           ne = position[E_AXIS] = lround(e * axis_steps_per_unit[E_AXIS]);
     st_set_position(nx, ny, nz, ne);
+    #ifdef DUAL_X_CARRIAGE
+      dxc_planned.dup_start = position[X_AXIS];
+      st_set_dxc_position(dxc_planned);
+    #endif
+    #ifdef FWRETRACT
+      retract_hop_raised = retract_hop != 0;
+    #endif
     previous_nominal_speed = 0.0; // Resets planner junction speeds. Assumes start from rest.
 
     for (int i=0; i<NUM_AXIS; i++) previous_speed[i] = 0.0;
   }
 
+/**
+ * Apply a change of feedrate_multiplier to the blocks already in the buffer.
+ * The block being executed and the block after it keep their entry speeds.
+ * Later blocks of G-code moves get their new nominal speed (within the axis
+ * feedrate limits), and the junction speeds are planned again, so the new
+ * speed is reached with the normal acceleration.
+ */
+void plan_update_feedrate_multiplier() {
+  static int planned_multiplier = 100;
+  if (feedrate_multiplier == planned_multiplier || feedrate_multiplier <= 0) return;
+
+  //Make a local copy of block_buffer_tail, because the interrupt can alter it
+  CRITICAL_SECTION_START;
+    unsigned char tail = block_buffer_tail;
+  CRITICAL_SECTION_END
+  uint8_t moves_queued = BLOCK_MOD(block_buffer_head - tail + BLOCK_BUFFER_SIZE);
+
+  #ifdef SD_BLOCK_PLAYBACK
+    // Blocks planned offline keep their trapezoids, the change waits until they ran
+    for (uint8_t i = tail; i != block_buffer_head; i = next_block_index(i))
+      if (block_buffer[i].planned_flag) return;
+  #endif
+
+  float ratio = (float)feedrate_multiplier / planned_multiplier;
+  planned_multiplier = feedrate_multiplier;
+
+  // The next move continues from the speed of the last block
+  if (moves_queued && block_buffer[prev_block_index(block_buffer_head)].override_speed) {
+    for (int i = 0; i < NUM_AXIS; i++) previous_speed[i] *= ratio;
+    previous_nominal_speed *= ratio;
+  }
+  if (moves_queued < 3) return;
+
+  block_t *first = &block_buffer[next_block_index(tail)];
+  uint8_t start = next_block_index(next_block_index(tail));
+
+  // New nominal speeds and junction limits
+  float prev_nominal = first->nominal_speed;
+  for (uint8_t i = start; i != block_buffer_head; i = next_block_index(i)) {
+    block_t *block = &block_buffer[i];
+    if (block->override_speed) {
+      float speed = min(block->override_speed * feedrate_multiplier / 100.0, block->max_nominal_speed);
+      unsigned long rate = ceil(block->step_event_count * speed / block->millimeters);
+      CRITICAL_SECTION_START;
+      if (!block->busy) {
+        block->nominal_speed = speed;
+        block->nominal_rate = rate;
+        #ifdef PLANNER_RUNTIME
+          set_segment_time(block, lround(block->millimeters * 1000000.0 / speed));
+        #endif
+      }
+      CRITICAL_SECTION_END;
+    }
+    block->max_entry_speed = min(block->max_junction_speed, min(block->nominal_speed, prev_nominal));
+    prev_nominal = block->nominal_speed;
+  }
+
+  // Reverse pass: fastest entry speeds that can still stop at the end of the buffer
+  float next_entry = MINIMUM_PLANNER_SPEED;
+  uint8_t i = block_buffer_head;
+  do {
+    i = prev_block_index(i);
+    block_t *block = &block_buffer[i];
+    block->entry_speed = min(block->max_entry_speed, max_allowable_speed(-block->acceleration, next_entry, block->millimeters));
+    next_entry = block->entry_speed;
+  } while (i != start);
+
+  // Forward pass from the fixed entry of the first block. Where a block can't
+  // slow down to the new speed, the next one enters faster and keeps decelerating.
+  block_t *previous = first;
+  for (i = start; i != block_buffer_head; i = next_block_index(i)) {
+    block_t *block = &block_buffer[i];
+    float v2 = previous->entry_speed * previous->entry_speed,
+          dv2 = 2 * previous->acceleration * previous->millimeters,
+          fastest = sqrt(v2 + dv2),
+          slowest = v2 > dv2 ? sqrt(v2 - dv2) : 0;
+    block->entry_speed = constrain(block->entry_speed, slowest, fastest);
+    if (block->nominal_speed < block->entry_speed) {
+      CRITICAL_SECTION_START;
+      if (!block->busy) {
+        block->nominal_speed = block->entry_speed;
+        block->nominal_rate = ceil(block->step_event_count * block->nominal_speed / block->millimeters);
+        #ifdef PLANNER_RUNTIME
+          set_segment_time(block, lround(block->millimeters * 1000000.0 / block->nominal_speed));
+        #endif
+      }
+      CRITICAL_SECTION_END;
+    }
+    block->nominal_length_flag = (block->nominal_speed <= max_allowable_speed(-block->acceleration, MINIMUM_PLANNER_SPEED, block->millimeters));
+    previous = block;
+  }
+
+  // New trapezoids, starting with the exit of the first block
+  previous = first;
+  for (i = start; i != block_buffer_head; i = next_block_index(i)) {
+    block_t *block = &block_buffer[i];
+    calculate_trapezoid_for_block(previous, previous->entry_speed / previous->nominal_speed, block->entry_speed / previous->nominal_speed);
+    previous->recalculate_flag = false;
+    previous = block;
+  }
+  calculate_trapezoid_for_block(previous, previous->entry_speed / previous->nominal_speed, MINIMUM_PLANNER_SPEED / previous->nominal_speed);
+  previous->recalculate_flag = false;
+  if (previous_nominal_speed > 0) previous_nominal_speed = previous->nominal_speed;
+}
+
 void plan_set_e_position(const float &e) {
+  if (MOVES_ABORTED) return;
   position[E_AXIS] = lround(e * axis_steps_per_unit[E_AXIS]);  
   st_set_e_position(position[E_AXIS]);
 }
 
+#ifdef REALTIME_COMMANDS
+
+  bool moves_aborted = false;
+
+  void plan_resume_after_abort(float pos[NUM_AXIS]) {
+    // Nothing was planned since quickStop(), no block is left to discard
+    quickStopDone();
+    moves_aborted = false;
+
+    #ifdef DUAL_X_CARRIAGE
+      // Take the carriage positions where the steppers stopped
+      st_get_dxc_position(dxc_planned, dxc_steppers_of(active_extruder));
+    #endif
+    for (int i = 0; i < NUM_AXIS; i++) pos[i] = st_get_position(i) / axis_steps_per_unit[i];
+    for (int i = X_AXIS; i <= Z_AXIS; i++) pos[i] += carriage_offset(i, active_extruder);
+    #ifdef MESH_BED_LEVELING
+      if (mbl.active) pos[Z_AXIS] -= mbl.get_z(pos[X_AXIS], pos[Y_AXIS]);
+    #elif defined(ENABLE_AUTO_BED_LEVELING)
+      apply_rotation_xyz(matrix_3x3::transpose(plan_bed_level_matrix), pos[X_AXIS], pos[Y_AXIS], pos[Z_AXIS]);
+    #endif
+
+    plan_set_position(pos[X_AXIS], pos[Y_AXIS], pos[Z_AXIS], pos[E_AXIS]);
+  }
+
+#endif // REALTIME_COMMANDS
+
 // Calculate the steps/s^2 acceleration rates, based on the mm/s^s
 void reset_acceleration_rates() {
   for (int i = 0; i < NUM_AXIS; i++)
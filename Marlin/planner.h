@@ -28,6 +28,41 @@
 
 // This struct is used when buffering the setup for each linear movement "nominal" values are as specified in 
 // the source g-code and may never actually be reached if acceleration management is active.
+#ifdef DUAL_X_CARRIAGE
+  // Bits of block_t::dxc_steppers
+  #define DXC_CARRIAGE_1 0  // X and E0
+  #define DXC_CARRIAGE_2 1  // X2 and E1
+  #define DXC_MIRROR_X2  2  // X2 moves in the opposite direction of X
+
+  /**
+   * The X step counts of the carriages. The planner and the stepper interrupt
+   * each count the X steps of the carriages of their last block (of the first
+   * carriage when both move), and keep those of the other carriages here.
+   * dxc_select() swaps them when a block moves other carriages, so a tool
+   * change needs no plan_set_position() and no wait for the queue.
+   */
+  typedef struct {
+    unsigned char steppers; // DXC_* bits of the carriages the X count is of
+    long x[2];              // X count of each carriage, while it isn't the X count
+    long dup_start;         // X count when the carriages started to move together
+  } dxc_position_t;
+
+  // Make x the X count of the given carriages, true if they are others than before
+  FORCE_INLINE bool dxc_select(dxc_position_t &dp, volatile long &x, const unsigned char steppers) {
+    if (steppers == dp.steppers) return false;
+    dp.x[TEST(dp.steppers, DXC_CARRIAGE_1) ? 0 : 1] = x;
+    if (TEST(dp.steppers, DXC_CARRIAGE_1) && TEST(dp.steppers, DXC_CARRIAGE_2)) {
+      // The second carriage followed the first
+      long moved = x - dp.dup_start;
+      dp.x[1] += TEST(dp.steppers, DXC_MIRROR_X2) ? -moved : moved;
+    }
+    x = dp.x[TEST(steppers, DXC_CARRIAGE_1) ? 0 : 1];
+    dp.dup_start = x;
+    dp.steppers = steppers;
+    return true;
+  }
+#endif
+
 typedef struct {
   // Fields used by the bresenham algorithm for tracing the line
   long steps[NUM_AXIS];                     // Step count along each axis
@@ -37,11 +72,14 @@ typedef struct {
   long acceleration_rate;                   // The acceleration rate used for acceleration calculation
   unsigned char direction_bits;             // The direction bit set for this block (refers to *_DIRECTION_BIT in config.h)
   unsigned char active_extruder;            // Selects the active extruder
+  #ifdef DUAL_X_CARRIAGE
+    unsigned char dxc_steppers;             // DXC_* bits of the carriages and extruders this block moves
+  #endif
   #ifdef ADVANCE
-    long advance_rate;
-    volatile long initial_advance;
-    volatile long final_advance;
-    float advance;
+    unsigned long advance_k;                // E steps of advance per step/s of the step rate (16.16 fixed point)
+  #endif
+  #ifdef PLANNER_RUNTIME
+    unsigned long segment_time_us;          // Time of the block at nominal speed, counted in block_buffer_runtime_us
   #endif
 
   // Fields used by the motion planner to manage acceleration
@@ -53,6 +91,14 @@ typedef struct {
   float acceleration;                                // acceleration mm/sec^2
   unsigned char recalculate_flag;                    // Planner flag to recalculate trapezoids on entry junction
   unsigned char nominal_length_flag;                 // Planner flag for nominal speed always reached
+  #ifdef SD_BLOCK_PLAYBACK
+    unsigned char planned_flag;                      // Planned offline, the look-ahead and feedrate_multiplier leave it alone
+  #endif
+
+  // Fields used to apply feedrate_multiplier changes to queued blocks
+  float override_speed;                              // Nominal speed at 100% in mm/sec, 0 if the block doesn't follow feedrate_multiplier
+  float max_nominal_speed;                           // Highest nominal speed the axis feedrate limits allow
+  float max_junction_speed;                          // Entry speed at which the jerk limits are reached
 
   // Settings for the trapezoid generator
   unsigned long nominal_rate;                        // The nominal step rate for this block in step_events/sec 
@@ -91,11 +137,17 @@ FORCE_INLINE uint8_t movesplanned() { return BLOCK_MOD(block_buffer_head - block
      * Get the position applying the bed level matrix
      */
     vector_3 plan_get_position();
+
+    /**
+     * Get the position of the active tool on one axis from the stepper counts
+     */
+    float plan_get_axis_position_mm(AxisEnum axis);
   #endif  // ENABLE_AUTO_BED_LEVELING
 
   /**
    * Add a new linear movement to the buffer. x, y, z are the signed, absolute target position in
    * millimeters. Feed rate specifies the (target) speed of the motion.
+   * The tool offsets of the extruder are applied here, so a tool change doesn't reset the planner.
    */
   void plan_buffer_line(float x, float y, float z, const float &e, float feed_rate, const uint8_t &extruder);
 
@@ -115,6 +167,98 @@ FORCE_INLINE uint8_t movesplanned() { return BLOCK_MOD(block_buffer_head - block
 
 void plan_set_e_position(const float &e);
 
+#ifdef REALTIME_COMMANDS
+  // Set by a real-time M410: the planner drops the moves of the running command
+  extern bool moves_aborted;
+  #define MOVES_ABORTED moves_aborted
+
+  /**
+   * Plan from where the steppers stopped after a real-time M410, and clear
+   * moves_aborted. pos[] gets the tool position in mm without the bed leveling,
+   * or the tower positions on DELTA and SCARA.
+   */
+  void plan_resume_after_abort(float pos[NUM_AXIS]);
+#else
+  #define MOVES_ABORTED false
+#endif
+
+// Apply a change of feedrate_multiplier to the blocks already in the buffer
+void plan_update_feedrate_multiplier();
+
+#ifdef FILAMENT_SENSOR
+  // Fill the filament width buffer with the current measurement
+  void plan_filwidth_fill();
+#endif
+
+#ifdef SD_BLOCK_PLAYBACK
+  /**
+   * A file of blocks planned by scripts/block_plan.py is a header followed by
+   * records of a type byte and their data, little endian. The header and every
+   * record are followed by the planned_checksum() of their bytes.
+   */
+  #define PLANNED_MAGIC "MBLK"
+  #define PLANNED_VERSION 2
+  #define PLANNED_COREXY 1        // Bit of planned_header_t::flags
+  #define PLANNED_BLOCK 'B'       // planned_block_t
+  #define PLANNED_COMMAND 'C'     // Length byte and the text of a command
+  #define PLANNED_POSITION 'P'    // float[NUM_AXIS], current_position after the moves so far
+
+  typedef struct {
+    char magic[4];
+    uint8_t version;
+    uint8_t flags;
+    uint16_t block_size;                // sizeof(planned_block_t)
+    float steps_per_unit[NUM_AXIS];     // axis_steps_per_unit the blocks were planned with
+    // The highest limits the blocks were planned with, the printer's must be as high
+    float max_feedrate[NUM_AXIS];
+    float max_acceleration[NUM_AXIS];   // max_acceleration_units_per_sq_second
+    float acceleration;
+    float retract_acceleration;
+    float travel_acceleration;
+    float max_xy_jerk;
+    float max_z_jerk;
+    float max_e_jerk;
+  } planned_header_t;
+
+  typedef struct {
+    long steps[NUM_AXIS];
+    unsigned long step_event_count;
+    long accelerate_until;
+    long decelerate_after;
+    unsigned long initial_rate;
+    unsigned long nominal_rate;
+    unsigned long final_rate;
+    unsigned long acceleration_st;
+    unsigned char direction_bits;
+    unsigned char active_extruder;
+    unsigned char fan_speed;
+    unsigned char reserved;
+  } planned_block_t;
+
+  // Fletcher-16 of size bytes, continuing from sum (0 to start)
+  uint16_t planned_checksum(uint16_t sum, const void *data, size_t size);
+
+  /**
+   * Add a block planned offline, with its trapezoid as it is. The planner
+   * position isn't updated, a PLANNED_POSITION record sets it after the blocks.
+   * Returns false, without adding it, if the block is inconsistent or exceeds
+   * MAX_STEP_FREQUENCY or the acceleration limits of the printer.
+   * The caller waits for a free block.
+   */
+  bool plan_buffer_planned(const planned_block_t &pb);
+#endif
+
+#ifdef FWRETRACT
+  /**
+   * Pull back (length > 0) or push forward (length < 0) the filament of the
+   * extruder by length mm in a block of its own, with retract_acceleration and
+   * retract_jerk. The planner E position is unchanged, so the E coordinate of the
+   * next moves stays the same. A retraction raises Z by zlift with the next move,
+   * blended into the travel; the recovery lowers it again together with the filament.
+   */
+  void plan_retract(const float &length, const float &feed_rate, const float &zlift, const uint8_t &extruder);
+#endif
+
 //===========================================================================
 //============================= public variables ============================
 //===========================================================================
@@ -132,6 +276,19 @@ extern float max_z_jerk;
 extern float max_e_jerk;
 extern float mintravelfeedrate;
 extern unsigned long axis_steps_per_sqr_second[NUM_AXIS];
+extern int plan_feedrate_multiplier; // feedrate_multiplier included in the feed rate of the moves being buffered, 0 if they don't follow it
+
+#ifdef FILAMENT_SENSOR
+  extern uint16_t filwidth_factor; // Volumetric factor of the width sensor applied to the last block, in 1/FILWIDTH_ONE
+#endif
+
+#ifdef FWRETRACT
+  extern float retract_jerk;  // E jerk of retract and recover blocks (mm/s). M207 J
+#endif
+
+#ifdef ADVANCE
+  extern float extruder_advance_k;  // Pressure advance K in seconds. M900 K
+#endif
 
 #ifdef AUTOTEMP
   extern bool autotemp_enabled;
@@ -144,14 +301,43 @@ extern block_t block_buffer[BLOCK_BUFFER_SIZE];            // A ring buffer for
 extern volatile unsigned char block_buffer_head;           // Index of the next block to be pushed
 extern volatile unsigned char block_buffer_tail; 
 
+#ifdef PLANNER_RUNTIME
+  extern volatile unsigned long block_buffer_runtime_us;   // Time of the queued blocks at their nominal speeds
+#endif
+
+#ifdef BUFFER_MONITORING
+  #define PLAN_SOURCE_SERIAL 0
+  #define PLAN_SOURCE_SD 1
+  extern uint8_t plan_source;                              // Where the moves being buffered come from, PLAN_SOURCE_*
+  extern volatile bool plan_ran_dry;                       // The stepper emptied the queue and nothing waited for it
+  extern volatile millis_t plan_dry_ms;                    // When the queue ran empty
+  extern unsigned long plan_underruns[2];                  // Underruns by the source of the move that ended them
+  extern unsigned long plan_starved_ms[2];                 // Time the stepper waited in them
+  extern unsigned long plan_lowest_runtime_us;             // Lowest time in the queue when a block was added to a moving queue
+  #ifdef SLOWDOWN
+    extern unsigned long plan_slowed_blocks;               // Blocks SLOWDOWN made longer
+  #endif
+  void plan_reset_monitoring();
+#endif
+
 // Returns true if the buffer has a queued block, false otherwise
 FORCE_INLINE bool blocks_queued() { return (block_buffer_head != block_buffer_tail); }
 
 // Called when the current block is no longer needed. Discards
 // the block and makes the memory available for new blocks.
 FORCE_INLINE void plan_discard_current_block() {
-  if (blocks_queued())
+  if (blocks_queued()) {
+    #ifdef PLANNER_RUNTIME
+      block_buffer_runtime_us -= block_buffer[block_buffer_tail].segment_time_us;
+    #endif
     block_buffer_tail = BLOCK_MOD(block_buffer_tail + 1);
+    #ifdef BUFFER_MONITORING
+      if (!blocks_queued()) {
+        plan_dry_ms = millis();
+        plan_ran_dry = true;
+      }
+    #endif
+  }
 }
 
 // Gets the current block. Returns NULL if buffer empty
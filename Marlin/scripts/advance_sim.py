@@ -0,0 +1,116 @@
+#!/usr/bin/python3
+"""Pressure advance simulator
+
+Runs one printing move through the same step rate and advance arithmetic as
+stepper.cpp (ADVANCE) and prints the E step stream of the extruder timer
+against the nozzle pressure target, as CSV:
+
+  time_ms, step_rate, commanded_e, target_e, issued_e
+
+commanded_e is the E position of the move in steps, target_e adds the
+advance (K times the E velocity) and issued_e is what the extruder timer
+has stepped. A summary with the largest lag behind the target goes to stderr.
+
+Usage: python3 advance_sim.py [options] > stream.csv
+
+Options:
+  --k=...          advance factor K in seconds (default: 0.05)
+  --length=...     move length in mm (default: 20)
+  --extrude=...    filament per mm of move (default: 0.033)
+  --speed=...      nominal speed in mm/s (default: 60)
+  --entry=...      entry and exit speed in mm/s (default: 5)
+  --accel=...      acceleration in mm/s^2 (default: 1000)
+  --xy-steps=...   steps per mm of the move (default: 80)
+  --e-steps=...    steps per mm of filament (default: 836)
+  --freq=...       ADVANCE_STEP_FREQUENCY in Hz (default: 100000)
+"""
+
+import getopt
+import sys
+from math import sqrt
+
+
+def simulate(k, length, extrude, speed, entry, accel, xy_steps, e_steps, freq):
+    # Block as plan_buffer_line() and calculate_trapezoid_for_block() build it
+    step_event_count = int(round(length * xy_steps))
+    steps_e = int(round(length * extrude * e_steps))
+    steps_per_mm = step_event_count / length
+    nominal_rate = speed * steps_per_mm
+    initial_rate = final_rate = max(entry * steps_per_mm, 120)
+    accel_st = accel * steps_per_mm
+    advance_k = int(k * steps_e / step_event_count * 65536)
+
+    # Stepper interrupt: one step event per tick, E steps and advance go to e_pending
+    t = 0.0
+    counter_e = -(step_event_count >> 1)
+    commanded = 0
+    old_advance = 0
+    e_pending = 0
+    events = []  # (time, rate, commanded, target, e_pending delta)
+    for n in range(step_event_count):
+        # Trapezoid: accelerate from the entry rate, cruise, decelerate to the exit rate
+        rate = sqrt(min(initial_rate ** 2 + 2 * accel_st * n,
+                        nominal_rate ** 2,
+                        final_rate ** 2 + 2 * accel_st * (step_event_count - n)))
+        delta = 0
+        counter_e += steps_e
+        if counter_e > 0:
+            counter_e -= step_event_count
+            commanded += 1
+            delta += 1
+        advance = (int(rate) * advance_k) >> 16
+        delta += advance - old_advance
+        old_advance = advance
+        target = commanded + k * rate * steps_e / step_event_count
+        events.append((t, rate, commanded, target, delta))
+        t += 1.0 / rate
+
+    # Extruder timer: a step takes two ticks, like the HAL_ADVANCE_TIMER_ISR
+    rows = []
+    issued = 0
+    tick = 1.0 / freq
+    clock = 0.0
+    pulse = False
+    max_lag = 0.0
+    for i, (time, rate, cmd, target, delta) in enumerate(events):
+        e_pending += delta
+        # Run the timer up to the next step event, then compare with the target
+        until = events[i + 1][0] if i + 1 < len(events) else time + 1.0 / rate
+        while clock < until:
+            if pulse:
+                pulse = False
+            elif e_pending:
+                step = 1 if e_pending > 0 else -1
+                issued += step
+                e_pending -= step
+                pulse = True
+            clock += tick
+        max_lag = max(max_lag, target - issued)
+        rows.append((time, rate, cmd, target, issued))
+    return rows, max_lag, advance_k
+
+
+def main(argv):
+    options = dict(k=0.05, length=20.0, extrude=0.033, speed=60.0, entry=5.0,
+                   accel=1000.0, xy_steps=80.0, e_steps=836.0, freq=100000.0)
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help"] + [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        options[opt[2:].replace('-', '_')] = float(arg)
+
+    rows, max_lag, advance_k = simulate(**options)
+    print("time_ms,step_rate,commanded_e,target_e,issued_e")
+    for time, rate, cmd, target, issued in rows:
+        print("%.3f,%.0f,%d,%.2f,%d" % (time * 1000, rate, cmd, target, issued))
+    sys.stderr.write("advance_k %d (16.16), largest lag behind target %.2f steps\n" % (advance_k, max_lag))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
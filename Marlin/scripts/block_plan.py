@@ -0,0 +1,324 @@
+#!/usr/bin/python3
+"""Offline block planner
+
+Plans the moves of a G-code file with the firmware itself, built for the
+host (see host_build.py), and writes the blocks as the stepper interrupt of
+the simulated printer took them to a file for SD_BLOCK_PLAYBACK. M23 and
+M24 print it like a G-code file, without parsing or planning the moves on
+the printer. Arcs, firmware retraction and everything else that queues
+moves are planned by the same code as on the printer.
+
+The other commands of the G-code are kept between the blocks and run by the
+printer when it gets to them:
+- temperature, fan, message and planner setting commands run while the
+  blocks before them are still moving, as in the G-code
+- all other commands first wait for the blocks before them to finish, after
+  a record that sets the position of the printer to the end of the moves.
+  The moves of these commands (G28, tool changes, ...) are made by the
+  printer, not planned
+
+The configuration in --config must be the one of the printer: the file is
+refused when its steps per unit or kinematics differ, or when its feed rate,
+acceleration or jerk limits, including those the G-code sets with
+M201-M205, are higher than the printer's when the print starts. The printer
+checks every block against MAX_STEP_FREQUENCY and its acceleration limits
+too, and every record against its checksum. Home offsets (M206),
+feedrate_multiplier (M220) and flow (M221) set on the printer don't apply to
+the planned blocks. M220 and M221 in the G-code are applied when planning.
+Bed leveling (G29) can't be planned: the blocks would follow the simulated
+bed, not the printer's. The firmware is built with BLOCK_BUFFER_SIZE set to
+--lookahead, without SLOWDOWN (the printer reads the file faster than the
+blocks run) and without PREVENT_DANGEROUS_EXTRUDE (the simulated hotend
+doesn't heat like the printer's, the G-code has to wait for it with M109).
+
+A summary goes to stderr.
+
+Usage: python3 block_plan.py [options] file.gcode file.mpb
+
+Options:
+  --config=...     directory with the configuration (default: the Marlin directory)
+  --define=...     configuration change for the build, as in host_build.py (may be repeated)
+  --lookahead=...  blocks planned ahead, a power of 2; the printer has BLOCK_BUFFER_SIZE (default: 64)
+"""
+
+import getopt
+import os
+import re
+import struct
+import sys
+
+from host_build import BuildError, DONE, Firmware, KILLED, build
+from motion_sim import config_value, read_config
+
+PLANNED_MAGIC = b"MBLK"
+PLANNED_VERSION = 2
+PLANNED_COREXY = 1
+
+# planned_header_t and planned_block_t of planner.h
+HEADER = struct.Struct("<4sBBH4f4f4f3f3f")
+BLOCK = struct.Struct("<4lL2l4L4B")
+POSITION = struct.Struct("<4f")
+CHECKSUM = struct.Struct("<H")
+
+# Commands that run while the blocks before them move
+PASS = ("M104", "M109", "M140", "M190", "M106", "M107", "M117", "M105", "M73", "M300",
+        "M92", "M201", "M203", "M204", "M205")
+# Commands that only change the planning, they aren't written
+PLANNING = ("G90", "G91", "M82", "M83", "G92", "M220", "M221")
+# Commands whose moves are planned
+MOVES = ("G0", "G1", "G2", "G3", "G10", "G11")
+# Commands the planned file can't follow
+REJECTED = {"G29": "bed leveling is measured on the printer"}
+
+# The host link of the simulation: fast enough to keep the block buffer full
+LINK_BAUD, LINK_WINDOW = 1000000, 2
+HEAT_RATE = 20.0
+
+
+class PlanError(Exception):
+    pass
+
+
+def planned_checksum(data, checksum=0):
+    # Fletcher-16, as planned_checksum() of planner.cpp
+    sum1, sum2 = checksum & 0xFF, checksum >> 8
+    for byte in bytearray(data):
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+    return sum2 << 8 | sum1
+
+
+class Writer(object):
+
+    def __init__(self, defines, fw, out):
+        self.fw = fw
+        self.out = out
+        self.steps_per_unit = [float(v) for v in config_value(defines, "DEFAULT_AXIS_STEPS_PER_UNIT", [80, 80, 4000, 500])]
+        self.corexy = "COREXY" in defines
+        self.settings = dict(
+            max_feedrate=[float(v) for v in config_value(defines, "DEFAULT_MAX_FEEDRATE", [300, 300, 5, 25])],
+            max_acceleration=[float(v) for v in config_value(defines, "DEFAULT_MAX_ACCELERATION", [3000, 3000, 100, 10000])],
+            acceleration=[config_value(defines, "DEFAULT_ACCELERATION", 3000)],
+            retract_acceleration=[config_value(defines, "DEFAULT_RETRACT_ACCELERATION", 3000)],
+            travel_acceleration=[config_value(defines, "DEFAULT_TRAVEL_ACCELERATION", 3000)],
+            max_xy_jerk=[config_value(defines, "DEFAULT_XYJERK", 20.0)],
+            max_z_jerk=[config_value(defines, "DEFAULT_ZJERK", 0.4)],
+            max_e_jerk=[config_value(defines, "DEFAULT_EJERK", 5.0)])
+        self.limits = {}
+        self.update_limits()
+        self.sent = []     # (kind, text) of the lines sent to the firmware
+        self.flushed = 0   # lines of sent written so far
+        self.written = 0   # blocks of the firmware written or dropped so far
+        self.known = [False, False, False, True]  # E starts wherever the printer is
+        self.moved = False
+        self.counts = dict(blocks=0, commands=0, syncs=0, dropped=0)
+        # The header is written again with the limits of the whole file by finish()
+        self.write_header()
+
+    def update_limits(self):
+        # The highest limits planned with so far
+        for name, values in self.settings.items():
+            self.limits[name] = [max(v, old) for v, old in zip(values, self.limits.get(name, values))]
+
+    def write_header(self):
+        flags = PLANNED_COREXY if self.corexy else 0
+        limits = self.limits
+        header = HEADER.pack(PLANNED_MAGIC, PLANNED_VERSION, flags, BLOCK.size,
+                             *(self.steps_per_unit + limits["max_feedrate"] + limits["max_acceleration"] +
+                               limits["acceleration"] + limits["retract_acceleration"] + limits["travel_acceleration"] +
+                               limits["max_xy_jerk"] + limits["max_z_jerk"] + limits["max_e_jerk"]))
+        self.out.write(header + CHECKSUM.pack(planned_checksum(header)))
+
+    def write_record(self, record):
+        # A record is its type, its data and the checksum of both
+        self.out.write(record + CHECKSUM.pack(planned_checksum(record)))
+
+    def write_command(self, text):
+        text = text.encode("ascii")
+        self.write_record(b"C" + struct.pack("<B", len(text)) + text)
+        self.counts["commands"] += 1
+
+    def write_block(self, block):
+        steps = list(block.steps)
+        if any(steps[i] and not self.known[i] for i in range(4)):
+            raise PlanError("a move before G28 or G92 set the position")
+        self.write_record(b"B" + BLOCK.pack(*(steps + [block.step_event_count, block.accelerate_until,
+                                                    block.decelerate_after, block.initial_rate,
+                                                    block.nominal_rate, block.final_rate,
+                                                    block.acceleration_st, block.direction_bits,
+                                                    block.active_extruder, block.fan_speed, 0])))
+        self.counts["blocks"] += 1
+
+    def run(self):
+        # Let the firmware take the lines sent so far and finish their moves
+        status = self.fw.run(36000)
+        if status != DONE:
+            output = self.fw.output().strip().splitlines()
+            raise PlanError("the firmware %s: %s" % ("was killed" if status == KILLED else "timed out",
+                                                     output[-1] if output else ""))
+        if self.fw.stats().rx_overflows:
+            raise PlanError("the simulated serial link dropped characters")
+
+    def flush(self):
+        # Write the blocks the firmware ran and the commands between them, in G-code order
+        self.run()
+        blocks = {}
+        for block in self.fw.blocks()[self.written:]:
+            blocks.setdefault(block.line, []).append(block)
+            self.written += 1
+        for line in range(self.flushed, len(self.sent)):
+            kind, text = self.sent[line]
+            if kind == "C":
+                self.write_command(text)
+            elif kind == "M" and line not in blocks:
+                self.counts["dropped"] += 1
+            for block in blocks.get(line, []):
+                self.write_block(block)
+                self.moved = True
+        self.flushed = len(self.sent)
+
+    def sync(self):
+        # Plan to a stop and let the printer take the position of the G-code
+        self.flush()
+        # Before the first G28 the printer keeps its own position
+        if all(self.known) and self.moved:
+            self.write_record(b"P" + POSITION.pack(*self.fw.positions()[0]))
+        self.moved = False
+        self.counts["syncs"] += 1
+
+    def finish(self):
+        self.sync()
+        self.out.seek(0)
+        self.write_header()
+
+    def send(self, kind, text):
+        self.fw.send(text)
+        self.sent.append((kind, text))
+
+    def command(self, code, words, text):
+        if code in REJECTED:
+            raise PlanError("%s: %s, it can't be planned offline" % (text, REJECTED[code]))
+        if code in MOVES:
+            self.send("M", text)
+        elif code in PLANNING:
+            self.send("", text)
+            if code == "G92":
+                for i, axis in enumerate("XYZE"):
+                    if axis in words:
+                        self.known[i] = True
+        elif code in PASS:
+            self.send("C", text)
+            self.change_settings(code, words)
+        else:
+            # The printer makes the moves of the command, those of the firmware here are dropped
+            self.sync()
+            self.write_command(text)
+            self.send("", text)
+            self.run()
+            self.flushed = len(self.sent)
+            self.written = len(self.fw.blocks())
+            if code == "G28":
+                for i, axis in enumerate("XYZ"):
+                    if axis in words or not any(a in words for a in "XYZ"):
+                        self.known[i] = True
+
+    def change_settings(self, code, words):
+        # The commands of PASS that change the limits
+        settings = self.settings
+        if code == "M201":
+            for i, axis in enumerate("XYZE"):
+                if axis in words:
+                    settings["max_acceleration"][i] = words[axis]
+        elif code == "M203":
+            for i, axis in enumerate("XYZE"):
+                if axis in words:
+                    settings["max_feedrate"][i] = words[axis]
+        elif code == "M204":
+            for letter, names in (("S", ("acceleration", "travel_acceleration")), ("P", ("acceleration",)),
+                                  ("R", ("retract_acceleration",)), ("T", ("travel_acceleration",))):
+                if letter in words:
+                    for name in names:
+                        settings[name] = [words[letter]]
+        elif code == "M205":
+            for letter, name in (("X", "max_xy_jerk"), ("Z", "max_z_jerk"), ("E", "max_e_jerk")):
+                if letter in words:
+                    settings[name] = [words[letter]]
+        self.update_limits()
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."), lookahead=64)
+    defines = []
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "define="] + [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        elif opt == "--define":
+            defines.append(arg)
+        else:
+            key = opt[2:].replace('-', '_')
+            options[key] = arg if key == "config" else int(arg)
+    lookahead = options["lookahead"]
+    if len(args) != 2 or lookahead < 4 or lookahead & (lookahead - 1):
+        print(__doc__)
+        sys.exit(2)
+
+    config = read_config(options["config"])
+    max_cmd_size = config_value(config, "MAX_CMD_SIZE", 96)
+    try:
+        lib = build(options["config"], defines + ["BLOCK_BUFFER_SIZE=%d" % lookahead, "-SLOWDOWN", "-PREVENT_DANGEROUS_EXTRUDE"])
+    except BuildError as err:
+        sys.stderr.write(str(err))
+        sys.exit(1)
+    fw = Firmware(lib)
+    fw.lib.sim_set_link(LINK_BAUD, LINK_WINDOW)
+    for e in range(config_value(config, "EXTRUDERS", 1)):
+        fw.lib.sim_set_heater(e, HEAT_RATE, 400.0, 25.0)
+    fw.lib.sim_set_heater(-1, HEAT_RATE, 150.0, 25.0)
+
+    lines = 0
+    with open(args[0]) as f, open(args[1], "wb") as out:
+        try:
+            if not fw.setup():
+                raise PlanError("the firmware was killed in setup()")
+            writer = Writer(config, fw, out)
+            for lines, line in enumerate(f, 1):
+                text = re.sub(r"\(.*?\)|;.*|\*.*", "", line).strip()
+                text = re.sub(r"^N\d+\s*", "", text)
+                if not text:
+                    continue
+                code = None
+                words = {}
+                for letter, value in re.findall(r"([A-Za-z])\s*([-+]?[0-9.]*)", text):
+                    letter = letter.upper()
+                    if code is None:
+                        code = letter + str(int(float(value or 0)))
+                    elif value:
+                        words[letter] = float(value)
+                if code is None:
+                    continue
+                if len(text) >= max_cmd_size:
+                    raise PlanError("the command is longer than MAX_CMD_SIZE")
+                writer.command(code, words, text)
+            writer.finish()
+        except PlanError as err:
+            sys.stderr.write("%s line %d: %s\n" % (args[0], lines, err))
+            sys.exit(1)
+        finally:
+            fw.close()
+
+    counts = writer.counts
+    sys.stderr.write("%d lines: %d blocks, %d commands, %d stops for commands, %d moves too short for a block\n" %
+                     (lines, counts["blocks"], counts["commands"], counts["syncs"], counts["dropped"]))
+    sys.stderr.write("%d bytes of G-code, %d bytes planned, %.1f s of printing simulated\n" %
+                     (os.path.getsize(args[0]), os.path.getsize(args[1]), fw.time()))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,228 @@
+#!/usr/bin/python3
+"""Segment coalescing check
+
+Runs the moves of a G-code file through the same merging as COALESCE_SEGMENTS
+(coalesce_line() in Marlin_main.cpp) and compares the merged path with the
+path of the G-code. Prints one CSV row per planner block:
+
+  block, moves, length_mm, deviation_mm, e_error_mm
+
+deviation_mm is the largest distance of a dropped corner from the block,
+e_error_mm the largest difference between the E of the G-code at a dropped
+corner and the E the block has at the same point of its move.
+
+A summary goes to stderr: the moves and the blocks they became, the largest
+deviation and E error, the E of both paths and the moves shorter than
+dropsegments steps, which plan_buffer_line() would skip, before and after
+merging.
+
+The settings are read from Configuration.h and Configuration_adv.h in
+--config, the options below override them. Feedrate multipliers are taken
+as 100%. Arcs and all other commands end the pending move, as they do in
+the firmware. The firmware also ends it when the planner runs low, which
+can only leave it with more blocks than listed here.
+
+Usage: python3 coalesce_check.py [options] file.gcode > blocks.csv
+
+Options:
+  --config=...     directory with the configuration (default: the Marlin directory)
+  --angle=...      COALESCE_ANGLE in degrees
+  --chord=...      COALESCE_CHORD in mm
+  --e-ratio=...    COALESCE_E_RATIO
+  --max-moves=...  COALESCE_MAX_SEGMENTS
+"""
+
+import getopt
+import os
+import re
+import sys
+from math import cos, radians, sqrt
+
+X, Y, Z, E = range(4)
+
+
+def read_config(path):
+    # The #defines of the configuration, unevaluated
+    defines = {}
+    for name in ("Configuration.h", "Configuration_adv.h"):
+        with open(os.path.join(path, name)) as f:
+            for line in f:
+                m = re.match(r"\s*#define\s+(\w+)(?:[ \t]+([^/\n]*))?", line)
+                if m:
+                    defines[m.group(1)] = (m.group(2) or "").strip()
+                m = re.match(r"\s*const\s+unsigned\s+int\s+dropsegments\s*=\s*(\d+)", line)
+                if m:
+                    defines["dropsegments"] = m.group(1)
+    return defines
+
+
+def read_moves(f):
+    # Lists of consecutive XY moves as (start, end, feed rate), split where
+    # the firmware would send the pending move to the planner
+    runs, run = [], []
+    position = [0.0] * 4
+    feedrate = 1500.0
+    relative = relative_e = False
+    for line in f:
+        line = re.sub(r"\(.*?\)|;.*", "", line).strip()
+        words = [(l.upper(), float(v)) for l, v in re.findall(r"([A-Za-z])\s*([-+]?[0-9.]+)", line)]
+        if not words:
+            continue
+        code = words[0][0] + str(int(words[0][1]))
+        args = dict(words[1:])
+        if code in ("G0", "G1"):
+            if "F" in args:
+                feedrate = args["F"]
+            end = list(position)
+            for i, axis in enumerate("XYZE"):
+                if axis in args:
+                    rel = relative_e if i == E else relative
+                    end[i] = position[i] + args[axis] if rel else args[axis]
+            if end == position:
+                continue
+            if end[X] == position[X] and end[Y] == position[Y]:
+                # E and Z only moves are planned as they are
+                if run:
+                    runs.append(run)
+                    run = []
+                runs.append([(position, end, feedrate)])
+            else:
+                run.append((position, end, feedrate))
+            position = end
+            continue
+        if run:
+            runs.append(run)
+            run = []
+        if code == "G90":
+            relative = relative_e = False
+        elif code == "G91":
+            relative = relative_e = True
+        elif code == "M82":
+            relative_e = False
+        elif code == "M83":
+            relative_e = True
+        elif code == "G92":
+            for i, axis in enumerate("XYZE"):
+                if axis in args:
+                    position[i] = args[axis]
+        elif code == "G28":
+            for i, axis in enumerate("XYZ"):
+                if axis in args or not any(a in args for a in "XYZ"):
+                    position[i] = 0.0
+    if run:
+        runs.append(run)
+    return runs
+
+
+def length3(v):
+    return sqrt(sum(c * c for c in v[:3]))
+
+
+def fits(block, start, end, feedrate, min_cos, chord_tol, e_ratio, max_moves):
+    # coalesce_fits()
+    if len(block["corners"]) + 1 >= max_moves or feedrate != block["feedrate"]:
+        return False
+    corner = block["corners"][-1] if block["corners"] else block["start"]
+    last = [block["end"][i] - corner[i] for i in range(3)]
+    nxt = [end[i] - start[i] for i in range(3)]
+    length = length3(nxt)
+    if sum(last[i] * nxt[i] for i in range(3)) < min_cos * length3(last) * length:
+        return False
+    e_pending = (block["end"][E] - block["start"][E]) / block["length"]
+    e_next = (end[E] - start[E]) / length
+    if abs(e_next - e_pending) > e_ratio * max(abs(e_pending), abs(e_next)):
+        return False
+    for p in block["corners"] + [block["end"]]:
+        if distance(block["start"], end, p)[0] > chord_tol:
+            return False
+    return True
+
+
+def distance(a, b, p):
+    # Distance of p from the line a-b and the fraction of a-b where it is closest
+    chord = [b[i] - a[i] for i in range(3)]
+    chord_length = length3(chord)
+    d = [p[i] - a[i] for i in range(3)]
+    along = sum(d[i] * chord[i] for i in range(3)) / chord_length
+    return sqrt(max(0.0, sum(c * c for c in d) - along * along)), along / chord_length
+
+
+def coalesce(runs, min_cos, chord_tol, e_ratio, max_moves):
+    # Planner blocks of the merged path, with the corners they dropped
+    blocks = []
+    for run in runs:
+        block = None
+        for start, end, feedrate in run:
+            length = length3([end[i] - start[i] for i in range(3)])
+            if block and length > 0 and fits(block, start, end, feedrate, min_cos, chord_tol, e_ratio, max_moves):
+                block["corners"].append(block["end"])
+                block["length"] += length
+            else:
+                block = dict(start=start, corners=[], length=length, feedrate=feedrate)
+                blocks.append(block)
+            block["end"] = end
+    return blocks
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."),
+                   angle=None, chord=None, e_ratio=None, max_moves=None)
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help"] + [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:].replace('-', '_')
+        options[key] = arg if key == "config" else float(arg)
+    if len(args) != 1:
+        print(__doc__)
+        sys.exit(2)
+
+    defines = read_config(options["config"])
+    setting = lambda key, name, default: options[key] if options[key] is not None else float(defines.get(name, default))
+    angle = setting("angle", "COALESCE_ANGLE", 2.0)
+    chord_tol = setting("chord", "COALESCE_CHORD", 0.01)
+    e_ratio = setting("e_ratio", "COALESCE_E_RATIO", 0.05)
+    max_moves = int(setting("max_moves", "COALESCE_MAX_SEGMENTS", 8))
+    steps = [float(v) for v in defines["DEFAULT_AXIS_STEPS_PER_UNIT"].strip("{} ").split(",")]
+    dropsegments = int(defines.get("dropsegments", 5))
+
+    with open(args[0]) as f:
+        runs = read_moves(f)
+    blocks = coalesce(runs, cos(radians(angle)), chord_tol, e_ratio, max_moves)
+
+    print("block,moves,length_mm,deviation_mm,e_error_mm")
+    max_deviation = max_e_error = 0.0
+    for k, block in enumerate(blocks):
+        deviation = e_error = 0.0
+        for p in block["corners"]:
+            d, t = distance(block["start"], block["end"], p)
+            deviation = max(deviation, d)
+            e_error = max(e_error, abs(block["start"][E] + t * (block["end"][E] - block["start"][E]) - p[E]))
+        max_deviation, max_e_error = max(max_deviation, deviation), max(max_e_error, e_error)
+        length = length3([block["end"][i] - block["start"][i] for i in range(3)])
+        print("%d,%d,%.4f,%.5f,%.5f" % (k, len(block["corners"]) + 1, length, deviation, e_error))
+
+    # Moves below dropsegments steps, on the largest axis as in plan_buffer_line()
+    short = lambda a, b: max(abs(round(b[i] * steps[i]) - round(a[i] * steps[i])) for i in range(4)) < dropsegments
+    moves = [m for run in runs for m in run]
+    e_moves = sum(m[1][E] - m[0][E] for m in moves)
+    e_blocks = sum(b["end"][E] - b["start"][E] for b in blocks)
+    sys.stderr.write("%d moves, %d blocks (%.1f%% fewer), mean block %.3f mm\n" %
+                     (len(moves), len(blocks), 100.0 * (len(moves) - len(blocks)) / max(1, len(moves)),
+                      sum(b["length"] for b in blocks) / max(1, len(blocks))))
+    sys.stderr.write("largest deviation %.5f mm (COALESCE_CHORD %g), largest E error %.5f mm\n" %
+                     (max_deviation, chord_tol, max_e_error))
+    sys.stderr.write("E: moves %.5f mm, blocks %.5f mm\n" % (e_moves, e_blocks))
+    sys.stderr.write("below dropsegments (%d steps): %d moves, %d blocks\n" %
+                     (dropsegments, sum(1 for m in moves if short(m[0], m[1])),
+                      sum(1 for b in blocks if short(b["start"], b["end"]))))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
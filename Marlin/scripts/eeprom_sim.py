@@ -0,0 +1,270 @@
+#!/usr/bin/python3
+"""I2C EEPROM stand-in
+
+Models a 24LCxx I2C EEPROM on the Wire bus of the Due: page writes that wrap
+within the page, an internal write cycle during which the device doesn't
+acknowledge its address, and sequential reads. M500 is run against it with
+the byte-wise driver Marlin used to have (one write transaction, delay(5),
+_delay_ms(2) and a one byte readback per byte) and with the paged driver of
+eeprom_write_block() (aligned page writes, acknowledge polling, one
+sequential read to verify each page). With --load the settings are read
+back as Config_RetrieveSettings() does at boot instead, one byte per
+transaction as before or with the sequential reads of eeprom_read_block().
+Prints one CSV row per driver:
+
+  driver, bytes, write_cycles, transactions, polls, bus_ms, wait_ms, total_ms
+
+Both drivers must leave the same contents in the device or read the same
+settings, which is checked.
+A summary goes to stderr.
+
+Usage: python3 eeprom_sim.py [options] > m500.csv
+
+Options:
+  --config=...       directory with the configuration, for I2C_EEPROM_PAGE_SIZE (default: the Marlin directory)
+  --size=...         settings image in bytes, as M500 reports it less EEPROM_OFFSET (default: 318)
+  --changed=...      bytes that differ from what is stored, the paged driver skips the other pages (default: all)
+  --write-cycle=...  write cycle time of the device in ms (default: 5, the 24LCxx maximum)
+  --clock=...        I2C clock in Hz (default: 100000, the Wire default)
+  --buffer=...       BUFFER_LENGTH of Wire (default: 32)
+  --load             time loading the settings at boot instead of M500
+"""
+
+import getopt
+import os
+import random
+import sys
+
+from motion_sim import config_value, read_config
+
+EEPROM_OFFSET = 100
+EEPROM_DEVICE_SIZE = 4096    # 24LC32
+WRITE_TIMEOUT_MS = 10        # I2C_EEPROM_WRITE_TIMEOUT
+EEPROM_HEADER_SIZE = 10      # version, size, crc
+
+
+class Eeprom(object):
+    # The device: a page write buffer and a busy time after every write
+
+    def __init__(self, size, page, write_cycle):
+        self.memory = bytearray(b"\xff" * size)
+        self.page = page
+        self.write_cycle = write_cycle
+        self.busy_until = 0.0
+        self.writes = 0
+
+    def ready(self, now):
+        return now >= self.busy_until
+
+    def write(self, now, address, data):
+        # Bytes past the end of the page wrap to its start
+        base = address - address % self.page
+        for i, value in enumerate(data):
+            self.memory[base + (address + i - base) % self.page] = value
+        self.busy_until = now + self.write_cycle
+        self.writes += 1
+
+    def read(self, address, n):
+        return bytes(self.memory[(address + i) % len(self.memory)] for i in range(n))
+
+
+class Bus(object):
+    # Wire on the TWI of the Due: every transaction is a start, 9 clocks per
+    # byte with the acknowledge, and a stop. A device that is busy doesn't
+    # acknowledge its address and the transaction ends there.
+
+    def __init__(self, device, clock):
+        self.device = device
+        self.bit = 1000.0 / clock   # ms
+        self.now = 0.0
+        self.address = 0
+        self.transactions = 0
+        self.polls = 0
+        self.waiting = 0.0
+
+    def _transfer(self, count):
+        self.transactions += 1
+        self.now += (2 + 9 * count) * self.bit
+
+    def write(self, payload):
+        # beginTransmission(), write(payload), endTransmission(): True on ACK
+        if not self.device.ready(self.now):
+            self._transfer(1)
+            return False
+        self._transfer(1 + len(payload))
+        if len(payload) > 2:
+            self.device.write(self.now, payload[0] << 8 | payload[1], payload[2:])
+        elif len(payload) == 2:
+            self.address = payload[0] << 8 | payload[1]
+        return True
+
+    def request(self, n):
+        # requestFrom(): the bytes read from the address pointer
+        if not self.device.ready(self.now):
+            self._transfer(1)
+            return b""
+        self._transfer(1 + n)
+        data = self.device.read(self.address, n)
+        self.address += n
+        return data
+
+    def delay(self, ms):
+        self.now += ms
+        self.waiting += ms
+
+
+def address_bytes(address):
+    return bytes((address >> 8, address & 0xFF))
+
+
+def store_bytewise(bus, image, offset):
+    # _EEPROM_writeData() before page writes: every byte is written, waited
+    # for and read back on its own. The version was invalidated first.
+    writes = [(offset, b"000\0"), (offset + 4, image[4:]), (offset, image[:4])]
+    ok = True
+    for start, data in writes:
+        for i, value in enumerate(data):
+            bus.write(address_bytes(start + i) + bytes((value,)))
+            bus.delay(5)
+            bus.delay(2)
+            bus.write(address_bytes(start + i))
+            ok = bus.request(1) == bytes((value,)) and ok
+    return ok, sum(len(data) for start, data in writes)
+
+
+def store_paged(bus, image, stored, offset, page, buffer_length):
+    # _EEPROM_commit() and eeprom_write_block(): the pages that differ are
+    # written in chunks that don't cross a page, each verified once the
+    # device acknowledges again
+    ok = True
+    written = 0
+    end = offset + len(image)
+    pos = offset
+    while pos < end:
+        next_pos = min((pos // page + 1) * page, end)
+        data = image[pos - offset:next_pos - offset]
+        if data != stored[pos - offset:next_pos - offset]:
+            address = pos
+            while data:
+                chunk = min(page - address % page, buffer_length - 2, len(data))
+                bus.write(address_bytes(address) + data[:chunk])
+                start = bus.now
+                while not bus.write(address_bytes(address)[:1]):
+                    bus.polls += 1
+                    if bus.now - start >= WRITE_TIMEOUT_MS:
+                        ok = False
+                        break
+                bus.write(address_bytes(address))
+                ok = bus.request(chunk) == data[:chunk] and ok
+                written += chunk
+                address += chunk
+                data = data[chunk:]
+        pos = next_pos
+    return ok, written
+
+
+def load_bytewise(bus, offset, size):
+    # _EEPROM_readData() before sequential reads: an address write and a one
+    # byte read per byte
+    data = bytearray()
+    for address in range(offset, offset + size):
+        bus.write(address_bytes(address))
+        data += bus.request(1)
+    return bytes(data)
+
+
+def load_sequential(bus, offset, size, buffer_length):
+    # _EEPROM_load() of the header and of the settings with eeprom_read_block()
+    data = bytearray()
+    for start, n in ((offset, EEPROM_HEADER_SIZE), (offset + EEPROM_HEADER_SIZE, size - EEPROM_HEADER_SIZE)):
+        for address in range(start, start + n, buffer_length):
+            bus.write(address_bytes(address))
+            data += bus.request(min(buffer_length, start + n - address))
+    return bytes(data)
+
+
+def load(options, size, page, stored):
+    results = []
+    for driver in ("bytewise", "sequential"):
+        device = Eeprom(EEPROM_DEVICE_SIZE, page, options["write-cycle"])
+        device.memory[EEPROM_OFFSET:EEPROM_OFFSET + size] = stored
+        bus = Bus(device, options["clock"])
+        if driver == "bytewise":
+            data = load_bytewise(bus, EEPROM_OFFSET, size)
+        else:
+            data = load_sequential(bus, EEPROM_OFFSET, size, int(options["buffer"]))
+        if data != stored:
+            sys.stderr.write("%s: the settings read differ from the stored ones\n" % driver)
+            sys.exit(1)
+        results.append(bus.now)
+        print("%s,%d,0,%d,0,%.1f,%.1f,%.1f" % (driver, size, bus.transactions,
+                                               bus.now - bus.waiting, bus.waiting, bus.now))
+    bytewise, sequential = results
+    sys.stderr.write("settings load of %d bytes at %d Hz\n" % (size, options["clock"]))
+    sys.stderr.write("byte-wise %.1f ms, sequential %.1f ms (%.0fx), settings verified\n" %
+                     (bytewise, sequential, bytewise / sequential))
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."),
+                   size=318, changed=None, clock=100000, buffer=32, load=False)
+    options["write-cycle"] = 5.0
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "config=", "size=", "changed=", "write-cycle=", "clock=", "buffer=", "load"])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:]
+        options[key] = arg if key == "config" else True if key == "load" else float(arg)
+    if args:
+        print(__doc__)
+        sys.exit(2)
+
+    page = int(config_value(read_config(options["config"]), "I2C_EEPROM_PAGE_SIZE", 32))
+    size = int(options["size"])
+    rnd = random.Random(1)
+    stored = bytes(rnd.randrange(256) for i in range(size))
+    image = bytearray(stored)
+    changed = size if options["changed"] is None else min(int(options["changed"]), size)
+    for i in rnd.sample(range(size), changed):
+        image[i] ^= 0xFF
+    image = bytes(image)
+    if options["load"]:
+        load(options, size, page, stored)
+        return
+
+    results = []
+    contents = []
+    for driver in ("bytewise", "paged"):
+        device = Eeprom(EEPROM_DEVICE_SIZE, page, options["write-cycle"])
+        device.memory[EEPROM_OFFSET:EEPROM_OFFSET + size] = stored
+        bus = Bus(device, options["clock"])
+        if driver == "bytewise":
+            ok, written = store_bytewise(bus, image, EEPROM_OFFSET)
+        else:
+            ok, written = store_paged(bus, image, stored, EEPROM_OFFSET, page, int(options["buffer"]))
+        if not ok:
+            sys.stderr.write("%s: readback failed\n" % driver)
+            sys.exit(1)
+        contents.append(bytes(device.memory))
+        results.append((driver, bus.now))
+        print("%s,%d,%d,%d,%d,%.1f,%.1f,%.1f" % (driver, written, device.writes, bus.transactions, bus.polls,
+                                                  bus.now - bus.waiting, bus.waiting, bus.now))
+
+    if contents[0] != contents[1] or contents[1][EEPROM_OFFSET:EEPROM_OFFSET + size] != image:
+        sys.stderr.write("the drivers left different contents\n")
+        sys.exit(1)
+    (_, bytewise), (_, paged) = results
+    sys.stderr.write("M500 of %d bytes, %d changed, %d byte pages, %g ms write cycle at %d Hz\n" %
+                     (size, changed, page, options["write-cycle"], options["clock"]))
+    sys.stderr.write("byte-wise %.0f ms, paged %.1f ms (%.0fx), contents verified\n" %
+                     (bytewise, paged, bytewise / paged))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
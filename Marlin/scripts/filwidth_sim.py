@@ -0,0 +1,127 @@
+#!/usr/bin/python3
+"""Filament width compensation simulator
+
+Feeds a synthetic filament width profile through the same distance-indexed
+buffer and fixed-point factors as plan_buffer_line() (FILAMENT_SENSOR) and
+prints, per planned block, the width in the melt zone against the
+compensation that was applied, as CSV:
+
+  filament_mm, width_at_nozzle, factor_applied, factor_ideal
+
+A summary with the largest and the mean volumetric error, once the filament
+measured after M405 reached the melt zone, goes to stderr.
+
+Usage: python3 filwidth_sim.py [options] > compensation.csv
+
+Options:
+  --profile=...    step, sine or noise (default: step)
+  --nominal=...    nominal filament diameter in mm (default: 1.75)
+  --amplitude=...  width deviation in mm (default: 0.05)
+  --period=...     sine period in mm of filament (default: 50)
+  --delay=...      MEASUREMENT_DELAY_CM, sensor to melt zone in cm (default: 14)
+  --max-delay=...  MAX_MEASUREMENT_DELAY in cm (default: 20)
+  --sample=...     MEASUREMENT_SAMPLE_MM (default: 2)
+  --block=...      filament per block in mm (default: 0.4)
+  --length=...     filament to feed in mm (default: 500)
+  --e-steps=...    steps per mm of filament (default: 836)
+"""
+
+import getopt
+import random
+import sys
+from math import sin, pi
+
+FILWIDTH_SHIFT = 12
+FILWIDTH_ONE = 1 << FILWIDTH_SHIFT
+
+
+def width_profile(kind, nominal, amplitude, period):
+    # Width of the filament at a position, measured from where feeding started
+    if kind == "sine":
+        return lambda x: nominal + amplitude * sin(2 * pi * x / period)
+    if kind == "noise":
+        rnd = random.Random(1)
+        table = [nominal + rnd.uniform(-amplitude, amplitude) for _ in range(10000)]
+        return lambda x: table[int(x) % len(table)]
+    return lambda x: nominal + (amplitude if x >= 100 else 0)
+
+
+def volumetric_factor(nominal, width):
+    # widthFil_to_volumetric_factor(), without the sensor limits
+    ratio = nominal / width
+    return min(int(ratio * ratio * FILWIDTH_ONE + 0.5), 65535)
+
+
+def simulate(profile, nominal, delay, max_delay, sample, block, length, e_steps):
+    slots = int(max_delay * 10 / sample) + 1
+    slot_steps = max(1, int(e_steps * sample))
+    delay_mm = delay * 10.0
+    # The sensor sees the filament delay_mm ahead of the melt zone
+    sensor = lambda fed: profile(fed + delay_mm)
+
+    # plan_filwidth_fill() at M405
+    buf = [volumetric_factor(nominal, sensor(0))] * slots
+    head = 0
+    remainder = 0
+    fed = 0.0
+    rows = []
+    while fed < length:
+        # Factor for the block: buffer slot of the filament in the melt zone
+        i = head - int(delay * 10 / sample)
+        if i < 0:
+            i += slots
+        factor = buf[i]
+        steps = (int(round(block * e_steps)) * factor) >> FILWIDTH_SHIFT
+        ideal = (nominal / profile(fed + block / 2)) ** 2
+        rows.append((fed, profile(fed), factor / float(FILWIDTH_ONE), ideal))
+
+        # filwidth_feed()
+        remainder += steps
+        if remainder >= slot_steps:
+            n = remainder // slot_steps
+            remainder -= n * slot_steps
+            current = volumetric_factor(nominal, sensor(fed + steps / e_steps))
+            for _ in range(min(n, slots)):
+                head = (head + 1) % slots
+                buf[head] = current
+        fed += steps / e_steps
+    return rows
+
+
+def main(argv):
+    options = dict(profile="step", nominal=1.75, amplitude=0.05, period=50.0, delay=14.0,
+                   max_delay=20.0, sample=2.0, block=0.4, length=500.0, e_steps=836.0)
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help"] + [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:].replace('-', '_')
+        options[key] = arg.lower() if key == "profile" else float(arg)
+    if options["profile"] not in ("step", "sine", "noise"):
+        print(__doc__)
+        sys.exit(2)
+
+    profile = width_profile(options["profile"], options["nominal"], options["amplitude"], options["period"])
+    rows = simulate(profile, options["nominal"], options["delay"], options["max_delay"], options["sample"],
+                    options["block"], options["length"], options["e_steps"])
+
+    print("filament_mm,width_at_nozzle,factor_applied,factor_ideal")
+    errors = []
+    for fed, width, applied, ideal in rows:
+        print("%.2f,%.4f,%.4f,%.4f" % (fed, width, applied, ideal))
+        # The filament below the sensor at M405 was never measured
+        if fed >= options["delay"] * 10:
+            errors.append(abs(applied - ideal) / ideal)
+    if errors:
+        sys.stderr.write("%d blocks, volumetric error: max %.2f%%, mean %.3f%%\n" %
+                         (len(rows), 100 * max(errors), 100 * sum(errors) / len(errors)))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
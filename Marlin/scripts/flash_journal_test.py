@@ -0,0 +1,345 @@
+#!/usr/bin/python3
+"""Flash journal test
+
+Builds flash_storage.cpp (FLASH_EEPROM_EMULATION) for the host against a
+simulated SAM3X flash and runs it through:
+
+  append      writes are read back, before and after a restart replays the journal
+  compaction  enough writes to fill the blocks many times over, the blocks alternate
+  power cuts  the same writes with the power cut at every page write, the page
+              being written torn part way; after the restart the interrupted write
+              is either all there or not at all, all earlier writes are there, and
+              the remaining writes still work and survive another restart
+  header      a power cut anywhere in a compaction before its header is written
+              keeps the old block; the new one is only used once the header is there
+
+Flash behaves like the SAM3X: programming a page can only clear bits, erasing
+sets the page to 0xFF. The pages erased per block are printed as CSV:
+
+  page, erases
+
+A summary goes to stderr, the exit status is 1 if a check fails.
+
+Usage: python3 flash_journal_test.py [options] > erases.csv
+
+Options:
+  --config=...  directory with the configuration, for FLASH_EEPROM_SIZE and FLASH_EEPROM_PAGES (default: the Marlin directory)
+  --writes=...  writes in the power cut sequence (default: 400)
+  --seed=...    seed of the random writes (default: 1)
+  --cxx=...     host C++ compiler (default: g++)
+"""
+
+import ctypes
+import getopt
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+from motion_sim import config_value, read_config
+
+FLASH_PAGE_SIZE = 256   # IFLASH1_PAGE_SIZE
+
+HAL_H = """
+#include <stdint.h>
+#include <string.h>
+#define IFLASH1_PAGE_SIZE %(page)d
+extern uint8_t sim_flash[];
+#define FLASH_STORAGE_ADDRESS ((uintptr_t)sim_flash)
+bool HAL_flash_write_page(uint32_t address, const uint8_t *data, bool erase);
+"""
+
+CONFIGURATION_H = """
+#define FLASH_EEPROM_EMULATION
+#define FLASH_EEPROM_SIZE %(size)d
+#define FLASH_EEPROM_PAGES %(pages)d
+"""
+
+# The simulated flash and the entry points for ctypes. A power cut tears the
+# page write it happens in and drops all writes after it until sim_restart().
+SIM_CPP = """
+#include "flash_storage.cpp"
+
+uint8_t sim_flash[FLASH_EEPROM_PAGES * FLASH_PAGE_SIZE];
+static uint32_t page_writes, cut_at, tear;
+static bool powered;
+extern "C" { uint32_t sim_erases[FLASH_EEPROM_PAGES]; }
+
+bool HAL_flash_write_page(uint32_t address, const uint8_t *data, bool erase) {
+  uint32_t offset = address - (uint32_t)(uintptr_t)sim_flash;
+  if (offset % FLASH_PAGE_SIZE || offset >= sizeof(sim_flash)) return false;
+  if (!powered) return false;
+  uint8_t *page = sim_flash + offset;
+  uint32_t n = FLASH_PAGE_SIZE;
+  if (++page_writes == cut_at) { n = tear; powered = false; }
+  if (erase) {
+    memset(page, 0xFF, n);
+    sim_erases[offset / FLASH_PAGE_SIZE]++;
+  }
+  else
+    for (uint32_t i = 0; i < n; i++) page[i] &= data[i];
+  return powered;
+}
+
+extern "C" {
+  // Erase the flash
+  void sim_clear() {
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+    memset(sim_erases, 0, sizeof(sim_erases));
+  }
+  // Power up with the flash as it is, cut the power after tear bytes of page write cut (0: never)
+  void sim_restart(uint32_t cut, uint32_t tear_bytes) {
+    page_writes = 0;
+    cut_at = cut;
+    tear = tear_bytes;
+    powered = true;
+    flash_initialised = false;
+  }
+  uint32_t sim_page_writes() { return page_writes; }
+  bool sim_powered() { return powered; }
+  uint32_t sim_sequence() { return sequence; }
+  uint8_t sim_active_block() { return active_block; }
+  uint8_t *sim_flash_data() { return sim_flash; }
+  void sim_read(uint16_t address, uint8_t *dest, uint16_t n) { flash_storage_read(address, dest, n); }
+  bool sim_write(uint16_t address, const uint8_t *src, uint16_t n) { return flash_storage_write(address, src, n); }
+}
+"""
+
+
+class TestError(Exception):
+    pass
+
+
+class Journal(object):
+    # flash_storage.cpp built for the host
+
+    def __init__(self, marlin, cxx, size, pages):
+        self.size = size
+        self.pages = pages
+        self.tmp = tempfile.mkdtemp()
+        for name in ("flash_storage.cpp", "flash_storage.h"):
+            shutil.copy(os.path.join(marlin, name), self.tmp)
+        values = dict(page=FLASH_PAGE_SIZE, size=size, pages=pages)
+        for name, text in (("HAL.h", HAL_H % values), ("Configuration.h", CONFIGURATION_H % values), ("sim.cpp", SIM_CPP)):
+            with open(os.path.join(self.tmp, name), "w") as f:
+                f.write(text)
+        lib = os.path.join(self.tmp, "journal.so")
+        subprocess.check_call([cxx, "-std=gnu++11", "-shared", "-fPIC", "-O1", "-Wall",
+                               "-o", lib, os.path.join(self.tmp, "sim.cpp")])
+        self.lib = ctypes.CDLL(lib)
+        self.lib.sim_write.restype = ctypes.c_bool
+        self.lib.sim_powered.restype = ctypes.c_bool
+        self.lib.sim_active_block.restype = ctypes.c_uint8
+        self.lib.sim_flash_data.restype = ctypes.POINTER(ctypes.c_uint8)
+        self.erases = (ctypes.c_uint32 * pages).in_dll(self.lib, "sim_erases")
+
+    def close(self):
+        shutil.rmtree(self.tmp)
+
+    def clear(self):
+        self.lib.sim_clear()
+        self.restart()
+
+    def restart(self, cut=0, tear=0):
+        # Power up and replay the journal
+        self.lib.sim_restart(cut, tear)
+        self.read()
+
+    def read(self):
+        buf = (ctypes.c_uint8 * self.size)()
+        self.lib.sim_read(0, buf, self.size)
+        return bytes(buf)
+
+    def write(self, address, data):
+        return self.lib.sim_write(address, bytes(data), len(data))
+
+    def flash(self):
+        return ctypes.string_at(self.lib.sim_flash_data(), self.pages * FLASH_PAGE_SIZE)
+
+    def set_flash(self, data):
+        ctypes.memmove(self.lib.sim_flash_data(), data, len(data))
+
+
+def random_writes(rnd, size, count):
+    # Settings-like writes: M500 hands over at most a page of 32 bytes at a time
+    writes = []
+    for i in range(count):
+        n = rnd.randint(1, 32)
+        address = rnd.randrange(size - n + 1)
+        writes.append((address, bytes(rnd.randrange(256) for k in range(n))))
+    return writes
+
+
+def apply(image, address, data):
+    image = bytearray(image)
+    image[address:address + len(data)] = data
+    return bytes(image)
+
+
+def check(condition, message):
+    if not condition:
+        raise TestError(message)
+
+
+def test_append(journal, rnd):
+    journal.clear()
+    check(journal.read() == b"\xff" * journal.size, "empty flash doesn't read as erased")
+    image = b"\xff" * journal.size
+    for address, data in random_writes(rnd, journal.size, 20):
+        check(journal.write(address, data), "write failed")
+        image = apply(image, address, data)
+        check(journal.read() == image, "read back differs after a write")
+    journal.restart()
+    check(journal.read() == image, "replay differs after a restart")
+    return 20
+
+
+def test_compaction(journal, rnd):
+    journal.clear()
+    image = b"\xff" * journal.size
+    compactions = 0
+    sequence = journal.lib.sim_sequence()
+    for address, data in random_writes(rnd, journal.size, 3000):
+        block = journal.lib.sim_active_block()
+        check(journal.write(address, data), "write failed")
+        image = apply(image, address, data)
+        if journal.lib.sim_sequence() != sequence:
+            check(journal.lib.sim_active_block() != block, "compaction didn't change the block")
+            check(journal.lib.sim_sequence() == sequence + 1, "compaction didn't count the sequence up")
+            sequence = journal.lib.sim_sequence()
+            compactions += 1
+            journal.restart()
+            check(journal.read() == image, "replay differs after a compaction")
+    journal.restart()
+    check(journal.read() == image, "replay differs after the compactions")
+    check(compactions > 2, "the writes didn't fill the blocks")
+    return compactions
+
+
+def test_power_cuts(journal, writes, rnd):
+    # The page writes of the sequence without a power cut
+    journal.clear()
+    for address, data in writes:
+        journal.write(address, data)
+    total = journal.lib.sim_page_writes()
+
+    compacting = 0
+    for cut in range(1, total + 1):
+        journal.clear()
+        journal.restart(cut, rnd.randrange(FLASH_PAGE_SIZE))
+        image = b"\xff" * journal.size
+        k = 0
+        while journal.lib.sim_powered():
+            address, data = writes[k]
+            sequence = journal.lib.sim_sequence()
+            ok = journal.write(address, data)
+            before, image = image, apply(image, address, data)
+            check(ok == journal.lib.sim_powered(), "a write failed with the power on")
+            k += 1
+
+        journal.restart()
+        found = journal.read()
+        check(found in (before, image),
+              "cut at page write %d: write %d is torn after the restart" % (cut, k - 1))
+        if journal.lib.sim_sequence() != sequence:
+            # The cut hit a compaction after its header: the new block holds everything
+            compacting += 1
+            check(found == image, "cut at page write %d: compacted block used without its data" % cut)
+        image = found
+
+        for address, data in writes[k:]:
+            check(journal.write(address, data), "cut at page write %d: write failed after the restart" % cut)
+            image = apply(image, address, data)
+        journal.restart()
+        check(journal.read() == image, "cut at page write %d: replay differs after recovering" % cut)
+    return total, compacting
+
+
+def test_header_last(journal, rnd):
+    # The write that compacts the second time, from the block filled by the first
+    journal.clear()
+    writes = []
+    for address, data in random_writes(rnd, journal.size, 3000):
+        writes.append((address, data))
+        journal.write(address, data)
+        if journal.lib.sim_sequence() == 2:
+            break
+    compacting = writes.pop()
+    journal.clear()
+    image = b"\xff" * journal.size
+    for address, data in writes:
+        journal.write(address, data)
+        image = apply(image, address, data)
+    snapshot = journal.flash()
+    block = journal.lib.sim_active_block()
+
+    journal.restart()
+    journal.write(*compacting)
+    total = journal.lib.sim_page_writes()
+    check(journal.lib.sim_active_block() != block, "the write didn't compact")
+
+    # Power cut at every page write of the compaction, the header is the last one
+    for cut in range(1, total + 1):
+        journal.set_flash(snapshot)
+        journal.restart(cut, rnd.randrange(FLASH_PAGE_SIZE))
+        journal.write(*compacting)
+        journal.restart()
+        found = journal.read()
+        if cut < total:
+            check(journal.lib.sim_active_block() == block,
+                  "compaction cut at page write %d of %d: the new block is used" % (cut, total))
+            check(found == image, "compaction cut at page write %d of %d: contents changed" % (cut, total))
+        else:
+            check(found in (image, apply(image, *compacting)), "compaction cut in the header write: contents torn")
+    return total
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."),
+                   writes=400, seed=1, cxx="g++")
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "config=", "writes=", "seed=", "cxx="])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:]
+        options[key] = int(arg) if key in ("writes", "seed") else arg
+    if args:
+        print(__doc__)
+        sys.exit(2)
+
+    defines = read_config(options["config"])
+    size = int(config_value(defines, "FLASH_EEPROM_SIZE", 1024))
+    pages = int(config_value(defines, "FLASH_EEPROM_PAGES", 32))
+    marlin = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+    journal = Journal(marlin, options["cxx"], size, pages)
+    rnd = random.Random(options["seed"])
+    try:
+        appended = test_append(journal, rnd)
+        compactions = test_compaction(journal, rnd)
+        for page in range(pages):
+            print("%d,%d" % (page, journal.erases[page]))
+        cuts, compaction_cuts = test_power_cuts(journal, random_writes(rnd, size, options["writes"]), rnd)
+        header_cuts = test_header_last(journal, rnd)
+    except TestError as err:
+        sys.stderr.write("FAILED: %s\n" % err)
+        sys.exit(1)
+    finally:
+        journal.close()
+
+    sys.stderr.write("%d byte EEPROM in %d pages of flash\n" % (size, pages))
+    sys.stderr.write("append: %d writes replayed\n" % appended)
+    sys.stderr.write("compaction: %d compactions of 3000 writes replayed\n" % compactions)
+    sys.stderr.write("power cuts: %d cuts recovered, %d of them in a compaction\n" % (cuts, compaction_cuts))
+    sys.stderr.write("header: %d cuts in one compaction, the old block kept until the header\n" % header_cuts)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
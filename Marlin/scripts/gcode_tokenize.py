@@ -0,0 +1,411 @@
+#!/usr/bin/python3
+"""G-code tokenizer
+
+Writes the commands of a G-code file as tokenized G-code for
+SD_TOKENIZED_GCODE, in the format described in cardreader.h: a head byte
+with the kind and code of the command, a mask of the parameter letters and
+one number per parameter, X Y Z E F as the change from their last value.
+M23 and M24 print the file like the G-code. Comments, line numbers and
+checksums are dropped.
+
+Commands the format can't hold are kept as text: letters outside
+TOKEN_LETTERS, parameters without a number or with more decimals than the
+letter has (3, 5 for E), strings like the ones of M23 and M117, and commands
+whose decoded text would be too long for the command queue.
+
+With --compress the records are LZ compressed, with the 1024 byte window
+of the decoder. --check puts the written file on a card image and decodes it
+with getTokenizedCommand() of cardreader.cpp, in the firmware built for the
+host with SD_TOKENIZED_GCODE (see host_build.py), then compares every
+command with the G-code. --decode prints the commands of a tokenized file,
+decoded in Python.
+
+A summary goes to stderr.
+
+Usage: python3 gcode_tokenize.py [options] file.gcode file.mtk
+       python3 gcode_tokenize.py --decode file.mtk > file.gcode
+
+Options:
+  --config=...  directory with the configuration, for MAX_CMD_SIZE (default: the Marlin directory)
+  --define=...  configuration change for the build of --check, as in host_build.py (may be repeated)
+  --compress    LZ compress the records
+  --check       decode the written file with the firmware and compare it with the G-code
+  --decode      print the commands of a tokenized file
+"""
+
+import getopt
+import os
+import re
+import struct
+import sys
+
+from host_build import BuildError, Firmware, build, fat_image
+from motion_sim import config_value, read_config
+
+TOKEN_MAGIC = b"MTOK"
+TOKEN_VERSION = 1
+TOKEN_COMPRESSED = 1
+TOKEN_G, TOKEN_M, TOKEN_T, TOKEN_TEXT = range(4)
+TOKEN_PARAMETERS = 4
+TOKEN_LETTERS = "XYZEFSPRIJTDHLKA"
+TOKEN_DELTA_LETTERS = 5
+TOKEN_LZ_WINDOW = 1024
+LZ_MIN, LZ_MAX = 3, 66
+
+HEADER = struct.Struct("<4sBBH")
+KINDS = "GMT"
+CHECK_FILE = "check.mtk"
+
+
+class TokenError(Exception):
+    pass
+
+
+def decimals(letter):
+    return 5 if letter == "E" else 3
+
+
+def parse(text):
+    # (kind, code, [(letter, value in 1/10^decimals)]) of a command, or None for text
+    m = re.match(r"([GMT])(\d+)((?:\s*[A-Z][-+]?(?:\d+\.?\d*|\.\d+))*)\s*$", text)
+    if not m:
+        return None
+    parameters = []
+    for letter, value in re.findall(r"([A-Z])([-+]?[0-9.]+)", m.group(3)):
+        if letter not in TOKEN_LETTERS or letter in (l for l, v in parameters):
+            return None
+        whole, _, fraction = value.lstrip("+").partition(".")
+        if len(fraction) > decimals(letter):
+            return None
+        negative = whole.startswith("-")
+        number = int((whole.lstrip("-") or "0") + fraction.ljust(decimals(letter), "0"))
+        parameters.append((letter, -number if negative else number))
+    return KINDS.index(m.group(1)), int(m.group(2)), parameters
+
+
+def number(n):
+    # 7 bits per byte, low first
+    out = bytearray()
+    while True:
+        out.append((n & 0x7F) | (0x80 if n > 0x7F else 0))
+        n >>= 7
+        if not n:
+            return bytes(out)
+
+
+def value_text(value, places):
+    # token_value() of cardreader.cpp
+    text = "-" if value < 0 else ""
+    value = abs(value)
+    text += str(value // 10 ** places)
+    fraction = value % 10 ** places
+    if fraction:
+        text += "." + str(fraction).rjust(places, "0").rstrip("0")
+    return text
+
+
+class Decoder(object):
+    # getTokenizedCommand() of cardreader.cpp, on the decompressed records
+
+    def __init__(self, data, max_cmd_size):
+        self.data = data
+        self.pos = 0
+        self.last = [0] * TOKEN_DELTA_LETTERS
+        self.max_cmd_size = max_cmd_size
+
+    def byte(self):
+        if self.pos >= len(self.data):
+            raise TokenError("the file ends inside a record")
+        self.pos += 1
+        return self.data[self.pos - 1]
+
+    def number(self):
+        n = 0
+        for shift in range(0, 32, 7):
+            c = self.byte()
+            n |= (c & 0x7F) << shift
+            if not c & 0x80:
+                return n
+        raise TokenError("a number longer than 32 bits")
+
+    def command(self):
+        if self.pos >= len(self.data):
+            return None
+        head = self.byte()
+        if head & 3 == TOKEN_TEXT:
+            length = self.byte()
+            if length >= self.max_cmd_size:
+                raise TokenError("a text record longer than MAX_CMD_SIZE")
+            return bytes(self.byte() for i in range(length)).decode("ascii")
+        code = head >> 3
+        if code == 31:
+            code = self.number()
+        text = "%s%d" % (KINDS[head & 3], code)
+        if head & TOKEN_PARAMETERS:
+            mask = self.byte() | self.byte() << 8
+            for i in range(16):
+                if not mask & 1 << i:
+                    continue
+                n = self.number()
+                value = (n >> 1) ^ -(n & 1)
+                if i < TOKEN_DELTA_LETTERS:
+                    self.last[i] = value = to_int32(self.last[i] + value)
+                if len(text) + 15 > self.max_cmd_size - 1:
+                    raise TokenError("a command too long for MAX_CMD_SIZE")
+                text += " " + TOKEN_LETTERS[i] + value_text(value, decimals(TOKEN_LETTERS[i]))
+        return text
+
+
+def to_int32(n):
+    n &= 0xFFFFFFFF
+    return n - (1 << 32) if n & 0x80000000 else n
+
+
+class Encoder(object):
+
+    def __init__(self, max_cmd_size):
+        self.max_cmd_size = max_cmd_size
+        self.last = [0] * TOKEN_DELTA_LETTERS
+        self.counts = dict(tokens=0, texts=0)
+
+    def record(self, text):
+        parsed = parse(text)
+        if parsed:
+            record = self.tokens(*parsed)
+            if record is not None:
+                self.counts["tokens"] += 1
+                return record
+        if len(text) >= min(256, self.max_cmd_size):
+            raise TokenError("the command is longer than MAX_CMD_SIZE")
+        self.counts["texts"] += 1
+        return struct.pack("<BB", TOKEN_TEXT, len(text)) + text.encode("ascii")
+
+    def tokens(self, kind, code, parameters):
+        # The token record, None if it doesn't fit the format or the command queue
+        length = len(KINDS[kind] + str(code))
+        mask = 0
+        values = {}
+        last = list(self.last)
+        for letter, value in parameters:
+            i = TOKEN_LETTERS.index(letter)
+            if value != to_int32(value) or length + 15 > self.max_cmd_size - 1:
+                return None
+            length += 2 + len(value_text(value, decimals(letter)))
+            mask |= 1 << i
+            if i < TOKEN_DELTA_LETTERS:
+                value, last[i] = to_int32(value - last[i]), value
+            values[i] = value
+        self.last = last
+        out = bytearray()
+        head = kind | (TOKEN_PARAMETERS if mask else 0)
+        if code < 31:
+            out.append(head | code << 3)
+        else:
+            out.append(head | 31 << 3)
+            out += number(code)
+        if mask:
+            out += struct.pack("<H", mask)
+            for i in sorted(values):
+                out += number(((values[i] << 1) ^ (values[i] >> 31)) & 0xFFFFFFFF)
+        return bytes(out)
+
+
+def compress(data):
+    # Groups of 8 items after a flag byte: a byte, or a match of distance and length
+    out = bytearray()
+    chains = {}
+    group = bytearray()
+    flags = items = 0
+    i = 0
+    while i < len(data):
+        best_length = best_distance = 0
+        key = data[i:i + LZ_MIN]
+        if len(key) == LZ_MIN:
+            for j in reversed(chains.get(key, [])[-64:]):
+                distance = i - j
+                if distance > TOKEN_LZ_WINDOW:
+                    break
+                length = 0
+                while length < LZ_MAX and i + length < len(data) and data[j + length] == data[i + length]:
+                    length += 1
+                if length > best_length:
+                    best_length, best_distance = length, distance
+                    if length == LZ_MAX:
+                        break
+        if best_length >= LZ_MIN:
+            flags |= 1 << items
+            m = (best_distance - 1) | (best_length - LZ_MIN) << 10
+            group += struct.pack("<H", m)
+            step = best_length
+        else:
+            group.append(data[i])
+            step = 1
+        for k in range(i, i + step):
+            chains.setdefault(data[k:k + LZ_MIN], []).append(k)
+        i += step
+        items += 1
+        if items == 8:
+            out.append(flags)
+            out += group
+            group = bytearray()
+            flags = items = 0
+    if items:
+        out.append(flags)
+        out += group
+    return bytes(out)
+
+
+def decompress(data):
+    # tokenByte() of cardreader.cpp
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        flags = data[i]
+        i += 1
+        for bit in range(8):
+            if i >= len(data):
+                break
+            if flags & 1 << bit:
+                if i + 1 >= len(data):
+                    raise TokenError("the file ends inside a match")
+                m = data[i] | data[i + 1] << 8
+                i += 2
+                distance, length = (m & (TOKEN_LZ_WINDOW - 1)) + 1, (m >> 10) + LZ_MIN
+                if distance > len(out):
+                    raise TokenError("a match before the start of the file")
+                for k in range(length):
+                    out.append(out[-distance])
+            else:
+                out.append(data[i])
+                i += 1
+    return bytes(out)
+
+
+def read_tokenized(path):
+    # The decompressed records of a tokenized file
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        raise TokenError("no header")
+    magic, version, flags, reserved = HEADER.unpack(data[:HEADER.size])
+    if magic != TOKEN_MAGIC or version != TOKEN_VERSION:
+        raise TokenError("not a tokenized file of version %d" % TOKEN_VERSION)
+    data = data[HEADER.size:]
+    return decompress(data) if flags & TOKEN_COMPRESSED else data
+
+
+def read_commands(f):
+    # The commands of a G-code file, without comments, line numbers and checksums
+    for line in f:
+        text = re.sub(r"\(.*?\)|;.*|\*.*", "", line).strip()
+        text = re.sub(r"^N\d+\s*", "", text)
+        if text:
+            yield text
+
+
+def same(text, decoded):
+    # The firmware reads both the same: same code, same parameter values
+    a, b = parse(text), parse(decoded)
+    if a is None or b is None:
+        return text == decoded
+    return a[:2] == b[:2] and sorted(a[2]) == sorted(b[2])
+
+
+def firmware_decode(path, config, defines):
+    # The commands of a tokenized file as the firmware decodes them
+    try:
+        lib = build(config, ["SD_TOKENIZED_GCODE"] + defines)
+    except BuildError as err:
+        raise TokenError("the build of the firmware failed:\n%s" % err)
+    with open(path, "rb") as f:
+        data = f.read()
+    try:
+        image = fat_image({CHECK_FILE: data})
+    except ValueError as err:
+        raise TokenError(str(err))
+    fw = Firmware(lib)
+    try:
+        fw.sd_load(image)
+        if not fw.setup():
+            raise TokenError("the firmware was killed: %s" % fw.output().strip().splitlines()[-1])
+        result, commands = fw.sd_decode(CHECK_FILE)
+    finally:
+        fw.close()
+    if result == -2:
+        raise TokenError("the firmware doesn't open the file as tokenized G-code")
+    if result < 0:
+        raise TokenError("getTokenizedCommand() failed after command %d" % len(commands))
+    return commands
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."),
+                   compress=False, check=False, decode=False)
+    defines = []
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "config=", "define=", "compress", "check", "decode"])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:]
+        if key == "define":
+            defines.append(arg)
+        else:
+            options[key] = arg if key == "config" else True
+    if len(args) != (1 if options["decode"] else 2):
+        print(__doc__)
+        sys.exit(2)
+
+    max_cmd_size = config_value(read_config(options["config"]), "MAX_CMD_SIZE", 96)
+    try:
+        if options["decode"]:
+            decoder = Decoder(read_tokenized(args[0]), max_cmd_size)
+            count = 0
+            for text in iter(decoder.command, None):
+                print(text)
+                count += 1
+            sys.stderr.write("%d commands\n" % count)
+            return
+
+        encoder = Encoder(max_cmd_size)
+        records = bytearray()
+        lines = 0
+        with open(args[0]) as f:
+            for lines, text in enumerate(read_commands(f), 1):
+                try:
+                    records += encoder.record(text)
+                except TokenError as err:
+                    raise TokenError("command %d: %s" % (lines, err))
+        data = compress(bytes(records)) if options["compress"] else bytes(records)
+        with open(args[1], "wb") as out:
+            out.write(HEADER.pack(TOKEN_MAGIC, TOKEN_VERSION, TOKEN_COMPRESSED if options["compress"] else 0, 0))
+            out.write(data)
+
+        if options["check"]:
+            commands = firmware_decode(args[1], options["config"], defines)
+            with open(args[0]) as f:
+                for k, text in enumerate(read_commands(f), 1):
+                    decoded = commands[k - 1] if k <= len(commands) else None
+                    if decoded is None or not same(text, decoded):
+                        raise TokenError("command %d: %s decodes as %s" % (k, text, decoded))
+            if len(commands) > lines:
+                raise TokenError("more commands in the tokenized file than in the G-code")
+    except TokenError as err:
+        sys.stderr.write("%s: %s\n" % (args[0], err))
+        sys.exit(1)
+
+    counts = encoder.counts
+    size_in, size_out = os.path.getsize(args[0]), os.path.getsize(args[1])
+    sys.stderr.write("%d commands: %d tokenized, %d kept as text\n" % (lines, counts["tokens"], counts["texts"]))
+    sys.stderr.write("%d bytes of G-code, %d bytes of records, %d bytes written (%.1f%%)%s\n" %
+                     (size_in, len(records), size_out, 100.0 * size_out / max(1, size_in),
+                      ", decoded by the firmware and compared" if options["check"] else ""))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
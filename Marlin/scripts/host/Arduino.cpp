@@ -0,0 +1,339 @@
+// **************************************************************************
+//
+// Description: Arduino Due core for building the firmware on the host
+//
+// **************************************************************************
+
+#include "Arduino.h"
+#include "fastio.h"
+#include "sim.h"
+
+static Pio pio_a(0), pio_b(1), pio_c(2), pio_d(3);
+Pio *const PIOA = &pio_a;
+Pio *const PIOB = &pio_b;
+Pio *const PIOC = &pio_c;
+Pio *const PIOD = &pio_d;
+
+static Tc tc_regs[3];
+Tc *const TC0 = &tc_regs[0];
+Tc *const TC1 = &tc_regs[1];
+Tc *const TC2 = &tc_regs[2];
+
+static Adc adc_regs;
+Adc *const ADC = &adc_regs;
+static Wdt wdt_regs;
+Wdt *const WDT = &wdt_regs;
+static Usart usart1_regs = { {USART_CR}, {USART_MR}, {USART_BRGR}, {USART_THR}, {USART_CSR}, {USART_TPR}, {USART_TCR}, {USART_PTCR} };
+Usart *const USART1 = &usart1_regs;
+
+// The pins of the Due as in fastio.h, the analog inputs are ADC channels 0 to 11
+#define DIGITAL_PIN(n) { DIO ## n ## _WPORT, MASK(DIO ## n ## _PIN), 0, 0, 0, 0, -1, -1, -1, -1 }
+#define ANALOG_PIN(n, a) { DIO ## n ## _WPORT, MASK(DIO ## n ## _PIN), 0, 0, 0, 0, a, a, -1, -1 }
+
+const PinDescription g_APinDescription[NUM_DIGITAL_PINS] = {
+  DIGITAL_PIN(0), DIGITAL_PIN(1), DIGITAL_PIN(2), DIGITAL_PIN(3), DIGITAL_PIN(4),
+  DIGITAL_PIN(5), DIGITAL_PIN(6), DIGITAL_PIN(7), DIGITAL_PIN(8), DIGITAL_PIN(9),
+  DIGITAL_PIN(10), DIGITAL_PIN(11), DIGITAL_PIN(12), DIGITAL_PIN(13), DIGITAL_PIN(14),
+  DIGITAL_PIN(15), DIGITAL_PIN(16), DIGITAL_PIN(17), DIGITAL_PIN(18), DIGITAL_PIN(19),
+  DIGITAL_PIN(20), DIGITAL_PIN(21), DIGITAL_PIN(22), DIGITAL_PIN(23), DIGITAL_PIN(24),
+  DIGITAL_PIN(25), DIGITAL_PIN(26), DIGITAL_PIN(27), DIGITAL_PIN(28), DIGITAL_PIN(29),
+  DIGITAL_PIN(30), DIGITAL_PIN(31), DIGITAL_PIN(32), DIGITAL_PIN(33), DIGITAL_PIN(34),
+  DIGITAL_PIN(35), DIGITAL_PIN(36), DIGITAL_PIN(37), DIGITAL_PIN(38), DIGITAL_PIN(39),
+  DIGITAL_PIN(40), DIGITAL_PIN(41), DIGITAL_PIN(42), DIGITAL_PIN(43), DIGITAL_PIN(44),
+  DIGITAL_PIN(45), DIGITAL_PIN(46), DIGITAL_PIN(47), DIGITAL_PIN(48), DIGITAL_PIN(49),
+  DIGITAL_PIN(50), DIGITAL_PIN(51), DIGITAL_PIN(52), DIGITAL_PIN(53),
+  ANALOG_PIN(54, 0), ANALOG_PIN(55, 1), ANALOG_PIN(56, 2), ANALOG_PIN(57, 3),
+  ANALOG_PIN(58, 4), ANALOG_PIN(59, 5), ANALOG_PIN(60, 6), ANALOG_PIN(61, 7),
+  ANALOG_PIN(62, 8), ANALOG_PIN(63, 9), ANALOG_PIN(64, 10), ANALOG_PIN(65, 11),
+  DIGITAL_PIN(66), DIGITAL_PIN(67), DIGITAL_PIN(68), DIGITAL_PIN(69),
+  DIGITAL_PIN(70), DIGITAL_PIN(71), DIGITAL_PIN(72), DIGITAL_PIN(73), DIGITAL_PIN(74),
+  DIGITAL_PIN(75), DIGITAL_PIN(76), DIGITAL_PIN(77), DIGITAL_PIN(78), DIGITAL_PIN(79),
+  DIGITAL_PIN(80), DIGITAL_PIN(81), DIGITAL_PIN(82), DIGITAL_PIN(83), DIGITAL_PIN(84),
+  DIGITAL_PIN(85), DIGITAL_PIN(86), DIGITAL_PIN(87), DIGITAL_PIN(88), DIGITAL_PIN(89),
+  DIGITAL_PIN(90), DIGITAL_PIN(91)
+};
+
+// --------------------------------------------------------------------------
+// PIO
+// --------------------------------------------------------------------------
+
+void PioSetClear::operator=(uint32_t mask) {
+  sim_pio_write(pio, mask, set);
+}
+
+void PIO_Configure(Pio *pio, int type, uint32_t mask, uint32_t attribute) {
+  if (type == PIO_PERIPH_A) return;   // the peripheral drives the pins
+  if (type == PIO_OUTPUT_0 || type == PIO_OUTPUT_1)
+    sim_pio_configure(pio, mask, true, type == PIO_OUTPUT_1);
+  else
+    sim_pio_configure(pio, mask, false, attribute & PIO_PULLUP);
+}
+
+void pinMode(uint32_t pin, uint32_t mode) {
+  if (pin >= NUM_DIGITAL_PINS) return;
+  const PinDescription &p = g_APinDescription[pin];
+  if (mode == OUTPUT)
+    sim_pio_configure(p.pPort, p.ulPin, true, false);
+  else
+    sim_pio_configure(p.pPort, p.ulPin, false, mode == INPUT_PULLUP);
+}
+
+void digitalWrite(uint32_t pin, uint32_t value) {
+  if (pin >= NUM_DIGITAL_PINS) return;
+  sim_pio_write(g_APinDescription[pin].pPort, g_APinDescription[pin].ulPin, value != LOW);
+}
+
+int digitalRead(uint32_t pin) {
+  if (pin >= NUM_DIGITAL_PINS) return LOW;
+  return (g_APinDescription[pin].pPort->PIO_PDSR & g_APinDescription[pin].ulPin) ? HIGH : LOW;
+}
+
+uint32_t analogRead(uint32_t pin) {
+  if (pin < A0) pin += A0;
+  if (pin >= NUM_DIGITAL_PINS || g_APinDescription[pin].ulADCChannelNumber < 0) return 0;
+  return sim_adc_value(g_APinDescription[pin].ulADCChannelNumber) >> 2;  // 10 bit by default
+}
+
+void analogWrite(uint32_t pin, uint32_t value) {
+  if (pin >= NUM_DIGITAL_PINS) return;
+  sim_analog_write(pin, value);
+}
+
+void analogReadResolution(int bits) {}
+void analogWriteResolution(int bits) {}
+
+// --------------------------------------------------------------------------
+// Timer counters, the interrupts are dispatched by the simulation
+// --------------------------------------------------------------------------
+
+static uint8_t timer_num(Tc *tc, uint32_t channel) {
+  return (tc - tc_regs) * 3 + channel;
+}
+
+// Ticks of HAL_TIMER_RATE (MCK / 2) per count of the timer clock
+static uint32_t ticks_per_count(uint32_t mode) {
+  static const uint32_t divider[] = { 1, 4, 16, 64 };
+  uint32_t clock = mode & TC_CMR_TCCLKS_Msk;
+  return clock < 4 ? divider[clock] : 1;
+}
+
+void TC_Configure(Tc *tc, uint32_t channel, uint32_t mode) {
+  TcChannel &ch = tc->TC_CHANNEL[channel];
+  sim_timer_stop(timer_num(tc, channel));
+  ch.TC_CMR = mode;
+  ch.TC_CV = 0;
+}
+
+void TC_Start(Tc *tc, uint32_t channel) {
+  sim_timer_start(timer_num(tc, channel), ticks_per_count(tc->TC_CHANNEL[channel].TC_CMR));
+}
+
+void TC_Stop(Tc *tc, uint32_t channel) {
+  sim_timer_stop(timer_num(tc, channel));
+}
+
+void TC_SetRA(Tc *tc, uint32_t channel, uint32_t v) { tc->TC_CHANNEL[channel].TC_RA = v; }
+void TC_SetRB(Tc *tc, uint32_t channel, uint32_t v) { tc->TC_CHANNEL[channel].TC_RB = v; }
+void TC_SetRC(Tc *tc, uint32_t channel, uint32_t v) { tc->TC_CHANNEL[channel].TC_RC = v; }
+
+void pmc_set_writeprotect(uint32_t enable) {}
+uint32_t pmc_enable_periph_clk(uint32_t id) { return 0; }
+uint32_t pmc_disable_periph_clk(uint32_t id) { return 0; }
+
+// The timers of the motion run at one priority and the temperature below
+// them, the simulation orders them by their compare match alone.
+void NVIC_EnableIRQ(IRQn_Type irq) {}
+void NVIC_DisableIRQ(IRQn_Type irq) {}
+void NVIC_ClearPendingIRQ(IRQn_Type irq) {}
+void NVIC_SetPriorityGrouping(uint32_t group) {}
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {}
+uint32_t NVIC_GetPriority(IRQn_Type irq) { return 0; }
+uint32_t NVIC_EncodePriority(uint32_t group, uint32_t preempt, uint32_t sub) { return preempt; }
+
+uint32_t __get_PRIMASK(void) { return sim_irq_enabled() ? 0 : 1; }
+void __disable_irq(void) { sim_irq_enable(false); }
+void __enable_irq(void) { sim_irq_enable(true); }
+
+uint32_t adc_get_channel_value(Adc *adc, adc_channel_num_t chan) { return sim_adc_value(chan); }
+void adc_enable_channel(Adc *adc, adc_channel_num_t chan) {}
+void adc_disable_channel(Adc *adc, adc_channel_num_t chan) {}
+void adc_start(Adc *adc) {}
+
+void WDT_Enable(Wdt *wdt, uint32_t mode) {}
+void WDT_Disable(Wdt *wdt) {}
+void WDT_Restart(Wdt *wdt) {}
+
+extern "C" void *_sbrk(int incr) { return 0; }
+
+// --------------------------------------------------------------------------
+// Time
+// --------------------------------------------------------------------------
+
+#define TICKS_PER_US (VARIANT_MCK / 2 / 1000000)
+
+unsigned long millis(void) {
+  sim_poll();
+  return sim_time() / (TICKS_PER_US * 1000);
+}
+
+unsigned long micros(void) {
+  sim_poll();
+  return sim_time() / TICKS_PER_US;
+}
+
+void delay(unsigned long ms) {
+  sim_wait((uint64_t)ms * 1000 * TICKS_PER_US);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim_wait((uint64_t)us * TICKS_PER_US);
+}
+
+void yield(void) {
+  sim_poll();
+}
+
+// --------------------------------------------------------------------------
+// Library functions of the AVR and SAM C libraries
+// --------------------------------------------------------------------------
+
+static uint32_t random_state = 1;
+
+static uint32_t random_next(void) {
+  random_state = random_state * 1103515245 + 12345;
+  return random_state >> 1;
+}
+
+long random(long howbig) {
+  return howbig > 0 ? random_next() % howbig : 0;
+}
+
+long random(long howsmall, long howbig) {
+  return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+  if (seed) random_state = seed;
+}
+
+char *ultoa(unsigned long value, char *str, int base) {
+  char buf[8 * sizeof(long) + 1], *p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  do {
+    unsigned long d = value % base;
+    *--p = d < 10 ? '0' + d : 'a' + d - 10;
+    value /= base;
+  } while (value);
+  return strcpy(str, p);
+}
+
+char *ltoa(long value, char *str, int base) {
+  if (value < 0 && base == 10) {
+    *str = '-';
+    ultoa(-(unsigned long)value, str + 1, base);
+    return str;
+  }
+  return ultoa((unsigned long)value, str, base);
+}
+
+char *itoa(int value, char *str, int base) {
+  return base == 10 ? ltoa(value, str, base) : ultoa((unsigned)value, str, base);
+}
+
+char *utoa(unsigned value, char *str, int base) {
+  return ultoa(value, str, base);
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout) {
+  sprintf(sout, "%*.*f", width, prec, val);
+  return sout;
+}
+
+// --------------------------------------------------------------------------
+// Print, as in the Arduino core
+// --------------------------------------------------------------------------
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) n += write(*buffer++);
+  return n;
+}
+
+size_t Print::print(const String &s) {
+  return write(s.c_str());
+}
+
+size_t Print::print(long n, int base) {
+  if (base == 0) return write((uint8_t)n);
+  if (base == 10 && n < 0) {
+    size_t t = print('-');
+    return t + printNumber(-(unsigned long)n, 10);
+  }
+  return printNumber(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  if (base == 0) return write((uint8_t)n);
+  return printNumber(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+  return printFloat(n, digits);
+}
+
+size_t Print::printNumber(unsigned long n, uint8_t base) {
+  char buf[8 * sizeof(long) + 1];
+  if (base < 2) base = 10;
+  return write(ultoa(n, buf, base));
+}
+
+size_t Print::printFloat(double number, uint8_t digits) {
+  size_t n = 0;
+  if (isnan(number)) return print("nan");
+  if (isinf(number)) return print("inf");
+  if (number > 4294967040.0) return print("ovf");
+  if (number < -4294967040.0) return print("ovf");
+
+  if (number < 0.0) {
+    n += print('-');
+    number = -number;
+  }
+
+  // Round correctly so that print(1.999, 2) prints as "2.00"
+  double rounding = 0.5;
+  for (uint8_t i = 0; i < digits; ++i) rounding /= 10.0;
+  number += rounding;
+
+  unsigned long int_part = (unsigned long)number;
+  double remainder = number - (double)int_part;
+  n += print(int_part);
+
+  if (digits > 0) n += print('.');
+  while (digits-- > 0) {
+    remainder *= 10.0;
+    int toPrint = int(remainder);
+    n += print(toPrint);
+    remainder -= toPrint;
+  }
+  return n;
+}
+
+// --------------------------------------------------------------------------
+// Serial port
+// --------------------------------------------------------------------------
+
+UARTClass Serial;
+
+void UARTClass::begin(unsigned long baud) { sim_serial_begin(baud); }
+void UARTClass::end() {}
+int UARTClass::available(void) { return sim_serial_available(); }
+int UARTClass::peek(void) { return sim_serial_peek(); }
+int UARTClass::read(void) { return sim_serial_read(); }
+void UARTClass::flush(void) {}
+size_t UARTClass::write(uint8_t c) { sim_serial_write(c); return 1; }
+
+#include "Wire.h"
+#include "SPI.h"
+
+TwoWire Wire;
+SPIClass SPI;
@@ -0,0 +1,322 @@
+// **************************************************************************
+//
+// Description: Arduino Due core for building the firmware on the host
+//
+// Only what Marlin uses. The registers of the SAM3X are plain structures,
+// the PIO set/clear registers report their writes to the simulation
+// (sim.cpp) and time is the virtual time of the simulation.
+// **************************************************************************
+
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <inttypes.h>
+
+// The C++ library before the macros below
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// __SAM3X8E__, F_CPU, ARDUINO and ARDUINO_ARCH_SAM come from the command line
+#define VARIANT_MCK 84000000UL
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define PI 3.1415926535897932384626433832795
+#define DEG_TO_RAD 0.017453292519943295769236907684886
+#define RAD_TO_DEG 57.295779513082320876798154814105
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+#define radians(deg) ((deg)*DEG_TO_RAD)
+#define degrees(rad) ((rad)*RAD_TO_DEG)
+#define sq(x) ((x)*(x))
+
+#define lowByte(w) ((uint8_t) ((w) & 0xff))
+#define highByte(w) ((uint8_t) ((w) >> 8))
+#define bit(b) (1UL << (b))
+#define _BV(b) (1UL << (b))
+
+// Analog pins
+#define A0 54
+#define A1 55
+#define A2 56
+#define A3 57
+#define A4 58
+#define A5 59
+#define A6 60
+#define A7 61
+#define A8 62
+#define A9 63
+#define A10 64
+#define A11 65
+
+// SPI pins of the Due
+#define SS 10
+#define MOSI 75
+#define MISO 74
+#define SCK 76
+
+// --------------------------------------------------------------------------
+// SAM3X peripherals
+// --------------------------------------------------------------------------
+
+typedef volatile uint32_t RoReg;
+typedef volatile uint32_t RwReg;
+typedef volatile uint32_t WoReg;
+
+struct Pio;
+
+// PIO_SODR and PIO_CODR: every write goes to the pins of the port
+struct PioSetClear {
+  Pio *pio;
+  bool set;
+  void operator=(uint32_t mask);
+  void operator|=(uint32_t mask) { *this = mask; }
+};
+
+struct Pio {
+  PioSetClear PIO_SODR, PIO_CODR;
+  RwReg PIO_PDSR;   // the levels of all pins, inputs as driven by the simulation
+  RwReg PIO_OSR;    // pins configured as outputs
+  uint8_t port;
+  Pio(uint8_t n) : PIO_PDSR(0), PIO_OSR(0), port(n) { PIO_SODR.pio = PIO_CODR.pio = this; PIO_SODR.set = true; PIO_CODR.set = false; }
+};
+extern Pio *const PIOA, *const PIOB, *const PIOC, *const PIOD;
+
+#define PIO_INPUT 0
+#define PIO_OUTPUT_0 1
+#define PIO_OUTPUT_1 2
+#define PIO_DEFAULT 0
+#define PIO_PULLUP 1
+
+#define PIO_PERIPH_A 3
+#define PIO_PA13A_TXD1 (1u << 13)
+#define PIO_PA16A_SCK1 (1u << 16)
+
+void PIO_Configure(Pio *pio, int type, uint32_t mask, uint32_t attribute);
+
+typedef enum _EAnalogChannel { NO_ADC = -1, ADC0 = 0 } EAnalogChannel;
+typedef enum { ADC_CHANNEL_0 = 0 } adc_channel_num_t;
+
+typedef struct _PinDescription {
+  Pio *pPort;
+  uint32_t ulPin;
+  uint32_t ulPeripheralId;
+  uint32_t ulPinType;
+  uint32_t ulPinConfiguration;
+  uint32_t ulPinAttribute;
+  int ulAnalogChannel;
+  int ulADCChannelNumber;
+  int ulPWMChannel;
+  int ulTCChannel;
+} PinDescription;
+extern const PinDescription g_APinDescription[];
+#define NUM_DIGITAL_PINS 92
+
+struct TcChannel {
+  WoReg TC_CCR;
+  RwReg TC_CMR;
+  RwReg TC_SMMR;
+  RoReg Reserved1;
+  RwReg TC_CV;    // set by the simulation before it calls the interrupt
+  RwReg TC_RA;
+  RwReg TC_RB;
+  RwReg TC_RC;
+  RoReg TC_SR;
+  WoReg TC_IER;
+  WoReg TC_IDR;
+  RoReg TC_IMR;
+};
+struct Tc { TcChannel TC_CHANNEL[3]; };
+extern Tc *const TC0, *const TC1, *const TC2;
+
+typedef enum IRQn {
+  TC0_IRQn = 27, TC1_IRQn, TC2_IRQn, TC3_IRQn, TC4_IRQn, TC5_IRQn, TC6_IRQn, TC7_IRQn, TC8_IRQn
+} IRQn_Type;
+
+#define ID_TC0 27
+#define ID_TC1 28
+#define ID_TC2 29
+#define ID_TC3 30
+#define ID_TC4 31
+#define ID_TC5 32
+#define ID_TC6 33
+#define ID_TC7 34
+#define ID_TC8 35
+
+// The interrupt handlers, defined by the firmware
+extern "C" {
+  void TC0_Handler(void); void TC1_Handler(void); void TC2_Handler(void);
+  void TC3_Handler(void); void TC4_Handler(void); void TC5_Handler(void);
+  void TC6_Handler(void); void TC7_Handler(void); void TC8_Handler(void);
+}
+
+#define TC_CCR_CLKEN 0x1u
+#define TC_CCR_CLKDIS 0x2u
+#define TC_CCR_SWTRG 0x4u
+#define TC_CMR_TCCLKS_TIMER_CLOCK1 0x0u
+#define TC_CMR_TCCLKS_TIMER_CLOCK2 0x1u
+#define TC_CMR_TCCLKS_TIMER_CLOCK3 0x2u
+#define TC_CMR_TCCLKS_TIMER_CLOCK4 0x3u
+#define TC_CMR_TCCLKS_TIMER_CLOCK5 0x4u
+#define TC_CMR_TCCLKS_Msk 0x7u
+#define TC_CMR_CPCTRG (0x1u << 14)
+#define TC_CMR_WAVSEL_UP_RC (0x2u << 13)
+#define TC_CMR_WAVE (0x1u << 15)
+#define TC_CMR_ACPA_CLEAR (0x2u << 16)
+#define TC_CMR_ACPC_CLEAR (0x2u << 18)
+#define TC_CMR_BCPB_CLEAR (0x2u << 24)
+#define TC_CMR_BCPC_CLEAR (0x2u << 26)
+#define TC_IER_CPAS (0x1u << 2)
+#define TC_IER_CPCS (0x1u << 4)
+#define TC_IDR_CPCS (0x1u << 4)
+#define TC_IMR_CPCS (0x1u << 4)
+#define TC_SR_CPAS (0x1u << 2)
+#define TC_SR_CPCS (0x1u << 4)
+
+void TC_Configure(Tc *tc, uint32_t channel, uint32_t mode);
+void TC_Start(Tc *tc, uint32_t channel);
+void TC_Stop(Tc *tc, uint32_t channel);
+void TC_SetRA(Tc *tc, uint32_t channel, uint32_t v);
+void TC_SetRB(Tc *tc, uint32_t channel, uint32_t v);
+void TC_SetRC(Tc *tc, uint32_t channel, uint32_t v);
+
+void pmc_set_writeprotect(uint32_t enable);
+uint32_t pmc_enable_periph_clk(uint32_t id);
+uint32_t pmc_disable_periph_clk(uint32_t id);
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_ClearPendingIRQ(IRQn_Type irq);
+void NVIC_SetPriorityGrouping(uint32_t group);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+uint32_t NVIC_GetPriority(IRQn_Type irq);
+uint32_t NVIC_EncodePriority(uint32_t group, uint32_t preempt, uint32_t sub);
+
+uint32_t __get_PRIMASK(void);
+void __disable_irq(void);
+void __enable_irq(void);
+
+// USART1, as the SPI master of the ST7920 display; the simulation sends
+// what is written to the display and reports the transfer state
+enum { USART_CR, USART_MR, USART_BRGR, USART_THR, USART_CSR, USART_TPR, USART_TCR, USART_PTCR };
+uint32_t sim_usart_read(uint8_t reg);
+void sim_usart_write(uint8_t reg, uint32_t v);
+
+struct UsartReg {
+  uint8_t reg;
+  operator uint32_t() const { return sim_usart_read(reg); }
+  void operator=(uint32_t v) { sim_usart_write(reg, v); }
+};
+struct Usart { UsartReg US_CR, US_MR, US_BRGR, US_THR, US_CSR, US_TPR, US_TCR, US_PTCR; };
+extern Usart *const USART1;
+
+#define ID_USART1 18
+#define US_CR_RSTRX (0x1u << 2)
+#define US_CR_RSTTX (0x1u << 3)
+#define US_CR_RXDIS (0x1u << 5)
+#define US_CR_TXEN (0x1u << 6)
+#define US_CR_TXDIS (0x1u << 7)
+#define US_MR_USART_MODE_SPI_MASTER 0xEu
+#define US_MR_USCLKS_MCK 0x0u
+#define US_MR_CHRL_8_BIT (0x3u << 6)
+#define US_MR_CPOL (0x1u << 16)
+#define US_MR_CLKO (0x1u << 18)
+#define US_CSR_TXEMPTY (0x1u << 9)
+#define US_PTCR_RXTDIS (0x1u << 1)
+#define US_PTCR_TXTEN (0x1u << 8)
+#define US_PTCR_TXTDIS (0x1u << 9)
+
+struct Adc { int dummy; };
+extern Adc *const ADC;
+uint32_t adc_get_channel_value(Adc *adc, adc_channel_num_t chan);
+void adc_enable_channel(Adc *adc, adc_channel_num_t chan);
+void adc_disable_channel(Adc *adc, adc_channel_num_t chan);
+void adc_start(Adc *adc);
+
+struct Wdt { int dummy; };
+extern Wdt *const WDT;
+#define WDT_MR_WDV_Pos 0
+#define WDT_MR_WDD_Pos 16
+#define WDT_MR_WDRSTEN (0x1u << 13)
+#define WDT_MR_WDDIS (0x1u << 15)
+void WDT_Enable(Wdt *wdt, uint32_t mode);
+void WDT_Disable(Wdt *wdt);
+void WDT_Restart(Wdt *wdt);
+
+extern "C" void *_sbrk(int incr);
+
+// --------------------------------------------------------------------------
+// Core functions
+// --------------------------------------------------------------------------
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield(void);
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+uint32_t analogRead(uint32_t pin);
+void analogWrite(uint32_t pin, uint32_t value);
+void analogReadResolution(int bits);
+void analogWriteResolution(int bits);
+
+#define interrupts() __enable_irq()
+#define noInterrupts() __disable_irq()
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+char *itoa(int value, char *str, int base);
+char *ltoa(long value, char *str, int base);
+char *utoa(unsigned value, char *str, int base);
+char *ultoa(unsigned long value, char *str, int base);
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout);
+
+#include <avr/pgmspace.h>
+#include "binary.h"
+#include "WString.h"
+#include "Print.h"
+#include "Stream.h"
+
+// The serial port, connected to the host side of the simulated link
+class UARTClass : public Stream {
+  public:
+    void begin(unsigned long baud);
+    void end();
+    int available(void);
+    int peek(void);
+    int read(void);
+    void flush(void);
+    size_t write(uint8_t c);
+    using Print::write;
+    operator bool() { return true; }
+};
+extern UARTClass Serial;
+
+#endif // _HOST_ARDUINO_H
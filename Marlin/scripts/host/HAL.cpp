@@ -0,0 +1,174 @@
+// **************************************************************************
+//
+// Description:          *** HAL for Arduino Due ***
+//
+// The HAL.cpp of the Due built for the host (scripts/host_build.py). The
+// timers are those of the Due, the simulation (sim.cpp) runs their
+// interrupts. The EEPROM is an array of the simulation, whether the
+// firmware keeps it in the flash or in an I2C EEPROM.
+// **************************************************************************
+
+#include "HAL.h"
+#include "Configuration.h"
+#include "sim.h"
+
+uint8_t MCUSR;
+
+void cli(void) {
+  noInterrupts();
+}
+
+void sei(void) {
+  interrupts();
+}
+
+// There is no heap to measure on the host
+int freeMemory() {
+  return 0;
+}
+
+// --------------------------------------------------------------------------
+// eeprom
+// --------------------------------------------------------------------------
+
+void eeprom_write_byte(unsigned char *pos, unsigned char value) {
+  unsigned address = (uintptr_t) pos;
+  if (address < sim_eeprom_size()) sim_eeprom()[address] = value;
+}
+
+unsigned char eeprom_read_byte(unsigned char *pos) {
+  unsigned address = (uintptr_t) pos;
+  return address < sim_eeprom_size() ? sim_eeprom()[address] : 0xFF;
+}
+
+bool eeprom_write_block(const void *src, void *pos, size_t n) {
+  unsigned address = (uintptr_t) pos;
+  if (address + n > sim_eeprom_size()) return false;
+  memcpy(sim_eeprom() + address, src, n);
+  return true;
+}
+
+void eeprom_read_block(void *dest, const void *pos, size_t n) {
+  for (size_t i = 0; i < n; i++)
+    ((uint8_t *) dest)[i] = eeprom_read_byte((unsigned char *)pos + i);
+}
+
+bool HAL_flash_write_page(uint32_t address, const uint8_t *data, bool erase) {
+  return false;
+}
+
+// --------------------------------------------------------------------------
+// Timers
+// --------------------------------------------------------------------------
+
+typedef struct {
+  Tc          *pTimerRegs;
+  uint16_t    channel;
+  IRQn_Type   IRQ_Id;
+} tTimerConfig;
+
+#define  NUM_HARDWARE_TIMERS 9
+
+static const tTimerConfig TimerConfig [NUM_HARDWARE_TIMERS] =
+{
+  { TC0, 0, TC0_IRQn},
+  { TC0, 1, TC1_IRQn},
+  { TC0, 2, TC2_IRQn},
+  { TC1, 0, TC3_IRQn},
+  { TC1, 1, TC4_IRQn},
+  { TC1, 2, TC5_IRQn},
+  { TC2, 0, TC6_IRQn},
+  { TC2, 1, TC7_IRQn},
+  { TC2, 2, TC8_IRQn},
+};
+
+void HAL_step_timer_start() {
+  Tc *tc = STEP_TIMER_COUNTER;
+  uint32_t channel = STEP_TIMER_CHANNEL;
+
+  TC_Configure(tc, channel, TC_CMR_WAVSEL_UP_RC | TC_CMR_WAVE | TC_CMR_TCCLKS_TIMER_CLOCK1);
+  tc->TC_CHANNEL[channel].TC_RC = (VARIANT_MCK >> 1) / 1000; // start with 1kHz
+  TC_Start(tc, channel);
+  sim_timer_irq(STEP_TIMER_NUM, true);
+}
+
+void HAL_temp_timer_start (uint8_t timer_num) {
+  Tc *tc = TimerConfig [timer_num].pTimerRegs;
+  uint32_t channel = TimerConfig [timer_num].channel;
+
+  TC_Configure (tc, channel, TC_CMR_CPCTRG | TC_CMR_TCCLKS_TIMER_CLOCK4);
+  tc->TC_CHANNEL[channel].TC_RC = (VARIANT_MCK >> 7) / TEMP_FREQUENCY;
+  TC_Start(tc, channel);
+  sim_timer_irq(timer_num, true);
+}
+
+void HAL_motion_timer_start (uint8_t timer_num, uint32_t frequency) {
+  Tc *tc = TimerConfig [timer_num].pTimerRegs;
+  uint32_t channel = TimerConfig [timer_num].channel;
+
+  TC_Configure (tc, channel, TC_CMR_WAVSEL_UP_RC | TC_CMR_WAVE | TC_CMR_TCCLKS_TIMER_CLOCK1);
+  tc->TC_CHANNEL[channel].TC_RC = (VARIANT_MCK >> 1) / frequency;
+  TC_Start(tc, channel);
+  sim_timer_irq(timer_num, false); // enabled by the stepper interrupt when it queues steps for this timer
+}
+
+void HAL_timer_enable_interrupt (uint8_t timer_num) {
+  sim_timer_irq(timer_num, true);
+}
+
+void HAL_timer_disable_interrupt (uint8_t timer_num) {
+  sim_timer_irq(timer_num, false);
+}
+
+int HAL_timer_get_count (uint8_t timer_num) {
+  Tc *tc = TimerConfig [timer_num].pTimerRegs;
+  uint32_t channel = TimerConfig [timer_num].channel;
+  return tc->TC_CHANNEL[channel].TC_RC;
+}
+
+static uint32_t tone_pin;
+
+void tone(uint8_t pin, int frequency) {
+  uint8_t timer_num = BEEPER_TIMER_NUM;
+  Tc *tc = TimerConfig [timer_num].pTimerRegs;
+  uint32_t channel = TimerConfig [timer_num].channel;
+
+  SET_OUTPUT(pin);
+  tone_pin = pin;
+  TC_Configure(tc, channel, TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | TC_CMR_TCCLKS_TIMER_CLOCK4);
+  uint32_t rc = VARIANT_MCK / 128 / frequency;
+  TC_SetRA(tc, channel, rc/2);
+  TC_SetRC(tc, channel, rc);
+  TC_Start(tc, channel);
+  sim_timer_irq(timer_num, true);
+}
+
+void noTone(uint8_t pin) {
+  uint8_t timer_num = BEEPER_TIMER_NUM;
+  TC_Stop(TimerConfig [timer_num].pTimerRegs, TimerConfig [timer_num].channel);
+  WRITE_VAR(pin, LOW);
+}
+
+HAL_BEEPER_TIMER_ISR {
+  static bool toggle;
+
+  HAL_timer_isr_status(BEEPER_TIMER_COUNTER, BEEPER_TIMER_CHANNEL);
+  WRITE_VAR(tone_pin, toggle);
+  toggle = !toggle;
+}
+
+// --------------------------------------------------------------------------
+// ADC
+// --------------------------------------------------------------------------
+
+uint16_t getAdcReading(adc_channel_num_t chan) {
+  return sim_adc_value(chan);
+}
+
+void startAdcConversion(adc_channel_num_t chan) {
+}
+
+adc_channel_num_t pinToAdcChannel(int pin) {
+  if (pin < A0) pin += A0;
+  return (adc_channel_num_t) (int) g_APinDescription[pin].ulADCChannelNumber;
+}
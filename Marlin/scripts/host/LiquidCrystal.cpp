@@ -0,0 +1,80 @@
+// **************************************************************************
+//
+// Description: LiquidCrystal on the host
+//
+// **************************************************************************
+
+#include "LiquidCrystal.h"
+
+#define LCD_MAX_COLS 40
+#define LCD_MAX_ROWS 4
+
+// The display memory and the custom characters of the display
+static char ddram[LCD_MAX_ROWS][LCD_MAX_COLS];
+static uint8_t cgram[8][8];
+static uint8_t lcd_cols = 16, lcd_rows = 2, cursor_col, cursor_row;
+static char screen[LCD_MAX_ROWS * (LCD_MAX_COLS + 1) + 1];
+
+// The library waits 100us after each of the two nibbles
+#define LCD_BYTE_US 204
+#define LCD_CLEAR_US 2000
+
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3) {
+  memset(ddram, ' ', sizeof(ddram));
+}
+
+LiquidCrystal::LiquidCrystal(uint8_t rs, uint8_t rw, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3) {
+  memset(ddram, ' ', sizeof(ddram));
+}
+
+void LiquidCrystal::begin(uint8_t cols, uint8_t rows, uint8_t charsize) {
+  lcd_cols = min(cols, LCD_MAX_COLS);
+  lcd_rows = min(rows, LCD_MAX_ROWS);
+  delayMicroseconds(50000);  // power up
+  clear();
+}
+
+void LiquidCrystal::command() {
+  delayMicroseconds(LCD_BYTE_US);
+}
+
+void LiquidCrystal::clear() {
+  memset(ddram, ' ', sizeof(ddram));
+  cursor_col = cursor_row = 0;
+  delayMicroseconds(LCD_BYTE_US + LCD_CLEAR_US);
+}
+
+void LiquidCrystal::home() {
+  cursor_col = cursor_row = 0;
+  delayMicroseconds(LCD_BYTE_US + LCD_CLEAR_US);
+}
+
+void LiquidCrystal::setCursor(uint8_t col, uint8_t row) {
+  cursor_col = col;
+  cursor_row = row;
+  command();
+}
+
+void LiquidCrystal::createChar(uint8_t location, uint8_t charmap[]) {
+  memcpy(cgram[location & 7], charmap, 8);
+  delayMicroseconds(LCD_BYTE_US * 9);
+}
+
+size_t LiquidCrystal::write(uint8_t c) {
+  if (cursor_row < lcd_rows && cursor_col < lcd_cols) ddram[cursor_row][cursor_col] = c;
+  cursor_col++;
+  delayMicroseconds(LCD_BYTE_US);
+  return 1;
+}
+
+// The rows of the screen, one line each. Custom characters are their code 0 to 7.
+extern "C" const char *sim_lcd_text() {
+  char *p = screen;
+  for (uint8_t r = 0; r < lcd_rows; r++) {
+    memcpy(p, ddram[r], lcd_cols);
+    p += lcd_cols;
+    *p++ = '\n';
+  }
+  *p = '\0';
+  return screen;
+}
@@ -0,0 +1,38 @@
+// **************************************************************************
+//
+// Description: LiquidCrystal on the host, a HD44780 with 4 data lines
+//
+// Keeps the characters in the display memory and takes the time of the
+// Arduino library for every byte, sim_lcd_text() returns the screen.
+// **************************************************************************
+
+#ifndef _HOST_LIQUIDCRYSTAL_H
+#define _HOST_LIQUIDCRYSTAL_H
+
+#include "Arduino.h"
+
+class LiquidCrystal : public Print {
+  public:
+    LiquidCrystal(uint8_t rs, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+    LiquidCrystal(uint8_t rs, uint8_t rw, uint8_t enable, uint8_t d0, uint8_t d1, uint8_t d2, uint8_t d3);
+
+    void begin(uint8_t cols, uint8_t rows, uint8_t charsize = 0);
+    void clear();
+    void home();
+    void noDisplay() { command(); }
+    void display() { command(); }
+    void noCursor() { command(); }
+    void cursor() { command(); }
+    void noBlink() { command(); }
+    void blink() { command(); }
+    void setCursor(uint8_t col, uint8_t row);
+    void createChar(uint8_t location, uint8_t charmap[]);
+    void createChar(uint8_t location, const uint8_t charmap[]) { createChar(location, (uint8_t *)charmap); }
+    virtual size_t write(uint8_t c);
+    using Print::write;
+
+  private:
+    void command();
+};
+
+#endif // _HOST_LIQUIDCRYSTAL_H
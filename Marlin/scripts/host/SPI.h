@@ -0,0 +1,40 @@
+// **************************************************************************
+//
+// Description: SPI on the host, no device answers on the bus
+//
+// **************************************************************************
+
+#ifndef _HOST_SPI_H
+#define _HOST_SPI_H
+
+#include "Arduino.h"
+
+#define SPI_MODE0 0x02
+#define SPI_MODE1 0x00
+#define SPI_MODE2 0x03
+#define SPI_MODE3 0x01
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_CLOCK_DIV2 11
+#define SPI_CLOCK_DIV4 21
+#define SPI_CLOCK_DIV8 42
+#define SPI_CLOCK_DIV16 84
+#define SPI_CLOCK_DIV32 168
+#define SPI_CLOCK_DIV64 255
+#define SPI_CLOCK_DIV128 255
+
+class SPIClass {
+  public:
+    void begin() {}
+    void begin(uint8_t pin) {}
+    void end() {}
+    uint8_t transfer(uint8_t data) { return 0xFF; }
+    uint8_t transfer(uint8_t pin, uint8_t data) { return 0xFF; }
+    void setBitOrder(uint8_t order) {}
+    void setDataMode(uint8_t mode) {}
+    void setClockDivider(uint8_t divider) {}
+};
+
+extern SPIClass SPI;
+
+#endif // _HOST_SPI_H
@@ -0,0 +1,142 @@
+/* Arduino Sd2Card Library
+ * Copyright (C) 2009 by William Greiman
+ *
+ * This file is part of the Arduino Sd2Card Library
+ *
+ * This Library is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This Library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with the Arduino Sd2Card Library.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+// The Sd2Card.cpp of the host build (scripts/host_build.py): the blocks are
+// those of the card image of the simulation, which also takes the time of
+// the transfers. Without an image init() fails like a missing card.
+
+#include "Marlin.h"
+
+#ifdef SDSUPPORT
+#include "Sd2Card.h"
+#include "sim.h"
+
+static uint32_t stream_block;   // the next block of readData(), writeData()
+
+uint8_t Sd2Card::cardCommand(uint8_t cmd, uint32_t arg) {
+  return 0;
+}
+
+uint32_t Sd2Card::cardSize() {
+  return sim_sd_blocks();
+}
+
+void Sd2Card::chipSelectHigh() {}
+void Sd2Card::chipSelectLow() {}
+
+bool Sd2Card::erase(uint32_t firstBlock, uint32_t lastBlock) {
+  uint8_t zero[512];
+  memset(zero, 0, sizeof(zero));
+  for (uint32_t b = firstBlock; b <= lastBlock; b++)
+    if (!sim_sd_write(b, zero)) {
+      error(SD_CARD_ERROR_ERASE);
+      return false;
+    }
+  return true;
+}
+
+bool Sd2Card::eraseSingleBlockEnable() {
+  return true;
+}
+
+bool Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
+  errorCode_ = type_ = 0;
+  chipSelectPin_ = chipSelectPin;
+  if (!sim_sd_blocks()) {
+    error(SD_CARD_ERROR_CMD0);
+    return false;
+  }
+  type(SD_CARD_TYPE_SDHC);
+  return setSckRate(sckRateID);
+}
+
+bool Sd2Card::readBlock(uint32_t blockNumber, uint8_t* dst) {
+  if (!sim_sd_read(blockNumber, dst)) {
+    error(SD_CARD_ERROR_CMD17);
+    return false;
+  }
+  return true;
+}
+
+bool Sd2Card::readData(uint8_t *dst) {
+  return readData(dst, 512);
+}
+
+bool Sd2Card::readData(uint8_t* dst, uint16_t count) {
+  if (!sim_sd_read(stream_block++, dst)) {
+    error(SD_CARD_ERROR_READ);
+    return false;
+  }
+  return true;
+}
+
+bool Sd2Card::readRegister(uint8_t cmd, void* buf) {
+  error(SD_CARD_ERROR_READ_REG);
+  return false;
+}
+
+bool Sd2Card::readStart(uint32_t blockNumber) {
+  stream_block = blockNumber;
+  return true;
+}
+
+bool Sd2Card::readStop() {
+  return true;
+}
+
+bool Sd2Card::setSckRate(uint8_t sckRateID) {
+  spiRate_ = sckRateID;
+  return true;
+}
+
+bool Sd2Card::waitNotBusy(uint16_t timeoutMillis) {
+  return true;
+}
+
+bool Sd2Card::writeBlock(uint32_t blockNumber, const uint8_t* src) {
+  if (!sim_sd_write(blockNumber, src)) {
+    error(SD_CARD_ERROR_WRITE);
+    return false;
+  }
+  return true;
+}
+
+bool Sd2Card::writeData(const uint8_t* src) {
+  if (!sim_sd_write(stream_block++, src)) {
+    error(SD_CARD_ERROR_WRITE_MULTIPLE);
+    return false;
+  }
+  return true;
+}
+
+bool Sd2Card::writeData(uint8_t token, const uint8_t* src) {
+  return writeData(src);
+}
+
+bool Sd2Card::writeStart(uint32_t blockNumber, uint32_t eraseCount) {
+  stream_block = blockNumber;
+  return true;
+}
+
+bool Sd2Card::writeStop() {
+  return true;
+}
+
+#endif // SDSUPPORT
@@ -0,0 +1,20 @@
+// **************************************************************************
+//
+// Description: Stream of the Arduino core
+//
+// **************************************************************************
+
+#ifndef _HOST_STREAM_H
+#define _HOST_STREAM_H
+
+#include "Print.h"
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+};
+
+#endif // _HOST_STREAM_H
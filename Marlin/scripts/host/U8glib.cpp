@@ -0,0 +1,168 @@
+// **************************************************************************
+//
+// Description: U8glib on the host, see U8glib.h
+//
+// The fonts are those of u8glib: a 17 byte header, then the glyphs from the
+// start encoding on, format 1 packing the glyph header into 3 bytes.
+// **************************************************************************
+
+#include "U8glib.h"
+#include "sim.h"
+
+// --------------------------------------------------------------------------
+// Pages
+// --------------------------------------------------------------------------
+
+uint8_t u8g_page_First(u8g_page_t *p) {
+  p->page = 0;
+  p->page_y0 = 0;
+  p->page_y1 = min(p->page_height, p->total_height) - 1;
+  return 1;
+}
+
+uint8_t u8g_page_Next(u8g_page_t *p) {
+  unsigned y0 = p->page_y1 + 1;
+  if (y0 >= p->total_height) return 0;
+  p->page++;
+  p->page_y0 = y0;
+  p->page_y1 = min(y0 + p->page_height, (unsigned)p->total_height) - 1;
+  return 1;
+}
+
+static uint8_t pb_base_fn(u8g_dev_t *dev, uint8_t msg) {
+  u8g_pb_t *pb = (u8g_pb_t *)dev->dev_mem;
+  switch (msg) {
+    case U8G_DEV_MSG_PAGE_FIRST:
+      memset(pb->buf, 0, pb->width * pb->p.page_height / 8);
+      return u8g_page_First(&pb->p);
+    case U8G_DEV_MSG_PAGE_NEXT:
+      if (!u8g_page_Next(&pb->p)) return 0;
+      memset(pb->buf, 0, pb->width * pb->p.page_height / 8);
+      return 1;
+  }
+  return 1;
+}
+
+uint8_t u8g_dev_pb8h1_base_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg) { return pb_base_fn(dev, msg); }
+uint8_t u8g_dev_pb16h1_base_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg) { return pb_base_fn(dev, msg); }
+uint8_t u8g_dev_pb32h1_base_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg) { return pb_base_fn(dev, msg); }
+uint8_t u8g_com_null_fn(u8g_t *u8g, uint8_t msg, uint8_t arg_val, void *arg_ptr) { return 1; }
+
+void u8g_Delay(uint16_t ms) { delay(ms); }
+void u8g_10MicroDelay(void) { delayMicroseconds(10); }
+
+// --------------------------------------------------------------------------
+// The picture loop
+// --------------------------------------------------------------------------
+
+U8GLIB::U8GLIB(u8g_dev_t *dev) : tx(0), ty(0), capture(false) {
+  u8g.dev = dev;
+  u8g.font = NULL;
+  u8g.color_index = 1;
+  u8g.initialized = false;  // the device is set up by the first picture loop, after the pins
+}
+
+u8g_uint_t U8GLIB::getWidth() { return ((u8g_pb_t *)u8g.dev->dev_mem)->width; }
+u8g_uint_t U8GLIB::getHeight() { return ((u8g_pb_t *)u8g.dev->dev_mem)->p.total_height; }
+
+void U8GLIB::firstPage() {
+  if (!u8g.initialized) {
+    u8g.initialized = true;
+    u8g.dev->dev_fn(&u8g, u8g.dev, U8G_DEV_MSG_INIT, NULL);
+  }
+  if (!capture) sim_lcd_frame_begin();
+  u8g.dev->dev_fn(&u8g, u8g.dev, U8G_DEV_MSG_PAGE_FIRST, NULL);
+}
+
+uint8_t U8GLIB::nextPage() {
+  uint64_t start = sim_main_time();
+  uint8_t more = u8g.dev->dev_fn(&u8g, u8g.dev, U8G_DEV_MSG_PAGE_NEXT, NULL);
+  if (!capture) {
+    sim_lcd_busy(sim_main_time() - start);
+    if (!more) sim_lcd_frame_end();
+  }
+  return more;
+}
+
+// --------------------------------------------------------------------------
+// Drawing
+// --------------------------------------------------------------------------
+
+void U8GLIB::setPixel(int x, int y) {
+  u8g_pb_t *pb = (u8g_pb_t *)u8g.dev->dev_mem;
+  if (x < 0 || x >= pb->width || y < pb->p.page_y0 || y > pb->p.page_y1) return;
+  uint8_t *p = (uint8_t *)pb->buf + (y - pb->p.page_y0) * (pb->width / 8) + x / 8;
+  uint8_t mask = 0x80 >> (x & 7);
+  if (u8g.color_index) *p |= mask; else *p &= ~mask;
+}
+
+void U8GLIB::draw8Pixel(int x, int y, uint8_t bits) {
+  for (int i = 0; i < 8; i++)
+    if (bits & (0x80 >> i)) setPixel(x + i, y);
+}
+
+void U8GLIB::drawPixel(u8g_uint_t x, u8g_uint_t y) { setPixel(x, y); }
+
+void U8GLIB::drawBox(u8g_uint_t x, u8g_uint_t y, u8g_uint_t w, u8g_uint_t h) {
+  for (int j = 0; j < h; j++)
+    for (int i = 0; i < w; i++) setPixel(x + i, y + j);
+}
+
+void U8GLIB::drawFrame(u8g_uint_t x, u8g_uint_t y, u8g_uint_t w, u8g_uint_t h) {
+  if (!w || !h) return;
+  for (int i = 0; i < w; i++) { setPixel(x + i, y); setPixel(x + i, y + h - 1); }
+  for (int j = 0; j < h; j++) { setPixel(x, y + j); setPixel(x + w - 1, y + j); }
+}
+
+void U8GLIB::drawBitmapP(u8g_uint_t x, u8g_uint_t y, u8g_uint_t cnt, u8g_uint_t h, const u8g_pgm_uint8_t *bitmap) {
+  for (int j = 0; j < h; j++)
+    for (int i = 0; i < cnt; i++) draw8Pixel(x + 8 * i, y + j, *bitmap++);
+}
+
+// u8g_draw_glyph() with the baseline as reference, returns the advance
+int8_t U8GLIB::drawGlyph(int x, int y, uint8_t encoding) {
+  const uint8_t *f = u8g.font;
+  if (!f) return 0;
+  uint8_t format = f[0], start = f[10], end = f[11];
+  uint8_t size = format == 1 ? 3 : 6, mask = format == 1 ? 15 : 255;
+  unsigned pos65 = f[6] << 8 | f[7], pos97 = f[8] << 8 | f[9];
+  if (encoding > end) return 0;
+  unsigned p = 17, i = start;
+  if (encoding >= 97 && pos97) { p = pos97; i = 97; }
+  else if (encoding >= 65 && pos65) { p = pos65; i = 65; }
+  for (; i <= end; i++) {
+    if (f[p] == 255) { p++; continue; }
+    if (i == encoding) {
+      int w, h, dx, gx, gy;
+      if (format == 1) {
+        gy = (f[p] & 15) - 2; gx = f[p] >> 4;
+        h = f[p + 1] & 15; w = f[p + 1] >> 4;
+        dx = f[p + 2] >> 4;
+      }
+      else {
+        w = f[p]; h = f[p + 1]; dx = (int8_t)f[p + 3];
+        gx = (int8_t)f[p + 4]; gy = (int8_t)f[p + 5];
+      }
+      const uint8_t *data = f + p + size;
+      int bytes = (w + 7) / 8;
+      x += gx;
+      y -= gy + 1;
+      for (int j = 0; j < h; j++)
+        for (int k = 0; k < bytes; k++) draw8Pixel(x + 8 * k, y - h + 1 + j, *data++);
+      return dx;
+    }
+    p += (f[p + 2] & mask) + size;
+  }
+  return 0;
+}
+
+u8g_uint_t U8GLIB::drawStr(u8g_uint_t x, u8g_uint_t y, const char *s) {
+  int start = x;
+  while (*s) x += drawGlyph(x, y, (uint8_t)*s++);
+  return x - start;
+}
+
+size_t U8GLIB::write(uint8_t c) {
+  tx += drawGlyph(tx, ty, c);
+  return 1;
+}
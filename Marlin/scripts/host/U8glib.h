@@ -0,0 +1,120 @@
+// **************************************************************************
+//
+// Description: U8glib on the host, what Marlin uses of it
+//
+// The picture loop, the page buffer devices (u8g_dev_pb8h1_base_fn and the
+// 16 and 32 row ones) and the drawing calls, with u8g fonts. Drawing goes
+// straight into the page buffer of the device. Rotation is not supported.
+// The display devices themselves are those of the firmware, with
+// ultralcd_st7920_u8glib_rrd.h sending the pages to the display the
+// simulation models (sim.cpp).
+// **************************************************************************
+
+#ifndef _HOST_U8GLIB_H
+#define _HOST_U8GLIB_H
+
+#include "Arduino.h"
+
+typedef uint8_t u8g_uint_t;
+typedef uint8_t u8g_fntpgm_uint8_t;
+typedef uint8_t u8g_pgm_uint8_t;
+
+#define U8G_SECTION(name)
+#define U8G_NOCOMMON
+#define U8G_PROGMEM
+
+#define U8G_DEV_MSG_INIT 10
+#define U8G_DEV_MSG_STOP 11
+#define U8G_DEV_MSG_CONTRAST 15
+#define U8G_DEV_MSG_PAGE_FIRST 20
+#define U8G_DEV_MSG_PAGE_NEXT 21
+
+#define U8G_I2C_OPT_NONE 0
+#define U8G_I2C_OPT_NO_ACK 2
+#define U8G_I2C_OPT_DEV_0 0
+#define U8G_I2C_OPT_FAST 16
+
+typedef struct _u8g_t u8g_t;
+typedef struct _u8g_dev_t u8g_dev_t;
+typedef uint8_t (*u8g_dev_fnptr)(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg);
+typedef uint8_t (*u8g_com_fnptr)(u8g_t *u8g, uint8_t msg, uint8_t arg_val, void *arg_ptr);
+
+struct _u8g_dev_t {
+  u8g_dev_fnptr dev_fn;
+  void *dev_mem;
+  u8g_com_fnptr com_fn;
+};
+
+typedef struct {
+  u8g_uint_t page_height;
+  u8g_uint_t total_height;
+  u8g_uint_t page;
+  u8g_uint_t page_y0;
+  u8g_uint_t page_y1;
+} u8g_page_t;
+
+typedef struct {
+  u8g_page_t p;
+  u8g_uint_t width;
+  void *buf;
+} u8g_pb_t;
+
+struct _u8g_t {
+  u8g_dev_t *dev;
+  const u8g_fntpgm_uint8_t *font;
+  uint8_t color_index;
+  bool initialized;
+};
+
+uint8_t u8g_page_First(u8g_page_t *p);
+uint8_t u8g_page_Next(u8g_page_t *p);
+
+uint8_t u8g_dev_pb8h1_base_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg);
+uint8_t u8g_dev_pb16h1_base_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg);
+uint8_t u8g_dev_pb32h1_base_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg);
+uint8_t u8g_com_null_fn(u8g_t *u8g, uint8_t msg, uint8_t arg_val, void *arg_ptr);
+
+void u8g_Delay(uint16_t ms);
+void u8g_10MicroDelay(void);
+
+class U8GLIB : public Print {
+  public:
+    U8GLIB(u8g_dev_t *dev);
+
+    u8g_t *getU8g() { return &u8g; }
+    u8g_uint_t getWidth();
+    u8g_uint_t getHeight();
+
+    void firstPage();
+    uint8_t nextPage();
+
+    void setColorIndex(uint8_t color) { u8g.color_index = color; }
+    void setContrast(uint8_t contrast) {}
+    void setRot90() {}
+    void setRot180() {}
+    void setRot270() {}
+    void setFont(const u8g_fntpgm_uint8_t *font) { u8g.font = font; }
+
+    void drawPixel(u8g_uint_t x, u8g_uint_t y);
+    void drawBox(u8g_uint_t x, u8g_uint_t y, u8g_uint_t w, u8g_uint_t h);
+    void drawFrame(u8g_uint_t x, u8g_uint_t y, u8g_uint_t w, u8g_uint_t h);
+    void drawBitmapP(u8g_uint_t x, u8g_uint_t y, u8g_uint_t cnt, u8g_uint_t h, const u8g_pgm_uint8_t *bitmap);
+    u8g_uint_t drawStr(u8g_uint_t x, u8g_uint_t y, const char *s);
+
+    void setPrintPos(u8g_uint_t x, u8g_uint_t y) { tx = x; ty = y; }
+    size_t write(uint8_t c);
+    using Print::write;
+
+    // The simulation draws frames of its own with the picture loop of the firmware
+    void setCapture(bool on) { capture = on; }
+
+  private:
+    u8g_t u8g;
+    u8g_uint_t tx, ty;
+    bool capture;
+    void setPixel(int x, int y);
+    void draw8Pixel(int x, int y, uint8_t bits);
+    int8_t drawGlyph(int x, int y, uint8_t encoding);
+};
+
+#endif // _HOST_U8GLIB_H
@@ -0,0 +1,21 @@
+// **************************************************************************
+//
+// Description: String of the Arduino core, as far as Marlin uses it
+//
+// **************************************************************************
+
+#ifndef _HOST_WSTRING_H
+#define _HOST_WSTRING_H
+
+#include <string>
+
+class String {
+  public:
+    String(const char *s = "") : s(s ? s : "") {}
+    const char *c_str() const { return s.c_str(); }
+    unsigned int length() const { return s.length(); }
+  private:
+    std::string s;
+};
+
+#endif // _HOST_WSTRING_H
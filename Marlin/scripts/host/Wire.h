@@ -0,0 +1,34 @@
+// **************************************************************************
+//
+// Description: Wire on the host, no device answers on the bus
+//
+// **************************************************************************
+
+#ifndef _HOST_WIRE_H
+#define _HOST_WIRE_H
+
+#include "Arduino.h"
+
+#define BUFFER_LENGTH 32
+
+class TwoWire : public Stream {
+  public:
+    void begin() {}
+    void beginTransmission(uint8_t address) {}
+    void beginTransmission(int address) {}
+    uint8_t endTransmission(bool stop = true) { return 2; }  // address not acknowledged
+    uint8_t requestFrom(uint8_t address, uint8_t quantity) { return 0; }
+    uint8_t requestFrom(int address, int quantity) { return 0; }
+    size_t write(uint8_t c) { return 1; }
+    size_t write(const uint8_t *data, size_t n) { return n; }
+    using Print::write;
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    void flush() {}
+    void setClock(uint32_t clock) {}
+};
+
+extern TwoWire Wire;
+
+#endif // _HOST_WIRE_H
@@ -0,0 +1,5 @@
+// **************************************************************************
+//
+// Description: Nothing to declare, interrupts are the timers of HAL.h
+//
+// **************************************************************************
@@ -0,0 +1,5 @@
+// **************************************************************************
+//
+// Description: pins_arduino.h of the Due variant, the pins are in Arduino.h
+//
+// **************************************************************************
@@ -0,0 +1,1341 @@
+// **************************************************************************
+//
+// Description: The machine around the host build of the firmware
+//
+// Marlin_main.cpp is built into this file so the simulation can see its
+// command queue. The rest of the firmware is built as it is, against the
+// Arduino core in this directory. The entry points at the end are used by
+// the scripts through ctypes, see scripts/host_build.py.
+//
+// The machine:
+//  - steppers count the step pulses their drivers get while enabled and
+//    move the axes, through the kinematics of the configuration
+//  - endstops and the Z probe switch where the configuration says they are,
+//    the bed under the probe is a plane
+//  - heaters warm their thermistors, which read back through the tables
+//    of the configuration
+//  - the serial port is connected to a host that sends the G-code lines,
+//    as many as it has no "ok" for yet as the window allows
+//  - an ST7920 graphic display takes the bytes of its serial interface,
+//    bit-banged on the pins or from USART1 (ST7920_USART_SPI)
+// **************************************************************************
+
+#include "Marlin_main.cpp"
+
+#include <setjmp.h>
+#include <string>
+#include <vector>
+#include "sim.h"
+
+// From sim_stepper.cpp
+block_t *sim_current_block(void);
+int sim_step_loops(void);
+bool sim_synchronizing(void);
+
+#pragma weak TC0_Handler
+#pragma weak TC1_Handler
+#pragma weak TC2_Handler
+#pragma weak TC3_Handler
+#pragma weak TC4_Handler
+#pragma weak TC5_Handler
+#pragma weak TC6_Handler
+#pragma weak TC7_Handler
+#pragma weak TC8_Handler
+
+#define SIM_TICKS_PER_US (HAL_TIMER_RATE / 1000000)
+#define SIM_TICKS_PER_S ((uint64_t)HAL_TIMER_RATE)
+
+static inline double ticks_to_s(uint64_t t) { return (double)t / SIM_TICKS_PER_S; }
+
+// --------------------------------------------------------------------------
+// Virtual time and the timer interrupts
+// --------------------------------------------------------------------------
+
+struct SimTimer {
+  void (*handler)(void);
+  bool running, irq, pending;
+  uint32_t tpc;       // ticks per count
+  uint64_t base;      // time of the last compare match, the counter started from 0 there
+  uint64_t cost;      // time each interrupt takes
+  uint64_t calls, busy, latency_max, missed;
+};
+
+static SimTimer timers[9];
+static uint64_t now, poll_ticks = SIM_TICKS_PER_US, cmd_ticks = 150 * SIM_TICKS_PER_US;
+static bool irq_enabled = true, in_isr = false;
+
+static jmp_buf run_jmp;
+static bool run_active = false, killed = false;
+static uint64_t run_end;
+
+static TcChannel &timer_channel(uint8_t n) {
+  Tc *tc = n < 3 ? TC0 : n < 6 ? TC1 : TC2;
+  return tc->TC_CHANNEL[n % 3];
+}
+
+static uint64_t timer_match(uint8_t n) {
+  uint32_t rc = timer_channel(n).TC_RC;
+  return timers[n].base + (rc ? (uint64_t)rc : (1ULL << 32)) * timers[n].tpc;
+}
+
+// Latch the compare matches up to now
+static void timers_latch(void) {
+  for (uint8_t n = 0; n < 9; n++) {
+    SimTimer &tm = timers[n];
+    if (!tm.running) continue;
+    for (uint64_t m; (m = timer_match(n)) <= now;) {
+      tm.base = m;
+      tm.pending = true;
+    }
+  }
+}
+
+static void record_step_isr(void);
+static void note_queued(void);
+
+// Run the pending interrupts, the earliest match first
+static void timers_dispatch(void) {
+  if (in_isr) return;
+  for (;;) {
+    if (!irq_enabled) return;
+    timers_latch();
+    int next = -1;
+    for (uint8_t n = 0; n < 9; n++) {
+      SimTimer &tm = timers[n];
+      if (tm.pending && tm.irq && tm.handler && (next < 0 || tm.base < timers[next].base)) next = n;
+    }
+    if (next < 0) return;
+    SimTimer &tm = timers[next];
+    TcChannel &ch = timer_channel(next);
+    tm.pending = false;
+    uint64_t latency = now - tm.base;
+    if (latency > tm.latency_max) tm.latency_max = latency;
+    ch.TC_CV = (uint32_t)((latency + tm.cost) / tm.tpc);
+    uint64_t start = now;
+    in_isr = true;
+    tm.handler();
+    in_isr = false;
+    now += tm.cost;
+    tm.calls++;
+    tm.busy += now - start;
+    // The counter ran past a compare value set too late, it wraps before it matches
+    if (tm.running && timer_match(next) < now) {
+      tm.missed++;
+      tm.base += (1ULL << 32) * tm.tpc;
+    }
+    if (next == STEP_TIMER_NUM) record_step_isr();
+  }
+}
+
+static uint64_t timers_next_match(void) {
+  uint64_t next = UINT64_MAX;
+  for (uint8_t n = 0; n < 9; n++) {
+    SimTimer &tm = timers[n];
+    if (tm.running && tm.irq && tm.handler) {
+      uint64_t m = tm.pending ? now : timer_match(n);
+      if (m < next) next = m;
+    }
+  }
+  return next;
+}
+
+static void serial_update(void);
+
+static void check_run(void) {
+  if (!run_active || in_isr) return;
+  if (killed) longjmp(run_jmp, 1);
+  if (now >= run_end) longjmp(run_jmp, 2);
+}
+
+uint64_t sim_time(void) { return now; }
+
+void sim_wait(uint64_t ticks) {
+  if (in_isr) { now += ticks; return; }
+  uint64_t target = now + ticks;
+  for (;;) {
+    uint64_t m = irq_enabled ? timers_next_match() : UINT64_MAX;
+    if (m > target) break;
+    if (m > now) now = m;
+    timers_dispatch();
+  }
+  if (target > now) now = target;
+  timers_dispatch();
+  serial_update();
+  check_run();
+}
+
+void sim_poll(void) {
+  if (in_isr) return;
+  sim_wait(poll_ticks);
+}
+
+void sim_irq_enable(bool on) {
+  irq_enabled = on;
+  if (on) timers_dispatch();
+}
+
+bool sim_irq_enabled(void) { return irq_enabled; }
+
+void sim_timer_start(uint8_t n, uint32_t ticks_per_count) {
+  SimTimer &tm = timers[n];
+  tm.running = true;
+  tm.pending = false;
+  tm.tpc = ticks_per_count;
+  tm.base = now;
+}
+
+void sim_timer_stop(uint8_t n) {
+  timers[n].running = timers[n].pending = false;
+}
+
+void sim_timer_irq(uint8_t n, bool on) {
+  timers[n].irq = on;
+  if (on) timers_dispatch();
+}
+
+// --------------------------------------------------------------------------
+// The machine
+// --------------------------------------------------------------------------
+
+enum { ROLE_NONE, ROLE_STEP, ROLE_DIR, ROLE_ENABLE, ROLE_HEATER, ROLE_SWITCH, ROLE_SD_DETECT, ROLE_LCD_CLK, ROLE_LCD_CS };
+
+struct Motor {
+  int8_t axis;        // X_AXIS .. E_AXIS
+  int8_t carriage;    // 1: the second X carriage, or the second Y or Z stepper
+  int8_t extruder;
+  bool invert_step, invert_dir, enable_on, has_enable;
+  bool enabled, forward;
+  long steps;
+};
+
+enum { SW_X_MIN, SW_X_MAX, SW_Y_MIN, SW_Y_MAX, SW_Z_MIN, SW_Z_MAX, SW_PROBE, SW_COUNT };
+
+struct Switch {
+  int8_t port, bit;
+  bool inverting;
+};
+
+struct Heater {
+  double temp, power, rate, full, ambient;
+  uint64_t last;
+  const short (*table)[2];
+  uint8_t table_len;
+  int8_t adc_channel;
+  int8_t port, bit;
+  bool active_high;
+};
+
+struct PinRole {
+  uint8_t role;
+  uint8_t index;      // motor, switch or heater
+};
+
+#define MAX_MOTORS 10
+#define MAX_ROLES 3
+
+static Motor motors[MAX_MOTORS];
+static uint8_t motor_count;
+static Switch switches[SW_COUNT];
+static Heater heaters[EXTRUDERS + 1];   // the bed last
+static PinRole roles[4][32][MAX_ROLES];
+static uint32_t odsr[4], pullups[4], override_mask[4], override_level[4], traced[4];
+static int8_t pin_of[4][32];
+
+static double steps_per_mm[NUM_AXIS] = DEFAULT_AXIS_STEPS_PER_UNIT;
+static double start_pos[3], start_x2;
+static double bed_a, bed_b, bed_c;
+static int8_t sd_detect_port = -1, sd_detect_bit;
+
+#ifdef DELTA
+  static double tower_x[3], tower_y[3], tower_home[3], start_h[3];
+  static const double delta_rod = DELTA_DIAGONAL_ROD;
+#endif
+
+struct TraceEntry {
+  uint64_t time;
+  uint8_t pin, level;
+};
+static void note_queued(void);
+static std::vector<TraceEntry> trace;
+
+static Pio *const ports[4] = { PIOA, PIOB, PIOC, PIOD };
+
+#define PIN_BIT(b) (1UL << (b))
+
+static void add_role(int pin, uint8_t role, uint8_t index) {
+  if (pin < 0 || pin >= NUM_DIGITAL_PINS) return;
+  const PinDescription &p = g_APinDescription[pin];
+  uint8_t port = p.pPort->port, bit = __builtin_ctz(p.ulPin);
+  for (uint8_t i = 0; i < MAX_ROLES; i++)
+    if (roles[port][bit][i].role == ROLE_NONE) {
+      roles[port][bit][i].role = role;
+      roles[port][bit][i].index = index;
+      return;
+    }
+}
+
+static void port_bit(int pin, int8_t &port, int8_t &bit) {
+  port = g_APinDescription[pin].pPort->port;
+  bit = __builtin_ctz(g_APinDescription[pin].ulPin);
+}
+
+static void add_motor(int8_t axis, int8_t carriage, int8_t extruder, int step_pin, int dir_pin, int enable_pin,
+                      bool invert_step, bool invert_dir, bool enable_on) {
+  if (motor_count >= MAX_MOTORS || step_pin < 0) return;
+  Motor &m = motors[motor_count];
+  m.axis = axis;
+  m.carriage = carriage;
+  m.extruder = extruder;
+  m.invert_step = invert_step;
+  m.invert_dir = invert_dir;
+  m.enable_on = enable_on;
+  m.has_enable = enable_pin >= 0;
+  m.enabled = !m.has_enable;
+  m.forward = true;
+  m.steps = 0;
+  add_role(step_pin, ROLE_STEP, motor_count);
+  add_role(dir_pin, ROLE_DIR, motor_count);
+  add_role(enable_pin, ROLE_ENABLE, motor_count);
+  motor_count++;
+}
+
+static void add_switch(uint8_t sw, int pin, bool inverting) {
+  if (pin < 0) return;
+  port_bit(pin, switches[sw].port, switches[sw].bit);
+  switches[sw].inverting = inverting;
+  add_role(pin, ROLE_SWITCH, sw);
+}
+
+static void add_heater(uint8_t h, int pin, int temp_pin, const short (*table)[2], uint8_t table_len,
+                       double rate, double full, bool active_high) {
+  Heater &ht = heaters[h];
+  ht.rate = rate;
+  ht.full = full;
+  ht.ambient = ht.temp = 20;
+  ht.table = table;
+  ht.table_len = table_len;
+  ht.adc_channel = temp_pin < 0 ? -1 : g_APinDescription[temp_pin < A0 ? temp_pin + A0 : temp_pin].ulADCChannelNumber;
+  ht.port = -1;
+  ht.active_high = active_high;
+  if (pin >= 0) {
+    port_bit(pin, ht.port, ht.bit);
+    add_role(pin, ROLE_HEATER, h);
+  }
+}
+
+#define MOTOR_PINS(P) P##_STEP_PIN, P##_DIR_PIN, P##_ENABLE_PIN
+
+#ifdef INVERTED_HEATER_PINS
+  #define HEATER_ACTIVE_HIGH false
+#else
+  #define HEATER_ACTIVE_HIGH true
+#endif
+
+static bool machine_ready, start_set;
+static void update_input(uint8_t port, uint8_t bit);
+#ifdef DELTA
+  static double carriage_height(int tower, const double p[3]);
+#endif
+
+static void lcd_clock(void);
+static void lcd_select(bool level);
+
+static void machine_init(void) {
+  for (uint8_t sw = 0; sw < SW_COUNT; sw++) switches[sw].port = -1;
+  for (uint8_t h = 0; h <= EXTRUDERS; h++) heaters[h].adc_channel = heaters[h].port = -1;
+  for (uint8_t port = 0; port < 4; port++)
+    for (uint8_t bit = 0; bit < 32; bit++) pin_of[port][bit] = -1;
+  for (int pin = NUM_DIGITAL_PINS; pin--;) {
+    int8_t port, bit;
+    port_bit(pin, port, bit);
+    pin_of[port][bit] = pin;
+  }
+
+  add_motor(X_AXIS, 0, -1, MOTOR_PINS(X), INVERT_X_STEP_PIN, INVERT_X_DIR, X_ENABLE_ON);
+  add_motor(Y_AXIS, 0, -1, MOTOR_PINS(Y), INVERT_Y_STEP_PIN, INVERT_Y_DIR, Y_ENABLE_ON);
+  add_motor(Z_AXIS, 0, -1, MOTOR_PINS(Z), INVERT_Z_STEP_PIN, INVERT_Z_DIR, Z_ENABLE_ON);
+  #ifdef DUAL_X_CARRIAGE
+    add_motor(X_AXIS, 1, -1, MOTOR_PINS(X2), INVERT_X_STEP_PIN, INVERT_X_DIR, X_ENABLE_ON);
+  #endif
+  #ifdef Y_DUAL_STEPPER_DRIVERS
+    add_motor(Y_AXIS, 1, -1, MOTOR_PINS(Y2), INVERT_Y_STEP_PIN, INVERT_Y_DIR != INVERT_Y2_VS_Y_DIR, Y_ENABLE_ON);
+  #endif
+  #ifdef Z_DUAL_STEPPER_DRIVERS
+    add_motor(Z_AXIS, 1, -1, MOTOR_PINS(Z2), INVERT_Z_STEP_PIN, INVERT_Z_DIR, Z_ENABLE_ON);
+  #endif
+  add_motor(E_AXIS, 0, 0, MOTOR_PINS(E0), INVERT_E_STEP_PIN, INVERT_E0_DIR, E_ENABLE_ON);
+  #if EXTRUDERS > 1
+    add_motor(E_AXIS, 0, 1, MOTOR_PINS(E1), INVERT_E_STEP_PIN, INVERT_E1_DIR, E_ENABLE_ON);
+    #if EXTRUDERS > 2
+      add_motor(E_AXIS, 0, 2, MOTOR_PINS(E2), INVERT_E_STEP_PIN, INVERT_E2_DIR, E_ENABLE_ON);
+      #if EXTRUDERS > 3
+        add_motor(E_AXIS, 0, 3, MOTOR_PINS(E3), INVERT_E_STEP_PIN, INVERT_E3_DIR, E_ENABLE_ON);
+      #endif
+    #endif
+  #endif
+
+  #if HAS_X_MIN
+    add_switch(SW_X_MIN, X_MIN_PIN, X_MIN_ENDSTOP_INVERTING);
+  #endif
+  #if HAS_X_MAX
+    add_switch(SW_X_MAX, X_MAX_PIN, X_MAX_ENDSTOP_INVERTING);
+  #endif
+  #if HAS_Y_MIN
+    add_switch(SW_Y_MIN, Y_MIN_PIN, Y_MIN_ENDSTOP_INVERTING);
+  #endif
+  #if HAS_Y_MAX
+    add_switch(SW_Y_MAX, Y_MAX_PIN, Y_MAX_ENDSTOP_INVERTING);
+  #endif
+  #if HAS_Z_MIN
+    add_switch(SW_Z_MIN, Z_MIN_PIN, Z_MIN_ENDSTOP_INVERTING);
+  #endif
+  #if HAS_Z_MAX
+    add_switch(SW_Z_MAX, Z_MAX_PIN, Z_MAX_ENDSTOP_INVERTING);
+  #endif
+  #if defined(Z_PROBE_ENDSTOP) && HAS_Z_PROBE
+    add_switch(SW_PROBE, Z_PROBE_PIN, Z_PROBE_ENDSTOP_INVERTING);
+  #endif
+
+  #if HAS_HEATER_0
+    add_heater(0, HEATER_0_PIN, TEMP_0_PIN, (const short (*)[2])HEATER_0_TEMPTABLE, HEATER_0_TEMPTABLE_LEN, 2, 400, HEATER_ACTIVE_HIGH);
+  #endif
+  #if EXTRUDERS > 1 && HAS_HEATER_1
+    add_heater(1, HEATER_1_PIN, TEMP_1_PIN, (const short (*)[2])HEATER_1_TEMPTABLE, HEATER_1_TEMPTABLE_LEN, 2, 400, HEATER_ACTIVE_HIGH);
+  #endif
+  #if EXTRUDERS > 2 && HAS_HEATER_2
+    add_heater(2, HEATER_2_PIN, TEMP_2_PIN, (const short (*)[2])HEATER_2_TEMPTABLE, HEATER_2_TEMPTABLE_LEN, 2, 400, HEATER_ACTIVE_HIGH);
+  #endif
+  #if EXTRUDERS > 3 && HAS_HEATER_3
+    add_heater(3, HEATER_3_PIN, TEMP_3_PIN, (const short (*)[2])HEATER_3_TEMPTABLE, HEATER_3_TEMPTABLE_LEN, 2, 400, HEATER_ACTIVE_HIGH);
+  #endif
+  #if HAS_HEATER_BED && HAS_TEMP_BED
+    add_heater(EXTRUDERS, HEATER_BED_PIN, TEMP_BED_PIN, (const short (*)[2])BEDTEMPTABLE, BEDTEMPTABLE_LEN, 0.5, 150, HEATER_ACTIVE_HIGH);
+  #endif
+
+  #if defined(SDSUPPORT) && defined(SDCARDDETECT) && SDCARDDETECT > -1
+    port_bit(SDCARDDETECT, sd_detect_port, sd_detect_bit);
+    add_role(SDCARDDETECT, ROLE_SD_DETECT, 0);
+  #endif
+
+  #ifdef U8GLIB_ST7920
+    add_role(LCD_PINS_D4, ROLE_LCD_CLK, 0);      // ST7920_CLK_PIN
+    add_role(LCD_PINS_RS, ROLE_LCD_CS, 0);       // ST7920_CS_PIN
+  #endif
+
+  // Start in the middle of X and Y, 10 mm off the Z home switch
+  if (!start_set) {
+    #ifdef DELTA
+      start_pos[X_AXIS] = start_pos[Y_AXIS] = 0;
+      start_pos[Z_AXIS] = Z_MAX_POS - 10;
+    #else
+      start_pos[X_AXIS] = (X_MIN_POS + X_MAX_POS) / 2.0;
+      start_pos[Y_AXIS] = (Y_MIN_POS + Y_MAX_POS) / 2.0;
+      start_pos[Z_AXIS] = Z_HOME_DIR < 0 ? Z_MIN_POS + 10 : Z_MAX_POS - 10;
+    #endif
+  }
+  #ifdef DUAL_X_CARRIAGE
+    start_x2 = X2_HOME_POS - 10;
+  #endif
+
+  #ifdef DELTA
+    const double r = DELTA_RADIUS, home[3] = { X_HOME_POS, Y_HOME_POS, Z_HOME_POS };
+    tower_x[0] = -SIN_60 * r; tower_y[0] = -COS_60 * r;
+    tower_x[1] =  SIN_60 * r; tower_y[1] = -COS_60 * r;
+    tower_x[2] = 0;           tower_y[2] = r;
+    for (int k = 0; k < 3; k++) {
+      tower_home[k] = carriage_height(k, home);
+      start_h[k] = carriage_height(k, start_pos);
+    }
+  #endif
+
+  for (int pin = 0; pin < NUM_DIGITAL_PINS; pin++) {
+    int8_t port, bit;
+    port_bit(pin, port, bit);
+    update_input(port, bit);
+  }
+  machine_ready = true;
+}
+
+#ifdef DELTA
+
+  static double carriage_height(int tower, const double p[3]) {
+    return p[Z_AXIS] + sqrt(delta_rod * delta_rod - sq(tower_x[tower] - p[X_AXIS]) - sq(tower_y[tower] - p[Y_AXIS]));
+  }
+
+  // The nozzle for the carriage heights, by trilateration
+  static void delta_forward(const double h[3], double p[3]) {
+    double p1[3] = { tower_x[0], tower_y[0], h[0] },
+           d2[3] = { tower_x[1] - p1[0], tower_y[1] - p1[1], h[1] - p1[2] },
+           d3[3] = { tower_x[2] - p1[0], tower_y[2] - p1[1], h[2] - p1[2] };
+    double d = sqrt(sq(d2[0]) + sq(d2[1]) + sq(d2[2])), ex[3], ey[3], ez[3];
+    for (int k = 0; k < 3; k++) ex[k] = d2[k] / d;
+    double i = ex[0] * d3[0] + ex[1] * d3[1] + ex[2] * d3[2];
+    for (int k = 0; k < 3; k++) ey[k] = d3[k] - i * ex[k];
+    double n = sqrt(sq(ey[0]) + sq(ey[1]) + sq(ey[2]));
+    for (int k = 0; k < 3; k++) ey[k] /= n;
+    double j = ey[0] * d3[0] + ey[1] * d3[1] + ey[2] * d3[2];
+    ez[0] = ex[1] * ey[2] - ex[2] * ey[1];
+    ez[1] = ex[2] * ey[0] - ex[0] * ey[2];
+    ez[2] = ex[0] * ey[1] - ex[1] * ey[0];
+    if (ez[2] > 0) for (int k = 0; k < 3; k++) ez[k] = -ez[k];   // the nozzle is below the carriages
+    double x = d / 2, y = (i * i + j * j) / (2 * j) - i / j * x,
+           z = sqrt(max(0.0, delta_rod * delta_rod - x * x - y * y));
+    for (int k = 0; k < 3; k++) p[k] = p1[k] + x * ex[k] + y * ey[k] + z * ez[k];
+  }
+
+#endif
+
+static double motor_mm(const Motor &m) {
+  return m.steps / steps_per_mm[m.axis];
+}
+
+// The nozzle of the first carriage, the second carriage is x2
+static void machine_position(double p[3], double *x2 = NULL) {
+  double mm[3] = { 0, 0, 0 };
+  for (uint8_t i = 0; i < motor_count; i++) {
+    const Motor &m = motors[i];
+    if (m.axis < E_AXIS && m.carriage == 0) mm[m.axis] = motor_mm(m);
+    if (x2 && m.axis == X_AXIS && m.carriage == 1) *x2 = start_x2 + motor_mm(m);
+  }
+  #ifdef DELTA
+    double h[3];
+    for (int k = 0; k < 3; k++) h[k] = start_h[k] + mm[k];
+    delta_forward(h, p);
+  #elif defined(COREXY)
+    p[X_AXIS] = start_pos[X_AXIS] + (mm[X_AXIS] + mm[Y_AXIS]) / 2;
+    p[Y_AXIS] = start_pos[Y_AXIS] + (mm[X_AXIS] - mm[Y_AXIS]) / 2;
+    p[Z_AXIS] = start_pos[Z_AXIS] + mm[Z_AXIS];
+  #else
+    for (int k = 0; k < 3; k++) p[k] = start_pos[k] + mm[k];
+  #endif
+}
+
+static double bed_height(double x, double y) {
+  return bed_a * x + bed_b * y + bed_c;
+}
+
+#ifdef ENABLE_AUTO_BED_LEVELING
+  static bool probe_hit(const double p[3]) {
+    double px = p[X_AXIS] + X_PROBE_OFFSET_FROM_EXTRUDER, py = p[Y_AXIS] + Y_PROBE_OFFSET_FROM_EXTRUDER;
+    return p[Z_AXIS] + Z_PROBE_OFFSET_FROM_EXTRUDER <= bed_height(px, py);
+  }
+#endif
+
+static bool switch_hit(uint8_t sw, const double p[3], double x2) {
+  #ifdef DELTA
+    double h[3];
+    for (uint8_t i = 0; i < motor_count; i++)
+      if (motors[i].axis < E_AXIS && motors[i].carriage == 0) h[motors[i].axis] = start_h[motors[i].axis] + motor_mm(motors[i]);
+    switch (sw) {
+      case SW_X_MAX: return h[0] >= tower_home[0];
+      case SW_Y_MAX: return h[1] >= tower_home[1];
+      case SW_Z_MAX: return h[2] >= tower_home[2];
+      #ifdef ENABLE_AUTO_BED_LEVELING
+        case SW_Z_MIN: case SW_PROBE: return probe_hit(p);
+      #endif
+      default: return false;
+    }
+  #else
+    switch (sw) {
+      case SW_X_MIN: return p[X_AXIS] <= (X_HOME_DIR < 0 ? X_HOME_POS : X_MIN_POS);
+      #ifdef DUAL_X_CARRIAGE
+        case SW_X_MAX: return x2 >= X2_HOME_POS;
+      #else
+        case SW_X_MAX: return p[X_AXIS] >= (X_HOME_DIR > 0 ? X_HOME_POS : X_MAX_POS);
+      #endif
+      case SW_Y_MIN: return p[Y_AXIS] <= (Y_HOME_DIR < 0 ? Y_HOME_POS : Y_MIN_POS);
+      case SW_Y_MAX: return p[Y_AXIS] >= (Y_HOME_DIR > 0 ? Y_HOME_POS : Y_MAX_POS);
+      #if defined(ENABLE_AUTO_BED_LEVELING) && !defined(Z_PROBE_ENDSTOP)
+        case SW_Z_MIN: return probe_hit(p);
+      #else
+        case SW_Z_MIN: return p[Z_AXIS] <= (Z_HOME_DIR < 0 ? Z_HOME_POS : Z_MIN_POS);
+      #endif
+      case SW_Z_MAX: return p[Z_AXIS] >= (Z_HOME_DIR > 0 ? Z_HOME_POS : Z_MAX_POS);
+      #ifdef ENABLE_AUTO_BED_LEVELING
+        case SW_PROBE: return probe_hit(p);
+      #endif
+      default: return false;
+    }
+  #endif
+}
+
+static void record_trace(uint8_t port, uint8_t bit, bool level) {
+  if (traced[port] & PIN_BIT(bit)) {
+    TraceEntry e = { now, (uint8_t)pin_of[port][bit], level };
+    trace.push_back(e);
+  }
+}
+
+static void set_input(uint8_t port, uint8_t bit, bool level) {
+  Pio *pio = ports[port];
+  uint32_t mask = PIN_BIT(bit);
+  if (pio->PIO_OSR & mask) return;
+  if (override_mask[port] & mask) level = override_level[port] & mask;
+  if (!!(pio->PIO_PDSR & mask) == level) return;
+  if (level) pio->PIO_PDSR |= mask; else pio->PIO_PDSR &= ~mask;
+  record_trace(port, bit, level);
+}
+
+static void update_switches(void) {
+  double p[3], x2 = 0;
+  machine_position(p, &x2);
+  for (uint8_t sw = 0; sw < SW_COUNT; sw++) {
+    const Switch &s = switches[sw];
+    if (s.port < 0) continue;
+    set_input(s.port, s.bit, switch_hit(sw, p, x2) != s.inverting);
+  }
+}
+
+static void update_input(uint8_t port, uint8_t bit) {
+  for (uint8_t i = 0; i < MAX_ROLES; i++) {
+    const PinRole &r = roles[port][bit][i];
+    if (r.role == ROLE_SWITCH) { update_switches(); return; }
+    if (r.role == ROLE_SD_DETECT) {
+      bool inserted = sim_sd_blocks() > 0;
+      #ifdef SDCARDDETECTINVERTED
+        set_input(port, bit, inserted);
+      #else
+        set_input(port, bit, !inserted);
+      #endif
+      return;
+    }
+  }
+  set_input(port, bit, pullups[port] & PIN_BIT(bit));
+}
+
+static void heater_update(Heater &h) {
+  if (now > h.last && h.rate > 0) {
+    double k = h.rate / (h.full - h.ambient), eq = h.ambient + h.rate * h.power / k;
+    h.temp = eq + (h.temp - eq) * exp(-k * ticks_to_s(now - h.last));
+  }
+  h.last = now;
+}
+
+static void pin_changed(uint8_t port, uint8_t bit, bool level) {
+  for (uint8_t i = 0; i < MAX_ROLES; i++) {
+    const PinRole &r = roles[port][bit][i];
+    switch (r.role) {
+      case ROLE_NONE: return;
+      case ROLE_STEP: {
+        Motor &m = motors[r.index];
+        if (level != m.invert_step && m.enabled) {
+          m.steps += m.forward ? 1 : -1;
+          if (m.axis < E_AXIS) update_switches();
+        }
+        break;
+      }
+      case ROLE_DIR:
+        motors[r.index].forward = level != motors[r.index].invert_dir;
+        break;
+      case ROLE_ENABLE:
+        motors[r.index].enabled = level == motors[r.index].enable_on;
+        break;
+      case ROLE_HEATER: {
+        Heater &h = heaters[r.index];
+        heater_update(h);
+        h.power = level == h.active_high ? 1 : 0;
+        break;
+      }
+      case ROLE_LCD_CLK:
+        if (level) lcd_clock();
+        break;
+      case ROLE_LCD_CS:
+        lcd_select(level);
+        break;
+    }
+  }
+}
+
+void sim_pio_write(Pio *pio, uint32_t mask, bool set) {
+  uint8_t port = pio->port;
+  if (set) odsr[port] |= mask; else odsr[port] &= ~mask;
+  mask &= pio->PIO_OSR;
+  while (mask) {
+    uint8_t bit = __builtin_ctz(mask);
+    mask &= mask - 1;
+    if (!!(pio->PIO_PDSR & PIN_BIT(bit)) == set) continue;
+    if (set) pio->PIO_PDSR |= PIN_BIT(bit); else pio->PIO_PDSR &= ~PIN_BIT(bit);
+    record_trace(port, bit, set);
+    pin_changed(port, bit, set);
+  }
+}
+
+void sim_pio_configure(Pio *pio, uint32_t mask, bool output, bool level) {
+  uint8_t port = pio->port;
+  if (output) {
+    pio->PIO_OSR |= mask;
+    pullups[port] &= ~mask;
+    sim_pio_write(pio, mask, level);
+  }
+  else {
+    pio->PIO_OSR &= ~mask;
+    if (level) pullups[port] |= mask; else pullups[port] &= ~mask;
+    while (mask) {
+      uint8_t bit = __builtin_ctz(mask);
+      mask &= mask - 1;
+      update_input(port, bit);
+    }
+  }
+}
+
+void sim_analog_write(uint32_t pin, uint32_t value) {
+  int8_t port, bit;
+  port_bit(pin, port, bit);
+  for (uint8_t i = 0; i < MAX_ROLES; i++) {
+    const PinRole &r = roles[port][bit][i];
+    if (r.role == ROLE_HEATER) {
+      Heater &h = heaters[r.index];
+      heater_update(h);
+      h.power = (h.active_high ? value : 255 - value) / 255.0;
+    }
+  }
+  ports[port]->PIO_OSR |= PIN_BIT(bit);
+  sim_pio_write(ports[port], PIN_BIT(bit), value > 127);
+}
+
+// The 12 bit reading of the thermistor at the temperature, from the table of the firmware
+static uint16_t thermistor_adc(const Heater &h) {
+  if (!h.table || !h.table_len) return 2048;
+  double raw;
+  const short (*t)[2] = h.table;
+  uint8_t n = h.table_len;
+  if (h.temp >= t[0][1]) raw = t[0][0];
+  else if (h.temp <= t[n - 1][1]) raw = t[n - 1][0];
+  else {
+    uint8_t i = 1;
+    while (i < n - 1 && t[i][1] > h.temp) i++;
+    raw = t[i - 1][0] + (t[i][0] - t[i - 1][0]) * (h.temp - t[i - 1][1]) / (double)(t[i][1] - t[i - 1][1]);
+  }
+  return (uint16_t)constrain(raw * 4 / OVERSAMPLENR + 0.5, 0, 4095);
+}
+
+uint16_t sim_adc_value(int channel) {
+  for (uint8_t i = 0; i <= EXTRUDERS; i++)
+    if (heaters[i].adc_channel == channel && channel >= 0) {
+      heater_update(heaters[i]);
+      return thermistor_adc(heaters[i]);
+    }
+  return 0;
+}
+
+// --------------------------------------------------------------------------
+// The serial link and the host at its other end
+// --------------------------------------------------------------------------
+
+#define RX_BUFFER_SIZE 128
+#define TX_BUFFER_SIZE 128
+
+struct WireByte {
+  uint64_t time;
+  uint8_t c;
+};
+
+static unsigned long link_baud, firmware_baud;
+static uint64_t byte_ticks;
+static std::vector<std::string> host_lines;
+static size_t lines_sent, lines_acked;
+static unsigned window = 1;
+static bool host_started;
+static uint64_t host_free;                 // when the host has written its last byte
+static std::vector<WireByte> wire;         // bytes on their way to the firmware
+static size_t wire_head;
+static uint8_t rx_buffer[RX_BUFFER_SIZE];
+static unsigned rx_head, rx_tail;
+static uint64_t rx_overflows;
+static uint64_t tx_free;                   // when the firmware has sent its last byte
+static std::string output, tx_line;
+static std::vector<uint64_t> ok_times;     // when the host gets each "ok"
+static size_t oks_written;
+
+static void host_send(uint64_t from) {
+  const std::string &line = host_lines[lines_sent++];
+  uint64_t t = max(host_free, from);
+  for (size_t i = 0; i <= line.size(); i++) {
+    t += byte_ticks;
+    WireByte b = { t, (uint8_t)(i < line.size() ? line[i] : '\n') };
+    wire.push_back(b);
+  }
+  host_free = t;
+}
+
+static void serial_update(void) {
+  if (!byte_ticks) return;
+  // The host sends a line for each "ok" it has, as the window allows
+  if (host_started) {
+    while (lines_acked < ok_times.size() && ok_times[lines_acked] <= now && lines_acked < lines_sent) lines_acked++;
+    while (lines_sent < host_lines.size() && lines_sent - lines_acked < window) {
+      uint64_t from = lines_acked ? ok_times[lines_acked - 1] : 0;
+      host_send(from);
+    }
+  }
+  // Bytes that arrived go into the receive buffer of the UART
+  while (wire_head < wire.size() && wire[wire_head].time <= now) {
+    unsigned next = (rx_head + 1) % RX_BUFFER_SIZE;
+    if (next == rx_tail) rx_overflows++;
+    else {
+      rx_buffer[rx_head] = wire[wire_head].c;
+      rx_head = next;
+    }
+    wire_head++;
+  }
+  if (wire_head == wire.size()) { wire.clear(); wire_head = 0; }
+}
+
+void sim_serial_begin(unsigned long baud) {
+  firmware_baud = baud;
+  byte_ticks = SIM_TICKS_PER_S * 10 / (link_baud ? link_baud : baud);
+  if (!tx_free) tx_free = now;
+}
+
+int sim_serial_available(void) {
+  sim_poll();
+  return (rx_head - rx_tail + RX_BUFFER_SIZE) % RX_BUFFER_SIZE;
+}
+
+int sim_serial_peek(void) {
+  return rx_head == rx_tail ? -1 : rx_buffer[rx_tail];
+}
+
+int sim_serial_read(void) {
+  if (rx_head == rx_tail) return -1;
+  uint8_t c = rx_buffer[rx_tail];
+  rx_tail = (rx_tail + 1) % RX_BUFFER_SIZE;
+  if (c == '\n' && !in_isr) sim_wait(cmd_ticks);   // parsing and planning the line
+  return c;
+}
+
+void sim_serial_write(uint8_t c) {
+  if (!byte_ticks) return;
+  // Wait while the transmit buffer is full
+  if (!in_isr && tx_free > now + TX_BUFFER_SIZE * byte_ticks) sim_wait(tx_free - now - TX_BUFFER_SIZE * byte_ticks);
+  tx_free = max(tx_free, now) + byte_ticks;
+  output += (char)c;
+  if (c != '\n') { if (c != '\r') tx_line += (char)c; return; }
+  if (tx_line.compare(0, 2, MSG_OK) == 0) {
+    note_queued();
+    ok_times.push_back(tx_free);
+    oks_written++;
+  }
+  else if (tx_line == "start")
+    host_started = true;
+  else if (tx_line.find(MSG_ERR_KILLED) != std::string::npos)
+    killed = true;
+  tx_line.clear();
+}
+
+// --------------------------------------------------------------------------
+// SD card and EEPROM
+// --------------------------------------------------------------------------
+
+static std::vector<uint8_t> sd_image;
+static uint8_t eeprom[4096];
+
+uint32_t sim_sd_blocks(void) { return sd_image.size() / 512; }
+
+bool sim_sd_read(uint32_t block, uint8_t *dst) {
+  if (block >= sim_sd_blocks()) return false;
+  memcpy(dst, &sd_image[block * 512], 512);
+  return true;
+}
+
+bool sim_sd_write(uint32_t block, const uint8_t *src) {
+  if (block >= sim_sd_blocks()) return false;
+  memcpy(&sd_image[block * 512], src, 512);
+  return true;
+}
+
+uint8_t *sim_eeprom(void) { return eeprom; }
+uint32_t sim_eeprom_size(void) { return sizeof(eeprom); }
+
+// --------------------------------------------------------------------------
+// The ST7920 display
+// --------------------------------------------------------------------------
+
+// A frame of the picture loop, as the display got it
+struct sim_lcd_frame {
+  double start, busy, transfer;   // seconds: CPU time in the transfer, time on the wire
+  int32_t pages, rows, bytes;     // pages and GDRAM rows sent, lcd_bytes_sent
+  int32_t stale;                  // the display differs from a full redraw
+  uint8_t image[64][16];          // the display after the frame
+};
+
+static struct {
+  bool cs, rs, high_set, extended, expect_y, new_row;
+  uint8_t shift, bits, high, y, pos;
+  uint8_t gdram[32][32];          // 32 rows of 256 pixels, the lower half of the display on the right
+  uint64_t page_start;
+} lcd;
+
+static uint64_t lcd_bit_ticks = SIM_TICKS_PER_US / 4;
+static std::vector<sim_lcd_frame> display_frames;
+static size_t frame_stop;         // sim_run() ends after the loop() that completes this frame
+static sim_lcd_frame lcd_frame;
+static bool lcd_frame_open;
+static uint32_t lcd_frame_bytes0;
+
+uint64_t sim_main_time(void) {
+  uint64_t t = now;
+  for (uint8_t n = 0; n < 9; n++) t -= timers[n].busy;
+  return t;
+}
+
+static void lcd_instruction(uint8_t c) {
+  if ((c & 0xE0) == 0x20) {       // function set, RE selects the extended instructions
+    lcd.extended = c & 0x04;
+    lcd.expect_y = true;
+  }
+  else if (lcd.extended && (c & 0x80)) {
+    if (lcd.expect_y) lcd.y = c & 0x3F;
+    else {
+      lcd.pos = (c & 0x0F) * 2;
+      lcd.new_row = true;
+    }
+    lcd.expect_y = !lcd.expect_y;
+  }
+}
+
+static void lcd_data(uint8_t d) {
+  if (lcd.new_row) {
+    lcd.new_row = false;
+    if (lcd_frame_open) lcd_frame.rows++;
+  }
+  if (lcd.y < 32 && lcd.pos < 32) lcd.gdram[lcd.y][lcd.pos] = d;
+  lcd.pos++;
+}
+
+// A byte of the serial interface: a sync byte, or half of a byte in the upper nibble
+static void lcd_byte(uint8_t b) {
+  if ((b & 0xF8) == 0xF8) {
+    lcd.rs = b & 0x02;
+    lcd.high_set = false;
+  }
+  else if (!lcd.high_set) {
+    lcd.high = b & 0xF0;
+    lcd.high_set = true;
+  }
+  else {
+    lcd.high_set = false;
+    uint8_t v = lcd.high | (b >> 4);
+    if (lcd.rs) lcd_data(v); else lcd_instruction(v);
+  }
+}
+
+static void lcd_clock(void) {
+  #ifdef U8GLIB_ST7920
+    if (!lcd.cs) return;
+    sim_wait(lcd_bit_ticks);       // the bit-banged clock keeps the CPU busy
+    bool dat = digitalRead(LCD_PINS_ENABLE);  // ST7920_DAT_PIN
+    lcd.shift = lcd.shift << 1 | dat;
+    if (++lcd.bits == 8) {
+      lcd.bits = 0;
+      lcd_byte(lcd.shift);
+    }
+  #endif
+}
+
+// Raising CS resets the serial interface and starts a page
+static void lcd_select(bool level) {
+  if (level == lcd.cs) return;
+  lcd.cs = level;
+  if (level) {
+    lcd.bits = 0;
+    lcd.high_set = false;
+    lcd.page_start = now;
+    if (lcd_frame_open) lcd_frame.pages++;
+  }
+  #ifndef ST7920_USART_SPI
+    else if (lcd_frame_open)
+      lcd_frame.transfer += ticks_to_s(now - lcd.page_start);
+  #endif
+}
+
+static void lcd_image(uint8_t image[64][16]) {
+  for (uint8_t y = 0; y < 64; y++) memcpy(image[y], &lcd.gdram[y & 31][y < 32 ? 0 : 16], 16);
+}
+
+void sim_lcd_frame_begin(void) {
+  memset(&lcd_frame, 0, sizeof(lcd_frame));
+  lcd_frame.start = ticks_to_s(now);
+  #ifdef ULTRA_LCD
+    lcd_frame_bytes0 = lcd_bytes_sent;
+  #endif
+  lcd_frame_open = true;
+}
+
+void sim_lcd_busy(uint64_t ticks) {
+  if (lcd_frame_open) lcd_frame.busy += ticks_to_s(ticks);
+}
+
+void sim_lcd_frame_end(void) {
+  if (!lcd_frame_open) return;
+  lcd_frame_open = false;
+  #ifdef ULTRA_LCD
+    lcd_frame.bytes = lcd_bytes_sent - lcd_frame_bytes0;
+  #endif
+  lcd_image(lcd_frame.image);
+  uint8_t full[64][16];
+  lcd_frame.stale = sim_lcd_render(&full[0][0]) && memcmp(full, lcd_frame.image, sizeof(full)) != 0;
+  display_frames.push_back(lcd_frame);
+}
+
+// USART1 as the SPI master of the display, with the PDC
+static struct {
+  uint64_t byte_ticks, free;      // when the last byte is out
+  uint64_t dma_end;
+  const uint8_t *tpr;
+  uint32_t tcr;
+} usart = { 8 * SIM_TICKS_PER_US };
+
+static uint32_t usart_remaining(void) {
+  return now < usart.dma_end ? (usart.dma_end - now + usart.byte_ticks - 1) / usart.byte_ticks : 0;
+}
+
+uint32_t sim_usart_read(uint8_t reg) {
+  sim_poll();
+  switch (reg) {
+    case USART_TCR: return usart_remaining();
+    case USART_CSR: return now >= usart.free ? US_CSR_TXEMPTY : 0;
+  }
+  return 0;
+}
+
+void sim_usart_write(uint8_t reg, uint32_t v) {
+  switch (reg) {
+    case USART_BRGR:
+      usart.byte_ticks = max(1ULL, 8ULL * v * HAL_TIMER_RATE / F_CPU);
+      break;
+    case USART_THR:
+      usart.free = max(now, usart.free) + usart.byte_ticks;
+      if (lcd.cs) lcd_byte(v);
+      break;
+    case USART_TPR:
+      // The firmware writes the low 32 bits of the address, the buffer is in the same data segment as lcd
+      usart.tpr = (const uint8_t *)(((uintptr_t)&lcd & ~(uintptr_t)0xFFFFFFFFU) | v);
+      break;
+    case USART_TCR:
+      usart.tcr = v;
+      break;
+    case USART_PTCR:
+      if (v & US_PTCR_TXTEN && usart.tcr) {
+        usart.dma_end = usart.free = max(now, usart.free) + usart.tcr * usart.byte_ticks;
+        for (uint32_t i = 0; i < usart.tcr; i++) if (lcd.cs) lcd_byte(usart.tpr[i]);
+        usart.tcr = 0;
+        if (lcd_frame_open) lcd_frame.transfer += ticks_to_s(usart.dma_end - lcd.page_start);
+      }
+      break;
+  }
+}
+
+// --------------------------------------------------------------------------
+// Statistics of the motion
+// --------------------------------------------------------------------------
+
+// A block as the stepper interrupt ran it, in seconds, mm and steps
+struct sim_block {
+  double queued, start, end;
+  double millimeters, nominal_speed, entry_speed, exit_speed, acceleration;
+  double position[NUM_AXIS];      // machine position at the end, E of the active extruder
+  int64_t steps[NUM_AXIS];
+  int64_t step_event_count, accelerate_until, decelerate_after;
+  int64_t initial_rate, nominal_rate, final_rate, acceleration_st;
+  int32_t line;                   // the G-code line that queued it, -1 if none
+  int32_t direction_bits, active_extruder, fan_speed;
+  int32_t lookahead;              // blocks queued behind it when it started
+};
+
+struct sim_stats {
+  double moving, idle, underrun;  // seconds
+  int64_t underruns, step_isrs, missed_compares, rx_overflows;
+  double step_isr_busy, min_interval, max_latency;  // seconds
+  double temp_isr_busy;
+};
+
+#define RATE_BINS 64
+
+static std::vector<sim_block> blocks;
+static double rate_time[RATE_BINS];
+static double rate_bin_hz = 5000;
+static uint64_t queued_time[BLOCK_BUFFER_SIZE];
+static int32_t queued_line[BLOCK_BUFFER_SIZE];
+static uint8_t seen_head;
+static block_t *active_block;
+static uint64_t empty_since;
+static bool empty_intended, motion_started;
+static sim_stats stats;
+
+static void note_queued(void) {
+  while (seen_head != block_buffer_head) {
+    queued_time[seen_head] = now;
+    queued_line[seen_head] = host_lines.empty() ? -1 : (int32_t)oks_written;
+    seen_head = BLOCK_MOD(seen_head + 1);
+  }
+}
+
+// Is the firmware waiting for something else than more moves?
+static bool intended_wait(void) {
+  if (sim_synchronizing()) return true;
+  if (!commands_in_queue) return false;
+  const char *cmd = command_queue[cmd_queue_index_r];
+  static const char *const waits[] = { "M109", "M190", "M303", "M600", "M400", "M0", "M1", "M226", "G4", "G28", "G29", "G30", NULL };
+  for (const char *const *w = waits; *w; w++) {
+    size_t n = strlen(*w);
+    if (strncmp(cmd, *w, n) == 0 && !isdigit(cmd[n])) return true;
+  }
+  return false;
+}
+
+static void block_finished(uint64_t t) {
+  sim_block &b = blocks.back();
+  b.end = ticks_to_s(t);
+  double p[3];
+  machine_position(p);
+  for (int k = 0; k < 3; k++) b.position[k] = p[k];
+  b.position[E_AXIS] = 0;
+  for (uint8_t i = 0; i < motor_count; i++)
+    if (motors[i].axis == E_AXIS && motors[i].extruder == b.active_extruder) b.position[E_AXIS] = motor_mm(motors[i]);
+  stats.moving += b.end - b.start;
+}
+
+static void block_started(block_t *blk) {
+  note_queued();
+  uint8_t slot = blk - block_buffer;
+  sim_block b;
+  memset(&b, 0, sizeof(b));
+  b.queued = ticks_to_s(queued_time[slot]);
+  b.line = queued_line[slot];
+  b.start = ticks_to_s(now);
+  b.millimeters = blk->millimeters;
+  b.nominal_speed = blk->nominal_speed;
+  b.entry_speed = blk->entry_speed;
+  b.exit_speed = blk->step_event_count ? blk->final_rate * blk->millimeters / blk->step_event_count : 0;
+  b.acceleration = blk->acceleration;
+  for (int k = 0; k < NUM_AXIS; k++) b.steps[k] = blk->steps[k];
+  b.step_event_count = blk->step_event_count;
+  b.accelerate_until = blk->accelerate_until;
+  b.decelerate_after = blk->decelerate_after;
+  b.initial_rate = blk->initial_rate;
+  b.nominal_rate = blk->nominal_rate;
+  b.final_rate = blk->final_rate;
+  b.acceleration_st = blk->acceleration_st;
+  b.direction_bits = blk->direction_bits;
+  b.active_extruder = blk->active_extruder;
+  b.fan_speed = blk->fan_speed;
+  b.lookahead = BLOCK_MOD(block_buffer_head - slot + BLOCK_BUFFER_SIZE) - 1;
+  blocks.push_back(b);
+
+  // The queue ran dry before this block, unless the firmware meant to wait
+  if (motion_started && !empty_intended && empty_since != UINT64_MAX && now > empty_since) {
+    stats.underruns++;
+    stats.underrun += ticks_to_s(now - empty_since);
+  }
+  motion_started = true;
+}
+
+static void record_step_isr(void) {
+  block_t *blk = sim_current_block();
+  if (blk != active_block) {
+    if (active_block) {
+      block_finished(now);
+      // Out of moves, unless the firmware meant to wait
+      if (!blocks_queued()) {
+        empty_since = now;
+        empty_intended = intended_wait();
+      }
+      else
+        empty_since = UINT64_MAX;
+    }
+    if (blk) block_started(blk);
+    active_block = blk;
+  }
+  if (!blk) return;
+  stats.step_isrs++;
+  uint32_t interval = timer_channel(STEP_TIMER_NUM).TC_RC;
+  double seconds = (double)interval * timers[STEP_TIMER_NUM].tpc / SIM_TICKS_PER_S;
+  if (seconds < stats.min_interval || !stats.min_interval) stats.min_interval = seconds;
+  double rate = sim_step_loops() / seconds;
+  int bin = min((int)(rate / rate_bin_hz), RATE_BINS - 1);
+  rate_time[bin] += seconds;
+}
+
+// --------------------------------------------------------------------------
+// Entry points for the scripts
+// --------------------------------------------------------------------------
+
+static bool done(void) {
+  note_queued();
+  return lines_acked == host_lines.size() && !blocks_queued() && !commands_in_queue
+    #ifdef INPUT_SHAPING
+      && !st_shaper_busy()
+    #endif
+    #ifdef SDSUPPORT
+      && !card.sdprinting
+    #endif
+    ;
+}
+
+extern "C" {
+
+  // Call the firmware's setup(), 0 when it ran, 1 if it was killed
+  int sim_setup(void) {
+    static void (*const handlers[9])(void) = { TC0_Handler, TC1_Handler, TC2_Handler, TC3_Handler,
+                                               TC4_Handler, TC5_Handler, TC6_Handler, TC7_Handler, TC8_Handler };
+    for (uint8_t n = 0; n < 9; n++) {
+      timers[n].handler = handlers[n];
+      timers[n].tpc = 1;
+      if (!timers[n].cost) timers[n].cost = SIM_TICKS_PER_US;
+    }
+    if (!machine_ready) machine_init();
+    for (uint8_t i = 0; i <= EXTRUDERS; i++) heaters[i].last = now;
+    run_active = true;
+    run_end = UINT64_MAX;
+    int r = setjmp(run_jmp);
+    if (!r) setup();
+    run_active = in_isr = false;
+    return r ? 1 : 0;
+  }
+
+  // Run the main loop for the time in seconds, or until all lines are done, or
+  // the frame of sim_set_frame_stop() is drawn. Out of time, the firmware is
+  // left in the middle of whatever it did. 0: done, 1: killed, 2: out of time
+  int sim_run(double seconds, bool until_done) {
+    run_end = now + (uint64_t)(seconds * SIM_TICKS_PER_S);
+    run_active = true;
+    int r = setjmp(run_jmp);
+    if (!r)
+      for (;;) {
+        loop();
+        sim_poll();
+        if (until_done && done()) break;
+        if (frame_stop && display_frames.size() >= frame_stop) break;
+      }
+    run_active = in_isr = false;
+    if (active_block) {
+      block_finished(now);
+      active_block = NULL;
+    }
+    if (motion_started) stats.idle = ticks_to_s(now) - stats.moving;
+    return r;
+  }
+
+  // Before sim_setup: costs, the link and the machine
+  void sim_set_poll(double us) { poll_ticks = (uint64_t)(us * SIM_TICKS_PER_US); }
+  void sim_set_command(double us) { cmd_ticks = (uint64_t)(us * SIM_TICKS_PER_US); }
+  void sim_set_cost(int timer, double us) { if (timer >= 0 && timer < 9) timers[timer].cost = max((uint64_t)1, (uint64_t)(us * SIM_TICKS_PER_US)); }
+  void sim_set_link(unsigned long baud, unsigned w) { link_baud = baud; window = max(1u, w); }
+  void sim_set_rate_bin(double hz) { rate_bin_hz = hz; }
+  void sim_set_start(double x, double y, double z) {
+    start_pos[X_AXIS] = x; start_pos[Y_AXIS] = y; start_pos[Z_AXIS] = z;
+    start_set = true;
+  }
+  // The bed is at z = a x + b y + c
+  void sim_set_bed(double a, double b, double c) {
+    bed_a = a; bed_b = b; bed_c = c;
+    if (machine_ready) update_switches();
+  }
+  void sim_set_steps_per_mm(int axis, double v) { if (axis >= 0 && axis < NUM_AXIS) steps_per_mm[axis] = v; }
+
+  // Heater 0.. EXTRUDERS - 1, or -1 for the bed: C/s at full power from the ambient, and the hottest it gets
+  void sim_set_heater(int heater, double rate, double full, double ambient) {
+    Heater &h = heaters[heater < 0 ? EXTRUDERS : heater];
+    heater_update(h);
+    h.rate = rate;
+    h.full = full;
+    h.ambient = h.temp = ambient;
+  }
+  double sim_heater_temp(int heater) {
+    Heater &h = heaters[heater < 0 ? EXTRUDERS : heater];
+    heater_update(h);
+    return h.temp;
+  }
+
+  // Drive an input pin, -1 to let the machine drive it again
+  void sim_set_input(int pin, int level) {
+    if (pin < 0 || pin >= NUM_DIGITAL_PINS) return;
+    int8_t port, bit;
+    port_bit(pin, port, bit);
+    if (level < 0) override_mask[port] &= ~PIN_BIT(bit);
+    else {
+      override_mask[port] |= PIN_BIT(bit);
+      if (level) override_level[port] |= PIN_BIT(bit); else override_level[port] &= ~PIN_BIT(bit);
+    }
+    update_input(port, bit);
+  }
+
+  void sim_trace_pin(int pin) {
+    if (pin < 0 || pin >= NUM_DIGITAL_PINS) return;
+    int8_t port, bit;
+    port_bit(pin, port, bit);
+    traced[port] |= PIN_BIT(bit);
+  }
+  size_t sim_trace_count(void) { return trace.size(); }
+  const TraceEntry *sim_trace_data(void) { return trace.data(); }
+
+  void sim_sd_load(const uint8_t *data, size_t size) {
+    sd_image.assign(data, data + size);
+    if (sd_detect_port >= 0) update_input(sd_detect_port, sd_detect_bit);
+  }
+  const uint8_t *sim_sd_data(void) { return sd_image.data(); }
+
+  #ifdef SD_TOKENIZED_GCODE
+    // Decode a tokenized file of the card with getTokenizedCommand(), as M24
+    // prints it, into sim_sd_decoded(): the commands, one per line. Returns
+    // what the last call returned, 0 at the end of the file or -1 for bad
+    // data, and -2 if the file doesn't open as tokenized G-code.
+    static std::string decoded;
+    int sim_sd_decode(const char *name) {
+      decoded.clear();
+      if (!card.cardOK) card.initsd();
+      card.openFile((char *)name, true);
+      if (!card.isFileOpen() || !card.tokenized) return -2;
+      char command[MAX_CMD_SIZE];
+      int8_t r;
+      while ((r = card.getTokenizedCommand(command)) > 0) {
+        decoded += command;
+        decoded += '\n';
+      }
+      card.closefile();
+      return r;
+    }
+    const char *sim_sd_decoded(void) { return decoded.c_str(); }
+  #endif
+
+  void sim_send(const char *line) { host_lines.push_back(line); }
+  size_t sim_lines_acked(void) { return lines_acked; }
+  const char *sim_output(void) { return output.c_str(); }
+  double sim_time_s(void) { return ticks_to_s(now); }
+
+  size_t sim_block_count(void) { return blocks.size(); }
+  const sim_block *sim_blocks(void) { return blocks.data(); }
+  size_t sim_block_size(void) { return sizeof(sim_block); }
+
+  const double *sim_rate_time(void) { return rate_time; }
+  int sim_rate_bins(void) { return RATE_BINS; }
+
+  const sim_stats *sim_get_stats(void) {
+    stats.missed_compares = timers[STEP_TIMER_NUM].missed;
+    stats.rx_overflows = rx_overflows;
+    stats.step_isr_busy = ticks_to_s(timers[STEP_TIMER_NUM].busy);
+    stats.temp_isr_busy = ticks_to_s(timers[TEMP_TIMER_NUM].busy);
+    stats.max_latency = ticks_to_s(timers[STEP_TIMER_NUM].latency_max);
+    return &stats;
+  }
+  size_t sim_stats_size(void) { return sizeof(sim_stats); }
+
+  // Positions the firmware and the machine have
+  void sim_positions(double *firmware, double *machine) {
+    for (int k = 0; k < NUM_AXIS; k++) firmware[k] = current_position[k];
+    machine_position(machine);
+    machine[E_AXIS] = 0;
+    for (uint8_t i = 0; i < motor_count; i++)
+      if (motors[i].axis == E_AXIS && motors[i].extruder == active_extruder) machine[E_AXIS] = motor_mm(motors[i]);
+  }
+
+  uint8_t *sim_eeprom_data(void) { return eeprom; }
+
+  // The display: the time of a bit-banged bit, the frames so far
+  void sim_set_lcd(double bit_ns) { lcd_bit_ticks = (uint64_t)(bit_ns * SIM_TICKS_PER_US / 1000); }
+  void sim_set_frame_stop(size_t frames) { frame_stop = frames; }
+  size_t sim_lcd_frame_count(void) { return display_frames.size(); }
+  const sim_lcd_frame *sim_lcd_frames(void) { return display_frames.data(); }
+  size_t sim_lcd_frame_size(void) { return sizeof(sim_lcd_frame); }
+}
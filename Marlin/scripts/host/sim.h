@@ -0,0 +1,62 @@
+// **************************************************************************
+//
+// Description: The simulation behind the host build of the firmware
+//
+// Time is virtual and counts in ticks of HAL_TIMER_RATE. It only passes when
+// the main code waits or polls (delay, millis, the serial port) and while an
+// interrupt runs. The timer interrupts run when their compare match falls
+// into that time, one after the other in the order of their matches.
+// **************************************************************************
+
+#ifndef _HOST_SIM_H
+#define _HOST_SIM_H
+
+#include <stdint.h>
+
+struct Pio;
+
+// Virtual time
+uint64_t sim_time(void);
+void sim_wait(uint64_t ticks);   // the main code or an interrupt spends ticks
+void sim_poll(void);             // the main code polls the time or a port
+void sim_irq_enable(bool on);    // __enable_irq, __disable_irq
+bool sim_irq_enabled(void);
+
+// Timers, numbered as in HAL.cpp: TC<n> is counter n / 3, channel n % 3
+void sim_timer_start(uint8_t timer_num, uint32_t ticks_per_count);
+void sim_timer_stop(uint8_t timer_num);
+void sim_timer_irq(uint8_t timer_num, bool on);
+
+// Pins
+void sim_pio_write(Pio *pio, uint32_t mask, bool set);
+void sim_pio_configure(Pio *pio, uint32_t mask, bool output, bool level);
+void sim_analog_write(uint32_t pin, uint32_t value);
+uint16_t sim_adc_value(int channel);
+
+// Serial port
+void sim_serial_begin(unsigned long baud);
+int sim_serial_available(void);
+int sim_serial_peek(void);
+int sim_serial_read(void);
+void sim_serial_write(uint8_t c);
+
+// SD card
+uint32_t sim_sd_blocks(void);
+bool sim_sd_read(uint32_t block, uint8_t *dst);
+bool sim_sd_write(uint32_t block, const uint8_t *src);
+
+// EEPROM
+uint8_t *sim_eeprom(void);
+uint32_t sim_eeprom_size(void);
+
+// Display: the picture loop of U8glib.cpp reports its frames. A frame ends
+// with the display compared to a full redraw, by sim_lcd_render() of
+// sim_lcd.cpp (false without a graphic display, and for frames not drawn by
+// lcd_update() as the boot screen).
+uint64_t sim_main_time(void);    // the time, less that of the interrupts
+void sim_lcd_frame_begin(void);
+void sim_lcd_busy(uint64_t ticks);
+void sim_lcd_frame_end(void);
+bool sim_lcd_render(uint8_t *image);
+
+#endif // _HOST_SIM_H
@@ -0,0 +1,48 @@
+// **************************************************************************
+//
+// Description: ultralcd.cpp of the host build
+//
+// With a graphic display the simulation redraws each frame in full, with
+// the picture loop of the firmware into a device of its own, to check that
+// what a partial redraw left on the display is right.
+// **************************************************************************
+
+#include "ultralcd.cpp"
+#include "sim.h"
+
+#ifdef DOGLCD
+
+  static uint8_t *render_image;
+
+  // Keep the pages instead of sending them
+  static uint8_t render_device_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg) {
+    if (msg == U8G_DEV_MSG_PAGE_NEXT) {
+      u8g_pb_t *pb = (u8g_pb_t *)dev->dev_mem;
+      memcpy(render_image + pb->p.page_y0 * (pb->width / 8), pb->buf, (pb->p.page_y1 - pb->p.page_y0 + 1) * (pb->width / 8));
+    }
+    return u8g_dev_pb8h1_base_fn(u8g, dev, msg, arg);
+  }
+
+  bool sim_lcd_render(uint8_t *image) {
+    if (!lcd_frame_pending) return false;   // not a frame of lcd_update(), as the boot screen
+    u8g_dev_t *dev = u8g.getU8g()->dev;
+    u8g_dev_fnptr device_fn = dev->dev_fn;
+    uint8_t dirty_bands = lcd_dirty_bands;
+    dev->dev_fn = render_device_fn;
+    render_image = image;
+    lcd_dirty_bands = 0xFF;
+    u8g.setCapture(true);
+    u8g.firstPage();
+    lcd_frame_pending = true;
+    while (lcd_frame_pending) lcd_draw_slice();
+    u8g.setCapture(false);
+    dev->dev_fn = device_fn;
+    lcd_dirty_bands = dirty_bands;
+    return true;
+  }
+
+#else
+
+  bool sim_lcd_render(uint8_t *image) { return false; }
+
+#endif
@@ -0,0 +1,24 @@
+// **************************************************************************
+//
+// Description: stepper.cpp of the host build
+//
+// st_synchronize() is wrapped so the simulation knows when the firmware
+// waits for the moves on purpose, and the stepper's state it needs for the
+// statistics is passed out.
+// **************************************************************************
+
+#define st_synchronize st_synchronize_firmware
+#include "stepper.cpp"
+#undef st_synchronize
+
+static bool synchronizing;
+
+void st_synchronize() {
+  synchronizing = true;
+  st_synchronize_firmware();
+  synchronizing = false;
+}
+
+bool sim_synchronizing(void) { return synchronizing; }
+block_t *sim_current_block(void) { return current_block; }
+int sim_step_loops(void) { return step_loops; }
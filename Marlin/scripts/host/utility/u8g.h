@@ -0,0 +1,6 @@
+// **************************************************************************
+//
+// Description: The u8g types of the fonts, those of U8glib.h on the host
+// **************************************************************************
+
+#include "U8glib.h"
@@ -0,0 +1,379 @@
+#!/usr/bin/python3
+"""Host build of the firmware
+
+Builds the firmware as it is (Marlin_main.cpp, planner.cpp, stepper.cpp,
+temperature.cpp, the LCD and SD card code, ...) into a shared library for
+the host, against the Arduino Due core and the simulated machine in
+scripts/host. The other scripts load it through the Firmware class below;
+run on its own it builds the library and prints its path.
+
+HAL.h is the one of the firmware with the delay loop in C. HAL.cpp and
+Sd2Card.cpp are replaced by those in scripts/host, flash_storage.cpp is left
+out: the EEPROM is an array of the simulation. U8glib is the one of
+scripts/host, the graphic display drives the ST7920 of the simulation.
+
+--define changes the configuration before the build: NAME=VALUE sets every
+#define of the name (uncommenting it if needed), NAME alone enables it, -NAME
+comments it out. Builds are kept in the temporary directory and reused while the sources,
+the configuration and the defines are the same.
+
+Usage: python3 host_build.py [options]
+
+Options:
+  --config=...   directory with the configuration (default: the Marlin directory)
+  --define=...   configuration change, may be given more than once
+  --cxx=...      host C++ compiler (default: g++)
+"""
+
+import ctypes
+import getopt
+import hashlib
+import os
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+from concurrent.futures import ThreadPoolExecutor
+
+SCRIPTS = os.path.dirname(os.path.abspath(__file__))
+MARLIN = os.path.normpath(os.path.join(SCRIPTS, os.pardir))
+HOST = os.path.join(SCRIPTS, "host")
+
+# Firmware sources not built on their own: built into sim.cpp, sim_stepper.cpp and sim_lcd.cpp,
+# or left out. HAL.cpp and Sd2Card.cpp are replaced by those in scripts/host.
+NOT_BUILT = ("Marlin_main.cpp", "stepper.cpp", "ultralcd.cpp", "flash_storage.cpp")
+CONFIG_FILES = ("Configuration.h", "Configuration_adv.h")
+# As the Arduino IDE builds for the Due, the SAM3X toolchain accepts what g++ calls -fpermissive
+CXXFLAGS = ["-std=gnu++11", "-O2", "-fPIC", "-fno-strict-aliasing", "-fpermissive", "-w",
+            "-D__SAM3X8E__", "-DF_CPU=84000000L", "-DARDUINO=10606", "-DARDUINO_SAM_DUE", "-DARDUINO_ARCH_SAM"]
+
+HAL_DELAY_US = "static inline void _delay_us(uint32_t usec) {\n  delayMicroseconds(usec);\n}\n"
+
+# Timers as numbered in HAL.h
+STEP_TIMER, TEMP_TIMER, BEEPER_TIMER, ADVANCE_TIMER, SHAPER_TIMER = 2, 3, 4, 1, 8
+
+
+class BuildError(Exception):
+    pass
+
+
+def parse_define(text):
+    # "NAME=VALUE", "NAME" or "-NAME" to (name, value), value None to comment it out
+    if text.startswith("-"):
+        return text[1:], None
+    name, _, value = text.partition("=")
+    return name, value
+
+
+def apply_defines(sources, defines):
+    # Change the #defines of Configuration.h and Configuration_adv.h in sources
+    for name, value in defines:
+        pattern = re.compile(r"^[ \t]*(?://[ \t]*)?#define[ \t]+%s\b.*$" % re.escape(name), re.M)
+        found = False
+        for file in CONFIG_FILES:
+            text = sources[file]
+            if value is None:
+                text, n = re.subn(r"^([ \t]*)(#define[ \t]+%s\b)" % re.escape(name), r"\1//\2", text, flags=re.M)
+                found = found or n > 0
+            else:
+                # Every #define of the name, as for BLOCK_BUFFER_SIZE with and without SDSUPPORT
+                text, n = pattern.subn(lambda m: "%s#define %s %s" % (re.match(r"[ \t]*", m.group(0)).group(0), name, value), text)
+                found = found or n > 0
+            sources[file] = text
+        if not found and value is not None:
+            text = sources["Configuration.h"]
+            at = text.index('#include "Configuration_adv.h"')
+            sources["Configuration.h"] = text[:at] + "#define %s %s\n" % (name, value) + text[at:]
+
+
+def host_hal(text):
+    # HAL.h with the delay loop of _delay_us() in C
+    m = re.search(r"static inline void _delay_us\(uint32_t usec\) \{.*?\n\}\n", text, re.S)
+    if not m:
+        raise BuildError("_delay_us() not found in HAL.h")
+    return text[:m.start()] + HAL_DELAY_US + text[m.end():]
+
+
+def build(config=MARLIN, defines=(), cxx="g++", extra=None):
+    """Build the firmware with the configuration in config, return the path of the library.
+
+    extra: optional function that gets the source dictionary (file name to text)
+    before it is written, to add or change files.
+    """
+    sources = {}
+    for name in os.listdir(MARLIN):
+        if name.endswith((".cpp", ".h")) and not name.startswith("."):
+            with open(os.path.join(MARLIN, name), encoding="latin-1") as f:
+                sources[name] = f.read()
+    for name in CONFIG_FILES:
+        with open(os.path.join(config, name), encoding="latin-1") as f:
+            sources[name] = f.read()
+    apply_defines(sources, [parse_define(d) if isinstance(d, str) else d for d in defines])
+    sources["HAL.h"] = host_hal(sources["HAL.h"])
+    for root, dirs, files in os.walk(HOST):
+        for name in files:
+            path = os.path.join(root, name)
+            with open(path, encoding="latin-1") as f:
+                sources[os.path.relpath(path, HOST)] = f.read()
+    if extra:
+        extra(sources)
+
+    digest = hashlib.sha1(" ".join([cxx] + CXXFLAGS).encode())
+    for name in sorted(sources):
+        digest.update(name.encode() + b"\0" + sources[name].encode("latin-1") + b"\0")
+    out = os.path.join(tempfile.gettempdir(), "marlin-host-" + digest.hexdigest()[:16])
+    lib = os.path.join(out, "marlin.so")
+    if os.path.exists(lib):
+        return lib
+
+    work = tempfile.mkdtemp(prefix="marlin-host-")
+    try:
+        for name, text in sources.items():
+            path = os.path.join(work, name)
+            os.makedirs(os.path.dirname(path), exist_ok=True)
+            with open(path, "w", encoding="latin-1") as f:
+                f.write(text)
+
+        units = sorted(name for name in sources if name.endswith(".cpp") and name not in NOT_BUILT)
+
+        def compile_unit(name):
+            obj = os.path.join(work, name[:-4] + ".o")
+            p = subprocess.run([cxx] + CXXFLAGS + ["-I", work, "-c", "-o", obj, os.path.join(work, name)],
+                               stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+            return name, obj, p.returncode, p.stdout
+
+        with ThreadPoolExecutor(os.cpu_count() or 1) as pool:
+            results = list(pool.map(compile_unit, units))
+        errors = "".join(log for name, obj, code, log in results if code)
+        if errors:
+            raise BuildError(errors)
+        p = subprocess.run([cxx, "-shared", "-Wl,--no-undefined", "-o", os.path.join(work, "marlin.so")] +
+                           [obj for name, obj, code, log in results],
+                           stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+        if p.returncode:
+            raise BuildError(p.stdout)
+        os.makedirs(out, exist_ok=True)
+        shutil.copy(os.path.join(work, "marlin.so"), lib + ".tmp")
+        os.rename(lib + ".tmp", lib)
+    finally:
+        shutil.rmtree(work)
+    return lib
+
+
+def fat_image(files, blocks=None):
+    """A card image with a FAT16 volume and the files in the root directory.
+
+    files: 8.3 file name to contents. The volume has no partition table,
+    SdVolume::init() falls back to the boot sector in block 0. One block per
+    cluster, FAT16 needs at least 4085 clusters. blocks defaults to 4 MB, or
+    what the files need.
+    """
+    if blocks is None:
+        need = sum((len(data) + 511) // 512 for data in files.values())
+        blocks = max(8192, need + need // 64 + 64)
+    root_entries, fat_blocks = 512, (blocks * 2 + 511) // 512
+    data_start = 1 + 2 * fat_blocks + root_entries * 32 // 512
+    if not 4085 <= blocks - data_start < 65525:
+        raise ValueError("%d blocks don't make a FAT16 volume" % blocks)
+    image = bytearray(blocks * 512)
+    small = blocks < 0x10000    # the 16 bit count of the blocks, else the 32 bit one
+    image[0:62] = struct.pack("<3s8sHBHBHHBHHHIIBBBI11s8s", b"\xEB\x3C\x90", b"MARLIN  ", 512, 1, 1, 2,
+                              root_entries, blocks if small else 0, 0xF8, fat_blocks, 32, 2, 0,
+                              0 if small else blocks, 0x80, 0, 0x29, 0x12345678, b"NO NAME    ", b"FAT16   ")
+    image[510:512] = b"\x55\xAA"
+    fat = [0xFFF8, 0xFFFF]
+    root = 512 * (1 + 2 * fat_blocks)
+    for n, (name, data) in enumerate(sorted(files.items())):
+        base, _, ext = name.upper().partition(".")
+        if n >= root_entries or len(base) > 8 or len(ext) > 3:
+            raise ValueError("can't put %s in the root directory" % name)
+        clusters = (len(data) + 511) // 512
+        first = len(fat) if clusters else 0
+        fat += [len(fat) + i + 1 for i in range(clusters - 1)] + [0xFFFF] * (clusters > 0)
+        if len(fat) > blocks - data_start + 2:
+            raise ValueError("the files don't fit into %d blocks" % blocks)
+        at = 512 * (data_start + first - 2)
+        image[at:at + len(data)] = data
+        image[root + 32 * n:root + 32 * n + 32] = struct.pack("<8s3sB10sHHHI", base.ljust(8).encode(), ext.ljust(3).encode(),
+                                                              0x20, bytes(10), 0, 0x21, first, len(data))
+    table = struct.pack("<%dH" % len(fat), *fat)
+    for i in range(2):
+        at = 512 * (1 + i * fat_blocks)
+        image[at:at + len(table)] = table
+    return image
+
+
+class Block(ctypes.Structure):
+    # struct sim_block of sim.cpp: a block as the stepper interrupt ran it
+    _fields_ = [(name, ctypes.c_double) for name in
+                ("queued", "start", "end", "millimeters", "nominal_speed", "entry_speed", "exit_speed", "acceleration")] + [
+        ("position", ctypes.c_double * 4),
+        ("steps", ctypes.c_int64 * 4)] + [(name, ctypes.c_int64) for name in
+                ("step_event_count", "accelerate_until", "decelerate_after",
+                 "initial_rate", "nominal_rate", "final_rate", "acceleration_st")] + [
+        (name, ctypes.c_int32) for name in ("line", "direction_bits", "active_extruder", "fan_speed", "lookahead")]
+
+
+class Stats(ctypes.Structure):
+    # struct sim_stats of sim.cpp
+    _fields_ = [("moving", ctypes.c_double), ("idle", ctypes.c_double), ("underrun", ctypes.c_double),
+                ("underruns", ctypes.c_int64), ("step_isrs", ctypes.c_int64),
+                ("missed_compares", ctypes.c_int64), ("rx_overflows", ctypes.c_int64),
+                ("step_isr_busy", ctypes.c_double), ("min_interval", ctypes.c_double),
+                ("max_latency", ctypes.c_double), ("temp_isr_busy", ctypes.c_double)]
+
+
+class LcdFrame(ctypes.Structure):
+    # struct sim_lcd_frame of sim.cpp: a frame of the picture loop, as the display got it
+    _fields_ = [(name, ctypes.c_double) for name in ("start", "busy", "transfer")] + [
+        (name, ctypes.c_int32) for name in ("pages", "rows", "bytes", "stale")] + [
+        ("image", ctypes.c_uint8 * (64 * 16))]
+
+
+class TraceEntry(ctypes.Structure):
+    _fields_ = [("time", ctypes.c_uint64), ("pin", ctypes.c_uint8), ("level", ctypes.c_uint8)]
+
+
+DONE, KILLED, TIMEOUT = 0, 1, 2
+
+
+class Firmware(object):
+    """The firmware of a host build, with the machine around it.
+
+    Each instance loads its own copy of the library, the firmware keeps its
+    state in globals. Configure the machine before setup(), then send()
+    lines and run().
+    """
+
+    def __init__(self, lib):
+        self.tmp = tempfile.mkdtemp(prefix="marlin-sim-")
+        path = os.path.join(self.tmp, "marlin.so")
+        shutil.copy(lib, path)
+        self.lib = ctypes.CDLL(path)
+        l = self.lib
+        for name in ("sim_set_poll", "sim_set_command", "sim_heater_temp", "sim_time_s"):
+            getattr(l, name).restype = ctypes.c_double if name in ("sim_heater_temp", "sim_time_s") else None
+        l.sim_set_poll.argtypes = l.sim_set_command.argtypes = [ctypes.c_double]
+        l.sim_set_cost.argtypes = [ctypes.c_int, ctypes.c_double]
+        l.sim_set_link.argtypes = [ctypes.c_ulong, ctypes.c_uint]
+        l.sim_set_rate_bin.argtypes = [ctypes.c_double]
+        l.sim_set_start.argtypes = l.sim_set_bed.argtypes = [ctypes.c_double] * 3
+        l.sim_set_steps_per_mm.argtypes = [ctypes.c_int, ctypes.c_double]
+        l.sim_set_heater.argtypes = [ctypes.c_int] + [ctypes.c_double] * 3
+        l.sim_heater_temp.argtypes = [ctypes.c_int]
+        l.sim_run.argtypes = [ctypes.c_double, ctypes.c_bool]
+        l.sim_send.argtypes = [ctypes.c_char_p]
+        l.sim_output.restype = ctypes.c_char_p
+        l.sim_sd_load.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+        l.sim_sd_data.restype = ctypes.POINTER(ctypes.c_uint8)
+        l.sim_block_count.restype = l.sim_trace_count.restype = l.sim_lines_acked.restype = ctypes.c_size_t
+        l.sim_blocks.restype = ctypes.POINTER(Block)
+        l.sim_block_size.restype = l.sim_stats_size.restype = ctypes.c_size_t
+        l.sim_get_stats.restype = ctypes.POINTER(Stats)
+        l.sim_rate_time.restype = ctypes.POINTER(ctypes.c_double)
+        l.sim_trace_data.restype = ctypes.POINTER(TraceEntry)
+        l.sim_eeprom_data.restype = ctypes.POINTER(ctypes.c_uint8)
+        l.sim_positions.argtypes = [ctypes.POINTER(ctypes.c_double)] * 2
+        l.sim_set_lcd.argtypes = [ctypes.c_double]
+        l.sim_set_frame_stop.argtypes = [ctypes.c_size_t]
+        l.sim_lcd_frame_count.restype = l.sim_lcd_frame_size.restype = ctypes.c_size_t
+        l.sim_lcd_frames.restype = ctypes.POINTER(LcdFrame)
+        if (l.sim_block_size() != ctypes.sizeof(Block) or l.sim_stats_size() != ctypes.sizeof(Stats) or
+                l.sim_lcd_frame_size() != ctypes.sizeof(LcdFrame)):
+            raise BuildError("sim_block, sim_stats or sim_lcd_frame of sim.cpp and host_build.py differ")
+
+    def close(self):
+        shutil.rmtree(self.tmp, ignore_errors=True)
+
+    def setup(self):
+        # Power up: run setup() of the firmware, True if it wasn't killed
+        return self.lib.sim_setup() == 0
+
+    def run(self, seconds, until_done=True):
+        return self.lib.sim_run(seconds, until_done)
+
+    def send(self, line):
+        self.lib.sim_send(line.encode("latin-1"))
+
+    def output(self):
+        return self.lib.sim_output().decode("latin-1")
+
+    def time(self):
+        return self.lib.sim_time_s()
+
+    def blocks(self):
+        n = self.lib.sim_block_count()
+        data = self.lib.sim_blocks()
+        return [data[i] for i in range(n)]
+
+    def stats(self):
+        return self.lib.sim_get_stats().contents
+
+    def rate_time(self):
+        data = self.lib.sim_rate_time()
+        return [data[i] for i in range(self.lib.sim_rate_bins())]
+
+    def trace(self):
+        n = self.lib.sim_trace_count()
+        data = self.lib.sim_trace_data()
+        return [(data[i].time, data[i].pin, data[i].level) for i in range(n)]
+
+    def positions(self):
+        firmware, machine = (ctypes.c_double * 4)(), (ctypes.c_double * 4)()
+        self.lib.sim_positions(firmware, machine)
+        return list(firmware), list(machine)
+
+    def sd_load(self, image):
+        self.lib.sim_sd_load(bytes(image), len(image))
+
+    def sd_decode(self, name):
+        # Decode a tokenized file of the card with getTokenizedCommand() (SD_TOKENIZED_GCODE):
+        # what the last call returned (0 at the end, -1 for bad data, -2 not tokenized) and the commands
+        l = self.lib
+        l.sim_sd_decode.argtypes = [ctypes.c_char_p]
+        l.sim_sd_decoded.restype = ctypes.c_char_p
+        result = l.sim_sd_decode(name.encode("latin-1"))
+        return result, l.sim_sd_decoded().decode("latin-1").splitlines()
+
+    def lcd_frames(self, start=0):
+        # The frames of the display from the start-th on
+        n = self.lib.sim_lcd_frame_count()
+        data = self.lib.sim_lcd_frames()
+        return [data[i] for i in range(start, n)]
+
+    def eeprom(self, size=4096):
+        return ctypes.string_at(self.lib.sim_eeprom_data(), size)
+
+
+def main(argv):
+    config, defines, cxx = MARLIN, [], "g++"
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "config=", "define=", "cxx="])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        elif opt == "--config":
+            config = arg
+        elif opt == "--define":
+            defines.append(arg)
+        elif opt == "--cxx":
+            cxx = arg
+    if args:
+        print(__doc__)
+        sys.exit(2)
+    try:
+        print(build(config, defines, cxx))
+    except BuildError as err:
+        sys.stderr.write(str(err))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,201 @@
+#!/usr/bin/python3
+"""Graphic LCD benchmark
+
+Runs the firmware built for the host (see host_build.py) with the
+REPRAP_DISCOUNT_FULL_GRAPHIC_SMART_CONTROLLER: ultralcd.cpp,
+dogm_lcd_implementation.h and the ST7920 device of
+ultralcd_st7920_u8glib_rrd.h as they are, on U8glib of scripts/host. The
+device drives the display pins, or USART1 with ST7920_USART_SPI, and the
+simulation decodes what reaches the ST7920 into its GDRAM. Prints one CSV
+row per frame of the picture loop:
+
+  frame, pages_sent, rows_sent, bytes, transfer_ms, busy_ms
+
+pages_sent and rows_sent are the pages and the GDRAM rows the display got,
+bytes is lcd_bytes_sent of the frame, as M251 reports it. transfer_ms is the
+time on the wire: bit-banged SPI at --bit-ns per bit and the
+u8g_10MicroDelay() calls, or the USART at ST7920_USART_SPI_FREQ. busy_ms is
+the time the main loop spent in the device, drawing the pages takes no time
+in the simulation.
+
+After every frame the firmware draws the frame again in full, and the
+display is compared with it: frames where a partial redraw left the display
+wrong are counted as stale.
+
+The print scenario prints circles at 60 mm/s from the SD card (over the
+serial port with --no-sd), after heating to 210 C. The idle scenario sends
+nothing. The display after each frame can be written as PBM files. A summary
+with the bytes per frame, the frame rate the transfer allows, the CPU time
+and the stale frames goes to stderr.
+
+With --usart the thermistor of A0 moves to A1 and the Y direction pin off
+D16, the RADDS pins that the display takes.
+
+Usage: python3 lcd_sim.py [options] > frames.csv
+
+Options:
+  --config=...      directory with the configuration (default: the Marlin directory)
+  --define=...      configuration change for the build, as in host_build.py (may be repeated)
+  --frames=...      frames to run after power up (default: 600, the Info Screen
+                    is redrawn every second)
+  --scenario=...    print or idle (default: print)
+  --full            without DOGLCD_PARTIAL_REDRAW
+  --usart           with ST7920_USART_SPI
+  --small-font      with USE_SMALL_INFOFONT
+  --extruders=...   EXTRUDERS (default: from the configuration)
+  --no-sd           without SDSUPPORT
+  --bit-ns=...      time of one bit-banged SPI bit in ns (default: 250)
+  --pbm=...         write the display after each frame to <prefix>NNNN.pbm
+"""
+
+import getopt
+import os
+import re
+import sys
+from math import cos, pi, sin
+
+from host_build import DONE, KILLED, BuildError, Firmware, build, fat_image
+from motion_sim import AMBIENT, config_value, read_config
+
+LCD_PIXEL_WIDTH = 128
+LCD_PIXEL_HEIGHT = 64
+ST7920_ROW_BYTES = 1 + 4 + 1 + 2 * LCD_PIXEL_WIDTH // 8
+HEAT_RATE = 10.0            # C/s at full power, to start printing in the first minutes
+PRINT_FILE = "circles.gco"
+
+# pins_RADDS.h with A0 and D16 free for ST7920_USART_SPI
+USART_PINS = ((r"(#define\s+TEMP_0_PIN\s+)0\b", r"\g<1>1"), (r"(#define\s+Y_DIR_PIN_ORIGIN\s+)16\b", r"\g<1>27"))
+
+
+def print_gcode(circles=100, radius=50.0, segments=72):
+    # Circles around the middle of the bed at 60 mm/s, 5 s each
+    lines = ["M109 S210", "G28", "G1 Z0.3 F600", "G92 E0", "G1 X%.1f Y100 F3600" % (100 + radius)]
+    e = 0.0
+    step = 2 * pi * radius / segments
+    for i in range(1, circles * segments + 1):
+        a = 2 * pi * i / segments
+        e += step * 0.033
+        lines.append("G1 X%.2f Y%.2f E%.4f" % (100 + radius * cos(a), 100 + radius * sin(a), e))
+    lines += ["M104 S0", "G28 X0 Y0"]
+    return lines
+
+
+def usart_pins(sources):
+    for pattern, value in USART_PINS:
+        sources["pins_RADDS.h"] = re.sub(pattern, value, sources["pins_RADDS.h"])
+
+
+def write_pbm(path, image):
+    with open(path, "wb") as f:
+        f.write(b"P4\n%d %d\n" % (LCD_PIXEL_WIDTH, LCD_PIXEL_HEIGHT))
+        f.write(bytes(image))
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir),
+                   frames=600, scenario="print", full=False, usart=False, extruders=None, sd=True,
+                   pbm=None)
+    options["small-font"] = False
+    options["bit-ns"] = 250.0
+    defines = []
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "config=", "define=", "frames=", "scenario=", "full", "usart",
+                                               "small-font", "extruders=", "no-sd", "bit-ns=", "pbm="])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:]
+        if key == "define":
+            defines.append(arg)
+        elif key == "no-sd":
+            options["sd"] = False
+        elif key in ("full", "usart", "small-font"):
+            options[key] = True
+        elif key in ("frames", "extruders"):
+            options[key] = int(arg)
+        elif key == "bit-ns":
+            options[key] = float(arg)
+        else:
+            options[key] = arg
+    if args or options["scenario"] not in ("print", "idle"):
+        print(__doc__)
+        sys.exit(2)
+
+    config = read_config(options["config"])
+    extruders = options["extruders"] or config_value(config, "EXTRUDERS", 1)
+    build_defines = ["REPRAP_DISCOUNT_FULL_GRAPHIC_SMART_CONTROLLER", "EXTRUDERS=%d" % extruders]
+    if options["full"]:
+        build_defines.append("-DOGLCD_PARTIAL_REDRAW")
+    if options["usart"]:
+        build_defines.append("ST7920_USART_SPI")
+    if options["small-font"]:
+        build_defines.append("USE_SMALL_INFOFONT")
+    if not options["sd"]:
+        build_defines.append("-SDSUPPORT")
+    try:
+        lib = build(options["config"], build_defines + defines, extra=usart_pins if options["usart"] else None)
+    except BuildError as err:
+        sys.stderr.write(str(err))
+        sys.exit(1)
+
+    fw = Firmware(lib)
+    fw.lib.sim_set_lcd(options["bit-ns"])
+    for e in range(extruders):
+        fw.lib.sim_set_heater(e, HEAT_RATE, 400.0, AMBIENT)
+    fw.lib.sim_set_heater(-1, HEAT_RATE / 4, 150.0, AMBIENT)
+    if options["scenario"] == "print":
+        gcode = print_gcode()
+        if options["sd"]:
+            fw.sd_load(fat_image({PRINT_FILE: "".join(line + "\n" for line in gcode).encode()}))
+            gcode = ["M21", "M23 " + PRINT_FILE, "M24"]
+        for line in gcode:
+            fw.send(line)
+    status = KILLED if not fw.setup() else DONE
+    first = len(fw.lcd_frames())
+    start = fw.time()
+    if status != KILLED:
+        fw.lib.sim_set_frame_stop(first + options["frames"])
+        status = fw.run(options["frames"] * 10.0, False)
+    frames = fw.lcd_frames(first)[:options["frames"]]
+    end = frames[-1].start if frames else fw.time()
+
+    print("frame,pages_sent,rows_sent,bytes,transfer_ms,busy_ms")
+    for n, f in enumerate(frames):
+        print("%d,%d,%d,%d,%.2f,%.2f" % (n, f.pages, f.rows, f.bytes, f.transfer * 1000, f.busy * 1000))
+        if options["pbm"]:
+            write_pbm("%s%04d.pbm" % (options["pbm"], n), f.image)
+    output = fw.output()
+    fw.close()
+
+    count = max(len(frames), 1)
+    total_bytes = sum(f.bytes for f in frames)
+    transfer = sum(f.transfer for f in frames) * 1000 / count
+    busy = sum(f.busy for f in frames)
+    stale = sum(1 for f in frames if f.stale)
+    spi_freq = config_value(config, "ST7920_USART_SPI_FREQ", 1000000)
+    sys.stderr.write("%s, %d frames in %.1f s, %s redraw, %s\n" % (
+        options["scenario"], len(frames), end - start, "full" if options["full"] else "partial",
+        "USART SPI at %d Hz" % spi_freq if options["usart"] else "bit-banged SPI at %g ns per bit" % options["bit-ns"]))
+    sys.stderr.write("%.0f bytes per frame (largest %d, full frame %d), %.2f ms transfer per frame\n" % (
+        float(total_bytes) / count, max([f.bytes for f in frames] or [0]), LCD_PIXEL_HEIGHT * ST7920_ROW_BYTES,
+        transfer))
+    sys.stderr.write("%.0f fps the transfer allows, CPU busy %.2f ms per frame, %.1f%% of the time\n" % (
+        1000.0 / transfer if transfer else 0, busy * 1000 / count, 100 * busy / (end - start) if end > start else 0))
+    sys.stderr.write("%d stale frames\n" % stale)
+    if status == KILLED:
+        sys.stderr.write("the firmware was killed: %s\n" % output.strip().splitlines()[-1])
+        sys.exit(1)
+    if len(frames) < options["frames"]:
+        sys.stderr.write("only %d frames were drawn\n" % len(frames))
+        sys.exit(1)
+    if stale:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
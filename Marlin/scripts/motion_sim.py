@@ -0,0 +1,207 @@
+#!/usr/bin/python3
+"""G-code motion simulator
+
+Streams a G-code file through the firmware built for the host (see
+host_build.py): Marlin_main.cpp, planner.cpp, stepper.cpp and temperature.cpp
+as they are, on a simulated SAM3X in virtual time. The timer interrupts run
+at their compare matches and take --isr-us each, the serial link runs at
+--baud with ok handshaking, and the machine around the pins moves the axes,
+switches the endstops and heats the heaters. Homing, probing, arcs and the
+other commands run as on the printer. Prints one CSV row per block, as the
+stepper interrupt ran it:
+
+  start_ms, duration_ms, millimeters, nominal_mm_s, entry_mm_s, exit_mm_s, queued, line
+
+queued is the number of blocks in the buffer when the block started. A block
+started with queued 1 had no look-ahead and was planned to a stop. line is
+the G-code line (counting the lines sent, without comments and empty lines)
+that queued the block.
+
+A summary goes to stderr: the print time, the planner underruns (the stepper
+running out of blocks between moves, not counting M400, G4, homing and the
+other waits of the G-code), the interrupt load and latency, the serial
+overruns and the time spent at each step rate.
+
+The machine starts in the middle of X and Y and 10 mm off the Z home switch,
+or at --start. --trace writes the changes of the given pins (Arduino pin
+numbers) to --trace-file as time_us,pin,level.
+
+Usage: python3 motion_sim.py [options] file.gcode > blocks.csv
+
+Options:
+  --config=...       directory with the configuration (default: the Marlin directory)
+  --define=...       configuration change for the build, as in host_build.py (may be repeated)
+  --baud=...         serial speed (default: BAUDRATE)
+  --window=...       lines the host sends before it waits for an ok (default: 1)
+  --cmd-us=...       main loop time to parse and plan one line in us (default: 150)
+  --poll-us=...      main loop time of each poll of the clock or serial port in us (default: 1)
+  --isr-us=...       time of one stepper interrupt in us (default: 2)
+  --bin=...          step rate histogram bin width in Hz (default: 5000)
+  --heat-rate=...    hotend heating rate at full power in C/s (default: 2)
+  --bed-rate=...     bed heating rate at full power in C/s (default: 0.5)
+  --start=X,Y,Z      machine position at power up
+  --bed=A,B,C        the bed is at z = A*x + B*y + C (default: 0,0,0)
+  --trace=...        pins to trace, separated by commas
+  --trace-file=...   where the trace goes (default: trace.csv)
+  --timeout=...      simulated seconds before giving up (default: 36000)
+  --echo             copy the serial output of the firmware to stderr
+"""
+
+import getopt
+import os
+import re
+import sys
+
+from host_build import BuildError, DONE, Firmware, KILLED, STEP_TIMER, TIMEOUT, build
+
+HAL_TIMER_RATE = 84000000 // 2
+AMBIENT = 25.0
+
+
+def read_config(path):
+    # The #defines of the configuration, unevaluated
+    defines = {}
+    for name in ("Configuration.h", "Configuration_adv.h"):
+        with open(os.path.join(path, name)) as f:
+            for line in f:
+                m = re.match(r"\s*#define\s+(\w+)(?:[ \t]+([^/\n]*))?", line)
+                if m:
+                    defines[m.group(1)] = (m.group(2) or "").strip()
+                m = re.match(r"\s*const\s+unsigned\s+int\s+dropsegments\s*=\s*(\d+)", line)
+                if m:
+                    defines["dropsegments"] = m.group(1)
+    return defines
+
+
+def config_value(defines, name, default):
+    try:
+        return eval(defines[name].replace("{", "[").replace("}", "]"), {"__builtins__": {}})
+    except Exception:
+        return default
+
+
+def gcode_lines(f):
+    # What a host sends: no comments, no empty lines
+    for line in f:
+        line = re.sub(r"\([^)]*\)", "", line.split(";", 1)[0]).strip()
+        if line:
+            yield line
+
+
+def main(argv):
+    options = dict(config=os.path.join(os.path.dirname(os.path.abspath(__file__)), os.pardir),
+                   baud=None, window=1, cmd_us=150.0, poll_us=1.0, isr_us=2.0, bin=5000.0,
+                   heat_rate=2.0, bed_rate=0.5, start=None, bed="0,0,0", trace="", trace_file="trace.csv",
+                   timeout=36000.0)
+    defines, echo = [], False
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help", "define=", "echo"] +
+                                   [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        elif opt == "--define":
+            defines.append(arg)
+        elif opt == "--echo":
+            echo = True
+        else:
+            key = opt[2:].replace('-', '_')
+            options[key] = arg if key in ("config", "start", "bed", "trace", "trace_file") else float(arg)
+    if len(args) != 1:
+        print(__doc__)
+        sys.exit(2)
+
+    config = read_config(options["config"])
+    if options["baud"] is None:
+        options["baud"] = config_value(config, "BAUDRATE", 115200)
+    try:
+        lib = build(options["config"], defines)
+    except BuildError as err:
+        sys.stderr.write(str(err))
+        sys.exit(1)
+
+    fw = Firmware(lib)
+    fw.lib.sim_set_link(int(options["baud"]), int(options["window"]))
+    fw.lib.sim_set_command(options["cmd_us"])
+    fw.lib.sim_set_poll(options["poll_us"])
+    fw.lib.sim_set_cost(STEP_TIMER, options["isr_us"])
+    fw.lib.sim_set_rate_bin(options["bin"])
+    if options["start"]:
+        fw.lib.sim_set_start(*[float(v) for v in options["start"].split(",")])
+    fw.lib.sim_set_bed(*[float(v) for v in options["bed"].split(",")])
+    for e in range(config_value(config, "EXTRUDERS", 1)):
+        fw.lib.sim_set_heater(e, options["heat_rate"], 400.0, AMBIENT)
+    fw.lib.sim_set_heater(-1, options["bed_rate"], 150.0, AMBIENT)
+    pins = [int(p) for p in options["trace"].split(",") if p]
+    for pin in pins:
+        fw.lib.sim_trace_pin(pin)
+
+    lines = 0
+    with open(args[0]) as f:
+        for line in gcode_lines(f):
+            fw.send(line)
+            lines += 1
+    status = KILLED if not fw.setup() else DONE
+    ready = fw.time()
+    if status != KILLED:
+        status = fw.run(options["timeout"])
+
+    output = fw.output()
+    if echo:
+        sys.stderr.write(output)
+    blocks = fw.blocks()
+    print("start_ms,duration_ms,millimeters,nominal_mm_s,entry_mm_s,exit_mm_s,queued,line")
+    for b in blocks:
+        print("%.3f,%.3f,%.3f,%.2f,%.2f,%.2f,%d,%d" % (b.start * 1000, (b.end - b.start) * 1000, b.millimeters,
+                                                        b.nominal_speed, b.entry_speed, b.exit_speed,
+                                                        b.lookahead + 1, b.line))
+    if pins:
+        with open(options["trace_file"], "w") as f:
+            f.write("time_us,pin,level\n")
+            for time, pin, level in fw.trace():
+                f.write("%.3f,%d,%d\n" % (time * 1e6 / HAL_TIMER_RATE, pin, level))
+
+    stats = fw.stats()
+    end = fw.time()
+    stops = sum(1 for b in blocks if b.lookahead == 0)
+    sys.stderr.write("%d lines, %d acked, %d blocks, print time %.1f s (moving %.1f s, ready after %.1f s)\n" %
+                     (lines, fw.lib.sim_lines_acked(), len(blocks), end, stats.moving, ready))
+    sys.stderr.write("planner underruns: %d (%.2f s), stepper idle %.2f s; %d blocks started without look-ahead\n" %
+                     (stats.underruns, stats.underrun, stats.idle, stops))
+    if stats.moving > 0 and stats.min_interval:
+        mean_rate = stats.step_isrs / stats.moving
+        sys.stderr.write("stepper interrupts: %d, mean %.1f kHz (%.1f%% load), peak %.1f kHz; "
+                         "%d missed compares, latency up to %.1f us\n" %
+                         (stats.step_isrs, mean_rate / 1000, mean_rate * options["isr_us"] / 10000,
+                          1 / stats.min_interval / 1000, stats.missed_compares, stats.max_latency * 1e6))
+    if end > 0:
+        sys.stderr.write("temperature interrupt: %.1f%% load\n" % (100 * stats.temp_isr_busy / end))
+    if stats.rx_overflows:
+        sys.stderr.write("serial receive buffer overflows: %d bytes lost\n" % stats.rx_overflows)
+    if stats.moving > 0:
+        sys.stderr.write("time per step rate:\n")
+        bin_hz = options["bin"]
+        for i, seconds in enumerate(fw.rate_time()):
+            if seconds > 0:
+                sys.stderr.write("  %6d - %6d Hz  %8.2f s  %5.1f%%\n" % (i * bin_hz, (i + 1) * bin_hz, seconds,
+                                                                         100 * seconds / stats.moving))
+    for message in ("Unknown command", "Error"):
+        count = sum(1 for line in output.splitlines() if message in line)
+        if count:
+            sys.stderr.write("%s: %d times\n" % (message.lower(), count))
+    fw.close()
+    if status == KILLED:
+        sys.stderr.write("the firmware was killed: %s\n" % output.strip().splitlines()[-1])
+        sys.exit(1)
+    if status == TIMEOUT:
+        sys.stderr.write("timed out after %.0f s with %d lines acked\n" % (end, fw.lib.sim_lines_acked()))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
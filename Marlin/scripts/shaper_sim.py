@@ -0,0 +1,169 @@
+#!/usr/bin/python3
+"""Input shaping simulator
+
+Runs one move of a single axis through the same step queue and fixed-point
+impulse arithmetic as the shaper timer in stepper.cpp (INPUT_SHAPING) and
+prints the commanded against the shaped step position, as CSV:
+
+  time_ms, commanded, shaped
+
+A summary goes to stderr: the ringing left after the move of a spring-mass
+system with the given frequency and damping, once driven by the commanded
+and once by the shaped motion.
+
+Usage: python3 shaper_sim.py [options] > motion.csv
+
+Options:
+  --type=...       zv, mzv or ei (default: mzv)
+  --freq=...       shaper frequency in Hz (default: 40)
+  --damping=...    shaper damping ratio (default: 0.1)
+  --ring-freq=...  frequency of the simulated frame in Hz (default: same as --freq, or 40)
+  --ring-damping=...  damping ratio of the simulated frame (default: 0.05)
+  --length=...     move length in mm (default: 30)
+  --speed=...      nominal speed in mm/s (default: 150)
+  --accel=...      acceleration in mm/s^2 (default: 3000)
+  --steps=...      steps per mm (default: 80)
+  --tick=...       SHAPING_STEP_FREQUENCY in Hz (default: 100000)
+"""
+
+import getopt
+import sys
+from math import sqrt, exp, pi
+
+ONE = 65536
+
+
+def impulses(kind, freq, damping, tick):
+    # Amplitudes in 1/65536 and delays in ticks, as st_set_shaping() computes them
+    zeta = min(max(damping, 0.0), 0.9)
+    df = sqrt(1 - zeta * zeta)
+    if freq <= 0:
+        return [ONE], [0]
+    freq = max(freq, tick / 30000.0 / df)
+    td = 1 / (freq * df)
+    k = exp(-zeta * pi / df)
+    if kind == "zv":
+        a, t = [1, k], [0, 0.5 * td]
+    elif kind == "mzv":
+        k = exp(-0.75 * zeta * pi / df)
+        a0 = 1 - sqrt(0.5)
+        a, t = [a0, (sqrt(2) - 1) * k, a0 * k * k], [0, 0.375 * td, 0.75 * td]
+    else:
+        a, t = [0.25 * 1.05, 0.5 * 0.95 * k, 0.25 * 1.05 * k * k], [0, 0.5 * td, td]
+    total = sum(a)
+    amps = [0] + [int(x / total * ONE + 0.5) for x in a[1:]]
+    amps[0] = ONE - sum(amps)
+    return amps, [0] + [int(x * tick + 0.5) for x in t[1:]]
+
+
+def step_events(length, speed, accel, steps):
+    # Step times of a trapezoid move, one step per stepper interrupt
+    n = int(round(length * steps))
+    rate_max = speed * steps
+    accel_st = accel * steps
+    t, times = 0.0, []
+    for i in range(n):
+        rate = sqrt(min(2 * accel_st * (i + 0.5), rate_max ** 2, 2 * accel_st * (n - i - 0.5)))
+        t += 1.0 / rate
+        times.append(t)
+    return times
+
+
+def shape(times, amps, delays, tick):
+    # Shaper timer: apply due impulses every tick, a step takes two ticks
+    period = 1.0 / tick
+    end = times[-1] + (max(delays) + 10) * period
+    read = [0] * len(amps)
+    pending = 0
+    issued = 0
+    pulse = False
+    ticks = 0
+    queued = [int(tm / period) for tm in times]  # tick each step was queued at
+    out = []
+    while ticks * period < end:
+        ticks += 1
+        for i in range(len(amps)):
+            while read[i] < len(queued) and ticks - queued[read[i]] >= delays[i]:
+                pending += amps[i]
+                read[i] += 1
+        if pulse:
+            pulse = False
+        elif pending >= ONE // 2:
+            pending -= ONE
+            issued += 1
+            pulse = True
+        out.append((ticks * period, issued))
+    return out
+
+
+def ringing(samples, settle, freq, damping, dt):
+    # Spring-mass frame driven by the motor position. Returns the largest
+    # distance from the end position in steps once the motor stopped at settle.
+    w = 2 * pi * freq
+    x = v = 0.0
+    last_u = samples[0]
+    peak = 0.0
+    for i, u in enumerate(samples):
+        du = (u - last_u) / dt
+        last_u = u
+        a = -w * w * (x - u) - 2 * damping * w * (v - du)
+        v += a * dt
+        x += v * dt
+        if i >= settle:
+            peak = max(peak, abs(x - samples[-1]))
+    return peak
+
+
+def main(argv):
+    options = dict(type="mzv", freq=40.0, damping=0.1, ring_freq=None, ring_damping=0.05,
+                   length=30.0, speed=150.0, accel=3000.0, steps=80.0, tick=100000.0)
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help"] + [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:].replace('-', '_')
+        options[key] = arg.lower() if key == "type" else float(arg)
+    if options["type"] not in ("zv", "mzv", "ei"):
+        print(__doc__)
+        sys.exit(2)
+    ring_freq = options["ring_freq"] or options["freq"]
+    tick = options["tick"]
+
+    amps, delays = impulses(options["type"], options["freq"], options["damping"], tick)
+    times = step_events(options["length"], options["speed"], options["accel"], options["steps"])
+    shaped = shape(times, amps, delays, tick)
+
+    # Commanded position sampled on the same ticks
+    commanded = []
+    j = 0
+    for t, issued in shaped:
+        while j < len(times) and times[j] <= t:
+            j += 1
+        commanded.append(j)
+
+    print("time_ms,commanded,shaped")
+    for (t, issued), cmd in zip(shaped[::10], commanded[::10]):
+        print("%.3f,%d,%d" % (t * 1000, cmd, issued))
+
+    # Follow both for a few ringing periods after the shaped move ended
+    if ring_freq <= 0:
+        ring_freq = 40.0
+    rest = [len(times)] * int(3 * tick / ring_freq)
+    dt = 1.0 / tick
+    issued = [s for t, s in shaped]
+    plain = ringing(commanded + rest, commanded.index(len(times)), ring_freq, options["ring_damping"], dt)
+    smooth = ringing(issued + rest, issued.index(len(times)), ring_freq, options["ring_damping"], dt)
+    sys.stderr.write("impulses %s at ticks %s\n" % (amps, delays))
+    sys.stderr.write("residual ringing: unshaped %.2f steps, shaped %.2f steps\n" % (plain, smooth))
+    if options["speed"] * options["steps"] > tick / 2:
+        sys.stderr.write("step rate above --tick / 2: the shaper timer falls behind\n")
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,189 @@
+#!/usr/bin/python3
+"""Step trace analyzer
+
+Reads the printout of M930 (STEP_TRACE) from a serial log and rebuilds the
+motion of each axis from the steps of the recorded stepper interrupts, as
+CSV with one row per axis and interrupt that stepped it:
+
+  time_ms, axis, position_mm, velocity_mm_s, acceleration_mm_s2, jerk_mm_s3
+
+Positions start at 0 with the first recorded interrupt. Velocities are taken
+over --window steps of the axis, accelerations and jerks are differences of
+consecutive values. The interrupts that don't step (no block in the buffer,
+waiting for the shaper timer) are recorded as idle entries holding the time
+they took, so the time of each row is that of the printer.
+
+The summary on stderr lists:
+- step rate jumps at block boundaries, between the last step rate of a block
+  and the first of the next, larger than --max-jump (a fraction of the
+  higher rate). They come from the exit and entry rates that
+  calculate_trapezoid_for_block() gives the two blocks.
+- interrupts whose step rate is above MAX_STEP_FREQUENCY
+- interrupts whose interval is shorter than --isr-us, where the next
+  interrupt is due before this one can have ended
+
+Usage: python3 step_trace.py [options] serial.log > motion.csv
+
+Options:
+  --window=...     steps per velocity sample (default: 4)
+  --max-jump=...   largest step rate change at a block boundary (default: 0.5)
+  --isr-us=...     time of one stepper interrupt in us (default: 2)
+  --list=...       events listed per check (default: 10)
+"""
+
+import getopt
+import re
+import sys
+
+AXES = "XYZE"
+TRACE_BLOCK_START = 1
+TRACE_ACCELERATING = 2
+TRACE_DECELERATING = 4
+TRACE_IDLE = 8
+
+
+def read_trace(f):
+    # Header and (interval, steps per motor, direction bits, flags) per interrupt
+    header = None
+    entries = []
+    for line in f:
+        m = re.search(r"TRACE rate:(\d+) max:(\d+) steps:([-0-9.,]+)( corexy)?", line)
+        if m:
+            # A new printout replaces an earlier one in the same log
+            header = dict(rate=int(m.group(1)), max=int(m.group(2)),
+                          steps=[float(v) for v in m.group(3).split(",")], corexy=bool(m.group(4)))
+            entries = []
+            continue
+        m = re.search(r"TRACE:(\d+),(\d+),(\d+),(\d+)", line)
+        if m and header:
+            interval, steps, dirs, flags = [int(v) for v in m.groups()]
+            entries.append((interval, [(steps >> (3 * i)) & 7 for i in range(4)], dirs, flags))
+    return header, entries
+
+
+def axis_samples(header, entries):
+    # (time, position in steps) of each axis at the interrupts that moved it
+    rate = float(header["rate"])
+    motors = [0] * 4
+    samples = dict((axis, []) for axis in AXES)
+    t = 0.0
+    for interval, steps, dirs, flags in entries:
+        moved = [False] * 4
+        for i in range(4):
+            if steps[i]:
+                motors[i] += -steps[i] if dirs & (1 << i) else steps[i]
+                moved[i] = True
+        position = list(motors)
+        if header["corexy"]:
+            # Motor A is X+Y, motor B is X-Y
+            position[0], position[1] = (motors[0] + motors[1]) / 2.0, (motors[0] - motors[1]) / 2.0
+            moved[0] = moved[1] = moved[0] or moved[1]
+        for i in range(4):
+            if moved[i]:
+                samples[AXES[i]].append((t, position[i]))
+        t += interval / rate
+    return samples, t
+
+
+def derivatives(samples, steps_per_mm, window):
+    # Rows of time, position, velocity, acceleration and jerk of one axis
+    rows = []
+    velocity = acceleration = None
+    last_t = None
+    for j, (t, p) in enumerate(samples):
+        k = max(0, j - window)
+        new_velocity = None
+        if t > samples[k][0]:
+            new_velocity = (p - samples[k][1]) / (t - samples[k][0]) / steps_per_mm
+        new_acceleration = new_jerk = None
+        if new_velocity is not None and velocity is not None and t > last_t:
+            new_acceleration = (new_velocity - velocity) / (t - last_t)
+            if acceleration is not None:
+                new_jerk = (new_acceleration - acceleration) / (t - last_t)
+        rows.append((t, p / steps_per_mm, new_velocity, new_acceleration, new_jerk))
+        if new_velocity is not None:
+            velocity, last_t = new_velocity, t
+            if new_acceleration is not None:
+                acceleration = new_acceleration
+    return rows
+
+
+def check(header, entries, max_jump, isr_us):
+    # Step rate jumps at block boundaries, step rates above the maximum, short intervals
+    rate = float(header["rate"])
+    jumps, fast, short = [], [], []
+    t = 0.0
+    previous = None  # step rate of the previous interrupt
+    for k, (interval, steps, dirs, flags) in enumerate(entries):
+        if flags & TRACE_IDLE:
+            t += interval / rate
+            continue
+        step_rate = max(steps) * rate / interval if interval else 0
+        if flags & TRACE_BLOCK_START and previous:
+            higher = max(previous, step_rate)
+            if higher and abs(step_rate - previous) > max_jump * higher:
+                jumps.append((t, k, previous, step_rate))
+        if step_rate > header["max"]:
+            fast.append((t, k, step_rate))
+        if interval < isr_us * rate / 1000000.0:
+            short.append((t, k, interval * 1000000.0 / rate))
+        previous = step_rate
+        t += interval / rate
+    return jumps, fast, short
+
+
+def main(argv):
+    options = dict(window=4, max_jump=0.5, isr_us=2.0, list=10)
+    try:
+        opts, args = getopt.getopt(argv, "h", ["help"] + [o.replace('_', '-') + "=" for o in options])
+    except getopt.GetoptError as err:
+        print(str(err))
+        print(__doc__)
+        sys.exit(2)
+    for opt, arg in opts:
+        if opt in ("-h", "--help"):
+            print(__doc__)
+            sys.exit()
+        key = opt[2:].replace('-', '_')
+        options[key] = float(arg)
+    if len(args) != 1:
+        print(__doc__)
+        sys.exit(2)
+
+    with open(args[0]) as f:
+        header, entries = read_trace(f)
+    if not entries:
+        sys.stderr.write("no step trace found\n")
+        sys.exit(1)
+
+    samples, duration = axis_samples(header, entries)
+    print("time_ms,axis,position_mm,velocity_mm_s,acceleration_mm_s2,jerk_mm_s3")
+    rows = []
+    for i, axis in enumerate(AXES):
+        for t, p, v, a, j in derivatives(samples[axis], header["steps"][i], max(1, int(options["window"]))):
+            rows.append((t, i, p, v, a, j))
+    rows.sort()
+    fmt = lambda v: "" if v is None else "%.3f" % v
+    for t, i, p, v, a, j in rows:
+        print("%.4f,%s,%.4f,%s,%s,%s" % (t * 1000, AXES[i], p, fmt(v), fmt(a), fmt(j)))
+
+    jumps, fast, short = check(header, entries, options["max_jump"], options["isr_us"])
+    listed = int(options["list"])
+    blocks = sum(1 for e in entries if e[3] & TRACE_BLOCK_START)
+    peak = max([max(e[1]) * float(header["rate"]) / e[0] for e in entries if e[0]] + [0])
+    idle = sum(e[0] for e in entries if e[3] & TRACE_IDLE) / float(header["rate"])
+    sys.stderr.write("%d interrupts, %d block starts, %.1f ms (%.1f ms idle), peak step rate %.0f Hz (MAX_STEP_FREQUENCY %d)\n" %
+                     (len(entries), blocks, duration * 1000, idle * 1000, peak, header["max"]))
+    sys.stderr.write("%d step rate jumps at block boundaries above %.0f%%\n" % (len(jumps), 100 * options["max_jump"]))
+    for t, k, before, after in jumps[:listed]:
+        sys.stderr.write("  %.3f ms (interrupt %d): %.0f -> %.0f Hz\n" % (t * 1000, k, before, after))
+    sys.stderr.write("%d interrupts above MAX_STEP_FREQUENCY\n" % len(fast))
+    for t, k, step_rate in fast[:listed]:
+        sys.stderr.write("  %.3f ms (interrupt %d): %.0f Hz\n" % (t * 1000, k, step_rate))
+    sys.stderr.write("%d intervals shorter than %.1f us\n" % (len(short), options["isr_us"]))
+    for t, k, us in short[:listed]:
+        sys.stderr.write("  %.3f ms (interrupt %d): %.2f us\n" % (t * 1000, k, us))
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -59,9 +59,59 @@ static long counter_x, counter_y, counter_z, counter_e;
 volatile static unsigned long step_events_completed; // The number of step events executed in the current block
 
 #ifdef ADVANCE
-  static long advance_rate, advance, final_advance = 0;
-  static long old_advance = 0;
-  static long e_steps[4];
+  static long advance, old_advance = 0;  // E steps the extruder runs ahead of the commanded position
+  static uint8_t advance_extruder = 0;   // The extruder old_advance belongs to
+  static volatile long e_steps[4];       // E steps still to be done by the extruder timer
+  static uint8_t e_dir_bits = 0,         // Extruders currently set to reverse
+                 e_pulse_bits = 0;       // Extruders with a step pulse to end
+
+  // Add the change of the advance to the E steps of the extruder
+  #define APPLY_ADVANCE(rate) do { \
+    advance = ((unsigned long long)(rate) * current_block->advance_k) >> 16; \
+    e_steps[current_block->active_extruder] += advance - old_advance; \
+    old_advance = advance; \
+  } while(0)
+#endif
+
+#ifdef INPUT_SHAPING
+  /**
+   * The stepper interrupt doesn't step X and Y. It queues their steps with
+   * the time of the shaper timer, and the shaper timer applies every queued
+   * step once per impulse of the shaper, scaled by the impulse amplitude and
+   * after the impulse delay. An axis steps whenever the applied fractions
+   * add up to half a step, so the motors follow the planned motion convolved
+   * with the shaper.
+   */
+  #if SHAPING_TYPE == SHAPER_ZV
+    #define SHAPER_IMPULSES 2
+  #else
+    #define SHAPER_IMPULSES 3
+  #endif
+  #define SHAPER_MASK (SHAPING_BUFFER_SIZE - 1)
+  #define SHAPER_ONE 65536L  // amplitudes and pending steps are in 1/65536 steps
+
+  typedef struct {
+    uint16_t tick;    // shaper tick the steps were queued at
+    int8_t steps[2];  // X and Y steps of one step interrupt
+  } shaper_event_t;
+
+  static shaper_event_t shaper_events[SHAPING_BUFFER_SIZE];
+  static volatile uint16_t shaper_head = 0,                 // next free event
+                           shaper_tail = 0;                 // oldest event not applied by every impulse
+  static uint16_t shaper_read[2][SHAPER_IMPULSES] = { { 0 } }; // next event of each axis and impulse
+  static uint16_t shaper_ticks = 0;
+  static long shaper_amplitude[2][SHAPER_IMPULSES];         // sums to SHAPER_ONE per axis
+  static uint16_t shaper_delay[2][SHAPER_IMPULSES];         // in shaper ticks
+  static long shaper_pending[2] = { 0 };                    // applied, but not stepped yet
+  static long shaper_commanded[2] = { 0 },                  // steps queued by the stepper interrupt
+              shaper_issued[2] = { 0 };                     // steps done by the shaper timer
+  static int8_t shaper_steps[2] = { 0 };                    // steps of the current interrupt
+  static uint8_t shaper_dir_bits = 0,                       // axes currently set to reverse
+                 shaper_pulse_bits = 0;                     // axes with a step pulse to end
+  static volatile bool shaper_running = false;              // the shaper interrupt is enabled
+
+  float shaping_frequency[2] = { SHAPING_FREQUENCY_X, SHAPING_FREQUENCY_Y },
+        shaping_damping[2] = { SHAPING_DAMPING_X, SHAPING_DAMPING_Y };
 #endif
 
 static long acceleration_time, deceleration_time;
@@ -92,31 +142,131 @@ static volatile char endstop_hit_bits = 0; // use X_MIN, Y_MIN, Z_MIN and Z_PROB
 
 static bool check_endstops = true;
 
+#ifdef BABYSTEPPING
+  volatile int babystepsTodo[3] = { 0 };
+  static long babystep_wait = 0; // timer ticks until the next babystep may be done
+#endif
+
 volatile long count_position[NUM_AXIS] = { 0 };
 volatile signed char count_direction[NUM_AXIS] = { 1, 1, 1, 1 };
 
+TcChannel *stepperChannel = (STEP_TIMER_COUNTER->TC_CHANNEL + STEP_TIMER_CHANNEL);
+
+#ifdef STEP_TRACE
+  /**
+   * One stepper interrupt of the step trace: the timer interval it set, the
+   * steps it did per motor (3 bits each, X in the low bits), the block
+   * direction bits and where it was in its block. Interrupts that don't step
+   * (no block, waiting for the shaper timer) are recorded as TRACE_IDLE, the
+   * consecutive ones in one entry with the sum of their intervals, so the
+   * intervals add up to the recorded time.
+   */
+  typedef struct {
+    uint32_t interval;
+    uint16_t steps;
+    uint8_t direction_bits;
+    uint8_t flags;
+  } step_trace_t;
+
+  #define TRACE_BLOCK_START  1 // first interrupt of a block
+  #define TRACE_ACCELERATING 2
+  #define TRACE_DECELERATING 4
+  #define TRACE_IDLE         8 // interrupts without steps
+
+  static step_trace_t step_trace[STEP_TRACE_SIZE];
+  static uint16_t step_trace_head = 0,  // next entry to write
+                  step_trace_count = 0; // entries recorded, up to STEP_TRACE_SIZE
+  static volatile bool step_trace_on = false;
+  static uint8_t step_trace_flags = 0;  // flags of the interrupt being recorded
+
+  #define TRACE_FLAG(f) step_trace_flags |= (f)
+
+  FORCE_INLINE void step_trace_store(const uint16_t steps, const uint8_t flags) {
+    step_trace_t *entry = &step_trace[step_trace_head];
+    entry->interval = stepperChannel->TC_RC; // as set by HAL_timer_stepper_count()
+    entry->steps = steps;
+    entry->direction_bits = out_bits;
+    entry->flags = flags;
+    if (++step_trace_head == STEP_TRACE_SIZE) step_trace_head = 0;
+    if (step_trace_count < STEP_TRACE_SIZE) step_trace_count++;
+  }
+
+  // Record the interrupt, with the step counts from before its steps
+  FORCE_INLINE void step_trace_record(const long position[NUM_AXIS]) {
+    uint16_t steps = 0;
+    for (int8_t i = 0; i < NUM_AXIS; i++) steps |= labs(count_position[i] - position[i]) << (3 * i);
+    step_trace_store(steps, step_trace_flags);
+  }
+
+  // Record an interrupt without steps, added to the previous one if that was idle too
+  FORCE_INLINE void step_trace_idle() {
+    if (!step_trace_on) return;
+    if (step_trace_count) {
+      step_trace_t *last = &step_trace[(step_trace_head ? step_trace_head : STEP_TRACE_SIZE) - 1];
+      uint32_t interval = stepperChannel->TC_RC;
+      if (last->flags == TRACE_IDLE && last->interval + interval > last->interval) {
+        last->interval += interval;
+        return;
+      }
+    }
+    step_trace_store(0, TRACE_IDLE);
+  }
+  #define TRACE_IDLE_INTERRUPT() step_trace_idle()
+#else
+  #define TRACE_FLAG(f)
+  #define TRACE_IDLE_INTERRUPT()
+#endif
+
 
 //===========================================================================
 //================================ functions ================================
 //===========================================================================
 
 #ifdef DUAL_X_CARRIAGE
-  #define X_APPLY_DIR(v,ALWAYS) \
-    if (extruder_duplication_enabled || ALWAYS) { \
-      X_DIR_WRITE(v); \
-      X2_DIR_WRITE(v); \
-    } \
-    else { \
-      if (current_block->active_extruder) X2_DIR_WRITE(v); else X_DIR_WRITE(v); \
+  /**
+   * The carriages and extruders a block moves are loaded with the block as
+   * PIO bit masks of their step pins, with 0 for the ones that stand still.
+   * A step is then the same register writes in every mode.
+   */
+  static uint8_t dxc_steppers = 0;
+  static dxc_position_t dxc_count = { BIT(DXC_CARRIAGE_1) }; // The carriages of count_position[X_AXIS]
+  static uint32_t x_step_mask, x2_step_mask, e0_step_mask, e1_step_mask;
+
+  #define _PIN_PORT(IO) DIO ## IO ## _WPORT
+  #define _PIN_MASK(IO) MASK(DIO ## IO ## _PIN)
+  #define PIN_PORT(IO) _PIN_PORT(IO)
+  #define PIN_MASK(IO) _PIN_MASK(IO)
+  #define WRITE_MASKED(IO, M, v) { if (v) PIN_PORT(IO)->PIO_SODR = M; else PIN_PORT(IO)->PIO_CODR = M; }
+
+  FORCE_INLINE void dxc_load_steppers(uint8_t steppers) {
+    dxc_steppers = steppers;
+    bool c1 = TEST(steppers, DXC_CARRIAGE_1), c2 = TEST(steppers, DXC_CARRIAGE_2);
+    x_step_mask = c1 ? PIN_MASK(X_STEP_PIN) : 0;
+    e0_step_mask = c1 ? PIN_MASK(E0_STEP_PIN) : 0;
+    x2_step_mask = c2 ? PIN_MASK(X2_STEP_PIN) : 0;
+    e1_step_mask = c2 ? PIN_MASK(E1_STEP_PIN) : 0;
+  }
+
+  #define X2_MIRROR(v) (TEST(dxc_steppers, DXC_MIRROR_X2) ? !(v) : (v))
+  #define X_APPLY_DIR(v,ALWAYS) { \
+    if (ALWAYS || TEST(dxc_steppers, DXC_CARRIAGE_1)) X_DIR_WRITE(v); \
+    if (ALWAYS || TEST(dxc_steppers, DXC_CARRIAGE_2)) X2_DIR_WRITE(X2_MIRROR(v)); \
+  }
+  #define X_APPLY_STEP(v,ALWAYS) { \
+    if (ALWAYS) { X_STEP_WRITE(v); X2_STEP_WRITE(v); } \
+    else { WRITE_MASKED(X_STEP_PIN, x_step_mask, v); WRITE_MASKED(X2_STEP_PIN, x2_step_mask, v); } \
+  }
+  #if EXTRUDERS == 2
+    #define E_STEP_WRITE(v) { WRITE_MASKED(E0_STEP_PIN, e0_step_mask, v); WRITE_MASKED(E1_STEP_PIN, e1_step_mask, v); }
+    #define NORM_E_DIR() { \
+      if (TEST(dxc_steppers, DXC_CARRIAGE_1)) E0_DIR_WRITE(!INVERT_E0_DIR); \
+      if (TEST(dxc_steppers, DXC_CARRIAGE_2)) E1_DIR_WRITE(!INVERT_E1_DIR); \
     }
-  #define X_APPLY_STEP(v,ALWAYS) \
-    if (extruder_duplication_enabled || ALWAYS) { \
-      X_STEP_WRITE(v); \
-      X2_STEP_WRITE(v); \
-    } \
-    else { \
-      if (current_block->active_extruder != 0) X2_STEP_WRITE(v); else X_STEP_WRITE(v); \
+    #define REV_E_DIR() { \
+      if (TEST(dxc_steppers, DXC_CARRIAGE_1)) E0_DIR_WRITE(INVERT_E0_DIR); \
+      if (TEST(dxc_steppers, DXC_CARRIAGE_2)) E1_DIR_WRITE(INVERT_E1_DIR); \
     }
+  #endif
 #else
   #define X_APPLY_DIR(v,Q) X_DIR_WRITE(v)
   #define X_APPLY_STEP(v,Q) X_STEP_WRITE(v)
@@ -156,6 +306,10 @@ volatile signed char count_direction[NUM_AXIS] = { 1, 1, 1, 1 };
 
 #define E_APPLY_STEP(v,Q) E_STEP_WRITE(v)
 
+#define _COUNTER(axis) counter_## axis
+#define _APPLY_STEP(AXIS) AXIS ##_APPLY_STEP
+#define _INVERT_STEP_PIN(AXIS) INVERT_## AXIS ##_STEP_PIN
+
 // intRes = intIn1 * intIn2 >> 16
 #define MultiU16X8toH16(intRes, charIn1, intIn2)   intRes = ((charIn1) * (intIn2)) >> 16
 
@@ -221,6 +375,91 @@ void enable_endstops(bool check) { check_endstops = check; }
 //  step_events_completed reaches block->decelerate_after after which it decelerates until the trapezoid generator is reset.
 //  The slope of acceleration is calculated using v = u + at where t is the accumulated timer values of the steps so far.
 
+#ifdef INPUT_SHAPING
+
+  // Queue the X and Y steps of this interrupt for the shaper timer
+  FORCE_INLINE void shaper_queue() {
+    if (shaper_steps[X_AXIS] || shaper_steps[Y_AXIS]) {
+      shaper_event_t &event = shaper_events[shaper_head];
+      event.tick = shaper_ticks;
+      event.steps[X_AXIS] = shaper_steps[X_AXIS];
+      event.steps[Y_AXIS] = shaper_steps[Y_AXIS];
+      shaper_commanded[X_AXIS] += shaper_steps[X_AXIS];
+      shaper_commanded[Y_AXIS] += shaper_steps[Y_AXIS];
+      shaper_steps[X_AXIS] = shaper_steps[Y_AXIS] = 0;
+      shaper_head = (shaper_head + 1) & SHAPER_MASK;
+      shaper_running = true;
+      HAL_timer_enable_interrupt(SHAPER_TIMER_NUM);
+    }
+  }
+
+  FORCE_INLINE bool shaper_full() { return ((shaper_head + 1) & SHAPER_MASK) == shaper_tail; }
+
+  // Drop the X and Y steps that haven't reached the motors yet (endstop hit,
+  // quickStop) and take them back out of the step counts.
+  static void shaper_stop() {
+    for (uint8_t axis = X_AXIS; axis <= Y_AXIS; axis++) {
+      count_position[axis] -= shaper_commanded[axis] - shaper_issued[axis];
+      shaper_commanded[axis] = shaper_issued[axis];
+      shaper_pending[axis] = 0;
+      for (uint8_t i = 0; i < SHAPER_IMPULSES; i++) shaper_read[axis][i] = shaper_head;
+    }
+    shaper_tail = shaper_head;
+  }
+
+  bool st_shaper_busy() { return shaper_running; }
+
+  /**
+   * Compute the impulses of both axes from shaping_frequency and
+   * shaping_damping. A frequency of 0 turns shaping off for the axis.
+   * A frequency below the lowest one the delays can hold is raised to
+   * it in shaping_frequency, so M593 and M503 report what is used.
+   */
+  void st_set_shaping() {
+    st_synchronize();
+    for (uint8_t axis = X_AXIS; axis <= Y_AXIS; axis++) {
+      float a[SHAPER_IMPULSES] = { 1 }, t[SHAPER_IMPULSES] = { 0 },
+            zeta = constrain(shaping_damping[axis], 0, 0.9),
+            df = sqrt(1 - zeta * zeta),
+            // The delays must fit the 16 bit ticks of the events
+            freq = max(shaping_frequency[axis], (float)(SHAPING_STEP_FREQUENCY / 30000.0 / df));
+      if (shaping_frequency[axis] > 0) {
+        shaping_frequency[axis] = freq;
+        float td = 1 / (freq * df), K = exp(-zeta * M_PI / df);
+        #if SHAPING_TYPE == SHAPER_ZV
+          a[1] = K;
+          t[1] = 0.5 * td;
+        #elif SHAPING_TYPE == SHAPER_MZV
+          K = exp(-0.75 * zeta * M_PI / df);
+          a[0] = 1 - M_SQRT1_2;
+          a[1] = (M_SQRT2 - 1) * K;
+          a[2] = a[0] * K * K;
+          t[1] = 0.375 * td;
+          t[2] = 0.75 * td;
+        #else // SHAPER_EI, 5% vibration tolerance
+          a[0] = 0.25 * 1.05;
+          a[1] = 0.5 * 0.95 * K;
+          a[2] = a[0] * K * K;
+          t[1] = 0.5 * td;
+          t[2] = td;
+        #endif
+      }
+      float sum = 0;
+      for (uint8_t i = 0; i < SHAPER_IMPULSES; i++) sum += a[i];
+      // The first impulse takes the rounding so the amplitudes add up to one step
+      long rest = SHAPER_ONE;
+      for (uint8_t i = 1; i < SHAPER_IMPULSES; i++) {
+        shaper_amplitude[axis][i] = a[i] / sum * SHAPER_ONE + 0.5;
+        shaper_delay[axis][i] = t[i] * SHAPING_STEP_FREQUENCY + 0.5;
+        rest -= shaper_amplitude[axis][i];
+      }
+      shaper_amplitude[axis][0] = rest;
+      shaper_delay[axis][0] = 0;
+    }
+  }
+
+#endif // INPUT_SHAPING
+
 void st_wake_up() {
   //  TCNT1 = 0;
   ENABLE_STEPPER_DRIVER_INTERRUPT();
@@ -254,21 +493,30 @@ FORCE_INLINE unsigned long calc_timer(unsigned long step_rate) {
 void set_stepper_direction() {
   
   // Set the direction bits (X_AXIS=A_AXIS and Y_AXIS=B_AXIS for COREXY)
+  // With INPUT_SHAPING the shaper timer sets the X and Y directions
   if (TEST(out_bits, X_AXIS)) {
-    X_APPLY_DIR(INVERT_X_DIR,0);
+    #ifndef INPUT_SHAPING
+      X_APPLY_DIR(INVERT_X_DIR,0);
+    #endif
     count_direction[X_AXIS] = -1;
   }
   else {
-    X_APPLY_DIR(!INVERT_X_DIR,0);
+    #ifndef INPUT_SHAPING
+      X_APPLY_DIR(!INVERT_X_DIR,0);
+    #endif
     count_direction[X_AXIS] = 1;
   }
 
   if (TEST(out_bits, Y_AXIS)) {
-    Y_APPLY_DIR(INVERT_Y_DIR,0);
+    #ifndef INPUT_SHAPING
+      Y_APPLY_DIR(INVERT_Y_DIR,0);
+    #endif
     count_direction[Y_AXIS] = -1;
   }
   else {
-    Y_APPLY_DIR(!INVERT_Y_DIR,0);
+    #ifndef INPUT_SHAPING
+      Y_APPLY_DIR(!INVERT_Y_DIR,0);
+    #endif
     count_direction[Y_AXIS] = 1;
   }
   
@@ -281,23 +529,24 @@ void set_stepper_direction() {
     count_direction[Z_AXIS] = 1;
   }
   
-  #ifndef ADVANCE
-    if (TEST(out_bits, E_AXIS)) {
+  // With ADVANCE the extruder timer sets the E direction
+  if (TEST(out_bits, E_AXIS)) {
+    #ifndef ADVANCE
       REV_E_DIR();
-      count_direction[E_AXIS] = -1;
-    }
-    else {
+    #endif
+    count_direction[E_AXIS] = -1;
+  }
+  else {
+    #ifndef ADVANCE
       NORM_E_DIR();
-      count_direction[E_AXIS] = 1;
-    }
-  #endif //!ADVANCE
+    #endif
+    count_direction[E_AXIS] = 1;
+  }
 }
 
 // Initializes the trapezoid generator from the current block. Called whenever a new
 // block begins.
 
-TcChannel *stepperChannel = (STEP_TIMER_COUNTER->TC_CHANNEL + STEP_TIMER_CHANNEL);
-
 FORCE_INLINE
 void HAL_timer_stepper_count(uint32_t count) {
 
@@ -308,17 +557,28 @@ void HAL_timer_stepper_count(uint32_t count) {
 
 FORCE_INLINE void trapezoid_generator_reset() {
 
+  #ifdef DUAL_X_CARRIAGE
+    // Other carriages: their direction pins need setting too
+    if (current_block->dxc_steppers != dxc_steppers) {
+      dxc_load_steppers(current_block->dxc_steppers);
+      out_bits = ~current_block->direction_bits;
+    }
+    dxc_select(dxc_count, count_position[X_AXIS], current_block->dxc_steppers);
+  #endif
+
   if (current_block->direction_bits != out_bits) {
     out_bits = current_block->direction_bits;
     set_stepper_direction();
   }
   
   #ifdef ADVANCE
-    advance = current_block->initial_advance;
-    final_advance = current_block->final_advance;
-    // Do E steps + advance steps
-    e_steps[current_block->active_extruder] += ((advance >>8) - old_advance);
-    old_advance = advance >>8;
+    if (current_block->active_extruder != advance_extruder) {
+      // Take the advance back from the extruder that was used before
+      e_steps[advance_extruder] -= old_advance;
+      old_advance = 0;
+      advance_extruder = current_block->active_extruder;
+    }
+    APPLY_ADVANCE(current_block->initial_rate);
   #endif
   deceleration_time = 0;
   // step_rate to timer interval
@@ -329,17 +589,100 @@ FORCE_INLINE void trapezoid_generator_reset() {
   acceleration_time = calc_timer(acc_step_rate);
   //HAL_timer_stepper_count(acceleration_time);
 
-  // SERIAL_ECHO_START;
-  // SERIAL_ECHOPGM("advance :");
-  // SERIAL_ECHO(current_block->advance/256.0);
-  // SERIAL_ECHOPGM("advance rate :");
-  // SERIAL_ECHO(current_block->advance_rate/256.0);
-  // SERIAL_ECHOPGM("initial advance :");
-  // SERIAL_ECHO(current_block->initial_advance/256.0);
-  // SERIAL_ECHOPGM("final advance :");
-  // SERIAL_ECHOLN(current_block->final_advance/256.0);
 }
 
+#ifdef BABYSTEPPING
+
+  // Called by the stepper interrupt, so no step or direction change
+  // of the planned moves (or of the ADVANCE and shaper timers) can come between.
+  static void babystep(const uint8_t axis, const bool direction) {
+
+    #define _ENABLE(axis) enable_## axis()
+    #define _READ_DIR(AXIS) AXIS ##_DIR_READ
+    #define _INVERT_DIR(AXIS) INVERT_## AXIS ##_DIR
+    #define _APPLY_DIR(AXIS, INVERT) AXIS ##_APPLY_DIR(INVERT, true)
+
+    #define BABYSTEP_AXIS(axis, AXIS, INVERT) { \
+        _ENABLE(axis); \
+        uint8_t old_pin = _READ_DIR(AXIS); \
+        _APPLY_DIR(AXIS, _INVERT_DIR(AXIS)^direction^INVERT); \
+        _APPLY_STEP(AXIS)(!_INVERT_STEP_PIN(AXIS), true); \
+        delayMicroseconds(2); \
+        _APPLY_STEP(AXIS)(_INVERT_STEP_PIN(AXIS), true); \
+        _APPLY_DIR(AXIS, old_pin); \
+      }
+
+    switch(axis) {
+
+      case X_AXIS:
+        BABYSTEP_AXIS(x, X, false);
+        break;
+
+      case Y_AXIS:
+        BABYSTEP_AXIS(y, Y, false);
+        break;
+ 
+      case Z_AXIS: {
+
+        #ifndef DELTA
+
+          BABYSTEP_AXIS(z, Z, BABYSTEP_INVERT_Z);
+
+        #else // DELTA
+
+          bool z_direction = direction ^ BABYSTEP_INVERT_Z;
+
+          enable_x();
+          enable_y();
+          enable_z();
+          uint8_t old_x_dir_pin = X_DIR_READ,
+                  old_y_dir_pin = Y_DIR_READ,
+                  old_z_dir_pin = Z_DIR_READ;
+          //setup new step
+          X_DIR_WRITE(INVERT_X_DIR^z_direction);
+          Y_DIR_WRITE(INVERT_Y_DIR^z_direction);
+          Z_DIR_WRITE(INVERT_Z_DIR^z_direction);
+          //perform step 
+          X_STEP_WRITE(!INVERT_X_STEP_PIN);
+          Y_STEP_WRITE(!INVERT_Y_STEP_PIN);
+          Z_STEP_WRITE(!INVERT_Z_STEP_PIN);
+          _delay_us(1U);
+          X_STEP_WRITE(INVERT_X_STEP_PIN); 
+          Y_STEP_WRITE(INVERT_Y_STEP_PIN); 
+          Z_STEP_WRITE(INVERT_Z_STEP_PIN);
+          //get old pin state back.
+          X_DIR_WRITE(old_x_dir_pin);
+          Y_DIR_WRITE(old_y_dir_pin);
+          Z_DIR_WRITE(old_z_dir_pin);
+
+        #endif
+
+      } break;
+ 
+      default: break;
+    }
+  }
+
+  /**
+   * Do the babysteps asked for by the LCD, at most BABYSTEP_FREQUENCY per
+   * second. interval is the time in timer ticks until the next interrupt.
+   */
+  FORCE_INLINE void babystep_check(unsigned long interval) {
+    if (babystep_wait <= 0) {
+      for (uint8_t axis = X_AXIS; axis <= Z_AXIS; axis++) {
+        int curTodo = babystepsTodo[axis]; //get rid of volatile for performance
+        if (curTodo) {
+          babystep(axis, curTodo > 0);
+          babystepsTodo[axis] = curTodo > 0 ? curTodo - 1 : curTodo + 1;
+          babystep_wait = HAL_TIMER_RATE / BABYSTEP_FREQUENCY;
+        }
+      }
+    }
+    if (babystep_wait > 0) babystep_wait -= interval;
+  }
+
+#endif //BABYSTEPPING
+
 // "The Stepper Driver Interrupt" - This timer interrupt is the workhorse.
 // It pops blocks from the block_buffer and executes them by pulsing the stepper pins appropriately.
 
@@ -358,6 +701,7 @@ HAL_STEP_TIMER_ISR {
     #endif
     cleaning_buffer_counter--;
     HAL_timer_stepper_count(HAL_TIMER_RATE / 200); //5ms wait
+    TRACE_IDLE_INTERRUPT();
     return;
   }
 
@@ -368,6 +712,7 @@ HAL_STEP_TIMER_ISR {
     if (current_block) {
       current_block->busy = true;
       trapezoid_generator_reset();
+      TRACE_FLAG(TRACE_BLOCK_START);
       counter_x = -(current_block->step_event_count >> 1);
       counter_y = counter_z = counter_e = counter_x;
       step_events_completed = 0;
@@ -375,22 +720,33 @@ HAL_STEP_TIMER_ISR {
       #ifdef Z_LATE_ENABLE
         if (current_block->steps[Z_AXIS] > 0) {
           enable_z();
-          HAL_timer_set_count (STEP_TIMER_COUNTER, STEP_TIMER_CHANNEL, HAL_TIMER_RATE / 1000); //1ms wait
+          HAL_timer_stepper_count(HAL_TIMER_RATE / 1000); //1ms wait
+          TRACE_IDLE_INTERRUPT();
           return;
         }
       #endif
 
-      // #ifdef ADVANCE
-      //   e_steps[current_block->active_extruder] = 0;
-      // #endif
     }
     else {
         HAL_timer_stepper_count(HAL_TIMER_RATE / 1000); // 1kHz
+        TRACE_IDLE_INTERRUPT();
+        #ifdef BABYSTEPPING
+          babystep_check(HAL_TIMER_RATE / 1000);
+        #endif
     }
   }
 
   if (current_block != NULL) {
 
+    #ifdef INPUT_SHAPING
+      // Wait for the shaper timer to make room
+      if (shaper_full()) {
+        HAL_timer_stepper_count(HAL_TIMER_RATE / 20000); // 50us
+        TRACE_IDLE_INTERRUPT();
+        return;
+      }
+    #endif
+
     // Check endstops
     if (check_endstops) {
       
@@ -414,9 +770,16 @@ HAL_STEP_TIMER_ISR {
       // TEST_ENDSTOP: test the old and the current status of an endstop
       #define TEST_ENDSTOP(ENDSTOP) (TEST(current_endstop_bits, ENDSTOP) && TEST(old_endstop_bits, ENDSTOP))
 
+      #ifdef INPUT_SHAPING
+        #define SHAPER_STOP() shaper_stop()
+      #else
+        #define SHAPER_STOP()
+      #endif
+
       #define UPDATE_ENDSTOP(AXIS,MINMAX) \
         SET_ENDSTOP_BIT(AXIS, MINMAX); \
         if (TEST_ENDSTOP(_ENDSTOP(AXIS, MINMAX))  && (current_block->steps[_AXIS(AXIS)] > 0)) { \
+          SHAPER_STOP(); \
           endstops_trigsteps[_AXIS(AXIS)] = count_position[_AXIS(AXIS)]; \
           _ENDSTOP_HIT(AXIS); \
           step_events_completed = current_block->step_event_count; \
@@ -550,10 +913,6 @@ HAL_STEP_TIMER_ISR {
       old_endstop_bits = current_endstop_bits;
     }
 
-	#define _COUNTER(axis) counter_## axis
-	#define _APPLY_STEP(AXIS) AXIS ##_APPLY_STEP
-	#define _INVERT_STEP_PIN(AXIS) INVERT_## AXIS ##_STEP_PIN
-
 	#define STEP_START(axis, AXIS) \
 	  _COUNTER(axis) += current_block->steps[_AXIS(AXIS)]; \
 	  if (_COUNTER(axis) > 0) { \
@@ -563,27 +922,48 @@ HAL_STEP_TIMER_ISR {
 
 	#define STEP_END(axis, AXIS) _APPLY_STEP(AXIS)(_INVERT_STEP_PIN(AXIS),0)
 
+	// With INPUT_SHAPING the X and Y steps are handed to the shaper timer
+	#define SHAPER_STEP(axis, AXIS) \
+	  _COUNTER(axis) += current_block->steps[_AXIS(AXIS)]; \
+	  if (_COUNTER(axis) > 0) { \
+		_COUNTER(axis) -= current_block->step_event_count; \
+		count_position[_AXIS(AXIS)] += count_direction[_AXIS(AXIS)]; \
+		shaper_steps[_AXIS(AXIS)] += count_direction[_AXIS(AXIS)]; }
+
+	#ifdef INPUT_SHAPING
+	  #define XY_STEP_START() SHAPER_STEP(x, X); SHAPER_STEP(y, Y)
+	  #define XY_STEP_END()
+	#else
+	  #define XY_STEP_START() STEP_START(x, X); STEP_START(y, Y)
+	  #define XY_STEP_END() STEP_END(x, X); STEP_END(y, Y)
+	#endif
+
+	// With ADVANCE the E steps are handed to the extruder timer
+	#define ADVANCE_STEP_E() \
+	  counter_e += current_block->steps[E_AXIS]; \
+	  if (counter_e > 0) { \
+		counter_e -= current_block->step_event_count; \
+		count_position[E_AXIS] += count_direction[E_AXIS]; \
+		e_steps[current_block->active_extruder] += count_direction[E_AXIS]; }
+
+    #ifdef STEP_TRACE
+      long trace_position[NUM_AXIS];
+      if (step_trace_on) for (int8_t i = 0; i < NUM_AXIS; i++) trace_position[i] = count_position[i];
+    #endif
+
     #if defined(ENABLE_HIGH_SPEED_STEPPING)
       // Take multiple steps per interrupt (For high speed moves)
       for (int8_t i = 0; i < step_loops; i++) {
 
-        #ifdef ADVANCE
-          counter_e += current_block->steps[E_AXIS];
-          if (counter_e > 0) {
-            counter_e -= current_block->step_event_count;
-            e_steps[current_block->active_extruder] += TEST(out_bits, E_AXIS) ? -1 : 1;
-          }
-        #endif //ADVANCE
-
-        STEP_START(x,X);
-        STEP_START(y,Y);
+        XY_STEP_START();
         STEP_START(z,Z);
-        #ifndef ADVANCE
+        #ifdef ADVANCE
+          ADVANCE_STEP_E();
+        #else
           STEP_START(e,E);
         #endif
 
-        STEP_END(x, X);
-        STEP_END(y, Y);
+        XY_STEP_END();
         STEP_END(z, Z);
         #ifndef ADVANCE
           STEP_END(e, E);
@@ -592,13 +972,20 @@ HAL_STEP_TIMER_ISR {
         step_events_completed++;
         if (step_events_completed >= current_block->step_event_count) break;
       }
+      #ifdef INPUT_SHAPING
+        shaper_queue();
+      #endif
     #else
-      STEP_START(x,X);
-      STEP_START(y,Y);
+      XY_STEP_START();
       STEP_START(z,Z);
-      #ifndef ADVANCE
+      #ifdef ADVANCE
+        ADVANCE_STEP_E();
+      #else
         STEP_START(e,E);
       #endif
+      #ifdef INPUT_SHAPING
+        shaper_queue();
+      #endif
       step_events_completed++;
     #endif
     // Calculate new timer value
@@ -616,15 +1003,9 @@ HAL_STEP_TIMER_ISR {
       // step_rate to timer interval
       timer = calc_timer(acc_step_rate);
       acceleration_time += timer;
+      TRACE_FLAG(TRACE_ACCELERATING);
       #ifdef ADVANCE
-        for(int8_t i=0; i < step_loops; i++) {
-          advance += advance_rate;
-        }
-        //if (advance > current_block->advance) advance = current_block->advance;
-        // Do E steps + advance steps
-        e_steps[current_block->active_extruder] += ((advance >>8) - old_advance);
-        old_advance = advance >>8;
-
+        APPLY_ADVANCE(acc_step_rate);
       #endif
     }
     else if (step_events_completed > (unsigned long)current_block->decelerate_after) {
@@ -645,15 +1026,10 @@ HAL_STEP_TIMER_ISR {
       // step_rate to timer interval
       timer = calc_timer(step_rate);
       deceleration_time += timer;
+      TRACE_FLAG(TRACE_DECELERATING);
       #ifdef ADVANCE
-        for(int8_t i=0; i < step_loops; i++) {
-          advance -= advance_rate;
-        }
-        if (advance < final_advance) advance = final_advance;
-        // Do E steps + advance steps
-        e_steps[current_block->active_extruder] += ((advance >>8) - old_advance);
-        old_advance = advance >>8;
-      #endif //ADVANCE
+        APPLY_ADVANCE(step_rate);
+      #endif
     }
     else {
       timer = OCR1A_nominal;
@@ -661,8 +1037,7 @@ HAL_STEP_TIMER_ISR {
       step_loops = step_loops_nominal;
     }
     #if !defined(ENABLE_HIGH_SPEED_STEPPING)
-      STEP_END(x, X);
-      STEP_END(y, Y);
+      XY_STEP_END();
       STEP_END(z, Z);
       #ifndef ADVANCE
         STEP_END(e, E);
@@ -671,6 +1046,19 @@ HAL_STEP_TIMER_ISR {
 
     HAL_timer_stepper_count(timer);
 
+    #ifdef STEP_TRACE
+      if (step_trace_on) step_trace_record(trace_position);
+      step_trace_flags = 0;
+    #endif
+
+    #ifdef BABYSTEPPING
+      babystep_check(timer);
+    #endif
+
+    #ifdef ADVANCE
+      if (e_steps[current_block->active_extruder]) HAL_timer_enable_interrupt(ADVANCE_TIMER_NUM);
+    #endif
+
     // If current block is finished, reset pointer
     if (step_events_completed >= current_block->step_event_count) {
       current_block = NULL;
@@ -680,77 +1068,127 @@ HAL_STEP_TIMER_ISR {
 }
 
 #ifdef ADVANCE
-  unsigned char old_OCR0A;
-  // Timer interrupt for E. e_steps is set in the main routine;
-  // Timer 0 is shared with millies
-  ISR(TIMER0_COMPA_vect)
-  {
-    old_OCR0A += 52; // ~10kHz interrupt (250000 / 26 = 9615kHz)
-    OCR0A = old_OCR0A;
-    // Set E direction (Depends on E direction + advance)
-    for(unsigned char i=0; i<4;i++) {
-      if (e_steps[0] != 0) {
-        E0_STEP_WRITE(INVERT_E_STEP_PIN);
-        if (e_steps[0] < 0) {
-          E0_DIR_WRITE(INVERT_E0_DIR);
-          e_steps[0]++;
-          E0_STEP_WRITE(!INVERT_E_STEP_PIN);
-        }
-        else if (e_steps[0] > 0) {
-          E0_DIR_WRITE(!INVERT_E0_DIR);
-          e_steps[0]--;
-          E0_STEP_WRITE(!INVERT_E_STEP_PIN);
-        }
-      }
- #if EXTRUDERS > 1
-      if (e_steps[1] != 0) {
-        E1_STEP_WRITE(INVERT_E_STEP_PIN);
-        if (e_steps[1] < 0) {
-          E1_DIR_WRITE(INVERT_E1_DIR);
-          e_steps[1]++;
-          E1_STEP_WRITE(!INVERT_E_STEP_PIN);
-        }
-        else if (e_steps[1] > 0) {
-          E1_DIR_WRITE(!INVERT_E1_DIR);
-          e_steps[1]--;
-          E1_STEP_WRITE(!INVERT_E_STEP_PIN);
-        }
-      }
- #endif
- #if EXTRUDERS > 2
-      if (e_steps[2] != 0) {
-        E2_STEP_WRITE(INVERT_E_STEP_PIN);
-        if (e_steps[2] < 0) {
-          E2_DIR_WRITE(INVERT_E2_DIR);
-          e_steps[2]++;
-          E2_STEP_WRITE(!INVERT_E_STEP_PIN);
-        }
-        else if (e_steps[2] > 0) {
-          E2_DIR_WRITE(!INVERT_E2_DIR);
-          e_steps[2]--;
-          E2_STEP_WRITE(!INVERT_E_STEP_PIN);
-        }
-      }
- #endif
- #if EXTRUDERS > 3
-      if (e_steps[3] != 0) {
-        E3_STEP_WRITE(INVERT_E_STEP_PIN);
-        if (e_steps[3] < 0) {
-          E3_DIR_WRITE(INVERT_E3_DIR);
-          e_steps[3]++;
-          E3_STEP_WRITE(!INVERT_E_STEP_PIN);
+
+  /**
+   * Extruder timer interrupt. Every tick either ends the step pulses of the
+   * last tick, sets a new direction (the step follows on the next tick, so
+   * the driver gets its setup time), or starts one step per extruder.
+   * The interrupt disables itself when all E steps are done.
+   */
+  #define _E_STEP(INDEX) \
+    if (e_steps[INDEX]) { \
+      bool rev = e_steps[INDEX] < 0; \
+      if (rev != TEST(e_dir_bits, INDEX)) { \
+        E## INDEX ##_DIR_WRITE(rev ? INVERT_E## INDEX ##_DIR : !INVERT_E## INDEX ##_DIR); \
+        e_dir_bits ^= BIT(INDEX); \
+      } \
+      else { \
+        E## INDEX ##_STEP_WRITE(!INVERT_E_STEP_PIN); \
+        e_pulse_bits |= BIT(INDEX); \
+        e_steps[INDEX] += rev ? 1 : -1; \
+      } \
+      busy = true; \
+    }
+
+  #define _E_STEP_END(INDEX) if (TEST(e_pulse_bits, INDEX)) E## INDEX ##_STEP_WRITE(INVERT_E_STEP_PIN)
+
+  HAL_ADVANCE_TIMER_ISR {
+    HAL_timer_isr_status(ADVANCE_TIMER_COUNTER, ADVANCE_TIMER_CHANNEL);
+
+    if (e_pulse_bits) {
+      _E_STEP_END(0);
+      #if EXTRUDERS > 1
+        _E_STEP_END(1);
+        #if EXTRUDERS > 2
+          _E_STEP_END(2);
+          #if EXTRUDERS > 3
+            _E_STEP_END(3);
+          #endif
+        #endif
+      #endif
+      e_pulse_bits = 0;
+      return;
+    }
+
+    bool busy = false;
+    _E_STEP(0);
+    #if EXTRUDERS > 1
+      _E_STEP(1);
+      #if EXTRUDERS > 2
+        _E_STEP(2);
+        #if EXTRUDERS > 3
+          _E_STEP(3);
+        #endif
+      #endif
+    #endif
+    if (!busy) HAL_timer_disable_interrupt(ADVANCE_TIMER_NUM);
+  }
+
+#endif // ADVANCE
+
+#ifdef INPUT_SHAPING
+
+  /**
+   * Shaper timer interrupt. Every tick applies the impulses that became due,
+   * then either ends the step pulses of the last tick, sets a new direction
+   * (the step follows on the next tick) or starts a step on the axes whose
+   * pending fraction reached half a step. The interrupt disables itself
+   * when nothing is queued or pending.
+   */
+  #define _SHAPER_STEP(AXIS) \
+    if (shaper_pending[_AXIS(AXIS)] >= SHAPER_ONE / 2 || shaper_pending[_AXIS(AXIS)] < -SHAPER_ONE / 2) { \
+      bool rev = shaper_pending[_AXIS(AXIS)] < 0; \
+      if (rev != TEST(shaper_dir_bits, _AXIS(AXIS))) { \
+        AXIS ##_APPLY_DIR(rev ? INVERT_## AXIS ##_DIR : !INVERT_## AXIS ##_DIR, 0); \
+        shaper_dir_bits ^= BIT(_AXIS(AXIS)); \
+      } \
+      else { \
+        AXIS ##_APPLY_STEP(!INVERT_## AXIS ##_STEP_PIN, 0); \
+        shaper_pulse_bits |= BIT(_AXIS(AXIS)); \
+        shaper_pending[_AXIS(AXIS)] += rev ? SHAPER_ONE : -SHAPER_ONE; \
+        shaper_issued[_AXIS(AXIS)] += rev ? -1 : 1; \
+      } \
+      busy = true; \
+    }
+
+  HAL_SHAPER_TIMER_ISR {
+    HAL_timer_isr_status(SHAPER_TIMER_COUNTER, SHAPER_TIMER_CHANNEL);
+    shaper_ticks++;
+
+    bool busy = false;
+    uint16_t head = shaper_head, tail = head;
+    for (uint8_t axis = X_AXIS; axis <= Y_AXIS; axis++) {
+      for (uint8_t i = 0; i < SHAPER_IMPULSES; i++) {
+        uint16_t r = shaper_read[axis][i];
+        while (r != head && (uint16_t)(shaper_ticks - shaper_events[r].tick) >= shaper_delay[axis][i]) {
+          shaper_pending[axis] += shaper_events[r].steps[axis] * shaper_amplitude[axis][i];
+          r = (r + 1) & SHAPER_MASK;
         }
-        else if (e_steps[3] > 0) {
-          E3_DIR_WRITE(!INVERT_E3_DIR);
-          e_steps[3]--;
-          E3_STEP_WRITE(!INVERT_E_STEP_PIN);
+        shaper_read[axis][i] = r;
+        if (r != head) {
+          busy = true;
+          if (((head - r) & SHAPER_MASK) > ((head - tail) & SHAPER_MASK)) tail = r;
         }
       }
- #endif
+    }
+    shaper_tail = tail;
 
+    if (shaper_pulse_bits) {
+      if (TEST(shaper_pulse_bits, X_AXIS)) X_APPLY_STEP(INVERT_X_STEP_PIN, 0);
+      if (TEST(shaper_pulse_bits, Y_AXIS)) Y_APPLY_STEP(INVERT_Y_STEP_PIN, 0);
+      shaper_pulse_bits = 0;
+      return;
+    }
+
+    _SHAPER_STEP(X);
+    _SHAPER_STEP(Y);
+    if (!busy) {
+      HAL_timer_disable_interrupt(SHAPER_TIMER_NUM);
+      shaper_running = false;
     }
   }
-#endif // ADVANCE
+
+#endif // INPUT_SHAPING
 
 void st_init() {
   digipot_init(); //Initialize Digipot Motor Current
@@ -948,15 +1386,27 @@ void st_init() {
   HAL_step_timer_start();
   ENABLE_STEPPER_DRIVER_INTERRUPT();
 
-  #if 0 // old AVR-stuff; needs rework
   #ifdef ADVANCE
-    #if defined(TCCR0A) && defined(WGM01)
-      TCCR0A &= ~BIT(WGM01);
-      TCCR0A &= ~BIT(WGM00);
-    #endif
     e_steps[0] = e_steps[1] = e_steps[2] = e_steps[3] = 0;
-    TIMSK0 |= BIT(OCIE0A);
+    #define _E_DIR_INIT(INDEX) E## INDEX ##_DIR_WRITE(!INVERT_E## INDEX ##_DIR)
+    _E_DIR_INIT(0);
+    #if EXTRUDERS > 1
+      _E_DIR_INIT(1);
+      #if EXTRUDERS > 2
+        _E_DIR_INIT(2);
+        #if EXTRUDERS > 3
+          _E_DIR_INIT(3);
+        #endif
+      #endif
+    #endif
+    HAL_motion_timer_start(ADVANCE_TIMER_NUM, ADVANCE_STEP_FREQUENCY);
   #endif //ADVANCE
+
+  #ifdef INPUT_SHAPING
+    X_APPLY_DIR(!INVERT_X_DIR, 0);
+    Y_APPLY_DIR(!INVERT_Y_DIR, 0);
+    st_set_shaping();
+    HAL_motion_timer_start(SHAPER_TIMER_NUM, SHAPING_STEP_FREQUENCY);
   #endif
 
   enable_endstops(true); // Start with endstops active. After homing they can be disabled
@@ -969,7 +1419,16 @@ void st_init() {
 /**
  * Block until all buffered steps are executed
  */
-void st_synchronize() { while (blocks_queued()) idle(); }
+void st_synchronize() {
+  #ifdef INPUT_SHAPING
+    while (blocks_queued() || st_shaper_busy()) idle();
+  #else
+    while (blocks_queued()) idle();
+  #endif
+  #ifdef BUFFER_MONITORING
+    plan_ran_dry = false; // The stop was waited for
+  #endif
+}
 
 void st_set_position(const long &x, const long &y, const long &z, const long &e) {
   CRITICAL_SECTION_START;
@@ -980,6 +1439,23 @@ void st_set_position(const long &x, const long &y, const long &z, const long &e)
   CRITICAL_SECTION_END;
 }
 
+#ifdef DUAL_X_CARRIAGE
+
+  void st_set_dxc_position(const dxc_position_t &dp) {
+    CRITICAL_SECTION_START;
+    dxc_count = dp;
+    CRITICAL_SECTION_END;
+  }
+
+  void st_get_dxc_position(dxc_position_t &dp, const unsigned char steppers) {
+    CRITICAL_SECTION_START;
+    dxc_select(dxc_count, count_position[X_AXIS], steppers);
+    dp = dxc_count;
+    CRITICAL_SECTION_END;
+  }
+
+#endif
+
 void st_set_e_position(const long &e) {
   CRITICAL_SECTION_START;
   count_position[E_AXIS] = e;
@@ -1007,87 +1483,89 @@ void finishAndDisableSteppers() {
   disable_all_steppers();
 }
 
+#ifdef STEP_TRACE
+
+  void st_trace_start() {
+    CRITICAL_SECTION_START;
+    step_trace_head = step_trace_count = 0;
+    step_trace_on = true;
+    CRITICAL_SECTION_END;
+  }
+
+  void st_trace_stop() { step_trace_on = false; }
+
+  void st_trace_dump() {
+    step_trace_on = false;
+    SERIAL_ECHOPAIR("TRACE rate:", (unsigned long)HAL_TIMER_RATE);
+    SERIAL_ECHOPAIR(" max:", (unsigned long)MAX_STEP_FREQUENCY);
+    SERIAL_ECHOPGM(" steps:");
+    for (int8_t i = 0; i < NUM_AXIS; i++) {
+      if (i) SERIAL_ECHOPGM(",");
+      SERIAL_ECHO(axis_steps_per_unit[i]);
+    }
+    #ifdef COREXY
+      SERIAL_ECHOPGM(" corexy");
+    #endif
+    SERIAL_ECHOPAIR(" count:", (unsigned long)step_trace_count);
+    SERIAL_EOL;
+    uint16_t i = (step_trace_head + STEP_TRACE_SIZE - step_trace_count) % STEP_TRACE_SIZE;
+    for (uint16_t n = 0; n < step_trace_count; n++) {
+      step_trace_t &entry = step_trace[i];
+      SERIAL_ECHOPAIR("TRACE:", (unsigned long)entry.interval);
+      SERIAL_ECHOPAIR(",", (unsigned long)entry.steps);
+      SERIAL_ECHOPAIR(",", (unsigned long)entry.direction_bits);
+      SERIAL_ECHOPAIR(",", (unsigned long)entry.flags);
+      SERIAL_EOL;
+      if (++i == STEP_TRACE_SIZE) i = 0;
+      if (!(n & 0x3F)) idle(); // keep the heaters managed
+    }
+  }
+
+#endif // STEP_TRACE
+
 void quickStop() {
   cleaning_buffer_counter = 5000;
   DISABLE_STEPPER_DRIVER_INTERRUPT();
   while (blocks_queued()) plan_discard_current_block();
   current_block = NULL;
+  #ifdef BUFFER_MONITORING
+    plan_ran_dry = false;
+  #endif
+  #ifdef ADVANCE
+    // Drop the E steps and the advance of the discarded blocks
+    HAL_timer_disable_interrupt(ADVANCE_TIMER_NUM);
+    e_steps[0] = e_steps[1] = e_steps[2] = e_steps[3] = 0;
+    advance = old_advance = 0;
+    if (e_pulse_bits) {
+      _E_STEP_END(0);
+      #if EXTRUDERS > 1
+        _E_STEP_END(1);
+        #if EXTRUDERS > 2
+          _E_STEP_END(2);
+          #if EXTRUDERS > 3
+            _E_STEP_END(3);
+          #endif
+        #endif
+      #endif
+      e_pulse_bits = 0;
+    }
+  #endif
+  #ifdef INPUT_SHAPING
+    HAL_timer_disable_interrupt(SHAPER_TIMER_NUM);
+    shaper_stop();
+    shaper_pulse_bits = 0;
+    shaper_running = false;
+    X_APPLY_STEP(INVERT_X_STEP_PIN, 0);
+    Y_APPLY_STEP(INVERT_Y_STEP_PIN, 0);
+  #endif
   ENABLE_STEPPER_DRIVER_INTERRUPT();
 }
 
-#ifdef BABYSTEPPING
-
-  // MUST ONLY BE CALLED BY AN ISR,
-  // No other ISR should ever interrupt this!
-  void babystep(const uint8_t axis, const bool direction) {
-
-    #define _ENABLE(axis) enable_## axis()
-    #define _READ_DIR(AXIS) AXIS ##_DIR_READ
-    #define _INVERT_DIR(AXIS) INVERT_## AXIS ##_DIR
-    #define _APPLY_DIR(AXIS, INVERT) AXIS ##_APPLY_DIR(INVERT, true)
-
-    #define BABYSTEP_AXIS(axis, AXIS, INVERT) { \
-        _ENABLE(axis); \
-        uint8_t old_pin = _READ_DIR(AXIS); \
-        _APPLY_DIR(AXIS, _INVERT_DIR(AXIS)^direction^INVERT); \
-        _APPLY_STEP(AXIS)(!_INVERT_STEP_PIN(AXIS), true); \
-        delayMicroseconds(2); \
-        _APPLY_STEP(AXIS)(_INVERT_STEP_PIN(AXIS), true); \
-        _APPLY_DIR(AXIS, old_pin); \
-      }
-
-    switch(axis) {
-
-      case X_AXIS:
-        BABYSTEP_AXIS(x, X, false);
-        break;
-
-      case Y_AXIS:
-        BABYSTEP_AXIS(y, Y, false);
-        break;
- 
-      case Z_AXIS: {
-
-        #ifndef DELTA
-
-          BABYSTEP_AXIS(z, Z, BABYSTEP_INVERT_Z);
-
-        #else // DELTA
-
-          bool z_direction = direction ^ BABYSTEP_INVERT_Z;
-
-          enable_x();
-          enable_y();
-          enable_z();
-          uint8_t old_x_dir_pin = X_DIR_READ,
-                  old_y_dir_pin = Y_DIR_READ,
-                  old_z_dir_pin = Z_DIR_READ;
-          //setup new step
-          X_DIR_WRITE(INVERT_X_DIR^z_direction);
-          Y_DIR_WRITE(INVERT_Y_DIR^z_direction);
-          Z_DIR_WRITE(INVERT_Z_DIR^z_direction);
-          //perform step 
-          X_STEP_WRITE(!INVERT_X_STEP_PIN);
-          Y_STEP_WRITE(!INVERT_Y_STEP_PIN);
-          Z_STEP_WRITE(!INVERT_Z_STEP_PIN);
-          _delay_us(1U);
-          X_STEP_WRITE(INVERT_X_STEP_PIN); 
-          Y_STEP_WRITE(INVERT_Y_STEP_PIN); 
-          Z_STEP_WRITE(INVERT_Z_STEP_PIN);
-          //get old pin state back.
-          X_DIR_WRITE(old_x_dir_pin);
-          Y_DIR_WRITE(old_y_dir_pin);
-          Z_DIR_WRITE(old_z_dir_pin);
-
-        #endif
-
-      } break;
- 
-      default: break;
-    }
-  }
+#ifdef REALTIME_COMMANDS
+  // Stop discarding the blocks planned after quickStop()
+  void quickStopDone() { cleaning_buffer_counter = 0; }
+#endif
 
-#endif //BABYSTEPPING
 
 // From Arduino DigitalPotControl example
 void digitalPotWrite(int address, int value) {
@@ -38,10 +38,7 @@
     #define NORM_E_DIR() { if(current_block->active_extruder == 1) { E1_DIR_WRITE(!INVERT_E1_DIR); } else { E0_DIR_WRITE(!INVERT_E0_DIR); }}
     #define REV_E_DIR() { if(current_block->active_extruder == 1) { E1_DIR_WRITE(INVERT_E1_DIR); } else { E0_DIR_WRITE(INVERT_E0_DIR); }}
   #else
-    extern bool extruder_duplication_enabled;
-    #define E_STEP_WRITE(v) { if(extruder_duplication_enabled) { E0_STEP_WRITE(v); E1_STEP_WRITE(v); } else if(current_block->active_extruder == 1) { E1_STEP_WRITE(v); } else { E0_STEP_WRITE(v); }}
-    #define NORM_E_DIR() { if(extruder_duplication_enabled) { E0_DIR_WRITE(!INVERT_E0_DIR); E1_DIR_WRITE(!INVERT_E1_DIR); } else if(current_block->active_extruder == 1) { E1_DIR_WRITE(!INVERT_E1_DIR); } else { E0_DIR_WRITE(!INVERT_E0_DIR); }}
-    #define REV_E_DIR() { if(extruder_duplication_enabled) { E0_DIR_WRITE(INVERT_E0_DIR); E1_DIR_WRITE(INVERT_E1_DIR); } else if(current_block->active_extruder == 1) { E1_DIR_WRITE(INVERT_E1_DIR); } else { E0_DIR_WRITE(INVERT_E0_DIR); }}
+    // With DUAL_X_CARRIAGE, stepper.cpp steps E0 and E1 with the carriages of the block
   #endif  
 #else
   #define E_STEP_WRITE(v) E0_STEP_WRITE(v)
@@ -66,11 +63,26 @@ void st_set_e_position(const long &e);
 // Get current position in steps
 long st_get_position(uint8_t axis);
 
+#ifdef DUAL_X_CARRIAGE
+  // Set the X counts of the carriages along with st_set_position()
+  void st_set_dxc_position(const dxc_position_t &dp);
+  // With the steppers stopped, make the X count that of the given carriages and get the X counts
+  void st_get_dxc_position(dxc_position_t &dp, const unsigned char steppers);
+#endif
+
 #ifdef ENABLE_AUTO_BED_LEVELING
   // Get current position in mm
   float st_get_position_mm(AxisEnum axis);
 #endif
 
+#ifdef INPUT_SHAPING
+  extern float shaping_frequency[2], shaping_damping[2]; // X and Y, frequency 0 is off
+  // Recompute the shaper impulses after a change of the settings above
+  void st_set_shaping();
+  // True while the shaper timer has X/Y steps to do
+  bool st_shaper_busy();
+#endif
+
 // The stepper subsystem goes to sleep when it runs out of things to execute. Call this
 // to notify the subsystem that it is time to go to work.
 void st_wake_up();
@@ -88,6 +100,9 @@ void finishAndDisableSteppers();
 extern block_t *current_block;  // A pointer to the block currently being traced
 
 void quickStop();
+#ifdef REALTIME_COMMANDS
+  void quickStopDone(); // End the cleanup of quickStop() once nothing is planned from before it
+#endif
 
 void digitalPotWrite(int address, int value);
 void microstep_ms(uint8_t driver, int8_t ms1, int8_t ms2);
@@ -103,8 +118,14 @@ void microstep_readings();
   void Lock_z2_motor(bool state);
 #endif
 
+#ifdef STEP_TRACE
+  void st_trace_start(); // Clear the step trace and record the stepper interrupts
+  void st_trace_stop();
+  void st_trace_dump();  // Stop recording and print the trace (M930)
+#endif
+
 #ifdef BABYSTEPPING
-  void babystep(const uint8_t axis,const bool direction); // perform a short step with a single stepper motor, outside of any convention
+  extern volatile int babystepsTodo[3]; // steps the stepper interrupt adds to X, Y and Z, outside of any planned move
 #endif
      
 #endif
@@ -66,10 +66,6 @@ float current_temperature_bed = 0.0;
 
 unsigned char soft_pwm_bed;
   
-#ifdef BABYSTEPPING
-  volatile int babystepsTodo[3] = { 0 };
-#endif
-
 #ifdef FILAMENT_SENSOR
   int current_raw_filwidth = 0;  //Holds measured filament diameter - one extruder only
 #endif  
@@ -180,10 +176,6 @@ static void updateTemperaturesFromRawValues();
   #define SOFT_PWM_SCALE 0
 #endif
 
-#ifdef FILAMENT_SENSOR
-  static int meas_shift_index;  //used to point to a delayed sample in buffer for filament width sensor
-#endif
-
 #ifdef HEATER_0_USES_MAX6675
   static int read_max6675();
 #endif
@@ -648,21 +640,6 @@ void manage_heater() {
     }
   #endif       
 
-  // Control the extruder rate based on the width sensor
-  #ifdef FILAMENT_SENSOR
-    if (filament_sensor) {
-      meas_shift_index = delay_index1 - meas_delay_cm;
-      if (meas_shift_index < 0) meas_shift_index += MAX_MEASUREMENT_DELAY + 1;  //loop around buffer if needed
-      
-      // Get the delayed info and add 100 to reconstitute to a percent of
-      // the nominal filament diameter then square it to get an area
-      meas_shift_index = constrain(meas_shift_index, 0, MAX_MEASUREMENT_DELAY);
-      float vm = pow((measurement_delay[meas_shift_index] + 100.0) / 100.0, 2);
-      if (vm < 0.01) vm = 0.01;
-      volumetric_multiplier[FILAMENT_SENSOR_EXTRUDER_NUM] = vm;
-    }
-  #endif //FILAMENT_SENSOR
-
   #ifndef PIDTEMPBED
     if (ms < next_bed_check_ms) return;
     next_bed_check_ms = ms + BED_CHECK_INTERVAL;
@@ -809,12 +786,13 @@ static void updateTemperaturesFromRawValues() {
     //return current_raw_filwidth;
   }
 
-  // Convert raw Filament Width to a ratio
-  int widthFil_to_size_ratio() {
+  // Convert raw Filament Width to a volumetric factor (FILWIDTH_ONE = 1.0)
+  uint16_t widthFil_to_volumetric_factor() {
     float temp = filament_width_meas;
     if (temp < MEASURED_LOWER_LIMIT) temp = filament_width_nominal;  //assume sensor cut out
     else if (temp > MEASURED_UPPER_LIMIT) temp = MEASURED_UPPER_LIMIT;
-    return filament_width_nominal / temp * 100;
+    float ratio = filament_width_nominal / temp;
+    return min(ratio * ratio * FILWIDTH_ONE + 0.5, 65535.0);
   } 
 
 #endif
@@ -1596,21 +1574,6 @@ HAL_TEMP_TIMER_ISR {
     #endif
 
   } // temp_count >= OVERSAMPLENR
-
-  #ifdef BABYSTEPPING
-    for (uint8_t axis = X_AXIS; axis <= Z_AXIS; axis++) {
-      int curTodo = babystepsTodo[axis]; //get rid of volatile for performance
-     
-      if (curTodo > 0) {
-        babystep(axis,/*fwd*/true);
-        babystepsTodo[axis]--; //fewer to do next time
-      }
-      else if (curTodo < 0) {
-        babystep(axis,/*fwd*/false);
-        babystepsTodo[axis]++; //fewer to do next time
-      }
-    }
-  #endif //BABYSTEPPING
 }
 
 #ifdef PIDTEMP
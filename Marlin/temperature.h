@@ -35,8 +35,10 @@ void manage_heater(); //it is critical that this is called periodically.
 // For converting raw Filament Width to milimeters 
  float analog2widthFil(); 
  
-// For converting raw Filament Width to an extrusion ratio 
- int widthFil_to_size_ratio();
+// For converting raw Filament Width to a volumetric factor in 1/FILWIDTH_ONE
+ #define FILWIDTH_SHIFT 12
+ #define FILWIDTH_ONE (1 << FILWIDTH_SHIFT)
+ uint16_t widthFil_to_volumetric_factor();
 #endif
 
 // low level conversion routines
@@ -77,10 +79,6 @@ extern float current_temperature_bed;
   extern float bedKp,bedKi,bedKd;
 #endif
   
-#ifdef BABYSTEPPING
-  extern volatile int babystepsTodo[3];
-#endif
-  
 //high level conversion routines, for use outside of temperature.cpp
 //inline so that there is no performance decrease.
 //deg=degreeCelsius
@@ -5,6 +5,7 @@
 #include "cardreader.h"
 #include "temperature.h"
 #include "stepper.h"
+#include "planner.h"
 #include "configuration_store.h"
 
 int8_t encoderDiff; // updated from interrupt context and added to encoderPosition every LCD update
@@ -251,6 +252,10 @@ uint8_t lcd_status_update_delay;
 bool ignore_click = false;
 bool wait_for_unclick;
 uint8_t lcdDrawUpdate = 2;                  /* Set to none-zero when the LCD needs to draw, decreased after every draw. Set to 2 in LCD routines so the LCD gets at least 1 full redraw (first redraw is partial) */
+uint32_t lcd_update_us, lcd_update_max_us; /* time spent in the last and in the longest lcd_update() call that drew something (M251) */
+uint32_t lcd_bytes_sent;                    /* bytes sent to the display controller, counted by the display driver */
+uint32_t lcd_frames, lcd_frame_bytes;       /* frames finished since lcd_stats_ms, bytes sent for the last one (M251) */
+uint32_t lcd_stats_ms;
 
 //prevMenu and prevEncoderPosition are used to store the previous menu location when editing settings.
 menuFunc_t prevMenu = NULL;
@@ -469,7 +474,10 @@ void lcd_set_home_offsets() {
 
   static void _lcd_babystep(int axis, const char *msg) {
     if (encoderPosition != 0) {
+      // The stepper interrupt counts babystepsTodo down
+      CRITICAL_SECTION_START;
       babystepsTodo[axis] += (int)encoderPosition;
+      CRITICAL_SECTION_END;
       encoderPosition = 0;
       lcdDrawUpdate = 1;
     }
@@ -726,6 +734,9 @@ static void lcd_prepare_menu() {
 #endif // DELTA_CALIBRATION_MENU
 
 inline void line_to_current(AxisEnum axis) {
+  #ifdef COALESCE_SEGMENTS
+    coalesce_flush();
+  #endif
   #ifdef DELTA
     calculate_delta(current_position);
     plan_buffer_line(delta[X_AXIS], delta[Y_AXIS], delta[Z_AXIS], current_position[E_AXIS], manual_feedrate[axis]/60, active_extruder);
@@ -1006,88 +1017,201 @@ static void lcd_control_temperature_menu() {
   END_MENU();
 }
 
+/**
+ * Table menus
+ *
+ * Menus without runtime conditions are described by a const table of
+ * menu_item_t, which is kept in flash. lcd_table_menu() only looks at the
+ * rows in view and at the selected row, instead of running every item of
+ * the menu once per display line like START_MENU / END_MENU do.
+ *
+ * The first item of a table has to be the "back" item; the back button
+ * goes to its menu.
+ */
+enum MenuItemType {
+  MENU_TYPE_back, MENU_TYPE_submenu, MENU_TYPE_function, MENU_TYPE_gcode,
+  MENU_TYPE_EDIT_bool, MENU_TYPE_EDIT_int3, MENU_TYPE_EDIT_float3, MENU_TYPE_EDIT_float32,
+  MENU_TYPE_EDIT_float43, MENU_TYPE_EDIT_float5, MENU_TYPE_EDIT_float51, MENU_TYPE_EDIT_float52,
+  MENU_TYPE_EDIT_long5
+};
+
+typedef struct {
+  uint8_t type;
+  const char* label;
+  menuFunc_t func;   // menu to go to, function to call, or callback after an edit (may be NULL)
+  void* value;       // value to edit, or G-code to run
+  float minValue, maxValue;
+} menu_item_t;
+
+#define TABLE_ITEM(type, label, func) { MENU_TYPE_ ## type, label, func, NULL, 0, 0 }
+#define TABLE_ITEM_GCODE(label, gcode) { MENU_TYPE_gcode, label, NULL, (void*)gcode, 0, 0 }
+#define TABLE_ITEM_EDIT(type, label, ptr, args...) { MENU_TYPE_EDIT_ ## type, label, NULL, ptr, ## args }
+#define TABLE_ITEM_EDIT_CALLBACK(type, label, ptr, minValue, maxValue, callback) { MENU_TYPE_EDIT_ ## type, label, callback, ptr, minValue, maxValue }
+#define TABLE_MENU(items) lcd_table_menu(items, sizeof(items) / sizeof(items[0]))
+
+static void lcd_table_menu_draw(const menu_item_t* item, bool sel, uint8_t row) {
+  const char* label = item->label;
+  switch (item->type) {
+    case MENU_TYPE_back: lcd_implementation_drawmenu_back(sel, row, label, item->func); break;
+    case MENU_TYPE_submenu: lcd_implementation_drawmenu_submenu(sel, row, label, item->func); break;
+    case MENU_TYPE_function: lcd_implementation_drawmenu_function(sel, row, label, item->func); break;
+    case MENU_TYPE_gcode: lcd_implementation_drawmenu_gcode(sel, row, label, (const char*)item->value); break;
+    case MENU_TYPE_EDIT_bool: lcd_implementation_drawmenu_setting_edit_bool(sel, row, label, label, (bool*)item->value); break;
+    #define TABLE_DRAW_EDIT(_type, _name) \
+      case MENU_TYPE_EDIT_ ## _name: lcd_implementation_drawmenu_setting_edit_ ## _name(sel, row, label, label, (_type*)item->value, 0, 0); break
+    TABLE_DRAW_EDIT(int, int3);
+    TABLE_DRAW_EDIT(float, float3);
+    TABLE_DRAW_EDIT(float, float32);
+    TABLE_DRAW_EDIT(float, float43);
+    TABLE_DRAW_EDIT(float, float5);
+    TABLE_DRAW_EDIT(float, float51);
+    TABLE_DRAW_EDIT(float, float52);
+    TABLE_DRAW_EDIT(unsigned long, long5);
+  }
+}
+
+static void lcd_table_menu_action(const menu_item_t* item) {
+  const char* label = item->label;
+  menuFunc_t callback = item->func;
+  switch (item->type) {
+    case MENU_TYPE_back: menu_action_back(item->func); break;
+    case MENU_TYPE_submenu: menu_action_submenu(item->func); break;
+    case MENU_TYPE_function: menu_action_function(item->func); break;
+    case MENU_TYPE_gcode: menu_action_gcode((const char*)item->value); break;
+    case MENU_TYPE_EDIT_bool:
+      if (callback) menu_action_setting_edit_callback_bool(label, (bool*)item->value, callback);
+      else menu_action_setting_edit_bool(label, (bool*)item->value);
+      break;
+    #define TABLE_ACTION_EDIT(_type, _name) \
+      case MENU_TYPE_EDIT_ ## _name: \
+        if (callback) menu_action_setting_edit_callback_ ## _name(label, (_type*)item->value, item->minValue, item->maxValue, callback); \
+        else menu_action_setting_edit_ ## _name(label, (_type*)item->value, item->minValue, item->maxValue); \
+        break
+    TABLE_ACTION_EDIT(int, int3);
+    TABLE_ACTION_EDIT(float, float3);
+    TABLE_ACTION_EDIT(float, float32);
+    TABLE_ACTION_EDIT(float, float43);
+    TABLE_ACTION_EDIT(float, float5);
+    TABLE_ACTION_EDIT(float, float51);
+    TABLE_ACTION_EDIT(float, float52);
+    TABLE_ACTION_EDIT(unsigned long, long5);
+  }
+}
+
+static void lcd_table_menu(const menu_item_t* items, uint8_t count) {
+  encoderRateMultiplierEnabled = false;
+  #if defined(BTN_BACK) && BTN_BACK > 0
+    if (LCD_BACK_CLICKED) {
+      lcd_quick_feedback();
+      menu_action_back(items[0].func);
+      return;
+    }
+  #endif
+  if (encoderPosition > 0x8000) encoderPosition = 0;
+  uint8_t encoderLine = encoderPosition / ENCODER_STEPS_PER_MENU_ITEM;
+  if (encoderLine >= count) {
+    encoderPosition = count * ENCODER_STEPS_PER_MENU_ITEM - 1;
+    encoderLine = count - 1;
+  }
+  if (encoderLine < currentMenuViewOffset) currentMenuViewOffset = encoderLine;
+  if (encoderLine >= currentMenuViewOffset + LCD_HEIGHT) {
+    currentMenuViewOffset = encoderLine - LCD_HEIGHT + 1;
+    lcdDrawUpdate = 1;
+  }
+
+  if (lcdDrawUpdate) {
+    for (uint8_t row = 0, n = currentMenuViewOffset; row < LCD_HEIGHT && n < count; row++, n++)
+      lcd_table_menu_draw(&items[n], n == encoderLine, row);
+  }
+
+  if (LCD_CLICKED) {
+    lcd_quick_feedback();
+    lcd_table_menu_action(&items[encoderLine]);
+  }
+}
+
 /**
  *
  * "Temperature" > "Preheat PLA conf" submenu
  *
  */
-static void lcd_control_temperature_preheat_pla_settings_menu() {
-  START_MENU(lcd_control_temperature_menu);
-  MENU_ITEM(back, MSG_TEMPERATURE, lcd_control_temperature_menu);
-  MENU_ITEM_EDIT(int3, MSG_FAN_SPEED, &plaPreheatFanSpeed, 0, 255);
+static const menu_item_t preheat_pla_settings_items[] = {
+  TABLE_ITEM(back, MSG_TEMPERATURE, lcd_control_temperature_menu),
+  TABLE_ITEM_EDIT(int3, MSG_FAN_SPEED, &plaPreheatFanSpeed, 0, 255),
   #if TEMP_SENSOR_0 != 0
-    MENU_ITEM_EDIT(int3, MSG_NOZZLE, &plaPreheatHotendTemp, HEATER_0_MINTEMP, HEATER_0_MAXTEMP - 15);
+    TABLE_ITEM_EDIT(int3, MSG_NOZZLE, &plaPreheatHotendTemp, HEATER_0_MINTEMP, HEATER_0_MAXTEMP - 15),
   #endif
   #if TEMP_SENSOR_BED != 0
-    MENU_ITEM_EDIT(int3, MSG_BED, &plaPreheatHPBTemp, BED_MINTEMP, BED_MAXTEMP - 15);
+    TABLE_ITEM_EDIT(int3, MSG_BED, &plaPreheatHPBTemp, BED_MINTEMP, BED_MAXTEMP - 15),
   #endif
   #ifdef EEPROM_SETTINGS
-    MENU_ITEM(function, MSG_STORE_EPROM, Config_StoreSettings);
+    TABLE_ITEM(function, MSG_STORE_EPROM, Config_StoreSettings),
   #endif
-  END_MENU();
-}
+};
+
+static void lcd_control_temperature_preheat_pla_settings_menu() { TABLE_MENU(preheat_pla_settings_items); }
 
 /**
  *
  * "Temperature" > "Preheat ABS conf" submenu
  *
  */
-static void lcd_control_temperature_preheat_abs_settings_menu() {
-  START_MENU(lcd_control_temperature_menu);
-  MENU_ITEM(back, MSG_TEMPERATURE, lcd_control_temperature_menu);
-  MENU_ITEM_EDIT(int3, MSG_FAN_SPEED, &absPreheatFanSpeed, 0, 255);
+static const menu_item_t preheat_abs_settings_items[] = {
+  TABLE_ITEM(back, MSG_TEMPERATURE, lcd_control_temperature_menu),
+  TABLE_ITEM_EDIT(int3, MSG_FAN_SPEED, &absPreheatFanSpeed, 0, 255),
   #if TEMP_SENSOR_0 != 0
-    MENU_ITEM_EDIT(int3, MSG_NOZZLE, &absPreheatHotendTemp, HEATER_0_MINTEMP, HEATER_0_MAXTEMP - 15);
+    TABLE_ITEM_EDIT(int3, MSG_NOZZLE, &absPreheatHotendTemp, HEATER_0_MINTEMP, HEATER_0_MAXTEMP - 15),
   #endif
   #if TEMP_SENSOR_BED != 0
-    MENU_ITEM_EDIT(int3, MSG_BED, &absPreheatHPBTemp, BED_MINTEMP, BED_MAXTEMP - 15);
+    TABLE_ITEM_EDIT(int3, MSG_BED, &absPreheatHPBTemp, BED_MINTEMP, BED_MAXTEMP - 15),
   #endif
   #ifdef EEPROM_SETTINGS
-    MENU_ITEM(function, MSG_STORE_EPROM, Config_StoreSettings);
+    TABLE_ITEM(function, MSG_STORE_EPROM, Config_StoreSettings),
   #endif
-  END_MENU();
-}
+};
+
+static void lcd_control_temperature_preheat_abs_settings_menu() { TABLE_MENU(preheat_abs_settings_items); }
 
 /**
  *
  * "Control" > "Motion" submenu
  *
  */
-static void lcd_control_motion_menu() {
-  START_MENU(lcd_control_menu);
-  MENU_ITEM(back, MSG_CONTROL, lcd_control_menu);
+static const menu_item_t motion_items[] = {
+  TABLE_ITEM(back, MSG_CONTROL, lcd_control_menu),
   #ifdef ENABLE_AUTO_BED_LEVELING
-    MENU_ITEM_EDIT(float32, MSG_ZPROBE_ZOFFSET, &zprobe_zoffset, Z_PROBE_OFFSET_RANGE_MIN, Z_PROBE_OFFSET_RANGE_MAX);
+    TABLE_ITEM_EDIT(float32, MSG_ZPROBE_ZOFFSET, &zprobe_zoffset, Z_PROBE_OFFSET_RANGE_MIN, Z_PROBE_OFFSET_RANGE_MAX),
   #endif
-  MENU_ITEM_EDIT(float5, MSG_ACC, &acceleration, 10, 99000);
-  MENU_ITEM_EDIT(float3, MSG_VXY_JERK, &max_xy_jerk, 1, 990);
-  MENU_ITEM_EDIT(float52, MSG_VZ_JERK, &max_z_jerk, 0.1, 990);
-  MENU_ITEM_EDIT(float3, MSG_VE_JERK, &max_e_jerk, 1, 990);
-  MENU_ITEM_EDIT(float3, MSG_VMAX MSG_X, &max_feedrate[X_AXIS], 1, 999);
-  MENU_ITEM_EDIT(float3, MSG_VMAX MSG_Y, &max_feedrate[Y_AXIS], 1, 999);
-  MENU_ITEM_EDIT(float3, MSG_VMAX MSG_Z, &max_feedrate[Z_AXIS], 1, 999);
-  MENU_ITEM_EDIT(float3, MSG_VMAX MSG_E, &max_feedrate[E_AXIS], 1, 999);
-  MENU_ITEM_EDIT(float3, MSG_VMIN, &minimumfeedrate, 0, 999);
-  MENU_ITEM_EDIT(float3, MSG_VTRAV_MIN, &mintravelfeedrate, 0, 999);
-  MENU_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_X, &max_acceleration_units_per_sq_second[X_AXIS], 100, 99000, reset_acceleration_rates);
-  MENU_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_Y, &max_acceleration_units_per_sq_second[Y_AXIS], 100, 99000, reset_acceleration_rates);
-  MENU_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_Z, &max_acceleration_units_per_sq_second[Z_AXIS], 10, 99000, reset_acceleration_rates);
-  MENU_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_E, &max_acceleration_units_per_sq_second[E_AXIS], 100, 99000, reset_acceleration_rates);
-  MENU_ITEM_EDIT(float5, MSG_A_RETRACT, &retract_acceleration, 100, 99000);
-  MENU_ITEM_EDIT(float5, MSG_A_TRAVEL, &travel_acceleration, 100, 99000);
-  MENU_ITEM_EDIT(float52, MSG_XSTEPS, &axis_steps_per_unit[X_AXIS], 5, 9999);
-  MENU_ITEM_EDIT(float52, MSG_YSTEPS, &axis_steps_per_unit[Y_AXIS], 5, 9999);
-  MENU_ITEM_EDIT(float51, MSG_ZSTEPS, &axis_steps_per_unit[Z_AXIS], 5, 9999);
-  MENU_ITEM_EDIT(float51, MSG_ESTEPS, &axis_steps_per_unit[E_AXIS], 5, 9999);
+  TABLE_ITEM_EDIT(float5, MSG_ACC, &acceleration, 10, 99000),
+  TABLE_ITEM_EDIT(float3, MSG_VXY_JERK, &max_xy_jerk, 1, 990),
+  TABLE_ITEM_EDIT(float52, MSG_VZ_JERK, &max_z_jerk, 0.1, 990),
+  TABLE_ITEM_EDIT(float3, MSG_VE_JERK, &max_e_jerk, 1, 990),
+  TABLE_ITEM_EDIT(float3, MSG_VMAX MSG_X, &max_feedrate[X_AXIS], 1, 999),
+  TABLE_ITEM_EDIT(float3, MSG_VMAX MSG_Y, &max_feedrate[Y_AXIS], 1, 999),
+  TABLE_ITEM_EDIT(float3, MSG_VMAX MSG_Z, &max_feedrate[Z_AXIS], 1, 999),
+  TABLE_ITEM_EDIT(float3, MSG_VMAX MSG_E, &max_feedrate[E_AXIS], 1, 999),
+  TABLE_ITEM_EDIT(float3, MSG_VMIN, &minimumfeedrate, 0, 999),
+  TABLE_ITEM_EDIT(float3, MSG_VTRAV_MIN, &mintravelfeedrate, 0, 999),
+  TABLE_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_X, &max_acceleration_units_per_sq_second[X_AXIS], 100, 99000, reset_acceleration_rates),
+  TABLE_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_Y, &max_acceleration_units_per_sq_second[Y_AXIS], 100, 99000, reset_acceleration_rates),
+  TABLE_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_Z, &max_acceleration_units_per_sq_second[Z_AXIS], 10, 99000, reset_acceleration_rates),
+  TABLE_ITEM_EDIT_CALLBACK(long5, MSG_AMAX MSG_E, &max_acceleration_units_per_sq_second[E_AXIS], 100, 99000, reset_acceleration_rates),
+  TABLE_ITEM_EDIT(float5, MSG_A_RETRACT, &retract_acceleration, 100, 99000),
+  TABLE_ITEM_EDIT(float5, MSG_A_TRAVEL, &travel_acceleration, 100, 99000),
+  TABLE_ITEM_EDIT(float52, MSG_XSTEPS, &axis_steps_per_unit[X_AXIS], 5, 9999),
+  TABLE_ITEM_EDIT(float52, MSG_YSTEPS, &axis_steps_per_unit[Y_AXIS], 5, 9999),
+  TABLE_ITEM_EDIT(float51, MSG_ZSTEPS, &axis_steps_per_unit[Z_AXIS], 5, 9999),
+  TABLE_ITEM_EDIT(float51, MSG_ESTEPS, &axis_steps_per_unit[E_AXIS], 5, 9999),
   #ifdef ABORT_ON_ENDSTOP_HIT_FEATURE_ENABLED
-    MENU_ITEM_EDIT(bool, MSG_ENDSTOP_ABORT, &abort_on_endstop_hit);
+    TABLE_ITEM_EDIT(bool, MSG_ENDSTOP_ABORT, &abort_on_endstop_hit),
   #endif
   #ifdef SCARA
-    MENU_ITEM_EDIT(float74, MSG_XSCALE, &axis_scaling[X_AXIS],0.5,2);
-    MENU_ITEM_EDIT(float74, MSG_YSCALE, &axis_scaling[Y_AXIS],0.5,2);
+    TABLE_ITEM_EDIT(float74, MSG_XSCALE, &axis_scaling[X_AXIS],0.5,2),
+    TABLE_ITEM_EDIT(float74, MSG_YSCALE, &axis_scaling[Y_AXIS],0.5,2),
   #endif
-  END_MENU();
-}
+};
+
+static void lcd_control_motion_menu() { TABLE_MENU(motion_items); }
 
 /**
  *
@@ -1152,23 +1276,24 @@ static void lcd_control_volumetric_menu() {
  *
  */
 #ifdef FWRETRACT
-  static void lcd_control_retract_menu() {
-    START_MENU(lcd_control_menu);
-    MENU_ITEM(back, MSG_CONTROL, lcd_control_menu);
-    MENU_ITEM_EDIT(bool, MSG_AUTORETRACT, &autoretract_enabled);
-    MENU_ITEM_EDIT(float52, MSG_CONTROL_RETRACT, &retract_length, 0, 100);
+  static const menu_item_t retract_items[] = {
+    TABLE_ITEM(back, MSG_CONTROL, lcd_control_menu),
+    TABLE_ITEM_EDIT(bool, MSG_AUTORETRACT, &autoretract_enabled),
+    TABLE_ITEM_EDIT(float52, MSG_CONTROL_RETRACT, &retract_length, 0, 100),
     #if EXTRUDERS > 1
-      MENU_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_SWAP, &retract_length_swap, 0, 100);
+      TABLE_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_SWAP, &retract_length_swap, 0, 100),
     #endif
-    MENU_ITEM_EDIT(float3, MSG_CONTROL_RETRACTF, &retract_feedrate, 1, 999);
-    MENU_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_ZLIFT, &retract_zlift, 0, 999);
-    MENU_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_RECOVER, &retract_recover_length, 0, 100);
+    TABLE_ITEM_EDIT(float3, MSG_CONTROL_RETRACTF, &retract_feedrate, 1, 999),
+    TABLE_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_ZLIFT, &retract_zlift, 0, 999),
+    TABLE_ITEM_EDIT(float3, MSG_CONTROL_RETRACT_JERK, &retract_jerk, 1, 990),
+    TABLE_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_RECOVER, &retract_recover_length, 0, 100),
     #if EXTRUDERS > 1
-      MENU_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_RECOVER_SWAP, &retract_recover_length_swap, 0, 100);
+      TABLE_ITEM_EDIT(float52, MSG_CONTROL_RETRACT_RECOVER_SWAP, &retract_recover_length_swap, 0, 100),
     #endif
-    MENU_ITEM_EDIT(float3, MSG_CONTROL_RETRACT_RECOVERF, &retract_recover_feedrate, 1, 999);
-    END_MENU();
-  }
+    TABLE_ITEM_EDIT(float3, MSG_CONTROL_RETRACT_RECOVERF, &retract_recover_feedrate, 1, 999),
+  };
+
+  static void lcd_control_retract_menu() { TABLE_MENU(retract_items); }
 #endif // FWRETRACT
 
 #ifdef SDSUPPORT
@@ -1461,6 +1586,44 @@ int lcd_strlen_P(const char *s) {
   return j;
 }
 
+#ifdef DOGLCD
+  static bool lcd_frame_pending = false; // A frame of the picture loop is being drawn
+#endif
+
+/**
+ * Is a frame still being drawn or sent to the display?
+ */
+static bool lcd_busy() {
+  #ifdef DOGLCD
+    return lcd_frame_pending;
+  #else
+    return lcd_implementation_busy();
+  #endif
+}
+
+/**
+ * Do one bounded unit of display work: draw and send one page of the
+ * graphical display, or send one changed row of the character display.
+ * Returns false if there was nothing to do.
+ */
+static bool lcd_draw_slice() {
+  #ifdef DOGLCD
+    if (!lcd_frame_pending) return false;
+    if (lcd_implementation_page_dirty()) { // Unchanged pages are not drawn or sent
+      lcd_setFont(FONT_MENU);
+      u8g.setPrintPos(125, 0);
+      if (blink % 2) u8g.setColorIndex(1); else u8g.setColorIndex(0); // Set color for the alive dot
+      u8g.drawPixel(127, 63); // draw alive dot
+      u8g.setColorIndex(1); // black on white
+      (*currentMenu)();
+    }
+    lcd_frame_pending = u8g.nextPage();
+    return true;
+  #else
+    return lcd_implementation_flush();
+  #endif
+}
+
 /**
  * Update the LCD, read encoder buttons, etc.
  *   - Read button states
@@ -1471,6 +1634,9 @@ int lcd_strlen_P(const char *s) {
  *   - Reset the Info Screen timeout if there's any input
  *   - Update status indicators, if any
  *   - Clear the LCD if lcdDrawUpdate == 2
+ *   - Draw one page or send one row of the display
+ *
+ * Nothing is done while the planner is running low on moves.
  *
  * Warning: This function is called from interrupt context!
  */
@@ -1507,7 +1673,20 @@ void lcd_update() {
   #endif//CARDINSERTED
   
   millis_t ms = millis();
-  if (ms > next_lcd_update_ms) {
+
+  #if LCD_MIN_PLANNED_MOVES > 0
+    // Leave the time to the planner while it is running low
+    uint8_t moves = movesplanned();
+    if (moves && moves < LCD_MIN_PLANNED_MOVES && ms < next_lcd_update_ms + LCD_MAX_DEFER) return;
+  #endif
+
+  uint32_t start_us = micros();
+  bool drawn = false;
+  static bool frame_open = false;
+  static uint32_t frame_start_bytes;
+
+  if (ms > next_lcd_update_ms && !lcd_busy()) {
+    drawn = true;
 
     #ifdef ULTIPANEL
 
@@ -1564,6 +1743,10 @@ void lcd_update() {
       }
     #endif //ULTIPANEL
 
+    #ifdef DOGLCD
+      bool partial_redraw = !lcdDrawUpdate; // Only the periodic refresh of the Info Screen can skip unchanged parts
+    #endif
+
     if (currentMenu == lcd_status_screen) {
       if (!lcd_status_update_delay) {
         lcdDrawUpdate = 1;
@@ -1573,18 +1756,17 @@ void lcd_update() {
         lcd_status_update_delay--;
       }
     }
+    if (lcdDrawUpdate && !frame_open) {
+      frame_open = true;
+      frame_start_bytes = lcd_bytes_sent;
+    }
+
     #ifdef DOGLCD  // Changes due to different driver architecture of the DOGM display
       if (lcdDrawUpdate) {
         blink++;     // Variable for fan animation and alive dot
+        lcd_implementation_prepare_frame(currentMenu == lcd_status_screen, partial_redraw);
         u8g.firstPage();
-        do {
-          lcd_setFont(FONT_MENU);
-          u8g.setPrintPos(125, 0);
-          if (blink % 2) u8g.setColorIndex(1); else u8g.setColorIndex(0); // Set color for the alive dot
-          u8g.drawPixel(127, 63); // draw alive dot
-          u8g.setColorIndex(1); // black on white
-          (*currentMenu)();
-        } while( u8g.nextPage() );
+        lcd_frame_pending = true; // The pages are drawn by lcd_draw_slice()
       }
     #else
       (*currentMenu)();
@@ -1614,6 +1796,20 @@ void lcd_update() {
     if (lcdDrawUpdate) lcdDrawUpdate--;
     next_lcd_update_ms = ms + LCD_UPDATE_INTERVAL;
   }
+
+  if (lcd_draw_slice()) drawn = true;
+
+  if (drawn) {
+    lcd_update_us = micros() - start_us;
+    if (lcd_update_us > lcd_update_max_us) lcd_update_max_us = lcd_update_us;
+  }
+
+  if (frame_open && !lcd_busy()) {
+    // The frame has been sent completely
+    frame_open = false;
+    lcd_frames++;
+    lcd_frame_bytes = lcd_bytes_sent - frame_start_bytes;
+  }
 }
 
 void lcd_ignore_click(bool b) {
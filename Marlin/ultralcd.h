@@ -32,7 +32,11 @@
   #define LCD_MESSAGEPGM(x) lcd_setstatuspgm(PSTR(x))
   #define LCD_ALERTMESSAGEPGM(x) lcd_setalertstatuspgm(PSTR(x))
 
+  extern uint32_t lcd_update_us, lcd_update_max_us;
+  extern uint32_t lcd_bytes_sent, lcd_frames, lcd_frame_bytes, lcd_stats_ms;
+
   #define LCD_UPDATE_INTERVAL 100
+  #define LCD_MAX_DEFER 2000 // Longest time (ms) the LCD waits for the planner to fill up
   #define LCD_TIMEOUT_TO_STATUS 15000
 
   #ifdef ULTIPANEL
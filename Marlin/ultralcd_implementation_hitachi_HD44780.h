@@ -133,6 +133,95 @@
 
 #endif //ULTIPANEL
 
+/**
+ * Frame buffer in front of the character LCD
+ *
+ * The menus and the Info Screen print into a RAM copy of the display.
+ * lcd_implementation_flush() then sends one changed row per call, so
+ * a redraw never holds up the main loop for a whole screen of slow
+ * HD44780 transfers. Custom characters are still written directly.
+ *
+ * A second copy holds what the display shows. Only the cells that differ
+ * from it are sent, and short runs of unchanged cells between them are
+ * sent along rather than paying for another cursor command.
+ */
+#define LCD_MAX_UNCHANGED_RUN 1 // Unchanged cells sent instead of moving the cursor
+
+template<class LCD> class LcdFrame : public LCD {
+  public:
+    template<typename... Args> LcdFrame(Args... args) : LCD(args...), direct(false) { clear(); display_cleared(); }
+
+    // The display was cleared by the library
+    void display_cleared() {
+      memset(shown, ' ', sizeof(shown));
+      dirty_rows = BIT(LCD_HEIGHT) - 1;
+    }
+
+    void clear() {
+      memset(frame, ' ', sizeof(frame));
+      dirty_rows = BIT(LCD_HEIGHT) - 1;
+      col = row = 0;
+    }
+
+    void setCursor(uint8_t c, uint8_t r) { col = c; row = r; }
+
+    using LCD::write;
+    virtual size_t write(uint8_t c) {
+      if (direct) return LCD::write(c);
+      if (row < LCD_HEIGHT && col < LCD_WIDTH && frame[row][col] != (char)c) {
+        frame[row][col] = c;
+        dirty_rows |= BIT(row);
+      }
+      col++;
+      return 1;
+    }
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      for (size_t i = 0; i < size; i++) write(buffer[i]);
+      return size;
+    }
+
+    template<typename T> void createChar(uint8_t location, T charmap) {
+      direct = true;
+      LCD::createChar(location, charmap);
+      direct = false;
+    }
+
+    // Rows still to be sent
+    bool flushing() { return dirty_rows != 0; }
+
+    // Send the changed cells of the first changed row to the display
+    void flush_row() {
+      for (uint8_t r = 0; r < LCD_HEIGHT; r++) {
+        if (TEST(dirty_rows, r)) {
+          dirty_rows &= ~BIT(r);
+          const char *f = frame[r];
+          char *d = shown[r];
+          int8_t cursor = -1; // Display cursor column, -1 if it must be set
+          for (uint8_t c = 0; c < LCD_WIDTH; c++) {
+            if (f[c] == d[c]) continue;
+            if (cursor < 0 || c - cursor > LCD_MAX_UNCHANGED_RUN) {
+              LCD::setCursor(c, r);
+              cursor = c;
+              lcd_bytes_sent++;
+            }
+            for (; cursor <= c; cursor++) {
+              d[cursor] = f[cursor];
+              LCD::write(d[cursor]);
+              lcd_bytes_sent++;
+            }
+          }
+          return;
+        }
+      }
+    }
+
+  private:
+    char frame[LCD_HEIGHT][LCD_WIDTH];
+    char shown[LCD_HEIGHT][LCD_WIDTH];
+    uint8_t col, row, dirty_rows;
+    bool direct;
+};
+
 ////////////////////////////////////
 // Create LCD class instance and chipset-specific information
 #if defined(LCD_I2C_TYPE_PCF8575)
@@ -150,7 +239,7 @@
   #include <LCD.h>
   #include <LiquidCrystal_I2C.h>
   #define LCD_CLASS LiquidCrystal_I2C
-  LCD_CLASS lcd(LCD_I2C_ADDRESS,LCD_I2C_PIN_EN,LCD_I2C_PIN_RW,LCD_I2C_PIN_RS,LCD_I2C_PIN_D4,LCD_I2C_PIN_D5,LCD_I2C_PIN_D6,LCD_I2C_PIN_D7);
+  LcdFrame<LCD_CLASS> lcd(LCD_I2C_ADDRESS,LCD_I2C_PIN_EN,LCD_I2C_PIN_RW,LCD_I2C_PIN_RS,LCD_I2C_PIN_D4,LCD_I2C_PIN_D5,LCD_I2C_PIN_D6,LCD_I2C_PIN_D7);
 
 #elif defined(LCD_I2C_TYPE_MCP23017)
   //for the LED indicators (which maybe mapped to different things in lcd_implementation_update_indicators())
@@ -164,9 +253,9 @@
   #include <LiquidTWI2.h>
   #define LCD_CLASS LiquidTWI2
   #if defined(DETECT_DEVICE)
-    LCD_CLASS lcd(LCD_I2C_ADDRESS, 1);
+    LcdFrame<LCD_CLASS> lcd(LCD_I2C_ADDRESS, 1);
   #else
-    LCD_CLASS lcd(LCD_I2C_ADDRESS);
+    LcdFrame<LCD_CLASS> lcd(LCD_I2C_ADDRESS);
   #endif
 
 #elif defined(LCD_I2C_TYPE_MCP23008)
@@ -174,15 +263,15 @@
   #include <LiquidTWI2.h>
   #define LCD_CLASS LiquidTWI2
   #if defined(DETECT_DEVICE)
-    LCD_CLASS lcd(LCD_I2C_ADDRESS, 1);
+    LcdFrame<LCD_CLASS> lcd(LCD_I2C_ADDRESS, 1);
   #else
-    LCD_CLASS lcd(LCD_I2C_ADDRESS);
+    LcdFrame<LCD_CLASS> lcd(LCD_I2C_ADDRESS);
   #endif
 
 #elif defined(LCD_I2C_TYPE_PCA8574)
     #include <LiquidCrystal_I2C.h>
     #define LCD_CLASS LiquidCrystal_I2C
-    LCD_CLASS lcd(LCD_I2C_ADDRESS, LCD_WIDTH, LCD_HEIGHT);
+    LcdFrame<LCD_CLASS> lcd(LCD_I2C_ADDRESS, LCD_WIDTH, LCD_HEIGHT);
 
 // 2 wire Non-latching LCD SR from:
 // https://bitbucket.org/fmalpartida/new-liquidcrystal/wiki/schematics#!shiftregister-connection
@@ -191,12 +280,12 @@
   #include <LCD.h>
   #include <LiquidCrystal_SR.h>
   #define LCD_CLASS LiquidCrystal_SR
-  LCD_CLASS lcd(SR_DATA_PIN, SR_CLK_PIN);
+  LcdFrame<LCD_CLASS> lcd(SR_DATA_PIN, SR_CLK_PIN);
 #else
   // Standard directly connected LCD implementations
   #include <LiquidCrystal.h>
   #define LCD_CLASS LiquidCrystal
-  LCD_CLASS lcd(LCD_PINS_RS, LCD_PINS_ENABLE, LCD_PINS_D4, LCD_PINS_D5,LCD_PINS_D6,LCD_PINS_D7);  //RS,Enable,D4,D5,D6,D7
+  LcdFrame<LCD_CLASS> lcd(LCD_PINS_RS, LCD_PINS_ENABLE, LCD_PINS_D4, LCD_PINS_D5,LCD_PINS_D6,LCD_PINS_D7);  //RS,Enable,D4,D5,D6,D7
 #endif
 
 #include "utf_mapper.h"
@@ -389,6 +478,7 @@ static void lcd_implementation_init(
   #endif
     lcd.begin(LCD_WIDTH, LCD_HEIGHT);
   #endif
+  lcd.display_cleared();
 
   lcd_set_custom_characters(
     #ifdef LCD_PROGRESS_BAR
@@ -401,6 +491,15 @@ static void lcd_implementation_init(
 
 static void lcd_implementation_clear() { lcd.clear(); }
 
+static bool lcd_implementation_busy() { return lcd.flushing(); }
+
+// Send one changed row of the frame buffer, if any
+static bool lcd_implementation_flush() {
+  if (!lcd.flushing()) return false;
+  lcd.flush_row();
+  return true;
+}
+
 /* Arduino < 1.0.0 is missing a function to print PROGMEM strings, so we need to implement our own */
 char lcd_printPGM(const char* str) {
   char c, n = 0;
@@ -634,7 +733,7 @@ static void lcd_implementation_status_screen() {
       lcd_printPGM(PSTR("Dia "));
       lcd.print(ftostr12ns(filament_width_meas));
       lcd_printPGM(PSTR(" V"));
-      lcd.print(itostr3(100.0*volumetric_multiplier[FILAMENT_SENSOR_EXTRUDER_NUM]));
+      lcd.print(itostr3(100L * filwidth_factor / FILWIDTH_ONE));
   	  lcd.print('%');
   	  return;
     }
@@ -19,27 +19,107 @@
 #define LCD_PIXEL_WIDTH 128
 #define LCD_PIXEL_HEIGHT 64
 
+// Sync byte and y, x command for a row, then two bytes per pixel byte
+#define ST7920_ROW_BYTES (1 + 4 + 1 + 2 * LCD_PIXEL_WIDTH / 8)
+
 #include <U8glib.h>
 
-static void ST7920_SWSPI_SND_8BIT(uint8_t val)
-{
-  uint8_t i;
-  for( i=0; i<8; i++ )
+#ifdef ST7920_USART_SPI
+
+  /**
+   * The display clock is wired to SCK1 (A0) and the data to TXD1 (D16), and
+   * USART1 runs as SPI master. Commands are sent polled. Pages are encoded
+   * into u8g_dev_st7920_128x64_rrd_tx and handed to the PDC, so the CPU is
+   * free while a page goes out. The next transfer waits for the last one.
+   */
+  #define ST7920_USART USART1
+
+  #ifndef ST7920_USART_SPI_FREQ
+    #define ST7920_USART_SPI_FREQ 1000000
+  #endif
+
+  static uint8_t u8g_dev_st7920_128x64_rrd_tx[PAGE_HEIGHT * ST7920_ROW_BYTES];
+
+  static void ST7920_USART_INIT()
   {
-    WRITE(ST7920_CLK_PIN,0);
-    WRITE(ST7920_DAT_PIN,val&0x80); 
-    val<<=1;
-    WRITE(ST7920_CLK_PIN,1);
+    PIO_Configure(PIOA, PIO_PERIPH_A, PIO_PA13A_TXD1 | PIO_PA16A_SCK1, PIO_DEFAULT);
+    pmc_enable_periph_clk(ID_USART1);
+    ST7920_USART->US_PTCR = US_PTCR_TXTDIS | US_PTCR_RXTDIS;
+    ST7920_USART->US_CR = US_CR_RSTRX | US_CR_RSTTX | US_CR_RXDIS | US_CR_TXDIS;
+    // Clock idle high, data sampled on the rising edge
+    ST7920_USART->US_MR = US_MR_USART_MODE_SPI_MASTER | US_MR_USCLKS_MCK | US_MR_CHRL_8_BIT | US_MR_CPOL | US_MR_CLKO;
+    ST7920_USART->US_BRGR = F_CPU / ST7920_USART_SPI_FREQ;
+    ST7920_USART->US_CR = US_CR_TXEN;
   }
-}
 
-#define ST7920_CS()              {WRITE(ST7920_CS_PIN,1);u8g_10MicroDelay();}
-#define ST7920_NCS()             {WRITE(ST7920_CS_PIN,0);}
+  // Wait until the last page is sent
+  static void ST7920_WAIT_DMA()
+  {
+    while (ST7920_USART->US_TCR || !(ST7920_USART->US_CSR & US_CSR_TXEMPTY)) { /* wait */ }
+  }
+
+  static void ST7920_START_DMA(const uint8_t *end)
+  {
+    ST7920_USART->US_TPR = (uint32_t)u8g_dev_st7920_128x64_rrd_tx;
+    ST7920_USART->US_TCR = end - u8g_dev_st7920_128x64_rrd_tx;
+    ST7920_USART->US_PTCR = US_PTCR_TXTEN;
+  }
+
+  static void ST7920_SWSPI_SND_8BIT(uint8_t val)
+  {
+    ST7920_USART->US_THR = val;
+    while (!(ST7920_USART->US_CSR & US_CSR_TXEMPTY)) { /* wait */ }
+  }
+
+  // Encode the commands and the pixel data of one row for the PDC
+  static uint8_t *ST7920_ENCODE_ROW(uint8_t *tx, uint8_t y, const uint8_t *ptr)
+  {
+    #define ST7920_ENCODE_BYTE(a) { *tx++ = (uint8_t)((a)&0xf0u); *tx++ = (uint8_t)((a)<<4u); }
+    *tx++ = 0xf8;                                   //command
+    ST7920_ENCODE_BYTE(0x80 | (y & 31));            //y
+    ST7920_ENCODE_BYTE(y < 32 ? 0x80 : 0x80 | 8);   //x=0 or x=64
+    *tx++ = 0xfa;                                   //data
+    for (uint8_t i = 0; i < LCD_PIXEL_WIDTH/8; i++) ST7920_ENCODE_BYTE(ptr[i]);
+    return tx;
+  }
+
+  // Toggling CS resets the serial interface of the display
+  #define ST7920_CS()              {ST7920_WAIT_DMA();WRITE(ST7920_CS_PIN,0);WRITE(ST7920_CS_PIN,1);u8g_10MicroDelay();}
+  #define ST7920_NCS()             {ST7920_WAIT_DMA();WRITE(ST7920_CS_PIN,0);}
+
+#else
+
+  static void ST7920_SWSPI_SND_8BIT(uint8_t val)
+  {
+    uint8_t i;
+    for( i=0; i<8; i++ )
+    {
+      WRITE(ST7920_CLK_PIN,0);
+      WRITE(ST7920_DAT_PIN,val&0x80); 
+      val<<=1;
+      WRITE(ST7920_CLK_PIN,1);
+    }
+  }
+
+  #define ST7920_CS()              {WRITE(ST7920_CS_PIN,1);u8g_10MicroDelay();}
+  #define ST7920_NCS()             {WRITE(ST7920_CS_PIN,0);}
+
+#endif // ST7920_USART_SPI
+
 #define ST7920_SET_CMD()         {ST7920_SWSPI_SND_8BIT(0xf8);u8g_10MicroDelay();}
 #define ST7920_SET_DAT()         {ST7920_SWSPI_SND_8BIT(0xfa);u8g_10MicroDelay();}
 #define ST7920_WRITE_BYTE(a)     {ST7920_SWSPI_SND_8BIT((uint8_t)((a)&0xf0u));ST7920_SWSPI_SND_8BIT((uint8_t)((a)<<4u));u8g_10MicroDelay();}
 #define ST7920_WRITE_BYTES(p,l)  {uint8_t i;for(i=0;i<l;i++){ST7920_SWSPI_SND_8BIT(*p&0xf0);ST7920_SWSPI_SND_8BIT(*p<<4);p++;}u8g_10MicroDelay();}
 
+#ifdef DOGLCD_PARTIAL_REDRAW
+  // Copy of the GDRAM, rows that are unchanged are not sent again
+  static uint8_t u8g_dev_st7920_128x64_rrd_gdram[LCD_PIXEL_HEIGHT][LCD_PIXEL_WIDTH/8];
+  static bool u8g_dev_st7920_128x64_rrd_gdram_valid = false;
+
+  // Send all rows of the next frame
+  static void u8g_dev_st7920_128x64_rrd_invalidate() { u8g_dev_st7920_128x64_rrd_gdram_valid = false; }
+#endif
+
 uint8_t u8g_dev_rrd_st7920_128x64_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, void *arg)
 {
   uint8_t i,y;
@@ -48,8 +128,12 @@ uint8_t u8g_dev_rrd_st7920_128x64_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, vo
     case U8G_DEV_MSG_INIT:
       {
         OUT_WRITE(ST7920_CS_PIN,LOW);
-        OUT_WRITE(ST7920_DAT_PIN,LOW);
-        OUT_WRITE(ST7920_CLK_PIN,HIGH);
+        #ifdef ST7920_USART_SPI
+          ST7920_USART_INIT();
+        #else
+          OUT_WRITE(ST7920_DAT_PIN,LOW);
+          OUT_WRITE(ST7920_CLK_PIN,HIGH);
+        #endif
 
         ST7920_CS();
         u8g_Delay(120);                 //initial delay for boot up
@@ -82,25 +166,50 @@ uint8_t u8g_dev_rrd_st7920_128x64_fn(u8g_t *u8g, u8g_dev_t *dev, uint8_t msg, vo
         ptr = (uint8_t*)pb->buf;
 
         ST7920_CS();
+        #ifdef ST7920_USART_SPI
+          uint8_t *tx = u8g_dev_st7920_128x64_rrd_tx;
+        #endif
         for( i = 0; i < PAGE_HEIGHT; i ++ )
         {
-          ST7920_SET_CMD();
-          if ( y < 32 )
-          {
-            ST7920_WRITE_BYTE(0x80 | y);       //y
-            ST7920_WRITE_BYTE(0x80);           //x=0
-          }
-          else
-          {
-            ST7920_WRITE_BYTE(0x80 | (y-32));  //y
-            ST7920_WRITE_BYTE(0x80 | 8);       //x=64
-          }
-
-          ST7920_SET_DAT();
-          ST7920_WRITE_BYTES(ptr,LCD_PIXEL_WIDTH/8); //ptr is incremented inside of macro
+          #ifdef DOGLCD_PARTIAL_REDRAW
+            if (u8g_dev_st7920_128x64_rrd_gdram_valid && memcmp(u8g_dev_st7920_128x64_rrd_gdram[y], ptr, LCD_PIXEL_WIDTH/8) == 0)
+            {
+              ptr += LCD_PIXEL_WIDTH/8;
+              y++;
+              continue;
+            }
+            memcpy(u8g_dev_st7920_128x64_rrd_gdram[y], ptr, LCD_PIXEL_WIDTH/8);
+          #endif
+          #ifdef ST7920_USART_SPI
+            tx = ST7920_ENCODE_ROW(tx, y, ptr);
+            ptr += LCD_PIXEL_WIDTH/8;
+          #else
+            ST7920_SET_CMD();
+            if ( y < 32 )
+            {
+              ST7920_WRITE_BYTE(0x80 | y);       //y
+              ST7920_WRITE_BYTE(0x80);           //x=0
+            }
+            else
+            {
+              ST7920_WRITE_BYTE(0x80 | (y-32));  //y
+              ST7920_WRITE_BYTE(0x80 | 8);       //x=64
+            }
+
+            ST7920_SET_DAT();
+            ST7920_WRITE_BYTES(ptr,LCD_PIXEL_WIDTH/8); //ptr is incremented inside of macro
+          #endif
+          lcd_bytes_sent += ST7920_ROW_BYTES;
           y++;
         }
-        ST7920_NCS();
+        #ifdef ST7920_USART_SPI
+          ST7920_START_DMA(tx); // CS stays set until the next transfer
+        #else
+          ST7920_NCS();
+        #endif
+        #ifdef DOGLCD_PARTIAL_REDRAW
+          if (y == LCD_PIXEL_HEIGHT) u8g_dev_st7920_128x64_rrd_gdram_valid = true;
+        #endif
       }
       break;
   }